@@ -136,7 +136,7 @@ if (NOT WIN32)
   set(CMAKE_FIND_LIBRARY_PREFIXES lib ${CMAKE_FIND_LIBRARY_PREFIXES})
 endif()
 
-find_package(Boost COMPONENTS system program_options unit_test_framework filesystem REQUIRED)
+find_package(Boost COMPONENTS system program_options unit_test_framework filesystem iostreams REQUIRED)
 if(Boost_FOUND)
   include_directories(SYSTEM ${Boost_INCLUDE_DIR})
   link_directories(${Boost_LIBRARY_DIRS})
@@ -152,6 +152,20 @@ if( NOT WIN32 )
   set(CMAKE_FIND_LIBRARY_PREFIXES ${_ORIGINAL_CMAKE_FIND_LIBRARY_PREFIXES})
 endif()
 
+# Look for zlib (for compressed template names) and, optionally, zstd (for compressed template names with a trained dictionary):
+
+find_package(ZLIB REQUIRED)
+
+find_path(ZSTD_INCLUDE_DIR NAMES zstd.h zdict.h)
+find_library(ZSTD_LIBRARY NAMES zstd)
+if(ZSTD_INCLUDE_DIR AND ZSTD_LIBRARY)
+  set(ZSTD_FOUND TRUE)
+  message(STATUS "zstd library found, with headers at '${ZSTD_INCLUDE_DIR}' and library '${ZSTD_LIBRARY}'")
+else()
+  set(ZSTD_FOUND FALSE)
+  message(STATUS "zstd library not found, the compression of template names with a trained dictionary is disabled.")
+endif()
+
 
 
 
@@ -183,6 +197,11 @@ macro(templight_setup_target target_name)
   message(STATUS "Registered templight-tools example program ${target_name}.")
 endmacro(templight_setup_target)
 
+macro(templight_setup_perf_program target_name)
+  set_property(TARGET ${target_name} PROPERTY RUNTIME_OUTPUT_DIRECTORY "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/perf")
+  message(STATUS "Registered templight-tools performance program ${target_name}.")
+endmacro(templight_setup_perf_program)
+
 macro(templight_setup_test_program target_name)
   set_property(TARGET ${target_name} PROPERTY RUNTIME_OUTPUT_DIRECTORY "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/unit_tests")
   add_test(NAME "${target_name}" WORKING_DIRECTORY "${CMAKE_RUNTIME_OUTPUT_DIRECTORY}/unit_tests/" COMMAND "$<TARGET_FILE:${target_name}>")
@@ -22,16 +22,23 @@
 
 #include <templight/EntryPrinter.h>
 #include <templight/ExtraWriters.h>
+#include <templight/NameCompression.h>
+#include <templight/ParallelProtobufReader.h>
 #include <templight/ProtobufReader.h>
+#include <templight/ProtobufTraceIndex.h>
 #include <templight/ProtobufWriter.h>
 #include <templight/CallGraphWriters.h>
+#include <templight/CompressedStreams.h>
 
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <memory>
 #include <string>
 #include <set>
 #include <system_error>
+#include <unordered_map>
+#include <vector>
 
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
@@ -40,6 +47,129 @@ namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 
 
+namespace {
+
+template <typename Reader>
+void printTraces(Reader& pbf_reader, templight::EntryPrinter& printer, bool& was_inited) {
+  using templight::ProtobufReader;
+  while ( pbf_reader.LastChunk != ProtobufReader::EndOfFile ) {
+    switch ( pbf_reader.LastChunk ) {
+      case ProtobufReader::EndOfFile:
+        break;
+      case ProtobufReader::Header:
+        if ( was_inited ) 
+          printer.finalize();
+        printer.initialize(pbf_reader.SourceName);
+        was_inited = true;
+        pbf_reader.next();
+        break;
+      case ProtobufReader::BeginEntry:
+        printer.printEntry(pbf_reader.LastBeginEntry);
+        pbf_reader.next();
+        break;
+      case ProtobufReader::EndEntry:
+        printer.printEntry(pbf_reader.LastEndEntry);
+        pbf_reader.next();
+        break;
+      case ProtobufReader::Other:
+      default:
+        pbf_reader.next();
+        break;
+    }
+  }
+}
+
+/* Collects the names and filenames that occur in more than one trace of the input files 
+ * (in the order in which they first recur), for the shared dictionary of a merged archive. */
+void collectSharedStrings(const std::vector<std::string>& in_files, 
+                          std::vector<std::string>& names, std::vector<std::string>& file_names) {
+  using templight::ProtobufReader;
+  struct Occurrence {
+    std::size_t last_trace;
+    bool shared;
+  };
+  std::unordered_map< std::string, Occurrence > name_occurrences;
+  std::unordered_map< std::string, Occurrence > file_occurrences;
+  std::vector< bool > seen_names, seen_files; // by the ids of the reader, within the current trace.
+  std::size_t trace = 0;
+  
+  // Counts the first occurrence of a string within a trace, and tells if it recurs across traces:
+  auto occurs = [&trace](Occurrence& occ, bool is_new) {
+    bool recurs = !is_new && !occ.shared && ( occ.last_trace != trace );
+    occ.shared = occ.shared || recurs;
+    occ.last_trace = trace;
+    return recurs;
+  };
+  auto first_in_trace = [](std::vector< bool >& seen, std::uint32_t id) {
+    if ( id == templight::InvalidStringID )
+      return false;
+    if ( seen.size() <= id )
+      seen.resize(id + 1, false);
+    bool is_first = !seen[id];
+    seen[id] = true;
+    return is_first;
+  };
+  
+  for(const std::string& in_file : in_files) {
+    ProtobufReader pbf_reader;
+    ProtobufReader::LastChunkType chunk = pbf_reader.startOnFile(in_file);
+    // The ids are those of the reader of the file, and each trace of it starts with a header:
+    seen_names.clear();
+    seen_files.clear();
+    while ( chunk != ProtobufReader::EndOfFile ) {
+      if ( chunk == ProtobufReader::Header ) {
+        ++trace;
+        seen_names.clear();
+        seen_files.clear();
+      } else if ( chunk == ProtobufReader::BeginEntry ) {
+        const templight::PrintableEntryBegin& entry = pbf_reader.LastBeginEntry;
+        if ( first_in_trace(seen_names, entry.NameID) ) {
+          auto res = name_occurrences.emplace(entry.getName(), Occurrence{trace, false});
+          if ( occurs(res.first->second, res.second) )
+            names.push_back(res.first->first);
+        }
+        for(std::uint32_t file_id : {entry.FileID, entry.TempOri_FileID}) {
+          if ( !first_in_trace(seen_files, file_id) )
+            continue;
+          const std::string& file_name = pbf_reader.getFileName(file_id);
+          auto res = file_occurrences.emplace(file_name, Occurrence{trace, false});
+          if ( occurs(res.first->second, res.second) )
+            file_names.push_back(file_name);
+        }
+      }
+      chunk = pbf_reader.next();
+    }
+  }
+}
+
+/* Prints the trace (or only the subtree of an entry) that a reader was seeked to. */
+void printSeekedTrace(templight::ProtobufReader& pbf_reader, templight::EntryPrinter& printer, 
+                      bool& was_inited, bool subtree_only) {
+  using templight::ProtobufReader;
+  ProtobufReader::LastChunkType chunk = pbf_reader.LastChunk;
+  if ( was_inited ) 
+    printer.finalize();
+  printer.initialize(pbf_reader.SourceName);
+  was_inited = true;
+  if ( chunk == ProtobufReader::Header )
+    chunk = pbf_reader.next();
+  std::size_t depth = 0;
+  while ( ( chunk != ProtobufReader::EndOfFile ) && ( chunk != ProtobufReader::Header ) ) {
+    if ( chunk == ProtobufReader::BeginEntry ) {
+      printer.printEntry(pbf_reader.LastBeginEntry);
+      ++depth;
+    } else if ( chunk == ProtobufReader::EndEntry ) {
+      printer.printEntry(pbf_reader.LastEndEntry);
+      if ( subtree_only && ( --depth == 0 ) )
+        break;
+    }
+    chunk = pbf_reader.next();
+  }
+}
+
+}
+
+
 int main(int argc, const char **argv) {
   
   using namespace templight;
@@ -47,16 +177,26 @@ int main(int argc, const char **argv) {
   po::options_description generic_options("Generic options");
   generic_options.add_options()
     ("help,h", "produce this help message.")
+    ("verbose,v", "Print statistics of the conversion (e.g., of the blacklist filtering) to the standard error.")
   ;
   
   po::options_description io_options("I/O options");
   io_options.add_options()
     ("output,o", po::value<std::string>()->default_value("-"), "Write Templight profiling traces to <output-file>. Use '-' for output to stdout (default).")
-    ("format,f", po::value<std::string>()->default_value("protobuf"), "Specify the format of Templight outputs (protobuf / yaml / xml / text / graphml / graphviz / nestedxml / graphml-cg / graphviz-cg / callgrind, default is protobuf).")
+    ("format,f", po::value<std::string>()->default_value("protobuf"), "Specify the format of Templight outputs (protobuf / yaml / xml / text / graphml / graphviz / nestedxml / graphml-cg / graphviz-cg / callgrind / top, default is protobuf).")
     ("blacklist,b", po::value<std::string>(), "Use regex expressions in <file> to filter out undesirable traces.")
-    ("compression,c", po::value<int>()->default_value(0), "Specify the compression level of Templight outputs whenever the format allows.")
+    ("compression,c", po::value<int>()->default_value(0), "Specify the compression level of Templight outputs whenever the format allows (for protobuf: 0 for plain names, 1 for zlib-compressed names, 2 for a dictionary of names, 3 for zstd-compressed names with a dictionary trained on the trace).")
+    ("output-compression,z", po::value<std::string>()->default_value("auto"), "Compress the output file or stream (none / gzip / zstd / auto, default is auto, i.e., gzip for a '.gz' output file, zstd for a '.zst' output file, none otherwise).")
+    ("segment-size", po::value<std::size_t>()->default_value(0), "Size of the segments in which protobuf traces are written out, in MB (0 to buffer whole traces, the default). Segmented traces written to a stream (e.g., stdout or a compressed output) need the segment-aware reader of this version of templight-tools (older readers lose the continued segments).")
     ("input,i", po::value< std::vector<std::string> >(), "Read Templight profiling traces from <input-file>. If not specified, the traces will be read from stdin.")
     ("inst-only", "Only keep template instantiations in the output trace.")
+    ("index", "Write the seek index of each input file as a sidecar file (<input-file>.idx), and only convert if a trace is selected.")
+    ("trace", po::value<std::size_t>(), "Only convert the trace (translation unit) with the given index (from 0) of each input file, using its sidecar seek index when it is up to date.")
+    ("entry", po::value<std::uint64_t>(), "Only convert the subtree rooted at the beginning entry with the given ordinal (from 0, counting beginning and end entries) within the selected trace.")
+    ("merge", "Merge the traces of all input files into one protobuf archive, in which the names and filenames that recur across traces are in a dictionary shared by all traces (the compression level is then 2 by default).")
+    ("jobs,j", po::value<unsigned int>()->default_value(1), "Specify the number of threads decoding the traces of an input file in parallel (0 for one per core, default is 1).")
+    ("top-count", po::value<std::size_t>()->default_value(50), "Number of entries in each ranked table of the top format (default is 50).")
+    ("stream", "Write the nodes of the template instantiation tree as soon as they are complete (in post-order), instead of buffering whole traces (graphml / graphviz formats only).")
   ;
   
   po::options_description cmdline_options;
@@ -85,11 +225,31 @@ int main(int argc, const char **argv) {
     in_files = vm["input"].as< std::vector<std::string> >();
   }
   
+  if( vm.count("index") && !vm.count("trace") ) {
+    for(unsigned int i = 0; i < in_files.size(); ++i) {
+      ProtobufTraceIndex index;
+      if( ( in_files[i] == "-" ) || !index.buildFromFile(in_files[i]) || 
+          !index.saveToFile(ProtobufTraceIndex::getSidecarName(in_files[i])) )
+        std::cerr << "Warning: [Templight-Convert] Could not index the templight trace file: " << in_files[i] << std::endl;
+    }
+    return 0;
+  }
+  if( vm.count("entry") && !vm.count("trace") ) {
+    std::cerr << "Error: [Templight-Convert] The entry option requires a trace to be selected!" << std::endl;
+    return 1;
+  }
+  
   std::string OutputFilename = vm["output"].as<std::string>();
 //   fs::create_directory(fs::path(OutputFilename).parent_path());
   
   
-  EntryPrinter printer(vm["output"].as<std::string>());
+  StreamCompression OutputCompression = NoCompression;
+  if ( !getCompressionByName(vm["output-compression"].as<std::string>(), OutputFilename, OutputCompression) ) {
+    std::cerr << "Error: [Templight-Convert] Unrecognized output compression: " << vm["output-compression"].as<std::string>() << std::endl;
+    return 2;
+  }
+  
+  EntryPrinter printer(vm["output"].as<std::string>(), OutputCompression);
   
   if ( !printer.getTraceStream() ) {
     std::cerr << "Error: [Templight-Convert] Failed to create templight trace file!" << std::endl;
@@ -98,9 +258,39 @@ int main(int argc, const char **argv) {
   
   std::string Format = vm["format"].as<std::string>();
   int Compression = vm["compression"].as<int>();
+  if ( ( Compression == 3 ) && !hasZstdNameCompression() )
+    std::cerr << "Warning: [Templight-Convert] Built without zstd, template names will not be compressed (level 3)." << std::endl;
+  unsigned int Jobs = vm["jobs"].as<unsigned int>();
+  
+  bool Stream = ( vm.count("stream") > 0 );
+  if ( Stream && ( Format != "graphml" ) && ( Format != "graphviz" ) )
+    std::cerr << "Warning: [Templight-Convert] The stream option only applies to the graphml and graphviz formats." << std::endl;
+  
+  bool Merge = ( vm.count("merge") > 0 );
+  if ( Merge ) {
+    if ( !Format.empty() && ( Format != "protobuf" ) ) {
+      std::cerr << "Error: [Templight-Convert] The merge option requires the protobuf format!" << std::endl;
+      return 2;
+    }
+    for(const std::string& in_file : in_files) {
+      if ( in_file == "-" ) {
+        std::cerr << "Error: [Templight-Convert] The merge option cannot read the traces from stdin!" << std::endl;
+        return 2;
+      }
+    }
+    if ( vm["compression"].defaulted() )
+      Compression = 2;
+  }
   
   if ( ( Format.empty() ) || ( Format == "protobuf" ) ) {
-    printer.takeWriter(new ProtobufWriter(*printer.getTraceStream(),Compression));
+    ProtobufWriter* writer = new ProtobufWriter(*printer.getTraceStream(), Compression, vm["segment-size"].as<std::size_t>() << 20);
+    printer.takeWriter(writer);
+    if ( Merge ) {
+      // A first pass over the input files finds the names and filenames to share:
+      std::vector<std::string> shared_names, shared_file_names;
+      collectSharedStrings(in_files, shared_names, shared_file_names);
+      writer->writeSharedDictionary(shared_names, shared_file_names);
+    }
   }
   else if ( Format == "xml" ) {
     printer.takeWriter(new XmlWriter(*printer.getTraceStream()));
@@ -109,10 +299,10 @@ int main(int argc, const char **argv) {
     printer.takeWriter(new TextWriter(*printer.getTraceStream()));
   }
   else if ( Format == "graphml" ) {
-    printer.takeWriter(new GraphMLWriter(*printer.getTraceStream()));
+    printer.takeWriter(new GraphMLWriter(*printer.getTraceStream(), Stream));
   }
   else if ( Format == "graphviz" ) {
-    printer.takeWriter(new GraphVizWriter(*printer.getTraceStream()));
+    printer.takeWriter(new GraphVizWriter(*printer.getTraceStream(), Stream));
   }
   else if ( Format == "nestedxml" ) {
     printer.takeWriter(new NestedXMLWriter(*printer.getTraceStream()));
@@ -126,6 +316,9 @@ int main(int argc, const char **argv) {
   else if ( Format == "callgrind" ) {
     printer.takeWriter(new CallGrindWriter(*printer.getTraceStream()));
   }
+  else if ( Format == "top" ) {
+    printer.takeWriter(new TopWriter(*printer.getTraceStream(), vm["top-count"].as<std::size_t>()));
+  }
   else if ( Format == "yaml" ) {
     printer.takeWriter(new YamlWriter(*printer.getTraceStream()));
   }
@@ -135,9 +328,13 @@ int main(int argc, const char **argv) {
   }
   
   bool was_inited = false;
+  bool input_failed = false;
   
+  // The blacklisted subtrees are skipped within the (sequential) readers, without being decoded:
+  ProtobufReader::EntryFilter blacklist_filter;
   if( vm.count("blacklist") ) {
     printer.readBlacklists(vm["blacklist"].as<std::string>());
+    blacklist_filter = [&printer](const PrintableEntryBegin& entry) { return printer.isBlacklisted(entry); };
   }
   
 //   if( vm.count("inst-only") ) {
@@ -145,53 +342,87 @@ int main(int argc, const char **argv) {
 //   }
   
   for(unsigned int i = 0; i < in_files.size(); ++i) {
-    std::istream* p_buf = nullptr;
-    if( in_files[i] == "-" )
-      p_buf = &std::cin;
-    else {
-      p_buf = new std::ifstream(in_files[i], std::ios_base::in | std::ios_base::binary);
-      if( p_buf && !(*p_buf) ) {
+    if( vm.count("trace") ) {
+      // Seek to the selected trace, or entry, without decoding the rest of the file:
+      ProtobufTraceIndex index;
+      std::string index_name = ProtobufTraceIndex::getSidecarName(in_files[i]);
+      boost::system::error_code ec;
+      if( ( in_files[i] == "-" ) || !fs::is_regular_file(in_files[i], ec) ) {
+        std::cerr << "Warning: [Templight-Convert] Could not seek in the templight trace file: " << in_files[i] << std::endl;
+        continue;
+      }
+      if( !index.loadFromFile(index_name) || !index.isUpToDate(in_files[i]) ) {
+        if( !index.buildFromFile(in_files[i]) ) {
+          std::cerr << "Warning: [Templight-Convert] Could not index the templight trace file: " << in_files[i] << std::endl;
+          continue;
+        }
+        if( vm.count("index") )
+          index.saveToFile(index_name);
+      }
+      ProtobufReader pbf_reader;
+      pbf_reader.setEntryFilter(blacklist_filter);
+      pbf_reader.setRequiredFields(printer.getRequiredFields());
+      pbf_reader.startOnFile(in_files[i]);
+      ProtobufReader::LastChunkType chunk = ProtobufReader::EndOfFile;
+      if( vm.count("entry") )
+        chunk = pbf_reader.seekToEntry(index, vm["trace"].as<std::size_t>(), vm["entry"].as<std::uint64_t>());
+      else
+        chunk = pbf_reader.seekToTrace(index, vm["trace"].as<std::size_t>());
+      if( ( chunk == ProtobufReader::EndOfFile ) || ( vm.count("entry") && ( chunk != ProtobufReader::BeginEntry ) ) ) {
+        std::cerr << "Warning: [Templight-Convert] Could not find the selected trace or entry in: " << in_files[i] << std::endl;
+        continue;
+      }
+      printSeekedTrace(pbf_reader, printer, was_inited, vm.count("entry") > 0);
+      continue;
+    }
+    if( in_files[i] != "-" ) {
+      boost::system::error_code ec;
+      if( !fs::exists(in_files[i], ec) || fs::is_directory(in_files[i], ec) ) {
         std::cerr << "Warning: [Templight-Convert] Could not open the templight trace file: " << in_files[i] << std::endl;
-        delete p_buf;
-        p_buf = nullptr;
         continue;
       }
+      // Decodes the traces of the file in parallel, if it can be memory-mapped:
+      if( Jobs != 1 ) {
+        ParallelProtobufReader par_reader(Jobs);
+        par_reader.setRequiredFields(printer.getRequiredFields());
+        if( par_reader.startOnFile(in_files[i]) != ProtobufReader::EndOfFile ) {
+          printTraces(par_reader, printer, was_inited);
+          if( par_reader.hasFailed() ) {
+            std::cerr << "Error: [Templight-Convert] Could not read the templight trace file entirely (corrupt or truncated): " << in_files[i] << std::endl;
+            input_failed = true;
+          }
+          continue;
+        }
+      }
     }
     ProtobufReader pbf_reader;
-    pbf_reader.startOnBuffer(*p_buf);
-    while ( pbf_reader.LastChunk != ProtobufReader::EndOfFile ) {
-      switch ( pbf_reader.LastChunk ) {
-        case ProtobufReader::EndOfFile:
-          break;
-        case ProtobufReader::Header:
-          if ( was_inited ) 
-            printer.finalize();
-          printer.initialize(pbf_reader.SourceName);
-          was_inited = true;
-          pbf_reader.next();
-          break;
-        case ProtobufReader::BeginEntry:
-          printer.printEntry(pbf_reader.LastBeginEntry);
-          pbf_reader.next();
-          break;
-        case ProtobufReader::EndEntry:
-          printer.printEntry(pbf_reader.LastEndEntry);
-          pbf_reader.next();
-          break;
-        case ProtobufReader::Other:
-        default:
-          pbf_reader.next();
-          break;
-      }
+    pbf_reader.setEntryFilter(blacklist_filter);
+    pbf_reader.setRequiredFields(printer.getRequiredFields());
+    if( in_files[i] == "-" )
+      pbf_reader.startOnStdin(); // Reads stdin by large blocks, without seeking.
+    else
+      pbf_reader.startOnFile(in_files[i]); // Memory-maps the file whenever possible.
+    printTraces(pbf_reader, printer, was_inited);
+    if( pbf_reader.hasFailed() ) {
+      std::cerr << "Error: [Templight-Convert] Could not read the templight trace file entirely (corrupt or truncated): " << in_files[i] << std::endl;
+      input_failed = true;
     }
-    if( p_buf && (p_buf != &std::cin) )
-      delete p_buf;
   }
   
   if ( was_inited )
     printer.finalize();
   
-  return 0;
+  if ( !printer.closeTraceStream() ) {
+    std::cerr << "Error: [Templight-Convert] Failed to write the templight trace output!" << std::endl;
+    return 1;
+  }
+  
+  if( vm.count("verbose") && vm.count("blacklist") ) {
+    std::cerr << "Info: [Templight-Convert] Blacklist: " << printer.getVerdictCacheMisses() 
+              << " names matched, " << printer.getVerdictCacheHits() << " verdicts reused from the cache." << std::endl;
+  }
+  
+  return ( input_failed ? 1 : 0 );
 }
 
 
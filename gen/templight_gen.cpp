@@ -0,0 +1,162 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/CompressedStreams.h>
+#include <templight/EntryPrinter.h>
+#include <templight/NameCompression.h>
+#include <templight/ProtobufWriter.h>
+#include <templight/SyntheticTraces.h>
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+
+int main(int argc, const char **argv) {
+
+  using namespace templight;
+
+  po::options_description generic_options("Generic options");
+  generic_options.add_options()
+    ("help,h", "produce this help message.")
+  ;
+
+  po::options_description io_options("I/O options");
+  io_options.add_options()
+    ("output,o", po::value<std::string>()->default_value("-"), "Write the synthetic traces to <output-file>. Use '-' for output to stdout (default).")
+    ("compression,c", po::value<int>()->default_value(2), "Specify the compression level of the protobuf output (0 for plain names, 1 for zlib-compressed names, 2 for a dictionary of names, 3 for zstd-compressed names with a dictionary trained on the trace, default is 2).")
+    ("output-compression,z", po::value<std::string>()->default_value("auto"), "Compress the output file or stream (none / gzip / zstd / auto, default is auto, i.e., gzip for a '.gz' output file, zstd for a '.zst' output file, none otherwise).")
+    ("segment-size", po::value<std::size_t>()->default_value(0), "Size of the segments in which the traces are written out, in MB (0 to buffer whole traces, the default). Segmented traces written to a stream need the segment-aware reader of this version of templight-tools (older readers lose the continued segments).")
+  ;
+
+  SyntheticTraceOptions defaults;
+  po::options_description trace_options("Trace options");
+  trace_options.add_options()
+    ("traces,t", po::value<unsigned int>()->default_value(1), "Number of traces (translation units) to generate.")
+    ("entries,n", po::value<std::size_t>()->default_value(1000000), "Number of (beginning) entries in each trace.")
+    ("depth,d", po::value<unsigned int>()->default_value(defaults.MaxDepth), "Maximum depth of the instantiation trees.")
+    ("fanout", po::value<double>()->default_value(defaults.FanOut), "Average number of nested entries of a top-level instantiation.")
+    ("fanout-decay", po::value<double>()->default_value(defaults.FanOutDecay), "Factor applied to the average number of nested entries at each level of depth (below 1 for bushier, shallower trees).")
+    ("recursion-ratio", po::value<double>()->default_value(defaults.RecursionRatio), "Fraction of the instantiations that start a recursive chain, like Fibonacci<N> instantiating Fibonacci<N-1> and Fibonacci<N-2>.")
+    ("recursion-length", po::value<unsigned int>()->default_value(defaults.RecursionLength), "Length of the recursive chains (N, limited by the maximum depth).")
+    ("memo-ratio", po::value<double>()->default_value(defaults.MemoizationRatio), "Fraction of the entries that are memoizations of earlier instantiations.")
+    ("name-length", po::value<std::size_t>()->default_value(defaults.NameLength), "Median length of the template names.")
+    ("name-spread", po::value<double>()->default_value(defaults.NameLengthSpread), "Spread of the lengths of the template names (sigma of their log-normal distribution, 0 for nearly constant lengths).")
+    ("files", po::value<unsigned int>()->default_value(defaults.FileCount), "Number of distinct filenames in each trace.")
+    ("memory-growth", po::value<std::uint64_t>()->default_value(defaults.MemoryGrowth), "Average growth of the memory usage at each entry, in bytes.")
+    ("memory-curve", po::value<std::string>()->default_value("linear"), "Shape of the memory usage along each trace (linear / log / sawtooth, where sawtooth drops back after each top-level entry).")
+    ("seed", po::value<std::uint64_t>()->default_value(defaults.Seed), "Seed of the generation (the same options always generate the same traces).")
+  ;
+
+  po::options_description cmdline_options;
+  cmdline_options.add(generic_options).add(io_options).add(trace_options);
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, cmdline_options), vm);
+  po::notify(vm);
+
+  if(vm.count("help")) {
+    std::cout <<
+      "Templight/Gen\n"
+      "  DESCRIPTION: A tool to generate synthetic (but realistic) templight traces, in the protobuf format.\n"
+      "  USAGE: templight-gen [options]\n" << std::endl;
+    std::cout << cmdline_options << std::endl;
+    return 0;
+  }
+
+  SyntheticTraceOptions trace_opts;
+  trace_opts.EntryCount = vm["entries"].as<std::size_t>();
+  trace_opts.MaxDepth = vm["depth"].as<unsigned int>();
+  trace_opts.FanOut = vm["fanout"].as<double>();
+  trace_opts.FanOutDecay = vm["fanout-decay"].as<double>();
+  trace_opts.RecursionRatio = vm["recursion-ratio"].as<double>();
+  trace_opts.RecursionLength = vm["recursion-length"].as<unsigned int>();
+  trace_opts.MemoizationRatio = vm["memo-ratio"].as<double>();
+  trace_opts.NameLength = vm["name-length"].as<std::size_t>();
+  trace_opts.NameLengthSpread = vm["name-spread"].as<double>();
+  trace_opts.FileCount = vm["files"].as<unsigned int>();
+  trace_opts.MemoryGrowth = vm["memory-growth"].as<std::uint64_t>();
+
+  std::string MemoryCurve = vm["memory-curve"].as<std::string>();
+  if ( MemoryCurve == "linear" ) {
+    trace_opts.MemoryCurve = LinearMemoryCurve;
+  }
+  else if ( MemoryCurve == "log" ) {
+    trace_opts.MemoryCurve = LogarithmicMemoryCurve;
+  }
+  else if ( MemoryCurve == "sawtooth" ) {
+    trace_opts.MemoryCurve = SawtoothMemoryCurve;
+  }
+  else {
+    std::cerr << "Error: [Templight-Gen] Unrecognized memory curve: " << MemoryCurve << std::endl;
+    return 2;
+  }
+
+  std::string OutputFilename = vm["output"].as<std::string>();
+  StreamCompression OutputCompression = NoCompression;
+  if ( !getCompressionByName(vm["output-compression"].as<std::string>(), OutputFilename, OutputCompression) ) {
+    std::cerr << "Error: [Templight-Gen] Unrecognized output compression: " << vm["output-compression"].as<std::string>() << std::endl;
+    return 2;
+  }
+
+  EntryPrinter printer(OutputFilename, OutputCompression);
+
+  if ( !printer.getTraceStream() ) {
+    std::cerr << "Error: [Templight-Gen] Failed to create templight trace file!" << std::endl;
+    return 1;
+  }
+
+  int Compression = vm["compression"].as<int>();
+  if ( ( Compression == 3 ) && !hasZstdNameCompression() )
+    std::cerr << "Warning: [Templight-Gen] Built without zstd, template names will not be compressed (level 3)." << std::endl;
+  unsigned int TraceCount = vm["traces"].as<unsigned int>();
+  std::uint64_t Seed = vm["seed"].as<std::uint64_t>();
+
+  printer.takeWriter(new ProtobufWriter(*printer.getTraceStream(), Compression, vm["segment-size"].as<std::size_t>() << 20));
+
+  for(unsigned int i = 0; i < TraceCount; ++i) {
+    trace_opts.Seed = Seed + i;
+    SyntheticTraceGenerator gen(trace_opts);
+    printer.initialize("synthetic_" + std::to_string(i) + ".cpp");
+    while ( true ) {
+      SyntheticTraceGenerator::LastEntryType entry = gen.next();
+      if ( entry == SyntheticTraceGenerator::BeginEntry )
+        printer.printEntry(gen.LastBeginEntry);
+      else if ( entry == SyntheticTraceGenerator::EndEntry )
+        printer.printEntry(gen.LastEndEntry);
+      else
+        break;
+    }
+    printer.finalize();
+  }
+  
+  if ( !printer.closeTraceStream() ) {
+    std::cerr << "Error: [Templight-Gen] Failed to write the templight trace output!" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
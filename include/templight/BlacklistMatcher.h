@@ -0,0 +1,105 @@
+/**
+ * \file BlacklistMatcher.h
+ *
+ * This library provides a matcher of template names against the regular expressions of a blacklist.
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_BLACKLIST_MATCHER_H
+#define TEMPLIGHT_BLACKLIST_MATCHER_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace templight {
+
+/** \brief A matcher of names against a set of regular expressions.
+ *
+ * This class tells if a name fully matches any of a set of regular expressions
+ * (as std::regex_match does, with the ECMAScript grammar), such as those of a
+ * blacklist file (see EntryPrinter::readBlacklists).
+ *
+ * The regular expressions are compiled together into a single automaton: a
+ * non-deterministic automaton (NFA) of all the patterns, from which a
+ * deterministic automaton (DFA) is built lazily, as names are matched, with
+ * its transitions on classes of equivalent bytes. A name is thus matched in
+ * a single pass over its bytes, without backtracking, whatever the number
+ * of patterns, and the match stops as soon as no pattern can match anymore.
+ * The DFA is bounded in size: if it grows too large (which some patterns can
+ * cause), it is discarded and built again from the states in use.
+ *
+ * The constructs that an automaton cannot express (back-references, lookaheads
+ * and word boundaries) are not compiled: the patterns that use them are
+ * matched with std::regex instead, one by one, after the automaton.
+ *
+ * \note The matching updates the DFA, so, a matcher cannot be shared between threads.
+ */
+class BlacklistMatcher {
+public:
+  BlacklistMatcher();
+  ~BlacklistMatcher();
+
+  BlacklistMatcher(const BlacklistMatcher&) = delete;
+  BlacklistMatcher& operator=(const BlacklistMatcher&) = delete;
+
+  /** \brief Adds a regular expression to the set.
+   *
+   * \param aPattern The regular expression, in the ECMAScript grammar (as for std::regex).
+   * \return True if the pattern was added, false if it is not a valid regular expression.
+   */
+  bool addPattern(const std::string& aPattern);
+
+  /// Removes all the regular expressions.
+  void clear();
+
+  /// Tells if there are no regular expressions in the set.
+  bool empty() const;
+
+  /// Returns the number of patterns compiled into the automaton.
+  std::size_t getAutomatonPatternCount() const;
+
+  /// Returns the number of patterns that are matched with std::regex.
+  std::size_t getRegexPatternCount() const;
+
+  /// Tells if a name fully matches any of the regular expressions.
+  bool matches(const char* aName, std::size_t aSize) const;
+
+  /// Tells if a name fully matches any of the regular expressions.
+  bool matches(const std::string& aName) const { return matches(aName.data(), aName.size()); }
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+
+}
+
+#endif
+
+
@@ -106,9 +106,12 @@ protected:
   
   graph_t g;
   vertex_t g_root;
-  std::unordered_map< std::string, vertex_t > inst_map;
+  std::unordered_multimap< std::uint64_t, vertex_t > inst_map;
   std::unordered_map< std::size_t, vertex_t > tree_to_graph;
   
+  /// Finds the vertex of a full instantiation with the same name as a given entry (or null_vertex).
+  vertex_t findInstantiation(const PrintableEntryBegin& aEntry) const;
+  
   /**
    * This virtual function is where derived classes are given the opportunity to 
    * print the meta-call-graph to the output stream.
@@ -136,6 +139,11 @@ public:
   GraphMLCGWriter(std::ostream& aOS);
   ~GraphMLCGWriter();
   
+  /// The graph has the points of instantiation (on the edges) and the templates' definitions (on the nodes).
+  unsigned int getRequiredFields() const override { 
+    return EntryNameField | EntryLocationField | EntryOriginField | EntryMemoryField;
+  };
+  
 protected:
   void writeGraph() override;
 };
@@ -157,6 +165,9 @@ public:
   GraphVizCGWriter(std::ostream& aOS);
   ~GraphVizCGWriter();
   
+  /// The graph only has the locations of the templates' definitions (no points of instantiation).
+  unsigned int getRequiredFields() const override { return EntryNameField | EntryOriginField | EntryMemoryField; };
+  
 protected:
   void writeGraph() override;
 };
@@ -179,6 +190,11 @@ public:
   CallGrindWriter(std::ostream& aOS);
   ~CallGrindWriter();
   
+  /// The calls are from the points of instantiation ("fl") to the templates' definitions ("cfi").
+  unsigned int getRequiredFields() const override { 
+    return EntryNameField | EntryLocationField | EntryOriginField | EntryMemoryField;
+  };
+  
 protected:
   void writeGraph() override;
 };
@@ -0,0 +1,210 @@
+/**
+ * \file CompressedStreams.h
+ *
+ * This library provides stream-buffers that decompress inputs and compress outputs (gzip or zstd) in a background thread.
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_COMPRESSED_STREAMS_H
+#define TEMPLIGHT_COMPRESSED_STREAMS_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace templight {
+
+/// Identifies the compression format of a stream.
+enum StreamCompression {
+  NoCompression = 0, ///< Not compressed (or not recognized).
+  GzipCompression,   ///< Compressed with gzip (deflate).
+  ZstdCompression    ///< Compressed with zstd.
+};
+
+/** \brief Detects the compression format of a stream from its first bytes.
+ *
+ * \param aData A pointer to the first bytes of the stream.
+ * \param aSize The number of bytes available (at least 4 are needed to detect anything).
+ * \return The compression format, from the magic number at the start of the stream.
+ */
+StreamCompression detectCompression(const char* aData, std::size_t aSize);
+
+/** \brief Gets the compression format for a given name ("none", "gzip" or "zstd").
+ *
+ * \param aName The name of the compression format, or "auto" to deduce it from the
+ *              extension of a given filename (".gz" or ".zst").
+ * \param aFilename The filename to deduce the compression format from.
+ * \param aResult The resulting compression format.
+ * \return False if the name is not recognized.
+ */
+bool getCompressionByName(const std::string& aName, const std::string& aFilename,
+                          StreamCompression& aResult);
+
+
+/** \brief A stream-buffer that reads a compressed input, decompressed in a background thread.
+ *
+ * This stream-buffer pulls a compressed input (from a stream-buffer, a C stream
+ * or a memory span), decompresses it in a background thread that fills a ring
+ * of blocks, and gives out the decompressed blocks, such that decompression
+ * overlaps with the decoding of what is read.
+ * If the input is corrupt, the stream ends early (see hasFailed).
+ */
+class DecompressingStreamBuf : public std::streambuf {
+public:
+
+  /** \brief Creates a decompressing stream-buffer over another stream-buffer.
+   *
+   * \param aFormat The compression format of the input.
+   * \param aSource The stream-buffer to read the compressed input from.
+   * \param aPrefix The first bytes of the compressed input, already read from the source.
+   */
+  DecompressingStreamBuf(StreamCompression aFormat, std::streambuf* aSource,
+                         const std::string& aPrefix = "");
+
+  /// Creates a decompressing stream-buffer over a C stream (see the constructor above).
+  DecompressingStreamBuf(StreamCompression aFormat, std::FILE* aSource,
+                         const std::string& aPrefix = "");
+
+  /// Creates a decompressing stream-buffer over a memory span, which must outlive it.
+  DecompressingStreamBuf(StreamCompression aFormat, const char* aData, std::size_t aSize);
+
+  ~DecompressingStreamBuf();
+
+  DecompressingStreamBuf(const DecompressingStreamBuf&) = delete;
+  DecompressingStreamBuf& operator=(const DecompressingStreamBuf&) = delete;
+
+  /// Returns true if the decompression failed (e.g., corrupt or truncated input).
+  bool hasFailed() const;
+
+protected:
+
+  int_type underflow() override;
+
+private:
+
+  struct Source {
+    std::string prefix;
+    std::streambuf* buf;
+    std::FILE* file;
+    const char* data;
+    std::size_t size;
+  };
+
+  StreamCompression format;
+  Source source;
+
+  std::vector< std::vector<char> > blocks;
+  std::vector< std::size_t > block_sizes;
+  std::size_t head;  // the next block to read.
+  std::size_t count; // the number of filled blocks.
+  bool holding_head;
+  bool done;
+  bool failed;
+  bool stopping;
+
+  mutable std::mutex ring_mutex;
+  std::condition_variable ring_cv;
+  std::thread worker;
+
+  void start();
+  void runWorker();
+
+};
+
+
+/** \brief A stream-buffer that writes a compressed output, compressed in a background thread.
+ *
+ * This stream-buffer fills blocks from what is written to it, and hands them
+ * over, through a ring of blocks, to a background thread that compresses them
+ * into another stream-buffer, such that compression overlaps with the
+ * rendering of what is written.
+ * \note The output is only complete once this stream-buffer is closed (or
+ *       destroyed). Flushing it only hands over the blocks written so far.
+ */
+class CompressingStreamBuf : public std::streambuf {
+public:
+
+  /** \brief Creates a compressing stream-buffer over another stream-buffer.
+   *
+   * \param aFormat The compression format of the output.
+   * \param aSink The stream-buffer to write the compressed output to.
+   * \param aLevel The compression level (negative for the default level of the format).
+   */
+  CompressingStreamBuf(StreamCompression aFormat, std::streambuf* aSink, int aLevel = -1);
+  ~CompressingStreamBuf();
+
+  CompressingStreamBuf(const CompressingStreamBuf&) = delete;
+  CompressingStreamBuf& operator=(const CompressingStreamBuf&) = delete;
+
+  /** \brief Writes out the remaining output and the end of the compressed stream, and waits for it.
+   * 
+   * \return False if the output could not be compressed or written entirely (see hasFailed).
+   */
+  bool close();
+  
+  /// Returns true if the compression or the writing of the output failed (e.g., the disk is full).
+  bool hasFailed() const;
+
+protected:
+
+  int_type overflow(int_type c) override;
+  int sync() override;
+
+private:
+
+  StreamCompression format;
+  std::streambuf* sink;
+  int level;
+
+  std::vector< std::vector<char> > blocks;
+  std::vector< std::size_t > block_sizes;
+  std::size_t head;  // the next block to compress.
+  std::size_t tail;  // the block being written.
+  std::size_t count; // the number of blocks to compress.
+  bool done;
+  bool failed;
+
+  mutable std::mutex ring_mutex;
+  std::condition_variable ring_cv;
+  std::thread worker;
+
+  void submitBlock();
+  void runWorker();
+  void compressBlocks();
+
+};
+
+
+}
+
+#endif
+
@@ -33,11 +33,14 @@
 #ifndef TEMPLIGHT_ENTRY_PRINTER_H
 #define TEMPLIGHT_ENTRY_PRINTER_H
 
+#include <templight/BlacklistMatcher.h>
+#include <templight/CompressedStreams.h>
 #include <templight/PrintableEntries.h>
 
+#include <cstdint>
 #include <memory>
 #include <string>
-#include <regex>
+#include <vector>
 
 namespace templight {
 
@@ -94,8 +97,12 @@ public:
    * 
    * This creates a printer for a given output file-name, if the 
    * filename is "-", then the standard output (stdout) is used instead.
+   * The output can be compressed (gzip or zstd), in which case, the 
+   * compression is done by a background thread (see CompressingStreamBuf), 
+   * and the output is complete when the printer is closed (see closeTraceStream) 
+   * or destroyed.
    */
-  EntryPrinter(const std::string& Output);
+  EntryPrinter(const std::string& Output, StreamCompression OutputCompression = NoCompression);
   ~EntryPrinter();
   
   /** \brief Check if the printer is in a good state.
@@ -114,6 +121,24 @@ public:
    */
   std::ostream* getTraceStream() const;
   
+  /** \brief Closes the output stream, after deleting the writer.
+   * 
+   * This function deletes the writer (which can write out the end of its output), 
+   * and then flushes and closes the output stream, writing out the end of the 
+   * compressed output (if any). No more traces can be printed afterwards.
+   * \return False if the output could not be written entirely (e.g., the disk is full).
+   */
+  bool closeTraceStream();
+  
+  /** \brief Gives the fields of the entries that this printer needs.
+   * 
+   * This function gives the fields that the writer needs (see EntryWriter::getRequiredFields), 
+   * along with the names if there is a blacklist, such that the trace reader can skip the 
+   * decoding of the other fields (see ProtobufReader::setRequiredFields).
+   * \return A mask of the fields that are needed (see EntryFieldMask).
+   */
+  unsigned int getRequiredFields() const;
+  
   /** \brief Takes ownership of an entry-writer object to use for the rendering.
    * 
    * This function takes ownership of an entry-writer object to use for the actual 
@@ -132,13 +157,55 @@ public:
    */
   void readBlacklists(const std::string& BLFilename);
   
+  /** \brief Get the number of blacklist verdicts that were found in the verdict cache.
+   * 
+   * The verdict of the blacklist on a name is cached, by the id of the name within the 
+   * string table of its entry (i.e., within a trace) and by the hash of the name (for 
+   * entries without a name id, and across traces), such that each distinct name is 
+   * matched against the blacklist only once, however many times it recurs.
+   */
+  std::uint64_t getVerdictCacheHits() const { return VerdictCacheHits; };
+  
+  /// Get the number of names that were matched against the blacklist (see getVerdictCacheHits).
+  std::uint64_t getVerdictCacheMisses() const { return VerdictCacheMisses; };
+  
+  /** \brief Tells if a beginning entry is filtered out by the blacklist.
+   * 
+   * This function tells if the name of a beginning entry matches the blacklist, in which 
+   * case, the printer ignores that entry and all its nested entries. It is meant to filter 
+   * the entries upstream, e.g., to skip them within a trace reader (see 
+   * ProtobufReader::setEntryFilter), such that they are never decoded.
+   * \param Entry The beginning part of a trace entry.
+   * \return True, if the entry (and its subtree) is filtered out by the blacklist.
+   */
+  bool isBlacklisted(const PrintableEntryBegin& Entry);
+  
 private:
   
+  struct VerdictSlot {
+    std::uint64_t hash;
+    std::size_t name_pos;   // the position of the name in VerdictNames.
+    std::size_t name_size;
+    std::uint8_t verdict;   // 0 for an empty slot, 1 if kept, 2 if blacklisted.
+  };
+  VerdictSlot& findVerdictSlot(std::uint64_t aHash, const std::string& aName);
+  VerdictSlot& findEmptyVerdictSlot(std::uint64_t aHash);
+  void growVerdictSlots();
+  
   std::size_t SkippedEndingsCount;
-  std::unique_ptr<std::regex> CoRegex;
-  std::unique_ptr<std::regex> IdRegex;
+  BlacklistMatcher Blacklist;
+  
+  const EntryStringTable* VerdictStrings;  // the string table that VerdictsByID are for.
+  std::vector<std::uint8_t> VerdictsByID;  // 0 if unknown, 1 if kept, 2 if blacklisted.
+  std::vector<VerdictSlot> VerdictSlots;   // an open-addressing table of the verdicts, by name hashes.
+  std::size_t VerdictCount;
+  std::string VerdictNames;                // the names of the verdicts by name hashes, end to end.
+  std::uint64_t VerdictCacheHits;
+  std::uint64_t VerdictCacheMisses;
   
   std::ostream* TraceOS;
+  std::ostream* FileOS;
+  std::unique_ptr<CompressingStreamBuf> CompressedBuf;
   
   std::unique_ptr<EntryWriter> p_writer;
   
@@ -35,9 +35,11 @@
 
 #include <templight/PrintableEntries.h>
 
+#include <cstdint>
 #include <ostream>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace templight {
@@ -117,32 +119,161 @@ public:
 };
 
 
+/** \brief Holds the costs of a node of a template instantiation tree, aggregated over its sub-tree.
+ * 
+ * The inclusive costs of a node are the differences between its end and beginning 
+ * entries, and its exclusive costs are its inclusive costs minus those of its children 
+ * (or zero, if they exceed them). The peak memory is the highest memory usage reached 
+ * within the sub-tree (at the beginning or end of any of its nodes), above the memory 
+ * usage at the beginning of the node.
+ */
+struct EntryAggregate {
+  double InclusiveTime;          ///< The time taken by the node, with its children.
+  double ExclusiveTime;          ///< The time taken by the node, without its children.
+  std::uint64_t InclusiveMemory; ///< The memory used by the node, with its children.
+  std::uint64_t ExclusiveMemory; ///< The memory used by the node, without its children.
+  std::uint64_t PeakMemory;      ///< The peak memory usage within the sub-tree, above its beginning.
+  std::uint32_t SubtreeSize;     ///< The number of nodes in the sub-tree, including the node itself.
+  std::uint32_t Depth;           ///< The number of ancestors of the node.
+  std::uint32_t ChildCount;      ///< The number of children of the node.
+  
+  EntryAggregate() : InclusiveTime(0.0), ExclusiveTime(0.0), InclusiveMemory(0), ExclusiveMemory(0), 
+    PeakMemory(0), SubtreeSize(0), Depth(0), ChildCount(0) { };
+  
+  /** \brief Adds the aggregate of a (complete) child to the aggregate of its (open) parent.
+   * 
+   * While a node is open, its aggregate holds the totals of its children so far: the sum of 
+   * their inclusive costs (in ExclusiveTime and ExclusiveMemory), the sum of the sizes of 
+   * their sub-trees, their count and the peak memory usage among them (in absolute terms).
+   * \param aChild The aggregate of the child, completed by complete().
+   * \param aChildMemoryUsage The memory usage at the beginning of the child.
+   */
+  void addChild(const EntryAggregate& aChild, std::uint64_t aChildMemoryUsage);
+  
+  /** \brief Completes the aggregate of a node, once all its children were added (see addChild).
+   * 
+   * \param aBeginTime The time-stamp at the beginning of the node.
+   * \param aEndTime The time-stamp at the end of the node.
+   * \param aBeginMemory The memory usage at the beginning of the node.
+   * \param aEndMemory The memory usage at the end of the node.
+   */
+  void complete(double aBeginTime, double aEndTime, std::uint64_t aBeginMemory, std::uint64_t aEndMemory);
+};
+
+
 struct EntryTraversalTask {
   static const std::size_t invalid_id = ~std::size_t(0);
   
   PrintableEntryBegin start;
   PrintableEntryEnd finish;
   std::size_t nd_id, id_end, parent_id;
+  EntryAggregate costs;  ///< The aggregated costs of the node (only if the writer asks for them).
   EntryTraversalTask(const PrintableEntryBegin& aStart,
                      std::size_t aNdId, std::size_t aParentId) :
                      start(aStart), finish(), 
                      nd_id(aNdId), id_end(invalid_id), 
-                     parent_id(aParentId) { };
+                     parent_id(aParentId), costs() { };
 };
 
 
-struct RecordedDFSEntryTree {
+/** \brief A template instantiation tree, recorded in depth-first order.
+ * 
+ * This struct records the entries of a trace, which come in the order of a depth-first 
+ * traversal of the template instantiation tree, as a set of parallel arrays (one per 
+ * field of the entries), along with the parent and the end of the sub-tree of each node. 
+ * The names and filenames are interned, each distinct string being stored once, such 
+ * that the nodes only hold the ids of their strings. The entries of a node are 
+ * reconstructed on demand (see getTask), with this tree as their string table.
+ * 
+ * Names are looked up by their hashes (see EntryNameHash), and compared on hash hits.
+ */
+struct RecordedDFSEntryTree : public EntryStringTable {
   static const std::size_t invalid_id = ~std::size_t(0);
-  
-  std::vector<EntryTraversalTask> parent_stack;
+  static const std::uint32_t invalid_node = ~std::uint32_t(0);  ///< The absence of a node in parent_ids and end_ids.
+  
+  std::vector<std::uint8_t>  kinds;
+  std::vector<std::uint32_t> name_ids;
+  std::vector<std::uint32_t> file_ids;
+  std::vector<int>           lines;
+  std::vector<int>           columns;
+  std::vector<std::uint32_t> ori_file_ids;
+  std::vector<int>           ori_lines;
+  std::vector<int>           ori_columns;
+  std::vector<double>        begin_times;
+  std::vector<double>        end_times;
+  std::vector<std::uint64_t> begin_memory;
+  std::vector<std::uint64_t> end_memory;
+  std::vector<std::uint32_t> parent_ids;  ///< The parents of the nodes (invalid_node for top-level nodes).
+  std::vector<std::uint32_t> end_ids;     ///< One past the last node of each sub-tree (invalid_node if not closed).
+  std::vector<std::uint32_t> depths;      ///< The number of ancestors of the nodes.
   std::size_t cur_top;
   
   RecordedDFSEntryTree();
   
+  /** \brief Records the beginning of a node.
+   * 
+   * \throw std::length_error If the node, its kind or its name does not fit in the 
+   *        narrow fields of the tree (e.g., more than 2^32 - 2 nodes or distinct names).
+   */
   void beginEntry(const PrintableEntryBegin& aEntry);
   
   void endEntry(const PrintableEntryEnd& aEntry);
   
+  /// Returns the number of nodes in the tree.
+  std::size_t size() const { return kinds.size(); };
+  
+  /** \brief Reconstructs the entries of a node of the tree.
+   * 
+   * \param aId The id of the node (its position in the depth-first order).
+   * \param aTask Receives the entries, the id, the end id and the parent id of the node. 
+   *              Its beginning entry refers to this tree for its strings.
+   */
+  void getTask(std::size_t aId, EntryTraversalTask& aTask) const;
+  
+  /** \brief Computes the aggregated costs of all the nodes of the tree.
+   * 
+   * The costs are aggregated from the leaves up in a single reverse pass over the 
+   * nodes, since the children of a node always come after it in the depth-first order.
+   * \param aAggregates Receives the aggregated costs of each node, by node id.
+   */
+  void computeAggregates(std::vector<EntryAggregate>& aAggregates) const;
+  
+  /** \brief Forgets the string ids of the producer of the entries.
+   * 
+   * The ids that entries carry are only valid within a trace, this must 
+   * be called when a new trace begins. The interned strings are kept.
+   */
+  void resetStringIDs();
+  
+  void appendName(std::uint32_t aNameID, std::string& aOut) const override;
+  void appendFileName(std::uint32_t aFileID, std::string& aOut) const override;
+  
+private:
+  struct NameSlot {
+    std::uint64_t hash;
+    std::uint32_t id;  // InvalidStringID if the slot is empty.
+  };
+  
+  std::uint32_t internName(const PrintableEntryBegin& aEntry);
+  std::uint32_t internFileName(const PrintableEntryBegin& aEntry, bool aIsOrigin);
+  NameSlot& findNameSlot(std::uint64_t aHash, const std::string& aName);
+  NameSlot& findEmptyNameSlot(std::uint64_t aHash);
+  void growNameSlots();
+  
+  // The distinct names are stored one after the other in fixed blocks (never moved):
+  std::vector< std::unique_ptr<char[]> > name_blocks;
+  char* name_block_pos;                    // the free space at the end of the last block,
+  std::size_t name_block_left;             // and its size.
+  std::vector<const char*> name_starts;    // the start of each name.
+  std::vector<std::uint32_t> name_sizes;   // the size of each name.
+  std::vector<std::uint64_t> name_hashes;  // the hash of each name.
+  std::vector<NameSlot> name_slots;        // an open-addressing table of the name ids, by name hashes.
+  std::vector<std::string> file_names;     // the distinct filenames.
+  std::unordered_map<std::string, std::uint32_t> file_index;
+  
+  const EntryStringTable* last_strings;  // the string table that the maps below are for.
+  std::vector<std::uint32_t> name_id_map; // the interned name ids, by the ids of last_strings.
+  std::vector<std::uint32_t> file_id_map; // the interned filename ids, by the ids of last_strings.
 };
 
 
@@ -151,6 +282,15 @@ struct RecordedDFSEntryTree {
  * This class will arrange the traces into a template instantiation 
  * tree (stored as a depth-first traversal stack), which it will then 
  * write to the output stream with the help of the derived-class implementation.
+ * Each trace is written with its own nodes only, whose ids carry on from one 
+ * trace to the next (such that they are unique within the output).
+ * 
+ * In the streaming mode, the tree is not recorded: only the stack of the open 
+ * nodes is kept, and each node is written (opened and closed at once) as soon 
+ * as its end entry arrives. The nodes are then written in post-order (children 
+ * before their parents), with the same ids as in the recorded mode, and the memory 
+ * used is only proportional to the depth of the tree. This mode is only suitable 
+ * for formats that do not nest the nodes (e.g., lists of nodes and edges).
  */
 class TreeWriter : public EntryWriter {
 public:
@@ -158,8 +298,10 @@ public:
   /** \brief Creates a writer for the given output stream.
    * 
    * Creates an entry-writer for the given output stream.
+   * \param aOS The output stream.
+   * \param aStreaming If true, the nodes are written as soon as they are closed (see TreeWriter).
    */
-  TreeWriter(std::ostream& aOS);
+  TreeWriter(std::ostream& aOS, bool aStreaming = false);
   ~TreeWriter();
   
   void initialize(const std::string& aSourceName = "") override;
@@ -203,7 +345,23 @@ protected:
    */
   virtual void finalizeTree() = 0;
   
+  /** \brief Tells if the tree-writer needs the aggregated costs of the tree nodes.
+   * 
+   * If this returns true, the tree nodes are given with their aggregated costs 
+   * (see EntryTraversalTask::costs), which the tree-writer can then print out.
+   */
+  virtual bool needsAggregates() const { return false; };
+  
   RecordedDFSEntryTree tree;
+  
+private:
+  void writeStreamedNode();
+  
+  bool streaming;
+  std::size_t trace_start;                     // the first node of the current trace, in the recorded mode.
+  std::vector<EntryTraversalTask> open_nodes;  // the stack of open nodes, in the streaming mode.
+  std::size_t open_count;
+  std::size_t node_count;
 };
 
 
@@ -230,6 +388,7 @@ protected:
   
   void initializeTree(const std::string& aSourceName = "") override;
   void finalizeTree() override;
+  bool needsAggregates() const override { return true; };
   
 };
 
@@ -246,8 +405,10 @@ public:
   /** \brief Creates a writer for the given output stream.
    * 
    * Creates an entry-writer for the given output stream.
+   * \param aOS The output stream.
+   * \param aStreaming If true, the nodes are written as soon as they are closed (see TreeWriter).
    */
-  GraphMLWriter(std::ostream& aOS);
+  GraphMLWriter(std::ostream& aOS, bool aStreaming = false);
   ~GraphMLWriter();
   
 protected:
@@ -256,6 +417,7 @@ protected:
   
   void initializeTree(const std::string& aSourceName = "") override;
   void finalizeTree() override;
+  bool needsAggregates() const override { return true; };
   
 private:
   int last_edge_id;
@@ -274,8 +436,10 @@ public:
   /** \brief Creates a writer for the given output stream.
    * 
    * Creates an entry-writer for the given output stream.
+   * \param aOS The output stream.
+   * \param aStreaming If true, the nodes are written as soon as they are closed (see TreeWriter).
    */
-  GraphVizWriter(std::ostream& aOS);
+  GraphVizWriter(std::ostream& aOS, bool aStreaming = false);
   ~GraphVizWriter();
   
 protected:
@@ -289,6 +453,72 @@ protected:
 
 
 
+/** \brief A writer of a report of the most expensive template instantiations.
+ * 
+ * This class will render, for each trace, a ranked table of the entries that took 
+ * the most time and of those that took the most memory, by their exclusive costs 
+ * (without their children), along with their inclusive costs, kind, location and 
+ * template origin. The entries are ranked as they stream in: only the stack of 
+ * the open entries and the highest ranked entries so far (in bounded min-heaps) 
+ * are kept, such that the memory used does not grow with the size of the traces.
+ * \note This is the class invoked when the 'top' format option is used.
+ */
+class TopWriter : public EntryWriter {
+public:
+  
+  /** \brief Creates a writer for the given output stream.
+   * 
+   * Creates an entry-writer for the given output stream.
+   * \param aOS The output stream.
+   * \param aCount The number of entries in each ranked table.
+   */
+  TopWriter(std::ostream& aOS, std::size_t aCount = 50);
+  ~TopWriter();
+  
+  void initialize(const std::string& aSourceName = "") override;
+  void finalize() override;
+  
+  void printEntry(const PrintableEntryBegin& aEntry) override;
+  void printEntry(const PrintableEntryEnd& aEntry) override;
+  
+  /// The report has the names, costs, locations and template origins of the entries.
+  unsigned int getRequiredFields() const override { 
+    return EntryNameField | EntryMemoryField | EntryLocationField | EntryOriginField;
+  };
+  
+private:
+  struct OpenEntry {
+    PrintableEntryBegin start;
+    EntryAggregate costs;
+  };
+  
+  struct RankedEntry {
+    double key;
+    std::uint64_t ordinal;  // the order of the entry in the trace, to break ties.
+    EntryAggregate costs;
+    int kind;
+    std::string name;
+    std::string location;
+    std::string origin;
+    
+    bool operator<(const RankedEntry& rhs) const {
+      return ( key > rhs.key ) || ( ( key == rhs.key ) && ( ordinal < rhs.ordinal ) );
+    };
+  };
+  
+  void rankEntry(std::vector<RankedEntry>& aHeap, double aKey, const OpenEntry& aEntry);
+  void writeTable(std::vector<RankedEntry>& aHeap, const char* aTitle);
+  
+  std::size_t count;
+  std::string source_name;
+  std::vector<OpenEntry> open_entries;  // the stack of open entries, whose elements are reused.
+  std::size_t open_count;
+  std::uint64_t entry_count;
+  std::vector<RankedEntry> time_heap;    // the entries with the highest exclusive times (a min-heap).
+  std::vector<RankedEntry> memory_heap;  // the entries with the highest exclusive memory (a min-heap).
+};
+
+
 }
 
 #endif
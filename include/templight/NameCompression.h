@@ -0,0 +1,129 @@
+/**
+ * \file NameCompression.h
+ *
+ * This library provides the codecs of the compressed template names of the protobuf format (zlib, or zstd with a trained dictionary).
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_NAME_COMPRESSION_H
+#define TEMPLIGHT_NAME_COMPRESSION_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace templight {
+
+/// Tells if templight-tools was built with zstd, which the compression of names with a trained dictionary requires.
+bool hasZstdNameCompression();
+
+/** \brief A compressor of template names, for the compressed_name field of the protobuf format.
+ *
+ * Without a dictionary, each name is compressed as a zlib stream, as the
+ * templight profiler does. Since template names are short, this barely
+ * compresses them. With a dictionary trained on samples of the names of
+ * the trace (see train), each name is instead compressed as a zstd frame
+ * that refers to that dictionary, which must then be stored in the trace
+ * before the names (see getDictionary).
+ */
+class NameCompressor {
+public:
+  NameCompressor();
+  ~NameCompressor();
+
+  NameCompressor(const NameCompressor&) = delete;
+  NameCompressor& operator=(const NameCompressor&) = delete;
+
+  /** \brief Trains a zstd dictionary on sample names.
+   *
+   * \param aSamples The sample names, concatenated.
+   * \param aSampleSizes The sizes of the sample names.
+   * \param aMaxSize The maximum size of the dictionary.
+   * \return True if a dictionary was trained, false if it could not be
+   *         (e.g., with too few samples, or without zstd), in which case
+   *         names are still compressed with zlib.
+   */
+  bool train(const std::string& aSamples, const std::vector<std::size_t>& aSampleSizes, std::size_t aMaxSize);
+
+  /// Forgets the dictionary, if any.
+  void clear();
+
+  /// Tells if names are compressed with a (zstd) dictionary.
+  bool hasDictionary() const { return !dictionary.empty(); };
+
+  /// Returns the dictionary (empty if there is none).
+  const std::string& getDictionary() const { return dictionary; };
+
+  /// Compresses a name into a string (replacing its content), and returns false if it could not (the name must then be stored plain).
+  bool compress(const char* aName, std::size_t aSize, std::string& aOut);
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+  std::string dictionary;
+};
+
+/** \brief A decompressor of template names, from the compressed_name field of the protobuf format.
+ *
+ * Compressed names are either zlib streams or zstd frames, which are told
+ * apart by their first bytes. The zstd frames can refer to a dictionary
+ * (see setDictionary).
+ */
+class NameDecompressor {
+public:
+  NameDecompressor();
+  ~NameDecompressor();
+
+  NameDecompressor(const NameDecompressor&) = delete;
+  NameDecompressor& operator=(const NameDecompressor&) = delete;
+
+  /// Sets the zstd dictionary of the names that follow, and returns false if it is invalid (or without zstd).
+  bool setDictionary(const char* aData, std::size_t aSize);
+
+  /// Forgets the dictionary, if any.
+  void clear();
+
+  /** \brief Decompresses a name into a string (replacing its content).
+   *
+   * \return True if the name was decompressed, false if it is corrupt, 
+   *         decompresses to more than 16 MB (a cap against corrupt sizes),
+   *         or is a zstd frame without zstd.
+   */
+  bool decompress(const char* aData, std::size_t aSize, std::string& aOut);
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
+
+
+}
+
+#endif
+
+
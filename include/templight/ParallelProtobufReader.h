@@ -0,0 +1,194 @@
+/**
+ * \file ParallelProtobufReader.h
+ *
+ * This library provides a class for reading the traces of protobuf formatted templight trace files in parallel.
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_PARALLEL_PROTOBUF_READER_H
+#define TEMPLIGHT_PARALLEL_PROTOBUF_READER_H
+
+#include <templight/PrintableEntries.h>
+#include <templight/ProtobufReader.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace boost { namespace iostreams {
+class mapped_file_source;
+} }
+
+namespace templight {
+
+/** \brief A trace-reader that decodes the traces of a protobuf file in parallel.
+ *
+ * A protobuf trace file is a sequence of length-prefixed traces (one per
+ * translation unit), which this class finds by scanning the outer framing
+ * of the file (see findTraces). Each trace is then decoded by a worker thread,
+ * with its own dictionaries, and the entries of the traces are delivered
+ * in their original order through the same interface as ProtobufReader
+ * (i.e., "next()", LastChunk, LastBeginEntry, etc.).
+ * Workers only decode a bounded number of traces ahead of the one being
+ * delivered, to keep the memory usage in check.
+ *
+ * Alternatively, the traces can be decoded and written entirely in parallel,
+ * to one entry-writer per trace (see decodeTraces).
+ *
+ * \note This requires the trace to be in memory or in a file that can be
+ *       memory-mapped (not a pipe), and not compressed, otherwise, use ProtobufReader.
+ */
+class ParallelProtobufReader {
+public:
+
+  typedef ProtobufReader::LastChunkType LastChunkType;
+
+  LastChunkType LastChunk; ///< Holds the record of the last kind of chunk encountered.
+
+  unsigned int Version;   ///< Holds the version number of the protobuf stream.
+  std::string SourceName; ///< Holds the source name of the translation unit that produced the trace.
+
+  PrintableEntryBegin LastBeginEntry; ///< Holds the last beginning entry.
+  PrintableEntryEnd   LastEndEntry;   ///< Holds the last end entry.
+
+  /// Represents the location of a trace (one or more consecutive trace messages) within a file.
+  struct TraceSpan {
+    std::size_t offset; ///< The offset of the trace, in bytes, from the start of the file.
+    std::size_t size;   ///< The size of the trace, in bytes, including its outer framing.
+    std::size_t dictionary_offset; ///< The offset of the contents of the shared dictionary of the trace (if any).
+    std::size_t dictionary_size;   ///< The size of the contents of the shared dictionary, or 0 if there is none.
+  };
+
+  /** \brief Creates a parallel protobuf reader object.
+   *
+   * \param aThreadCount The number of worker threads to use (zero for one per hardware thread).
+   */
+  explicit ParallelProtobufReader(unsigned int aThreadCount = 0);
+  ~ParallelProtobufReader();
+
+  ParallelProtobufReader(const ParallelProtobufReader&) = delete;
+  ParallelProtobufReader& operator=(const ParallelProtobufReader&) = delete;
+
+  /** \brief Starts to read a given file, which must be memory-mappable.
+   *
+   * \param aFilename The name of the file where there are protobuf traces to read from.
+   * \return The first kind of chunk found in the file (usually, should be Header),
+   *         or EndOfFile if the file could not be memory-mapped.
+   */
+  LastChunkType startOnFile(const std::string& aFilename);
+
+  /** \brief Starts to read a given memory span.
+   *
+   * \param aData A pointer to the start of the memory span holding protobuf traces,
+   *              which must outlive the reading.
+   * \param aSize The size, in bytes, of the memory span.
+   * \return The first kind of chunk found in the span (usually, should be Header).
+   */
+  LastChunkType startOnMemory(const char* aData, std::size_t aSize);
+
+  /** \brief Reads the next chunk, in the order of the file.
+   *
+   * \return The kind of chunk found (see ProtobufReader::next()). The string
+   *         table of LastBeginEntry is only valid until the next trace starts.
+   */
+  LastChunkType next();
+
+  /// Returns true if a trace read so far ends early, because the input is truncated (see ProtobufReader::hasFailed).
+  bool hasFailed() const { return input_failed; }
+
+  /** \brief Sets the fields of the entries that need to be decoded (see ProtobufReader::setRequiredFields).
+   *
+   * \param aFields A mask of the fields to decode (see EntryFieldMask), all of them by default.
+   * \note This must be set before starting to read, since the traces are decoded ahead.
+   */
+  void setRequiredFields(unsigned int aFields) { required_fields = aFields; }
+
+  /** \brief Finds the traces within a memory span holding a protobuf trace file.
+   *
+   * This function scans the outer framing of a trace file, without decoding
+   * the traces. A trace starts at each trace message that starts with a header,
+   * and extends over any following trace messages without a header.
+   * The traces of an archive also refer to the shared dictionary before them.
+   * A compressed span (see detectCompression) has no traces that can be found.
+   * \param aData A pointer to the start of the memory span.
+   * \param aSize The size, in bytes, of the memory span.
+   * \return The locations of the traces within the memory span.
+   */
+  static std::vector<TraceSpan> findTraces(const char* aData, std::size_t aSize);
+
+  /** \brief Decodes and writes the traces of a memory span in parallel, to one writer per trace.
+   *
+   * \param aData A pointer to the start of the memory span holding protobuf traces.
+   * \param aSize The size, in bytes, of the memory span.
+   * \param aMakeWriter A factory of entry-writers, called with the index of each trace,
+   *                    from the worker threads. Ownership of the writer is taken,
+   *                    and it is destroyed once its trace has been finalized.
+   *                    A null writer skips the trace.
+   * \param aThreadCount The number of worker threads to use (zero for one per hardware thread).
+   */
+  static void decodeTraces(const char* aData, std::size_t aSize,
+                           const std::function< EntryWriter*(std::size_t) >& aMakeWriter,
+                           unsigned int aThreadCount = 0);
+
+private:
+
+  struct DecodedTrace;
+
+  unsigned int thread_count;
+  unsigned int required_fields;
+  std::unique_ptr<boost::iostreams::mapped_file_source> mapping;
+  const char* data;
+  std::vector<TraceSpan> traces;
+  std::vector< std::unique_ptr<DecodedTrace> > decoded;
+  std::unique_ptr<DecodedTrace> cur_trace;
+  std::size_t cur_entry;
+  std::size_t next_to_deliver;
+  std::size_t next_to_decode;
+  bool input_failed;
+  bool stopping;
+
+  std::mutex decode_mutex;
+  std::condition_variable decode_cv;
+  std::vector<std::thread> workers;
+
+  void stopWorkers();
+  void runWorker();
+  static void decodeTrace(const char* aData, const TraceSpan& aSpan, unsigned int aRequiredFields,
+                          DecodedTrace& aTrace);
+
+};
+
+
+}
+
+#endif
+
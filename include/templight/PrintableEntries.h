@@ -35,10 +35,80 @@
 
 #include <ostream>
 #include <string>
+#include <vector>
 #include <cstdint>
 
 namespace templight {
 
+/// Marks a name or file id that could not be resolved (e.g., a location without a file).
+static constexpr std::uint32_t InvalidStringID = ~std::uint32_t(0);
+
+/** \brief A hash of template names that composes under concatenation.
+ * 
+ * This class computes a 64-bit hash of a string as a polynomial modulo 
+ * the Mersenne prime 2^61-1, such that the hash of a concatenation can be 
+ * obtained from the hashes of its parts (see append(const EntryNameHash&)). 
+ * This allows the hash of a compressed template name to be computed from 
+ * its dictionary entries, without expanding it.
+ */
+class EntryNameHash {
+public:
+  /// Creates the hash of an empty string.
+  EntryNameHash() : value(0), power(1) { };
+  
+  /// Creates the hash of a given string.
+  EntryNameHash(const char* aStr, std::size_t aLen) : value(0), power(1) { append(aStr, aLen); };
+  
+  /// Appends a string to the hashed string.
+  void append(const char* aStr, std::size_t aLen);
+  
+  /// Appends a string, given by its hash, to the hashed string.
+  void append(const EntryNameHash& aSuffix);
+  
+  /// Returns the (mixed) 64-bit hash value.
+  std::uint64_t get() const;
+  
+private:
+  std::uint64_t value;
+  std::uint64_t power;
+};
+
+/** \brief Interface to the string tables of a producer of trace entries.
+ * 
+ * This is the interface through which the names and filenames of trace 
+ * entries are materialized, from the ids carried in the entries (see 
+ * PrintableEntryBegin::NameID, FileID and TempOri_FileID).
+ */
+class EntryStringTable {
+public:
+  virtual ~EntryStringTable() { };
+  
+  /// Appends the name with a given id to a string.
+  virtual void appendName(std::uint32_t aNameID, std::string& aOut) const = 0;
+  
+  /// Appends the filename with a given id to a string.
+  virtual void appendFileName(std::uint32_t aFileID, std::string& aOut) const = 0;
+  
+  /** \brief Gives the dictionary entry of the name with a given id, if it has one.
+   * 
+   * Tables that keep names as a dictionary (as in the protobuf format) can give 
+   * out the entry of a name, i.e., its marked name, in which each '\0' marks the 
+   * place of a sub-name, and the ids of these sub-names (which are also entries 
+   * of the dictionary, or InvalidStringID for an empty sub-name). This allows a 
+   * name to be re-encoded without being expanded (see ProtobufWriter).
+   * \param aNameID The id of the name.
+   * \param aMarkedName Receives the marked name.
+   * \param aMarkedSize Receives the size of the marked name.
+   * \param aMarkers Receives the ids of the sub-names.
+   * \param aMarkerCount Receives the number of sub-names.
+   * \return True if the name is a dictionary entry, false otherwise (the default).
+   */
+  virtual bool getDictionaryEntry(std::uint32_t aNameID, const char*& aMarkedName, std::size_t& aMarkedSize, 
+                                  const std::uint32_t*& aMarkers, std::size_t& aMarkerCount) const { 
+    return false;
+  };
+};
+
 /** \brief Represents the beginning of a templight trace entry.
  * 
  * This struct represents the beginning of a templight trace entry, 
@@ -47,18 +117,58 @@ namespace templight {
  * template (template's definition), and the absolute compilation costs 
  * at the point of instantiation (difference with the ending part gives 
  * the actual cost of the instantiation).
+ * 
+ * When produced by a trace reader, the entry also carries the ids of its 
+ * names and filenames in the reader's string tables (valid until the 
+ * reader starts a new trace) and the hash of its name (if it is known), 
+ * and the strings themselves, and the hash otherwise, are only materialized 
+ * when they are asked for (see getName, getFileName, getTempOriFileName 
+ * and getNameHash). An entry that must outlive its 
+ * reader must be detached from it (see detachStrings).
  */
 struct PrintableEntryBegin {
   int InstantiationKind; ///< The kind of instantiation that this entry represents.
-  std::string Name;      ///< The name of the template instantiation.
-  std::string FileName;  ///< The filename where the instantiation occurred.
+  mutable std::string Name;      ///< The name of the template instantiation (see getName).
+  mutable std::string FileName;  ///< The filename where the instantiation occurred (see getFileName).
   int Line;              ///< The line where the instantiation occurred.
   int Column;            ///< The column where the instantiation occurred.
   double TimeStamp;          ///< The time-stamp at the beginning of the instantiation.
   std::uint64_t MemoryUsage; ///< The memory usage at the beginning of the instantiation.
-  std::string TempOri_FileName; ///< The filename where the template is defined.
+  mutable std::string TempOri_FileName; ///< The filename where the template is defined (see getTempOriFileName).
   int TempOri_Line;             ///< The line where the template is defined.
   int TempOri_Column;           ///< The column where the template is defined.
+  
+  std::uint32_t NameID;         ///< The id of the name in Strings (InvalidStringID if none).
+  std::uint32_t FileID;         ///< The id of the filename in Strings (InvalidStringID if none).
+  std::uint32_t TempOri_FileID; ///< The id of the template origin filename in Strings (InvalidStringID if none).
+  std::uint64_t NameHash;       ///< The hash of the name (see EntryNameHash), or 0 if not computed.
+  const EntryStringTable* Strings; ///< The table to materialize strings from, or null if the strings are filled in.
+  
+  PrintableEntryBegin() : InstantiationKind(0), Line(0), Column(0), TimeStamp(0.0), MemoryUsage(0), 
+    TempOri_Line(0), TempOri_Column(0), NameID(InvalidStringID), FileID(InvalidStringID), 
+    TempOri_FileID(InvalidStringID), NameHash(0), Strings(nullptr), Materialized(0) { };
+  
+  /// Returns the name of the template instantiation, materializing it if needed.
+  const std::string& getName() const;
+  /// Returns the filename where the instantiation occurred, materializing it if needed.
+  const std::string& getFileName() const;
+  /// Returns the filename where the template is defined, materializing it if needed.
+  const std::string& getTempOriFileName() const;
+  /// Returns the hash of the name, computing it if needed.
+  std::uint64_t getNameHash() const;
+  
+  /** \brief Sets the string table from which the strings will be materialized.
+   * 
+   * This marks all the strings as not yet materialized, the ids must 
+   * be set accordingly.
+   */
+  void setStrings(const EntryStringTable* aStrings) { Strings = aStrings; Materialized = 0; };
+  
+  /// Materializes all the strings and detaches the entry from its string table.
+  void detachStrings();
+  
+private:
+  mutable std::uint8_t Materialized;
 };
 
 const char* GetInstantiationKindString(int inst_kind);
@@ -79,6 +189,67 @@ struct PrintableEntryEnd {
 };
 
 
+/** \brief Holds a batch of templight trace entries in a columnar layout.
+ * 
+ * This struct holds a sequence of beginning and end entries, in trace order, 
+ * as a set of parallel arrays (one per field), such that aggregations can 
+ * be done in tight loops over contiguous arrays. The names and filenames 
+ * are not stored in the batch, only their ids within the string tables 
+ * of the producer of the batch (e.g., see ProtobufReader::getName and 
+ * ProtobufReader::getFileName). The fields that only exist in beginning 
+ * entries are set to zero (or InvalidStringID) for end entries.
+ * This is how ParallelProtobufReader holds the entries of the traces that 
+ * it decodes ahead, until they are replayed in order.
+ */
+struct EntryBatch {
+  std::vector<std::uint8_t>  IsBegin;        ///< Whether each entry is a beginning (1) or end (0) entry.
+  std::vector<int>           Kind;           ///< The kinds of instantiation.
+  std::vector<std::uint32_t> NameID;         ///< The ids of the names of the template instantiations.
+  std::vector<std::uint64_t> NameHash;       ///< The hashes of the names (see EntryNameHash), or 0 if not computed.
+  std::vector<std::uint32_t> FileID;         ///< The ids of the filenames where the instantiations occurred.
+  std::vector<int>           Line;           ///< The lines where the instantiations occurred.
+  std::vector<int>           Column;         ///< The columns where the instantiations occurred.
+  std::vector<double>        TimeStamp;      ///< The time-stamps of the entries.
+  std::vector<std::uint64_t> MemoryUsage;    ///< The memory usages of the entries.
+  std::vector<std::uint32_t> TempOri_FileID; ///< The ids of the filenames where the templates are defined.
+  std::vector<int>           TempOri_Line;   ///< The lines where the templates are defined.
+  std::vector<int>           TempOri_Column; ///< The columns where the templates are defined.
+  
+  /// Returns the number of entries in the batch.
+  std::size_t size() const { return IsBegin.size(); };
+  /// Checks if the batch holds no entries.
+  bool empty() const { return IsBegin.empty(); };
+  
+  /// Removes all the entries, but keeps the capacity of the arrays.
+  void clear();
+  /// Reserves capacity for a given number of entries in all the arrays.
+  void reserve(std::size_t aCount);
+  
+  /// Appends a beginning entry to the batch (only its ids are kept, not its strings).
+  void addBegin(const PrintableEntryBegin& aEntry);
+  
+  /// Appends an end entry to the batch.
+  void addEnd(const PrintableEntryEnd& aEntry);
+};
+
+
+/** \brief Identifies the fields of the entries that a consumer of entries needs.
+ * 
+ * These flags are combined into a mask of the fields that an entry-writer needs 
+ * (see EntryWriter::getRequiredFields), such that a trace reader can skip the 
+ * decoding of the other fields (see ProtobufReader::setRequiredFields), which 
+ * are then left to their default values (e.g., InvalidStringID and zero). 
+ * The kind of instantiation and the time-stamps are always decoded.
+ */
+enum EntryFieldMask {
+  EntryNameField     = 0x01, ///< The name of the instantiation (NameID, NameHash).
+  EntryLocationField = 0x02, ///< The location of the instantiation (FileID, Line, Column).
+  EntryOriginField   = 0x04, ///< The location of the template's definition (TempOri_FileID, TempOri_Line, TempOri_Column).
+  EntryMemoryField   = 0x08, ///< The memory usage, in beginning and end entries (MemoryUsage).
+  AllEntryFields     = 0x0F  ///< All the fields.
+};
+
+
 /** \brief Base class for entry writers.
  * 
  * This base-class handles the actual writing of the templight trace 
@@ -126,6 +297,14 @@ public:
    */
   virtual void printEntry(const PrintableEntryEnd& aEntry) = 0;
   
+  /** \brief Gives the fields of the entries that this writer needs.
+   * 
+   * This function tells which fields of the entries this writer actually uses, 
+   * such that the other fields need not be decoded by the trace reader.
+   * \return A mask of the fields that are needed (see EntryFieldMask), all of them by default.
+   */
+  virtual unsigned int getRequiredFields() const { return AllEntryFields; };
+  
 protected:
   std::ostream& OutputOS;
 };
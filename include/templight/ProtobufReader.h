@@ -32,12 +32,27 @@
 #ifndef TEMPLIGHT_PROTOBUF_READER_H
 #define TEMPLIGHT_PROTOBUF_READER_H
 
+#include <templight/CompressedStreams.h>
+#include <templight/NameCompression.h>
 #include <templight/PrintableEntries.h>
+#include <templight/ProtobufTraceIndex.h>
 
+#include <boost/utility/string_ref.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <memory>
 #include <string>
 #include <vector>
+#include <unordered_map>
 #include <istream>
 
+namespace boost { namespace iostreams { 
+class mapped_file_source;
+} }
+
 namespace templight {
 
 /** \brief A trace-reader for a Google protobuf format.
@@ -50,24 +65,174 @@ namespace templight {
  * 
  * And the explanation of the protobuf format compression scheme can be found at:
  * https://github.com/mikael-s-persson/templight/wiki/Protobuf-Template-Name-Compression---Explained
+ * 
+ * The reader can either pull the trace from an input stream (see startOnBuffer and 
+ * startOnStdin) or decode it directly from a memory span, such as a memory-mapped 
+ * file (see startOnFile and startOnMemory). In the latter case, the trace chunks are 
+ * decoded in-place, without being copied out of the span. In the former case, the 
+ * stream is read by large blocks in which the chunks are decoded in-place, and the 
+ * reader keeps count of the bytes it consumed, such that it never needs to query 
+ * the position of the stream (tellg) or to seek within it. This makes it suitable 
+ * for pipes and FIFOs (e.g., "zcat trace.pbf.gz | templight-convert").
+ * 
+ * All inputs are checked for gzip or zstd compression (from their first bytes), 
+ * in which case they are decompressed by a background thread, as a stream 
+ * (see DecompressingStreamBuf), and thus, they cannot be seeked.
+ * 
+ * The beginning entries refer to the names and filenames by their ids in the 
+ * string tables of the reader, which stay valid until the next trace header. 
+ * Inline (uncompressed) names are interned as they are read, such that every 
+ * distinct name of a trace gets a single id. The names are kept as views into 
+ * the memory span, or into the block of the stream that they were read from, 
+ * from which they are only copied out when the block is refilled, and the 
+ * hashes of inline names are only computed when asked for. The strings of 
+ * LastBeginEntry are only materialized when asked for (see PrintableEntryBegin).
+ * 
+ * The dictionary of compressed names is kept as it is in the trace, i.e., as 
+ * marked names whose markers refer to earlier entries, forming a DAG. Names are 
+ * only expanded when asked for (see appendName), and the most recently expanded 
+ * names are kept in a cache of bounded size (see setNameCacheLimit).
+ * Compressed names (zlib, or zstd with the dictionary of names of the trace) 
+ * are decompressed and interned like inline names (see ProtobufWriter).
+ * 
+ * The traces of an archive (see ProtobufWriter::writeSharedDictionary) follow 
+ * a shared dictionary of names and filenames, which the reader loads once, as 
+ * the first entries of its string tables, and keeps across the traces that 
+ * follow it (only the names and filenames of each trace are reset at its header).
+ * 
+ * With a seek index of the trace file (see ProtobufTraceIndex), the reader 
+ * can jump to a given trace or entry without decoding everything before it 
+ * (see seekToTrace and seekToEntry).
  */
-class ProtobufReader {
+class ProtobufReader : public EntryStringTable {
 private:
   
-  std::istream* buffer;
-  std::streampos next_start;
+  // The input stream (or stdin), read by large blocks, without tellg or seeking:
+  std::streambuf* in_buf;
+  std::FILE* in_file;
+  std::unique_ptr<std::istream> owned_buffer;
+  std::vector< std::uint8_t > block;
+  const std::uint8_t* blk_cur;
+  const std::uint8_t* blk_end;
+  std::uint64_t blk_offset;    // the number of input bytes before the start of the block.
+  std::uint64_t blk_trace_end; // the input position of the end of the current trace message.
+  bool in_eof;
+  bool in_truncated;           // whether the input ended within a trace message.
+  std::streampos stream_start; // only to seek within the stream, if it can.
+  
+  // The memory span that was started on, kept to seek within it:
+  const std::uint8_t* mem_begin;
+  std::size_t mem_size;
+  
+  std::unique_ptr<boost::iostreams::mapped_file_source> mapping;
+  std::unique_ptr<DecompressingStreamBuf> decompressor; // reads from the inputs above.
+  const std::uint8_t* mem_cur;
+  const std::uint8_t* mem_end;
+  const std::uint8_t* mem_trace_end;
   
   std::vector< std::string > fileNameMap;
-  std::vector< std::string > templateNameMap;
   
-  void loadHeader(std::streampos buf_limit);
-  void loadDictionaryEntry(std::streampos buf_limit);
-  void loadTemplateName(std::streampos buf_limit);
-  void loadBeginEntry(std::streampos buf_limit);
-  void loadEndEntry(std::streampos buf_limit);
+  // The names, as marked names (with '\0' markers) and the ids of their markers:
+  std::vector< boost::string_ref > templateNameMap; // views into the input, the block or nameBlocks.
+  std::vector< std::uint32_t > templateMarkerStarts;
+  std::vector< std::uint32_t > templateMarkers;
+  std::vector< std::size_t > templateNameLengths;
+  std::vector< EntryNameHash > templateNameHashes;
+  std::vector< bool > templateNameIsEntry; // whether a name is a dictionary entry (or inline).
+  std::vector< std::uint32_t > dictionaryNameIDs;
+  
+  // The inline names, in an open-addressing table of their ids, by hashes (see hashNameBytes):
+  struct InlineNameSlot {
+    std::uint64_t hash;
+    std::uint32_t id;  // InvalidStringID if the slot is empty.
+  };
+  std::vector< InlineNameSlot > inlineNameSlots;
+  std::size_t inlineNameCount;
+  
+  // The names that cannot be viewed where they were read from are copied into fixed blocks 
+  // (never moved), the first blocks hold those of the shared dictionary (if any):
+  std::vector< std::unique_ptr<char[]> > nameBlocks;
+  char* nameBlockPos;
+  std::size_t nameBlockLeft;
+  std::size_t sharedNameBlockCount;
+  std::vector< std::uint32_t > blockNameIDs; // the names viewed in the stream block, until it is refilled.
+  
+  // The sizes of the string tables that the shared dictionary (if any) fills, 
+  // and where the shared dictionary is in the input (if known):
+  std::size_t sharedNameCount;
+  std::size_t sharedMarkerCount;
+  std::size_t sharedDictionaryCount;
+  std::size_t sharedFileCount;
+  std::uint64_t sharedDictionaryOffset;
+  
+  // The decompressor of compressed names (with the dictionary of the trace, if any):
+  NameDecompressor nameDecompressor;
+  std::string decompressedName;
+  
+  // The cache of expanded names, in least-recently used order:
+  struct CachedExpansion {
+    std::string name;
+    std::list< std::uint32_t >::iterator lru_it;
+  };
+  mutable std::unordered_map< std::uint32_t, CachedExpansion > expansionCache;
+  mutable std::list< std::uint32_t > expansionLRU;
+  mutable std::size_t expansionCacheSize;
+  std::size_t expansionCacheLimit;
+  
+  // The stack of the names being expanded, with their next piece and marker:
+  struct ExpansionFrame {
+    std::uint32_t name_id;
+    const char* piece;
+    std::size_t marker;
+  };
+  mutable std::vector< ExpansionFrame > expansionStack;
+  
+  std::uint32_t internName(boost::string_ref aName);
+  InlineNameSlot& findInlineNameSlot(std::uint64_t aHash, boost::string_ref aName);
+  InlineNameSlot& findEmptyInlineNameSlot(std::uint64_t aHash);
+  void growInlineNameSlots();
+  boost::string_ref storeName(boost::string_ref aName, std::uint32_t aNameID);
+  boost::string_ref copyName(boost::string_ref aName);
+  void releaseBlockNames();
+  void addTemplateName(boost::string_ref aMarkedName, std::size_t aMarkerStart);
+  void clearNameTables();
+  void clearSharedDictionary();
+  void loadSharedDictionary(const std::uint8_t* p, const std::uint8_t* p_end, std::uint64_t aOffset);
+  bool restoreSharedDictionary(const ProtobufTraceIndex::Trace& aTrace);
+  std::size_t getMarkerEnd(std::uint32_t aNameID) const;
+  void expandName(std::uint32_t aNameID, std::string& aOut) const;
+  void cacheExpansion(std::uint32_t aNameID, const char* aName, std::size_t aSize) const;
+  bool isStreaming() const { return in_buf || in_file; };
+  std::uint64_t getStreamPos() const { return blk_offset + (blk_cur - block.data()); };
+  void resetBlock(std::uint64_t aOffset);
+  std::size_t readInput(std::uint8_t* aDest, std::size_t aSize);
+  bool fillBlock(std::size_t aMinSize);
+  void skipStreamData(std::uint64_t wire);
+  void detectStreamCompression();
+  bool seekTo(std::uint64_t aOffset, std::uint64_t aEnd);
+  bool readTraceChunk(std::uint64_t& wire, const std::uint8_t*& p, const std::uint8_t*& p_end);
+  
+  void loadHeader(const std::uint8_t* p, const std::uint8_t* p_end);
+  void loadDictionaryEntry(const std::uint8_t* p, const std::uint8_t* p_end);
+  void loadTemplateName(const std::uint8_t* p, const std::uint8_t* p_end);
+  void loadLocation(const std::uint8_t* p, const std::uint8_t* p_end, 
+                    std::uint32_t& FileID, int& Line, int& Column);
+  void loadBeginEntry(const std::uint8_t* p, const std::uint8_t* p_end);
+  void loadEndEntry(const std::uint8_t* p, const std::uint8_t* p_end);
+  void skipBeginEntry(const std::uint8_t* p, const std::uint8_t* p_end);
+  void skipEntrySubtree();
+  
+  // The filter of the beginning entries (see setEntryFilter):
+  std::function<bool(const PrintableEntryBegin&)> entryFilter;
+  std::uint64_t skippedEntryCount;
+  
+  unsigned int requiredFields; // the fields of the entries that are decoded (see EntryFieldMask).
   
 public:
   
+  /// The type of the filters of beginning entries (see setEntryFilter), which return true to skip an entry.
+  typedef std::function<bool(const PrintableEntryBegin&)> EntryFilter;
+  
   /// Identifies what kind of chunk was last seen in the trace file (during last call to "next()")
   enum LastChunkType {
     EndOfFile = 0,  ///< Reached the end of the file / stream.
@@ -89,15 +254,50 @@ public:
    * in a given input stream.
    */
   ProtobufReader();
+  ~ProtobufReader();
+  
+  ProtobufReader(const ProtobufReader&) = delete;
+  ProtobufReader& operator=(const ProtobufReader&) = delete;
   
   /** \brief Starts to read a given input stream.
    * 
    * This function triggers the start of the reading of a trace from a given input stream.
+   * The stream is read by large blocks, i.e., the reader reads ahead of the chunks 
+   * it returns, up to the end of the stream.
    * \param aBuffer An input stream where there is a protobuf trace to read from.
    * \return The first kind of chunk found in the buffer (usually, should be Header).
    */
   LastChunkType startOnBuffer(std::istream& aBuffer);
   
+  /** \brief Starts to read the standard input.
+   * 
+   * This function triggers the start of the reading of a trace from the standard 
+   * input, read by large blocks directly from the C stdin stream, which bypasses 
+   * the synchronization of std::cin (which should not be used in the meantime).
+   * \return The first kind of chunk found in the standard input (usually, should be Header).
+   */
+  LastChunkType startOnStdin();
+  
+  /** \brief Starts to read a given file, memory-mapping it whenever possible.
+   * 
+   * This function triggers the start of the reading of a trace from a given file. 
+   * The file is memory-mapped and decoded in-place, unless it cannot be mapped 
+   * (e.g., it is a pipe), in which case it is read as a file stream instead.
+   * \param aFilename The name of the file where there is a protobuf trace to read from.
+   * \return The first kind of chunk found in the file (usually, should be Header).
+   */
+  LastChunkType startOnFile(const std::string& aFilename);
+  
+  /** \brief Starts to read a given memory span.
+   * 
+   * This function triggers the start of the reading of a trace from a given memory 
+   * span. The span is decoded in-place and must outlive the reading.
+   * \param aData A pointer to the start of the memory span holding a protobuf trace.
+   * \param aSize The size, in bytes, of the memory span.
+   * \return The first kind of chunk found in the span (usually, should be Header).
+   */
+  LastChunkType startOnMemory(const char* aData, std::size_t aSize);
+  
   /** \brief Reads the next chunk in the input stream.
    * 
    * This function reads the next chunk of a trace from its input stream.
@@ -108,6 +308,137 @@ public:
    */
   LastChunkType next();
   
+  /** \brief Seeks to the start of a trace, using a seek index of the input.
+   * 
+   * This function moves the reader to the header of a given trace, as if 
+   * it had read everything before it. The input must be a memory span 
+   * (or memory-mapped file) or a seekable stream (not the standard input, 
+   * see startOnStdin), indexed by the given index.
+   * \param aIndex The seek index of the input.
+   * \param aTrace The index of the trace to seek to.
+   * \return The first kind of chunk of the trace (usually, should be Header), 
+   *         or EndOfFile if the trace does not exist or the input cannot seek.
+   */
+  LastChunkType seekToTrace(const ProtobufTraceIndex& aIndex, std::size_t aTrace);
+  
+  /** \brief Seeks to an entry of a trace, using a seek index of the input.
+   * 
+   * This function moves the reader to a given entry of a trace, as if it had 
+   * read everything before it. It restores the string tables from the string 
+   * definitions recorded in the index, resumes at the last checkpoint before 
+   * the entry and decodes forward from there.
+   * \param aIndex The seek index of the input.
+   * \param aTrace The index of the trace to seek to.
+   * \param aEntry The ordinal of the entry within the trace, counting 
+   *               beginning and end entries from zero.
+   * \return The kind of the entry (BeginEntry or EndEntry), whose information 
+   *         is in LastBeginEntry or LastEndEntry, or EndOfFile if the entry 
+   *         does not exist or the input cannot seek.
+   */
+  LastChunkType seekToEntry(const ProtobufTraceIndex& aIndex, std::size_t aTrace, std::uint64_t aEntry);
+  
+  /// Returns the (expanded) name for a given name id (see PrintableEntryBegin::NameID), or an empty string if invalid.
+  std::string getName(std::uint32_t aNameID) const;
+  
+  /** \brief Returns a view of the name with a given id, if the name is stored in one piece.
+   * 
+   * Inline names and dictionary entries without markers are stored in one piece, as 
+   * views into the memory span (or memory-mapped file) of the input, into the block 
+   * of the stream, or into the copies of the names (see the class description), 
+   * whereas the other names must be expanded (see appendName).
+   * \param aNameID The id of the name (see PrintableEntryBegin::NameID).
+   * \return A view of the name, which is valid until the reader reads or seeks further, 
+   *         or an empty view if the id is invalid or the name is not stored in one piece.
+   */
+  boost::string_ref getNameRef(std::uint32_t aNameID) const;
+  
+  /// Returns the filename for a given file id (see PrintableEntryBegin::FileID), or an empty string if invalid.
+  const std::string& getFileName(std::uint32_t aFileID) const;
+  
+  /// Returns the number of names currently in the string table of names.
+  std::size_t getNameCount() const { return templateNameMap.size(); };
+  
+  /// Returns the number of filenames currently in the string table of filenames.
+  std::size_t getFileCount() const { return fileNameMap.size(); };
+  
+  /** \brief Appends the expanded name with a given id to a string.
+   * 
+   * This function expands a name from its dictionary entries (or from the cache 
+   * of expanded names), straight into the given string.
+   * \param aNameID The id of the name to append (see PrintableEntryBegin::NameID).
+   * \param aOut The string to which the expanded name is appended.
+   */
+  void appendName(std::uint32_t aNameID, std::string& aOut) const override;
+  
+  /// Appends the filename with a given id to a string.
+  void appendFileName(std::uint32_t aFileID, std::string& aOut) const override;
+  
+  /// Gives the dictionary entry of the name with a given id, if it came from the dictionary of the trace.
+  bool getDictionaryEntry(std::uint32_t aNameID, const char*& aMarkedName, std::size_t& aMarkedSize, 
+                          const std::uint32_t*& aMarkers, std::size_t& aMarkerCount) const override;
+  
+  /** \brief Sets the shared dictionary of the traces that follow.
+   * 
+   * This function loads a shared dictionary of names and filenames, as it is 
+   * found in an archive (see ProtobufWriter::writeSharedDictionary), as if the 
+   * reader had read it before the current trace. This is needed when a reader 
+   * is started on a trace of an archive that was cut out of it (as done by 
+   * ParallelProtobufReader), and should be called after the header of the trace.
+   * \param aData A pointer to the contents of the TemplightDictionary message.
+   * \param aSize The size, in bytes, of the contents of the message.
+   */
+  void setSharedDictionary(const char* aData, std::size_t aSize);
+  
+  /** \brief Sets a filter of the beginning entries, which skips the rejected entries with their subtrees.
+   * 
+   * When the filter rejects a beginning entry (returns true), the reader skips that entry 
+   * and all the entries nested in it, up to its matching end entry, such that none of them 
+   * are returned (by "next()"). The nested entries are only framed, to track 
+   * their nesting, and only the definitions that later entries can refer to (dictionary 
+   * entries and filenames) are loaded: their names are neither interned nor decompressed.
+   * \param aFilter The filter, or an empty function to not filter the entries (the default).
+   * \note The filter is not applied while seeking to an entry (see seekToEntry), only to the 
+   *       entries that follow it.
+   */
+  void setEntryFilter(EntryFilter aFilter);
+  
+  /** \brief Returns true if the input could not be read entirely.
+   * 
+   * The reading ends early (as if the input ended there) if a gzip or zstd input 
+   * cannot be decompressed (corrupt), or if the input ends within a trace (truncated), 
+   * which this tells apart from a complete input, once the reading reached the end 
+   * of the input (EndOfFile).
+   */
+  bool hasFailed() const { return in_truncated || ( decompressor && decompressor->hasFailed() ); };
+  
+  /// Returns the number of beginning entries that were skipped because of the filter (see setEntryFilter).
+  std::uint64_t getSkippedEntryCount() const { return skippedEntryCount; };
+  
+  /** \brief Sets the fields of the entries that need to be decoded.
+   * 
+   * This function sets which fields of the entries are decoded, such that the others 
+   * are skipped without being decoded, and are left to their default values in 
+   * LastBeginEntry and LastEndEntry (e.g., the names are neither interned nor 
+   * decompressed if they are not needed). This is usually set to the fields that 
+   * the consumer of the entries needs (see EntryWriter::getRequiredFields).
+   * \param aFields A mask of the fields to decode (see EntryFieldMask), all of them by default.
+   */
+  void setRequiredFields(unsigned int aFields);
+  
+  /// Returns the mask of the fields of the entries that are decoded (see setRequiredFields).
+  unsigned int getRequiredFields() const { return requiredFields; };
+  
+  /** \brief Sets the maximum size of the cache of expanded names.
+   * 
+   * \param aBytes The maximum total size, in bytes, of the cached expanded names 
+   *               (zero disables the cache).
+   */
+  void setNameCacheLimit(std::size_t aBytes);
+  
+private:
+  
+  LastChunkType startOnTrace();
+  
 };
 
 
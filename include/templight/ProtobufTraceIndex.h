@@ -0,0 +1,178 @@
+/**
+ * \file ProtobufTraceIndex.h
+ *
+ * This library provides a class for building, saving and loading seek indices of protobuf formatted templight trace files.
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_PROTOBUF_TRACE_INDEX_H
+#define TEMPLIGHT_PROTOBUF_TRACE_INDEX_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace templight {
+
+/** \brief A seek index of a protobuf trace file.
+ *
+ * This class records where the traces of a protobuf trace file start, and
+ * where a ProtobufReader can resume decoding within a trace (see
+ * ProtobufReader::seekToTrace and ProtobufReader::seekToEntry), such that
+ * looking at one translation unit or one subtree of a large trace file
+ * does not require decoding it from the start.
+ *
+ * For each trace, the index holds:
+ *  - the offset of its header (or of its first chunk, if it has no header);
+ *  - the offsets of the chunks that define strings, i.e., the dictionary
+ *    entries, the dictionary of compressed names (if any), and the beginning
+ *    entries that introduce a new filename, which
+ *    form the dictionary state to restore before resuming at a checkpoint;
+ *  - checkpoints at every K-th top-level beginning entry, with their
+ *    entry ordinal (counting beginning and end entries from zero);
+ *  - the span of the shared dictionary that the trace refers to, if the
+ *    file is an archive (see ProtobufWriter::writeSharedDictionary).
+ *
+ * The index can be saved as a small sidecar file next to the trace file
+ * (see getSidecarName), itself in a protobuf format:
+ * \code
+ * message TemplightTraceIndex {
+ *   required uint32 version = 1;
+ *   required uint64 file_size = 2;
+ *   required uint32 stride = 3;
+ *   repeated TraceIndex traces = 4;
+ *   optional int64 file_time = 5;   // last write time of the trace file.
+ *   required uint64 head_hash = 6;  // hash of the first bytes of the trace file.
+ *   required uint64 trace_count = 7; // the number of traces, last (to detect truncated sidecars).
+ * }
+ * message TraceIndex {
+ *   required uint64 offset = 1;
+ *   required uint64 message_end = 2;
+ *   optional uint32 version = 3;
+ *   optional string source_file = 4;
+ *   required uint64 entry_count = 5;
+ *   optional bytes definitions = 6;  // delta-encoded varints of the offsets.
+ *   repeated Checkpoint checkpoints = 7;
+ *   optional uint64 dictionary_offset = 8;
+ *   optional uint64 dictionary_size = 9;
+ * }
+ * message Checkpoint {
+ *   required uint64 entry = 1;
+ *   required uint64 offset = 2;
+ *   required uint64 message_end = 3;
+ * }
+ * \endcode
+ * 
+ * A sidecar file is only valid for the trace file it was built from, which is 
+ * checked with its size, last write time and first bytes (see isUpToDate).
+ */
+class ProtobufTraceIndex {
+public:
+
+  /// A point within a trace where decoding can resume.
+  struct Checkpoint {
+    std::uint64_t entry;       ///< The ordinal of the (top-level beginning) entry within its trace.
+    std::uint64_t offset;      ///< The offset of the entry's chunk, from the start of the file.
+    std::uint64_t message_end; ///< The offset of the end of the trace message holding the entry.
+  };
+
+  /// The index of one trace of the file.
+  struct Trace {
+    std::uint64_t offset;      ///< The offset of the header chunk, from the start of the file.
+    std::uint64_t message_end; ///< The offset of the end of the trace message holding the header.
+    unsigned int version;      ///< The version number in the header of the trace.
+    std::string source_name;   ///< The source name in the header of the trace.
+    std::uint64_t entry_count; ///< The number of beginning and end entries in the trace.
+    std::vector< std::uint64_t > definitions; ///< The offsets of the chunks that define strings, in order.
+    std::vector< Checkpoint > checkpoints;    ///< The checkpoints, in order.
+    std::uint64_t dictionary_offset; ///< The offset of the contents of the shared dictionary of the trace (if any).
+    std::uint64_t dictionary_size;   ///< The size of the contents of the shared dictionary, or 0 if there is none.
+  };
+
+  std::uint64_t FileSize; ///< Holds the size of the indexed trace file.
+  std::int64_t FileTime;  ///< Holds the last write time of the indexed trace file (or 0 if it was not indexed from a file).
+  std::uint64_t HeadHash; ///< Holds the hash of the first bytes of the indexed trace file.
+  unsigned int Stride;    ///< Holds the number of top-level beginning entries between checkpoints.
+  std::vector< Trace > Traces; ///< Holds the indices of the traces, in order.
+
+  ProtobufTraceIndex() : FileSize(0), FileTime(0), HeadHash(0), Stride(0) { }
+
+  /** \brief Builds the index of a memory span holding a protobuf trace file.
+   *
+   * \param aData A pointer to the start of the memory span.
+   * \param aSize The size, in bytes, of the memory span.
+   * \param aStride The number of top-level beginning entries between checkpoints.
+   */
+  void build(const char* aData, std::size_t aSize, unsigned int aStride = 16);
+
+  /** \brief Builds the index of a protobuf trace file.
+   *
+   * \param aFilename The name of the trace file, which must be memory-mappable (and not compressed).
+   * \param aStride The number of top-level beginning entries between checkpoints.
+   * \return True if the file could be read.
+   */
+  bool buildFromFile(const std::string& aFilename, unsigned int aStride = 16);
+
+  /// Writes the index to an output stream, in the sidecar format.
+  void save(std::ostream& aOS) const;
+
+  /// Reads the index from an input stream, in the sidecar format, and returns false if it is invalid (or truncated).
+  bool load(std::istream& aIS);
+
+  /// Writes the index to a sidecar file, and returns false if the file could not be written.
+  bool saveToFile(const std::string& aFilename) const;
+
+  /// Reads the index from a sidecar file, and returns false if it could not be read or is invalid.
+  bool loadFromFile(const std::string& aFilename);
+
+  /** \brief Tells if the index is still that of a given trace file.
+   *
+   * \param aFilename The name of the trace file.
+   * \return True if the size, last write time and first bytes of the file are those it was indexed with.
+   */
+  bool isUpToDate(const std::string& aFilename) const;
+
+  /// Returns the name of the sidecar index file for a given trace file.
+  static std::string getSidecarName(const std::string& aTraceFilename);
+
+  /** \brief Finds the checkpoint from which to reach a given entry of a trace.
+   *
+   * \param aTrace The index of the trace.
+   * \param aEntry The ordinal of the entry within the trace.
+   * \return The last checkpoint at or before the entry, or null if there is none.
+   */
+  const Checkpoint* findCheckpoint(std::size_t aTrace, std::uint64_t aEntry) const;
+
+};
+
+
+}
+
+#endif
+
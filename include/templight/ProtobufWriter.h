@@ -32,10 +32,14 @@
 #ifndef TEMPLIGHT_PROTOBUF_WRITER_H
 #define TEMPLIGHT_PROTOBUF_WRITER_H
 
+#include <templight/NameCompression.h>
 #include <templight/PrintableEntries.h>
 
+#include <cstdint>
+#include <memory>
 #include <ostream>
 #include <string>
+#include <vector>
 #include <unordered_map>
 
 namespace templight {
@@ -45,6 +49,56 @@ namespace templight {
  * 
  * This class will render the traces into the given output stream in 
  * a Google protobuf format, as a flat sequence of begin and end entries.
+ * Each entry is serialized in a single pass into the buffer of the trace, 
+ * the sizes of its nested messages being computed before they are written.
+ * 
+ * When the entries come from a trace reader that keeps their names in a 
+ * dictionary (see EntryStringTable::getDictionaryEntry), as when converting 
+ * a protobuf trace to the protobuf format, the dictionary entries of the names 
+ * are copied over (only those that are used), instead of being expanded and 
+ * split up again.
+ * 
+ * The template names are written according to the compression level: 
+ *  - 0: plain names;
+ *  - 1: names compressed with zlib (in the compressed_name field);
+ *  - 2: a dictionary of the parts of the names (the default);
+ *  - 3: names compressed with zstd and a dictionary trained on the names of 
+ *       the trace itself. To train it, the first entries of each trace are held 
+ *       back (up to a few megabytes of names), and the dictionary is then written 
+ *       in the trace (as "optional bytes name_dictionary = 4;" of the TemplightTrace 
+ *       message), before the entries. If the dictionary cannot be trained (e.g., 
+ *       too few names, or templight-tools built without zstd), names are plain.
+ * 
+ * By default, a whole trace is buffered until it is finalized. With a segment 
+ * size, the trace is instead written out in segments of about that size, such 
+ * that the memory held by the writer does not grow with the size of the trace 
+ * (except for its dictionaries of unique names). On a seekable output stream, 
+ * the trace remains a single message, whose length is back-patched when the 
+ * trace is finalized. Otherwise (e.g., a pipe or a compressed output), each 
+ * segment is written as a trace message of its own, without a header, which 
+ * readers treat as the continuation of the trace (i.e., the header and the 
+ * dictionaries of the trace carry over).
+ * \note Such continuation messages break the "required header" of the format 
+ *       for older readers (or other consumers of the format), which would lose 
+ *       the entries of the continued segments. Segments are therefore opt-in.
+ * 
+ * Several traces can also be written as an archive, whose traces share a 
+ * dictionary of names and filenames (see writeSharedDictionary), for the 
+ * names and filenames that recur across translation units, e.g., those of 
+ * the standard library. The shared dictionary is a message of its own, 
+ * before the traces that refer to it:
+ * \code
+ * message TemplightTraceCollection {
+ *   repeated TemplightTrace traces = 1;
+ *   optional TemplightDictionary dictionary = 2;
+ * }
+ * message TemplightDictionary {
+ *   repeated string file_names = 1;     // the file-ids 0, 1, 2, ...
+ *   repeated DictionaryEntry names = 3; // the dict-ids 0, 1, 2, ... (as in TemplightTrace)
+ * }
+ * \endcode
+ * The file-ids and dictionary ids of each trace that follows it continue 
+ * from those of the shared dictionary.
  * 
  * The message definition for the protobuf format can be found at:
  * https://github.com/mikael-s-persson/templight/blob/master/templight_messages.proto
@@ -59,20 +113,112 @@ private:
   
   std::string buffer;
   std::unordered_map< std::string, std::size_t > fileNameMap;
-  std::unordered_map< std::string, std::size_t > templateNameMap;
+  
+  // The dictionary of template names, an open-addressing table of views of the names 
+  // stored in an arena (such that names can be looked up from their substrings, without copies):
+  struct TemplateNameSlot {
+    std::uint64_t hash;
+    const char* data;
+    std::size_t size;
+    std::size_t id;   // the id of the dictionary entry, or ~0 for an empty slot.
+  };
+  std::vector< TemplateNameSlot > templateNameSlots;
+  std::size_t templateNameCount;
+  std::vector< std::unique_ptr<char[]> > templateNameArena;
+  char* templateNameArenaNext;       // the free part of the last block of the arena.
+  std::size_t templateNameArenaLeft;
+  
+  // The shared dictionary (see writeSharedDictionary), with which the tables above start each trace:
+  std::unordered_map< std::string, std::size_t > sharedFileNameMap;
+  std::vector< TemplateNameSlot > sharedTemplateNameSlots;
+  std::size_t sharedTemplateNameCount;
+  std::vector< std::unique_ptr<char[]> > sharedTemplateNameArena;
+  std::size_t sharedEmptyFileID;
+  
+  // The marked names and markers of the dictionary entries being created (nested ones on top):
+  std::string markedNameStack;
+  std::vector< std::size_t > markerStack;
+  
   int compressionMode;
+  std::size_t emptyFileID; // the id of the empty filename (if it has one).
   
-  std::size_t createDictionaryEntry(const std::string& Name);
-  std::string printEntryLocation(const std::string& FileName, int Line, int Column);
-  std::string printTemplateName(const std::string& Name);
+  // The state of the output of a trace written out in segments:
+  enum SegmentMode {
+    NotSegmented,       // the trace is buffered until it is finalized.
+    PatchedSegments,    // one message, whose length is back-patched.
+    ContinuedSegments   // one message per segment.
+  };
+  std::size_t segmentSize;
+  SegmentMode segmentMode;
+  std::streampos patchPos;       // where the length of the message goes.
+  std::uint64_t segmentedLength; // the length of the message written so far.
+  
+  // The compressor of names (levels 1 and 3), and, for level 3, the entries 
+  // held back until the dictionary is trained on their names:
+  NameCompressor nameCompressor;
+  std::string compressedName;
+  bool nameTraining;
+  std::string trainingNames;
+  std::vector< std::size_t > trainingNameSizes;
+  std::vector< bool > trainingIsBegin;
+  std::vector< PrintableEntryBegin > trainingBegins;
+  std::vector< PrintableEntryEnd > trainingEnds;
+  
+  // Caches of the ids above, indexed by the ids of the entries' string table:
+  const EntryStringTable* idSource;
+  std::vector< std::size_t > fileIDCache;
+  std::vector< std::size_t > nameIDCache;
+  
+  // A source location, resolved and sized before it is serialized:
+  struct ResolvedLocation {
+    const std::string* new_file_name; // the filename, if it is seen for the first time.
+    std::size_t file_id;
+    std::uint64_t line;
+    std::uint64_t column;
+    std::size_t size; // the size of the SourceLocation message.
+  };
+  
+  TemplateNameSlot& findTemplateNameSlot(std::uint64_t aHash, const char* aName, std::size_t aSize);
+  void growTemplateNameSlots();
+  const char* storeTemplateName(const char* aName, std::size_t aSize);
+  std::size_t saveDictionaryEntry(const char* aMarkedName, std::size_t aSize, std::size_t aMarkersStart);
+  std::size_t createDictionaryEntry(const char* aName, std::size_t aSize);
+  std::size_t copyDictionaryEntry(std::uint32_t aNameID);
+  std::size_t lookupDictionaryEntry(const PrintableEntryBegin& aEntry);
+  std::size_t getCachedFileID(const PrintableEntryBegin& aEntry, std::uint32_t aFileID) const;
+  void resolveEntryLocation(const PrintableEntryBegin& aEntry, std::uint32_t aFileID, 
+                            const std::string& (PrintableEntryBegin::*aGetFileName)() const, 
+                            int Line, int Column, ResolvedLocation& aLoc);
+  bool hasTempOriFileName(const PrintableEntryBegin& aEntry) const;
+  void saveEntryLocation(unsigned int aTag, const ResolvedLocation& aLoc);
+  void writeSegment();
+  void finishNameTraining();
   
 public:
   
   /** \brief Creates a writer for the given output stream.
    * 
    * Creates an entry-writer for the given output stream.
+   * \param aOS The output stream to write the traces to.
+   * \param aCompressLevel The compression level of the template names (see above, 2 for a dictionary).
+   * \param aSegmentSize The size, in bytes, of the segments in which traces are written out, 
+   *                     or 0 to buffer whole traces until they are finalized.
+   */
+  ProtobufWriter(std::ostream& aOS, int aCompressLevel = 2, std::size_t aSegmentSize = 0);
+  
+  /** \brief Writes a dictionary of names and filenames shared by the traces that follow.
+   * 
+   * This function writes a shared dictionary to the output, such that the traces 
+   * written after it refer to its names and filenames instead of defining them 
+   * again (see the format above), which makes an archive of many traces much 
+   * more compact. The names are only put in the dictionary with the compression 
+   * level 2 (a dictionary of names), while the filenames always are. This must 
+   * be called between traces, i.e., not between initialize and finalize, and 
+   * replaces the previous shared dictionary (if any).
+   * \param aNames The template names to put in the shared dictionary.
+   * \param aFileNames The filenames to put in the shared dictionary.
    */
-  ProtobufWriter(std::ostream& aOS, int aCompressLevel = 2);
+  void writeSharedDictionary(const std::vector<std::string>& aNames, const std::vector<std::string>& aFileNames);
   
   void initialize(const std::string& aSourceName = "") override;
   void finalize() override;
@@ -0,0 +1,146 @@
+/**
+ * \file SyntheticTraces.h
+ *
+ * This library provides a class for generating synthetic templight traces, e.g., for benchmarks.
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_SYNTHETIC_TRACES_H
+#define TEMPLIGHT_SYNTHETIC_TRACES_H
+
+#include <templight/PrintableEntries.h>
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace templight {
+
+/// Identifies the shape of the memory usage along a synthetic trace.
+enum SyntheticMemoryCurve {
+  LinearMemoryCurve = 0,  ///< The memory usage grows steadily.
+  LogarithmicMemoryCurve, ///< The memory usage grows ever more slowly.
+  SawtoothMemoryCurve     ///< The memory usage grows steadily, but drops back after each top-level entry.
+};
+
+/// Holds the parameters of a synthetic templight trace (see SyntheticTraceGenerator).
+struct SyntheticTraceOptions {
+  std::size_t EntryCount;   ///< The number of (beginning) entries in the trace.
+  unsigned int MaxDepth;    ///< The maximum depth of the instantiation tree.
+  double FanOut;            ///< The average number of nested entries of a top-level instantiation.
+  double FanOutDecay;       ///< The factor applied to the average number of nested entries at each level of depth.
+  std::size_t NameLength;   ///< The (approximate) median length of new template names.
+  double NameLengthSpread;  ///< The spread of the lengths of new template names (the sigma of their log-normal distribution).
+  double MemoizationRatio;  ///< The fraction of nested entries that are memoizations of earlier instantiations.
+  double RecursionRatio;    ///< The fraction of instantiations that start a recursive chain (see SyntheticTraceGenerator).
+  unsigned int RecursionLength; ///< The length of the recursive chains (limited by the maximum depth).
+  unsigned int FileCount;   ///< The number of distinct filenames in the trace.
+  std::uint64_t MemoryGrowth;     ///< The average growth of the memory usage at each beginning entry, in bytes.
+  SyntheticMemoryCurve MemoryCurve; ///< The shape of the memory usage along the trace.
+  std::uint64_t Seed;       ///< The seed of the pseudo-random generator.
+
+  SyntheticTraceOptions() : EntryCount(100000), MaxDepth(16), FanOut(3.0), FanOutDecay(1.0),
+    NameLength(80), NameLengthSpread(0.0), MemoizationRatio(0.3), RecursionRatio(0.0),
+    RecursionLength(20), FileCount(64), MemoryGrowth(2048), MemoryCurve(LinearMemoryCurve), Seed(42) { };
+};
+
+/** \brief A generator of synthetic templight traces.
+ *
+ * This class generates the entries of a pseudo-random templight trace, one
+ * at a time, in the same way as a ProtobufReader gives out the entries of a
+ * trace file. The trace is shaped after real traces: a forest of nested
+ * instantiations whose names are template-ids built from a set of class
+ * templates and from the names of earlier instantiations (such that names
+ * share long common parts, as with real traces), where memoizations are
+ * leaf entries that refer to earlier instantiations, and where time-stamps
+ * and memory usages increase along the trace (see SyntheticMemoryCurve).
+ * Some instantiations can also start recursive chains, like the instantiations
+ * of a Fibonacci<N> template, i.e., a chain of nested instantiations of
+ * the same template (with N-1), each followed by the memoization of N-2.
+ *
+ * The same options (including the seed) always generate the same trace.
+ */
+class SyntheticTraceGenerator {
+public:
+
+  /// Identifies what kind of entry was last generated (during last call to "next()")
+  enum LastEntryType {
+    EndOfTrace = 0, ///< Reached the end of the trace.
+    BeginEntry,     ///< Generated the beginning part of a templight entry.
+    EndEntry        ///< Generated the ending part of a templight entry.
+  } LastEntry; ///< Holds the kind of the last generated entry.
+
+  PrintableEntryBegin LastBeginEntry; ///< Holds the last beginning entry (with its strings filled in).
+  PrintableEntryEnd   LastEndEntry;   ///< Holds the last end entry.
+
+  /// Creates a generator for a trace with the given parameters.
+  explicit SyntheticTraceGenerator(const SyntheticTraceOptions& aOptions = SyntheticTraceOptions());
+
+  /** \brief Generates the next entry of the trace.
+   *
+   * \return The kind of entry that was generated,
+   *         if BeginEntry is returned, then use LastBeginEntry to get the
+   *         entry, if EndEntry is returned, then use LastEndEntry to get the entry.
+   */
+  LastEntryType next();
+
+private:
+
+  struct Frame {
+    std::size_t remaining;   // the number of nested entries still to generate.
+    std::size_t chain_tmpl;  // the template of the recursive chain (if chain_n is not 0).
+    unsigned int chain_n;    // the argument of the recursive chain, or 0 if not in a chain.
+  };
+
+  SyntheticTraceOptions options;
+  std::mt19937_64 rng;
+  std::vector<Frame> stack;
+  std::size_t begin_count;
+  double time_stamp;
+  std::uint64_t memory_usage;
+
+  std::vector<std::string> templates;
+  std::vector<std::string> filenames;
+  std::vector<std::string> names;
+
+  void makeBeginEntry(unsigned int aDepth);
+  void makeChainEntry(const Frame& aParent, unsigned int aDepth);
+  void makeName(std::string& aName);
+  void makeChainName(std::size_t aTmpl, unsigned int aN, std::string& aName) const;
+  void addName(const std::string& aName);
+  void setCommonFields(PrintableEntryBegin& aEntry);
+  std::uint64_t drawMemoryGrowth(std::uint64_t aMean);
+
+};
+
+
+}
+
+#endif
+
+
@@ -46,8 +46,14 @@
 #include <istream>
 #include <string>
 #include <cstdint>
+#include <cstring>
+#include <cstddef>
 #include <limits>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace thin_protobuf {
 
 namespace {
@@ -139,11 +145,13 @@ inline std::uint64_t loadVarInt(std::istream& p_buf) {
   std::uint64_t u = 0;
   if ( !p_buf )
     return u;
-  std::uint8_t shifts = 0;
+  unsigned int shifts = 0;
   char c;
   while( p_buf.get(c) ) {
-    u |= (c & 0x7F) << shifts;
-    if( !(c & 0x80) )
+    std::uint8_t b = static_cast<std::uint8_t>(c);
+    if( shifts < 64 )
+      u |= std::uint64_t(b & 0x7F) << shifts;
+    if( !(b & 0x80) )
       return u;
     shifts += 7;
   };
@@ -155,6 +163,77 @@ inline T loadVarIntAs(std::istream& p_buf) {
   return static_cast<T>(loadVarInt(p_buf));
 }
 
+namespace {
+
+inline unsigned int countTrailingZeros64(std::uint64_t u) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(u);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  unsigned long r = 0;
+  _BitScanForward64(&r, u);
+  return r;
+#else
+  unsigned int r = 0;
+  while( !(u & 1) ) { u >>= 1; ++r; }
+  return r;
+#endif
+}
+
+inline std::uint64_t loadVarIntSlow(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  std::uint64_t u = 0;
+  unsigned int shifts = 0;
+  while( p_cur < p_end ) {
+    std::uint8_t b = *p_cur++;
+    if( shifts < 64 )
+      u |= std::uint64_t(b & 0x7F) << shifts;
+    if( !(b & 0x80) )
+      return u;
+    shifts += 7;
+  };
+  return u;
+}
+
+}
+
+/** \brief Loads a single variable-length integer (uint32, uint64) from a memory span.
+ * 
+ * Loads a single variable-length integer (uint32, uint64) from a memory span, 
+ * never reading past the end of the span. Varints of up to 8 bytes are decoded 
+ * without a per-byte loop, by loading a whole word, locating the terminating byte 
+ * and compacting the 7-bit groups with masks and shifts.
+ * \param p_cur A cursor into the memory span, which is moved past the varint.
+ * \param p_end The end of the memory span.
+ * \return The variable-length integer (uint32, uint64) that was read from the memory span.
+ */
+inline std::uint64_t loadVarInt(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  if( ( p_cur < p_end ) && !(*p_cur & 0x80) )  // Most common case: single-byte varint (e.g., wire values).
+    return *p_cur++;
+#if TPROTO_BYTE_ORDER == TPROTO_ORDER_LITTLE_ENDIAN
+  if( p_end - p_cur >= 8 ) {
+    std::uint64_t w;
+    std::memcpy(&w, p_cur, sizeof(w));
+    std::uint64_t stops = ~w & 0x8080808080808080ULL;
+    if( stops ) {
+      unsigned int last_bit = countTrailingZeros64(stops);  // msb of the terminating byte.
+      p_cur += (last_bit >> 3) + 1;
+      // Keep the bytes of this varint only, and drop their continuation bits:
+      w &= (~std::uint64_t(0) >> (63 - last_bit)) & 0x7F7F7F7F7F7F7F7FULL;
+      // Compact the 7-bit groups: 8 x 7 bits -> 4 x 14 bits -> 2 x 28 bits -> 56 bits.
+      w = ((w & 0x7F007F007F007F00ULL) >> 1) | (w & 0x007F007F007F007FULL);
+      w = ((w & 0x3FFF00003FFF0000ULL) >> 2) | (w & 0x00003FFF00003FFFULL);
+      w = ((w & 0x0FFFFFFF00000000ULL) >> 4) | (w & 0x000000000FFFFFFFULL);
+      return w;
+    }
+  }
+#endif
+  return loadVarIntSlow(p_cur, p_end);
+}
+
+template <typename T>
+inline T loadVarIntAs(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  return static_cast<T>(loadVarInt(p_cur, p_end));
+}
+
 /** \brief Meta-function to get the wire value for a variable-length integer with a given tag number.
  * 
  * This meta-function gives a compile-time wire value corresponding to a variable-length 
@@ -190,6 +269,18 @@ inline std::int64_t loadSInt(std::istream& p_buf) {
   return (u >> 1) ^ (-static_cast<std::int64_t>(u & 1));
 }
 
+/** \brief Loads a single signed integer (int32, int64, sint32, sint64) from a memory span.
+ * 
+ * Loads a single signed integer (int32, int64, sint32, sint64) from a memory span.
+ * \param p_cur A cursor into the memory span, which is moved past the integer.
+ * \param p_end The end of the memory span.
+ * \return The signed integer (int32, int64, sint32, sint64) that was read from the memory span.
+ */
+inline std::int64_t loadSInt(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  std::uint64_t u = loadVarInt(p_cur, p_end);
+  return (u >> 1) ^ (-static_cast<std::int64_t>(u & 1));
+}
+
 /** \brief Meta-function to get the wire value for a signed integer with a given tag number.
  * 
  * This meta-function gives a compile-time wire value corresponding to a signed integer 
@@ -216,6 +307,25 @@ inline double loadDouble(std::istream& p_buf) {
   return tmp.d;
 }
 
+/** \brief Loads a single double (fixed64, sfixed64, double) from a memory span.
+ * 
+ * Loads a single double (fixed64, sfixed64, double) from a memory span.
+ * \param p_cur A cursor into the memory span, which is moved past the double.
+ * \param p_end The end of the memory span.
+ * \return The double (fixed64, sfixed64, double) that was read from the memory span.
+ */
+inline double loadDouble(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  double_to_ulong tmp;
+  if( p_end - p_cur < static_cast<std::ptrdiff_t>(sizeof(double)) ) {
+    p_cur = p_end;
+    return 0.0;
+  }
+  std::memcpy(&tmp, p_cur, sizeof(double));
+  p_cur += sizeof(double);
+  le2h_2ui32(tmp);
+  return tmp.d;
+}
+
 /** \brief Meta-function to get the wire value for a double with a given tag number.
  * 
  * This meta-function gives a compile-time wire value corresponding to a double 
@@ -328,6 +438,45 @@ inline std::string loadString(std::istream& p_buf) {
   return s;  //NRVO
 }
 
+/** \brief Loads a string (string, bytes, message, ..) from a memory span, without copying it.
+ * 
+ * Loads a string (string, bytes, message, ..) from a memory span. This is a 
+ * length-delimited field composed of the length (as a varint) and 
+ * a corresponding number of bytes following it, which are left in place. 
+ * This is also the way to get the memory span of a nested message.
+ * \param p_cur A cursor into the memory span, which is moved past the string.
+ * \param p_end The end of the memory span.
+ * \param p_size Receives the number of bytes of the string (truncated to the end of the memory span).
+ * \return A pointer to the first byte of the string, within the memory span.
+ */
+inline const std::uint8_t* loadStringSpan(const std::uint8_t*& p_cur, const std::uint8_t* p_end, 
+                                          std::size_t& p_size) {
+  auto u = loadVarInt(p_cur, p_end);
+  const std::uint8_t* p_start = p_cur;
+  if( u > static_cast<std::uint64_t>(p_end - p_cur) )
+    p_cur = p_end;
+  else
+    p_cur += static_cast<std::size_t>(u);
+  p_size = p_cur - p_start;
+  return p_start;
+}
+
+/** \brief Loads a string (string, bytes, message, ..) from a memory span.
+ * 
+ * Loads a string (string, bytes, message, ..) from a memory span. This is a 
+ * length-delimited field composed of the length (as a varint) and 
+ * a corresponding number of bytes following it. All those bytes are 
+ * copied into a string that is returned by this function.
+ * \param p_cur A cursor into the memory span, which is moved past the string.
+ * \param p_end The end of the memory span.
+ * \return The string that was read from the memory span.
+ */
+inline std::string loadString(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  std::size_t u = 0;
+  const std::uint8_t* p_start = loadStringSpan(p_cur, p_end, u);
+  return std::string(reinterpret_cast<const char*>(p_start), u);
+}
+
 /** \brief Meta-function to get the wire value for a string with a given tag number.
  * 
  * This meta-function gives a compile-time wire value corresponding to a string 
@@ -373,6 +522,39 @@ inline void skipData(std::istream& p_buf, std::uint64_t wire) {
   }
 }
 
+/** \brief Skips the next chunk of data in a memory span, identified by a given wire type.
+ * 
+ * This function skips the next chunk of data identified by a given wire value, 
+ * see the input stream version of skipData.
+ * \param p_cur A cursor into the memory span, which is moved past the chunk of data.
+ * \param p_end The end of the memory span.
+ * \param wire The wire value seen, which describes the chunk of data ahead 
+ *             in the memory span.
+ */
+inline void skipData(const std::uint8_t*& p_cur, const std::uint8_t* p_end, std::uint64_t wire) {
+  std::uint64_t u = 0;
+  switch(wire & 0x7) {
+    case 0:
+      loadVarInt(p_cur, p_end);
+      return;
+    case 1:
+      u = sizeof(double);
+      break;
+    case 2:
+      u = loadVarInt(p_cur, p_end);
+      break;
+    case 5:
+      u = sizeof(float);
+      break;
+    default:
+      return;
+  }
+  if( u > static_cast<std::uint64_t>(p_end - p_cur) )
+    p_cur = p_end;
+  else
+    p_cur += static_cast<std::size_t>(u);
+}
+
 
 
 /** \brief Saves a single variable-length integer (uint32, uint64) to an output stream.
@@ -393,6 +575,26 @@ inline void saveVarInt(std::ostream& OS, std::uint64_t u) {
   OS.write(reinterpret_cast<char*>(buf), pbuf - buf + 1);
 }
 
+/** \brief Saves a single variable-length integer (uint32, uint64) with a fixed width to an output stream.
+ * 
+ * Saves a single variable-length integer (uint32, uint64) to an output stream, padded 
+ * with continuation bytes to a fixed number of bytes (a valid, but non-minimal, encoding), 
+ * such that it can be overwritten later, e.g., to back-patch the length of a message 
+ * whose size was not known when it was started.
+ * \param OS An output stream to write to.
+ * \param u The variable-length integer (uint32, uint64) to write to the output stream.
+ * \param width The number of bytes to write (from 1 to 10, must fit the value).
+ */
+inline void savePaddedVarInt(std::ostream& OS, std::uint64_t u, std::size_t width) {
+  std::uint8_t buf[10];
+  for(std::size_t i = 0; i + 1 < width; ++i) {
+    buf[i] = (u & 0x7F) | 0x80;
+    u >>= 7;
+  }
+  buf[width - 1] = (u & 0x7F);
+  OS.write(reinterpret_cast<char*>(buf), width);
+}
+
 /** \brief Saves a variable-length integer field (uint32, uint64) to an output stream.
  * 
  * Saves a variable-length integer field (uint32, uint64) to an output stream, with a 
@@ -559,6 +761,98 @@ inline void saveString(std::ostream& OS, unsigned int tag, const std::string& s)
 }
 
 
+/** \brief Gets the number of bytes of a variable-length integer (uint32, uint64).
+ * 
+ * Gets the number of bytes that a variable-length integer (uint32, uint64) takes 
+ * once encoded, e.g., to compute the size of a nested message before writing it.
+ * \param u The variable-length integer (uint32, uint64).
+ * \return The number of bytes of the encoded variable-length integer (from 1 to 10).
+ */
+inline std::size_t getVarIntSize(std::uint64_t u) {
+  std::size_t n = 1;
+  while( u >= 0x80 ) {
+    u >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+/// Gets the number of bytes of a variable-length integer field (uint32, uint64) with a given tag number.
+inline std::size_t getVarIntFieldSize(unsigned int tag, std::uint64_t u) {
+  return getVarIntSize(tag << 3) + getVarIntSize(u);
+}
+
+/// Gets the number of bytes of a double field (fixed64, sfixed64, double) with a given tag number.
+inline std::size_t getDoubleFieldSize(unsigned int tag) {
+  return getVarIntSize((tag << 3) | 1) + sizeof(double);
+}
+
+/// Gets the number of bytes of a string field (string, bytes, message, ..) of a given length and tag number.
+inline std::size_t getStringFieldSize(unsigned int tag, std::size_t len) {
+  return getVarIntSize((tag << 3) | 2) + getVarIntSize(len) + len;
+}
+
+/** \brief Saves a single variable-length integer (uint32, uint64) at the end of a buffer.
+ * 
+ * Saves a single variable-length integer (uint32, uint64) at the end of a buffer.
+ * The buffer versions of the save functions allow messages to be serialized 
+ * directly into one contiguous buffer, where nested messages are written in 
+ * place after their size (see getVarIntFieldSize, getDoubleFieldSize, 
+ * getStringFieldSize and saveStringHeader).
+ * \param buf A buffer to append to.
+ * \param u The variable-length integer (uint32, uint64) to append to the buffer.
+ */
+inline void saveVarInt(std::string& buf, std::uint64_t u) {
+  char tmp[10];  // 80-bits, supports at most a 64-bit varint.
+  std::size_t n = 0;
+  while( u >= 0x80 ) {
+    tmp[n++] = static_cast<char>((u & 0x7F) | 0x80);
+    u >>= 7;
+  }
+  tmp[n++] = static_cast<char>(u);
+  buf.append(tmp, n);
+}
+
+/// Saves a variable-length integer field (uint32, uint64) with a given tag number at the end of a buffer.
+inline void saveVarInt(std::string& buf, unsigned int tag, std::uint64_t u) {
+  saveVarInt(buf, (tag << 3)); // wire-type 0: Varint.
+  saveVarInt(buf, u);
+}
+
+/// Saves a double field (fixed64, sfixed64, double) with a given tag number at the end of a buffer.
+inline void saveDouble(std::string& buf, unsigned int tag, double d) {
+  saveVarInt(buf, (tag << 3) | 1); // wire-type 1: 64-bit.
+  double_to_ulong tmp = { d };
+  le2h_2ui32(tmp);
+  buf.append(reinterpret_cast<const char*>(&tmp), sizeof(double));
+}
+
+/** \brief Saves the header of a string field (string, bytes, message, ..) at the end of a buffer.
+ * 
+ * Saves the wire value and the length of a string field (string, bytes, message, ..) 
+ * with a given tag number at the end of a buffer, such that the contents (e.g., the 
+ * fields of a nested message, of a size computed beforehand) can be appended in place.
+ * \param buf A buffer to append to.
+ * \param tag The tag number of the field, to be written into the wire value.
+ * \param len The length of the contents of the field that will follow.
+ */
+inline void saveStringHeader(std::string& buf, unsigned int tag, std::size_t len) {
+  saveVarInt(buf, (tag << 3) | 2); // wire-type 2: length-delimited.
+  saveVarInt(buf, len);
+}
+
+/// Saves a string field (string, bytes, message, ..) with a given tag number at the end of a buffer.
+inline void saveString(std::string& buf, unsigned int tag, const char* s, std::size_t len) {
+  saveStringHeader(buf, tag, len);
+  buf.append(s, len);
+}
+
+/// Saves a string field (string, bytes, message, ..) with a given tag number at the end of a buffer.
+inline void saveString(std::string& buf, unsigned int tag, const std::string& s) {
+  saveString(buf, tag, s.data(), s.size());
+}
+
+
 } // namespace thin_protobuf
 
 #endif
@@ -0,0 +1,233 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/BlacklistMatcher.h>
+#include <templight/SyntheticTraces.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+using namespace templight;
+
+
+namespace {
+
+struct BenchTimer {
+  std::chrono::steady_clock::time_point start;
+  BenchTimer() : start(std::chrono::steady_clock::now()) { }
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+/* A blacklist like those of real projects: a few broad patterns on namespaces, and
+ * many narrow ones on templates, most of which do not occur in the names. */
+std::vector<std::string> generatePatterns(std::size_t aCount, std::uint64_t aSeed) {
+  std::vector<std::string> result = {
+    "std::.*",
+    "^boost::mpl::.*",
+    ".*::detail::.*",
+    "Eigen::internal::(evaluator|product)<.*",
+    ".*<(int|long), (true|false)>",
+    ".*\\d+ul.*>",
+    "(meta|detail)::if_<[^<>]*>",
+    ".*[Aa]nonymous.*"
+  };
+  static const char* const libs[] = { "mylib", "app", "core", "gfx", "net", "io", "util", "sim" };
+  static const char* const kinds[] = { "vector", "map", "handle", "traits", "view", "impl", "node", "expr" };
+  std::mt19937_64 rng(aSeed);
+  while( result.size() < aCount ) {
+    std::string lib = libs[rng() % 8];
+    std::string kind = kinds[rng() % 8];
+    std::string pattern;
+    switch( rng() % 4 ) {
+      case 0: pattern = lib + "::" + kind + std::to_string(rng() % 100) + "<.*>"; break;
+      case 1: pattern = "^" + lib + "(::[a-z_]+)*::" + kind + "_[0-9]+(<.*>)?"; break;
+      case 2: pattern = ".*" + lib + "::" + kind + "<" + lib + "::.*"; break;
+      default: pattern = "(" + lib + "|" + kind + ")::[a-z]{2,6}_" + std::to_string(rng() % 100) + "<.*"; break;
+    }
+    result.push_back(pattern);
+  }
+  result.resize(aCount);
+  return result;
+}
+
+std::vector<std::string> readPatterns(const std::string& aFilename) {
+  std::vector<std::string> result;
+  std::ifstream file_in(aFilename.c_str());
+  std::string line;
+  while( std::getline(file_in, line) ) {
+    if( line.compare(0, 8, "context ") == 0 )
+      result.push_back(line.substr(8));
+    else if( line.compare(0, 11, "identifier ") == 0 )
+      result.push_back(line.substr(11));
+  }
+  return result;
+}
+
+std::vector<std::string> generateNames(const SyntheticTraceOptions& aOptions) {
+  std::vector<std::string> result;
+  SyntheticTraceGenerator gen(aOptions);
+  SyntheticTraceGenerator::LastEntryType entry;
+  while( ( entry = gen.next() ) != SyntheticTraceGenerator::EndOfTrace ) {
+    if( entry == SyntheticTraceGenerator::BeginEntry )
+      result.push_back(gen.LastBeginEntry.getName());
+  }
+  return result;
+}
+
+/* Runs a matching function over all the names, and reports the best of some repetitions. */
+std::vector<char> runBench(const std::string& aName, const std::vector<std::string>& aNames,
+                           const std::function<bool(const std::string&)>& aMatch, int aRepeat) {
+  std::uint64_t bytes = 0;
+  for(const std::string& name : aNames)
+    bytes += name.size();
+  std::vector<char> matched(aNames.size(), 0);
+  double best = 0.0;
+  std::size_t match_count = 0;
+  for(int r = 0; r < aRepeat; ++r) {
+    match_count = 0;
+    BenchTimer timer;
+    for(std::size_t i = 0; i < aNames.size(); ++i) {
+      matched[i] = aMatch(aNames[i]);
+      match_count += matched[i];
+    }
+    double secs = timer.seconds();
+    if( ( r == 0 ) || ( secs < best ) )
+      best = secs;
+  }
+  std::cout << "  " << std::left << std::setw(34) << aName << std::right
+            << std::fixed << std::setprecision(3) << std::setw(14) << (1e-6 * aNames.size() / best)
+            << std::setprecision(1) << std::setw(12) << (1e-6 * bytes / best)
+            << std::setw(12) << match_count << std::endl;
+  return matched;
+}
+
+}
+
+
+int main(int argc, const char **argv) {
+
+  po::options_description options("Options");
+  options.add_options()
+    ("help,h", "produce this help message.")
+    ("entries,n", po::value<std::size_t>()->default_value(20000), "Number of (beginning) entries in the synthetic trace, whose names are matched.")
+    ("name-length", po::value<std::size_t>()->default_value(80), "Approximate length of the template names.")
+    ("seed", po::value<std::uint64_t>()->default_value(42), "Seed of the generation of the synthetic trace and blacklist.")
+    ("patterns,p", po::value<std::size_t>()->default_value(64), "Number of regular expressions in the synthetic blacklist.")
+    ("blacklist,b", po::value<std::string>(), "Use the regular expressions of a blacklist file instead of a synthetic blacklist.")
+    ("repeat,r", po::value<int>()->default_value(3), "Number of times each benchmark is repeated (the best time is reported).")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+
+  if(vm.count("help")) {
+    std::cout <<
+      "Templight/BlacklistBench\n"
+      "  DESCRIPTION: A benchmark of the matching of template names against a blacklist,\n"
+      "               with std::regex and with the compiled automaton of BlacklistMatcher.\n"
+      "  USAGE: templight-blacklist-bench [options]\n" << std::endl;
+    std::cout << options << std::endl;
+    return 0;
+  }
+
+  SyntheticTraceOptions trace_opts;
+  trace_opts.EntryCount = vm["entries"].as<std::size_t>();
+  trace_opts.NameLength = vm["name-length"].as<std::size_t>();
+  trace_opts.Seed = vm["seed"].as<std::uint64_t>();
+  const int repeat = std::max(vm["repeat"].as<int>(), 1);
+
+  std::vector<std::string> patterns;
+  if( vm.count("blacklist") )
+    patterns = readPatterns(vm["blacklist"].as<std::string>());
+  else
+    patterns = generatePatterns(vm["patterns"].as<std::size_t>(), trace_opts.Seed);
+  std::vector<std::string> names = generateNames(trace_opts);
+
+  // The joined alternation, as the blacklists were matched before, and the patterns one by one:
+  std::string joined;
+  std::vector<std::regex> regexes;
+  BlacklistMatcher matcher;
+  for(const std::string& pattern : patterns) {
+    try {
+      regexes.emplace_back(pattern);
+    } catch(std::regex_error&) {
+      std::cerr << "Warning: [Templight-Bench] Skipping the invalid pattern: " << pattern << std::endl;
+      continue;
+    }
+    if( !joined.empty() )
+      joined += '|';
+    joined += "(" + pattern + ")";
+    matcher.addPattern(pattern);
+  }
+  std::regex joined_regex(joined);
+
+  std::cout << "Matching " << names.size() << " names against " << regexes.size() << " patterns ("
+            << matcher.getAutomatonPatternCount() << " compiled, "
+            << matcher.getRegexPatternCount() << " with std::regex):" << std::endl
+            << "  " << std::left << std::setw(34) << "" << std::right
+            << std::setw(14) << "M names/s" << std::setw(12) << "MB/s"
+            << std::setw(12) << "matches" << std::endl;
+
+  std::vector<char> expected = runBench("std::regex (alternation)", names,
+    [&](const std::string& aName) { return std::regex_match(aName, joined_regex); }, repeat);
+  std::vector<char> each = runBench("std::regex (one by one)", names,
+    [&](const std::string& aName) {
+      for(const std::regex& re : regexes) {
+        if( std::regex_match(aName, re) )
+          return true;
+      }
+      return false;
+    }, repeat);
+  std::vector<char> compiled = runBench("BlacklistMatcher", names,
+    [&](const std::string& aName) { return matcher.matches(aName); }, repeat);
+
+  std::size_t mismatches = 0;
+  for(std::size_t i = 0; i < names.size(); ++i) {
+    if( ( expected[i] != compiled[i] ) || ( expected[i] != each[i] ) ) {
+      if( mismatches++ < 10 )
+        std::cerr << "Error: [Templight-Bench] Mismatched results for the name: " << names[i] << std::endl;
+    }
+  }
+  if( mismatches ) {
+    std::cerr << "Error: [Templight-Bench] " << mismatches << " names had mismatched results!" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+
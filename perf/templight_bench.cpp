@@ -0,0 +1,415 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/CallGraphWriters.h>
+#include <templight/ExtraWriters.h>
+#include <templight/NameCompression.h>
+#include <templight/PrintableEntries.h>
+#include <templight/ProtobufReader.h>
+#include <templight/ProtobufWriter.h>
+#include <templight/SyntheticTraces.h>
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+using namespace templight;
+
+
+namespace {
+
+/* A trace held in memory, such that writers can be timed without the cost
+ * of producing the entries. */
+struct RecordedTrace {
+  std::vector<std::uint8_t> IsBegin;
+  std::vector<PrintableEntryBegin> Begins;
+  std::vector<PrintableEntryEnd> Ends;
+
+  void replay(EntryWriter& aWriter) const {
+    std::size_t i_begin = 0, i_end = 0;
+    for(std::uint8_t is_begin : IsBegin) {
+      if( is_begin )
+        aWriter.printEntry(Begins[i_begin++]);
+      else
+        aWriter.printEntry(Ends[i_end++]);
+    }
+  }
+};
+
+/* Discards what is written to it, only counting the bytes, such that
+ * writers are timed without the cost of storing their output. */
+class CountingStreamBuf : public std::streambuf {
+public:
+  CountingStreamBuf() : count(0), buffer(1 << 16) { setp(&buffer[0], &buffer[0] + buffer.size()); }
+
+  std::uint64_t size() { sync(); return count; }
+
+protected:
+  int_type overflow(int_type c) override {
+    sync();
+    if( !traits_type::eq_int_type(c, traits_type::eof()) ) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    count += static_cast<std::uint64_t>(pptr() - pbase());
+    setp(&buffer[0], &buffer[0] + buffer.size());
+    return 0;
+  }
+
+private:
+  std::uint64_t count;
+  std::vector<char> buffer;
+};
+
+/* The peak RSS is reset before each benchmark when the platform allows it
+ * (Linux), otherwise, the reported peak is that of the whole process so far. */
+void resetPeakRSS() {
+#if defined(__linux__)
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  if( clear_refs )
+    clear_refs << "5" << std::flush;
+#endif
+}
+
+double getPeakRSSInMB() {
+#if defined(__linux__)
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while( std::getline(status, line) ) {
+    if( line.compare(0, 6, "VmHWM:") == 0 )
+      return 1e-3 * std::stod(line.substr(6)); // in kB.
+  }
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if( getrusage(RUSAGE_SELF, &usage) == 0 ) {
+#if defined(__APPLE__)
+    return 1e-6 * static_cast<double>(usage.ru_maxrss); // in bytes.
+#else
+    return 1e-3 * static_cast<double>(usage.ru_maxrss); // in kB.
+#endif
+  }
+#endif
+  return 0.0;
+}
+
+struct BenchTimer {
+  std::chrono::steady_clock::time_point start;
+  BenchTimer() : start(std::chrono::steady_clock::now()) { }
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+/* What a benchmark run reports, to compute the throughputs from. */
+struct BenchCounts {
+  std::uint64_t entries;
+  std::uint64_t bytes;
+  std::uint64_t checksum;
+};
+
+void reportHeader(const std::string& aTitle) {
+  std::cout << aTitle << std::endl
+            << "  " << std::left << std::setw(34) << "" << std::right
+            << std::setw(14) << "M entries/s" << std::setw(12) << "MB/s"
+            << std::setw(14) << "peak RSS (MB)" << std::endl;
+}
+
+void reportResult(const std::string& aName, const BenchCounts& aCounts, double aSeconds, double aPeakRSS) {
+  std::cout << "  " << std::left << std::setw(34) << aName << std::right
+            << std::fixed << std::setprecision(2) << std::setw(14) << (1e-6 * aCounts.entries / aSeconds)
+            << std::setprecision(1) << std::setw(12) << (1e-6 * aCounts.bytes / aSeconds)
+            << std::setw(14) << aPeakRSS
+            << "   (checksum " << std::hex << aCounts.checksum << std::dec << ")" << std::endl;
+}
+
+RecordedTrace generateTrace(const SyntheticTraceOptions& aOptions) {
+  RecordedTrace trace;
+  SyntheticTraceGenerator gen(aOptions);
+  while( true ) {
+    SyntheticTraceGenerator::LastEntryType entry = gen.next();
+    if( entry == SyntheticTraceGenerator::BeginEntry ) {
+      trace.IsBegin.push_back(1);
+      trace.Begins.push_back(gen.LastBeginEntry);
+    } else if( entry == SyntheticTraceGenerator::EndEntry ) {
+      trace.IsBegin.push_back(0);
+      trace.Ends.push_back(gen.LastEndEntry);
+    } else {
+      break;
+    }
+  }
+  return trace;
+}
+
+std::string encodeTrace(const RecordedTrace& aTrace, int aCompressLevel) {
+  std::ostringstream OS;
+  ProtobufWriter writer(OS, aCompressLevel);
+  writer.initialize("synthetic.cpp");
+  aTrace.replay(writer);
+  writer.finalize();
+  return OS.str();
+}
+
+BenchCounts decodeEntries(const std::string& aBuf, bool aWithNames) {
+  BenchCounts counts = {0, aBuf.size(), 0};
+  ProtobufReader reader;
+  ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size());
+  while( chunk != ProtobufReader::EndOfFile ) {
+    if( chunk == ProtobufReader::BeginEntry ) {
+      ++counts.entries;
+      if( aWithNames )
+        counts.checksum += reader.LastBeginEntry.getName().size() + reader.LastBeginEntry.getFileName().size();
+      else
+        counts.checksum += reader.LastBeginEntry.NameID + reader.LastBeginEntry.FileID;
+    } else if( chunk == ProtobufReader::EndEntry ) {
+      ++counts.entries;
+    }
+    chunk = reader.next();
+  }
+  return counts;
+}
+
+BenchCounts convertTrace(const std::string& aBuf, EntryWriter& aWriter, CountingStreamBuf& aSink) {
+  BenchCounts counts = {0, 0, 0};
+  ProtobufReader reader;
+  // As templight-convert does, only decode the fields that the writer needs:
+  reader.setRequiredFields(aWriter.getRequiredFields());
+  bool was_inited = false;
+  ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size());
+  while( chunk != ProtobufReader::EndOfFile ) {
+    switch( chunk ) {
+      case ProtobufReader::Header:
+        if( was_inited )
+          aWriter.finalize();
+        aWriter.initialize(reader.SourceName);
+        was_inited = true;
+        break;
+      case ProtobufReader::BeginEntry:
+        ++counts.entries;
+        aWriter.printEntry(reader.LastBeginEntry);
+        break;
+      case ProtobufReader::EndEntry:
+        ++counts.entries;
+        aWriter.printEntry(reader.LastEndEntry);
+        break;
+      default:
+        break;
+    }
+    chunk = reader.next();
+  }
+  if( was_inited )
+    aWriter.finalize();
+  counts.bytes = aSink.size();
+  counts.checksum = counts.bytes;
+  return counts;
+}
+
+typedef std::function<EntryWriter*(std::ostream&)> WriterFactory;
+
+std::vector< std::pair<std::string, WriterFactory> > getWriterFactories() {
+  std::vector< std::pair<std::string, WriterFactory> > result;
+  result.emplace_back("protobuf", [](std::ostream& OS) { return new ProtobufWriter(OS); });
+  result.emplace_back("yaml", [](std::ostream& OS) { return new YamlWriter(OS); });
+  result.emplace_back("xml", [](std::ostream& OS) { return new XmlWriter(OS); });
+  result.emplace_back("text", [](std::ostream& OS) { return new TextWriter(OS); });
+  result.emplace_back("nestedxml", [](std::ostream& OS) { return new NestedXMLWriter(OS); });
+  result.emplace_back("graphml", [](std::ostream& OS) { return new GraphMLWriter(OS); });
+  result.emplace_back("graphml-stream", [](std::ostream& OS) { return new GraphMLWriter(OS, true); });
+  result.emplace_back("graphviz", [](std::ostream& OS) { return new GraphVizWriter(OS); });
+  result.emplace_back("graphviz-stream", [](std::ostream& OS) { return new GraphVizWriter(OS, true); });
+  result.emplace_back("graphml-cg", [](std::ostream& OS) { return new GraphMLCGWriter(OS); });
+  result.emplace_back("graphviz-cg", [](std::ostream& OS) { return new GraphVizCGWriter(OS); });
+  result.emplace_back("callgrind", [](std::ostream& OS) { return new CallGrindWriter(OS); });
+  result.emplace_back("top", [](std::ostream& OS) { return new TopWriter(OS); });
+  return result;
+}
+
+bool isFormatSelected(const std::string& aFormats, const std::string& aFormat) {
+  if( aFormats == "all" )
+    return true;
+  std::istringstream IS(aFormats);
+  std::string format;
+  while( std::getline(IS, format, ',') ) {
+    if( format == aFormat )
+      return true;
+  }
+  return false;
+}
+
+}
+
+
+int main(int argc, const char **argv) {
+
+  po::options_description options("Options");
+  options.add_options()
+    ("help,h", "produce this help message.")
+    ("entries,n", po::value<std::size_t>()->default_value(200000), "Number of (beginning) entries in the synthetic trace.")
+    ("depth,d", po::value<unsigned int>()->default_value(16), "Maximum depth of the instantiation tree of the synthetic trace.")
+    ("fanout", po::value<double>()->default_value(3.0), "Average number of nested entries of an instantiation.")
+    ("name-length", po::value<std::size_t>()->default_value(80), "Approximate length of the template names.")
+    ("memo-ratio", po::value<double>()->default_value(0.3), "Fraction of the entries that are memoizations of earlier instantiations.")
+    ("files", po::value<unsigned int>()->default_value(64), "Number of distinct filenames in the synthetic trace.")
+    ("seed", po::value<std::uint64_t>()->default_value(42), "Seed of the generation of the synthetic trace.")
+    ("formats,f", po::value<std::string>()->default_value("all"), "Comma-separated list of the formats to benchmark the writers of (default is all), where the \"-stream\" suffix selects the streaming mode of the tree writers (e.g., graphml-stream).")
+    ("repeat,r", po::value<int>()->default_value(3), "Number of times each benchmark is repeated (the best time is reported).")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+
+  if(vm.count("help")) {
+    std::cout <<
+      "Templight/Bench\n"
+      "  DESCRIPTION: A benchmark of the templight trace reader and writers, on a synthetic trace.\n"
+      "  USAGE: templight-bench [options]\n" << std::endl;
+    std::cout << options << std::endl;
+    return 0;
+  }
+
+  SyntheticTraceOptions trace_opts;
+  trace_opts.EntryCount = vm["entries"].as<std::size_t>();
+  trace_opts.MaxDepth = vm["depth"].as<unsigned int>();
+  trace_opts.FanOut = vm["fanout"].as<double>();
+  trace_opts.NameLength = vm["name-length"].as<std::size_t>();
+  trace_opts.MemoizationRatio = vm["memo-ratio"].as<double>();
+  trace_opts.FileCount = vm["files"].as<unsigned int>();
+  trace_opts.Seed = vm["seed"].as<std::uint64_t>();
+  std::string formats = vm["formats"].as<std::string>();
+  int repeat = vm["repeat"].as<int>();
+
+  // Run a benchmark a few times and keep the best time, and the peak RSS over all runs:
+  auto runBest = [repeat](const std::string& aName, std::function<BenchCounts()> aBench) {
+    double best = 0.0;
+    BenchCounts counts = {0, 0, 0};
+    resetPeakRSS();
+    for(int i = 0; i < repeat; ++i) {
+      BenchTimer timer;
+      counts = aBench();
+      double t = timer.seconds();
+      if( i == 0 || t < best )
+        best = t;
+    }
+    reportResult(aName, counts, best, getPeakRSSInMB());
+  };
+
+  BenchTimer gen_timer;
+  RecordedTrace trace = generateTrace(trace_opts);
+  std::uint64_t name_bytes = 0;
+  for(const PrintableEntryBegin& entry : trace.Begins)
+    name_bytes += entry.Name.size();
+  std::cout << "Synthetic trace: " << trace.Begins.size() << " entries ("
+            << trace.IsBegin.size() << " beginning and end entries), "
+            << ( trace.Begins.empty() ? 0 : name_bytes / trace.Begins.size() ) << " bytes per name on average"
+            << " (generated in " << std::fixed << std::setprecision(2) << gen_timer.seconds() << " s)" << std::endl;
+
+  // Encoding: throughput in the encoded bytes.
+  reportHeader("Encoding (ProtobufWriter, MB/s of output):");
+  std::vector<std::string> encoded(4);
+  for(int level = 0; level < 4; ++level) {
+    encoded[level] = encodeTrace(trace, level);
+    runBest("compression level " + std::to_string(level), [&]() {
+      CountingStreamBuf sink;
+      std::ostream OS(&sink);
+      ProtobufWriter writer(OS, level);
+      writer.initialize("synthetic.cpp");
+      trace.replay(writer);
+      writer.finalize();
+      BenchCounts counts = {trace.IsBegin.size(), sink.size(), 0};
+      counts.checksum = counts.bytes;
+      return counts;
+    });
+  }
+
+  // Decoding: throughput in the encoded bytes.
+  reportHeader("Decoding (ProtobufReader, MB/s of input):");
+  for(int level = 0; level < 4; ++level) {
+    const std::string& buf = encoded[level];
+    std::string suffix = " (level " + std::to_string(level) + ", " + std::to_string(buf.size() / 1000) + " kB)";
+    runBest("next(), ids" + suffix, [&]() { return decodeEntries(buf, false); });
+    runBest("next(), names" + suffix, [&]() { return decodeEntries(buf, true); });
+  }
+
+  // Sizes of the encodings of the names (0 plain, 1 zlib, 2 dictionary, 3 zstd with a trained dictionary):
+  std::cout << "Encoded sizes (level 3 " << ( hasZstdNameCompression() ? "with zstd" : "falls back to plain names, without zstd" ) << "):" << std::endl;
+  for(int level = 0; level < 4; ++level) {
+    std::cout << "  " << std::left << std::setw(34) << ( "compression level " + std::to_string(level) ) << std::right
+              << std::setw(14) << ( encoded[level].size() / 1000 ) << " kB"
+              << std::fixed << std::setprecision(1) << std::setw(9)
+              << ( 100.0 * encoded[level].size() / encoded[0].size() ) << " %" << std::endl;
+  }
+
+  std::vector< std::pair<std::string, WriterFactory> > writers = getWriterFactories();
+
+  // Writing: throughput in the output bytes, from entries in memory.
+  reportHeader("Writing (from memory, MB/s of output):");
+  for(const auto& w : writers) {
+    if( !isFormatSelected(formats, w.first) )
+      continue;
+    runBest(w.first, [&]() {
+      CountingStreamBuf sink;
+      std::ostream OS(&sink);
+      std::unique_ptr<EntryWriter> writer(w.second(OS));
+      writer->initialize("synthetic.cpp");
+      trace.replay(*writer);
+      writer->finalize();
+      BenchCounts counts = {trace.IsBegin.size(), sink.size(), 0};
+      counts.checksum = counts.bytes;
+      return counts;
+    });
+  }
+
+  // Converting: end-to-end, from the (default) protobuf encoding, throughput in the output bytes.
+  reportHeader("Converting (from protobuf, MB/s of output):");
+  for(const auto& w : writers) {
+    if( !isFormatSelected(formats, w.first) )
+      continue;
+    runBest(w.first, [&]() {
+      CountingStreamBuf sink;
+      std::ostream OS(&sink);
+      std::unique_ptr<EntryWriter> writer(w.second(OS));
+      return convertTrace(encoded[2], *writer, sink);
+    });
+  }
+
+  return 0;
+}
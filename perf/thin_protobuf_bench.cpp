@@ -0,0 +1,254 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/ThinProtobuf.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include <boost/program_options.hpp>
+
+namespace po = boost::program_options;
+
+
+namespace {
+
+/* Byte-at-a-time decoding over a memory span, as a reference point for the
+ * word-at-a-time decoding of thin_protobuf::loadVarInt. */
+std::uint64_t loadVarIntBytewise(const std::uint8_t*& p_cur, const std::uint8_t* p_end) {
+  std::uint64_t u = 0;
+  unsigned int shifts = 0;
+  while( p_cur < p_end ) {
+    std::uint8_t b = *p_cur++;
+    if( shifts < 64 )
+      u |= std::uint64_t(b & 0x7F) << shifts;
+    if( !(b & 0x80) )
+      return u;
+    shifts += 7;
+  }
+  return u;
+}
+
+/* Draws values whose varint lengths follow roughly what is seen in templight traces:
+ * mostly single-byte wire values and kinds, then sizes and line numbers, and a
+ * few large values like memory usages. */
+std::uint64_t drawTraceLikeValue(std::mt19937_64& rng) {
+  unsigned int dice = rng() % 100;
+  if( dice < 55 )
+    return rng() % 0x80;
+  if( dice < 80 )
+    return rng() % 0x4000;
+  if( dice < 92 )
+    return rng() % 0x200000;
+  if( dice < 98 )
+    return rng() % 0x800000000ULL;
+  return rng();
+}
+
+std::string makeVarIntBuffer(std::size_t aSize, std::size_t& aCount) {
+  std::mt19937_64 rng(42);
+  std::ostringstream OS;
+  aCount = 0;
+  while( static_cast<std::size_t>(OS.tellp()) < aSize ) {
+    thin_protobuf::saveVarInt(OS, drawTraceLikeValue(rng));
+    ++aCount;
+  }
+  return OS.str();
+}
+
+/* Builds a buffer of fields shaped like the entries of a trace: kind, name
+ * (as a string or a dictionary id), location sub-message, time-stamp and memory. */
+std::string makeFieldBuffer(std::size_t aSize, std::size_t& aCount) {
+  std::mt19937_64 rng(43);
+  std::ostringstream OS;
+  aCount = 0;
+  std::string name;
+  while( static_cast<std::size_t>(OS.tellp()) < aSize ) {
+    thin_protobuf::saveVarInt(OS, 1, rng() % 24);
+    if( rng() % 4 == 0 ) {
+      name.assign(8 + rng() % 120, 'a' + rng() % 26);
+      thin_protobuf::saveString(OS, 2, name);
+    } else {
+      thin_protobuf::saveVarInt(OS, 3, rng() % 50000);
+    }
+    thin_protobuf::saveVarInt(OS, 4, rng() % 2000);
+    thin_protobuf::saveDouble(OS, 5, 1e-4 * (rng() % 100000000));
+    thin_protobuf::saveVarInt(OS, 6, 1000000 + rng() % 1000000000);
+    aCount += 5;
+  }
+  return OS.str();
+}
+
+struct BenchTimer {
+  std::chrono::steady_clock::time_point start;
+  BenchTimer() : start(std::chrono::steady_clock::now()) { }
+  double seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+void reportResult(const std::string& aName, std::size_t aBytes, std::size_t aCount,
+                  double aSeconds, std::uint64_t aChecksum) {
+  std::cout << "  " << std::left << std::setw(32) << aName << std::right
+            << std::fixed << std::setprecision(1) << std::setw(10) << (1e-6 * aBytes / aSeconds) << " MB/s"
+            << std::setw(10) << (1e-6 * aCount / aSeconds) << " M/s"
+            << "   (checksum " << std::hex << aChecksum << std::dec << ")" << std::endl;
+}
+
+std::uint64_t decodeVarIntsStream(const std::string& aBuf, std::size_t aCount) {
+  std::istringstream IS(aBuf);
+  std::uint64_t sum = 0;
+  for(std::size_t i = 0; i < aCount; ++i)
+    sum += thin_protobuf::loadVarInt(IS);
+  return sum;
+}
+
+template <std::uint64_t (*LoadVarInt)(const std::uint8_t*&, const std::uint8_t*)>
+std::uint64_t decodeVarIntsSpan(const std::string& aBuf) {
+  const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(aBuf.data());
+  const std::uint8_t* p_end = p + aBuf.size();
+  std::uint64_t sum = 0;
+  while( p < p_end )
+    sum += LoadVarInt(p, p_end);
+  return sum;
+}
+
+std::uint64_t decodeFieldsStream(const std::string& aBuf) {
+  std::istringstream IS(aBuf);
+  std::uint64_t sum = 0;
+  while( IS.peek() != std::char_traits<char>::eof() ) {
+    auto wire = thin_protobuf::loadVarInt(IS);
+    switch( wire ) {
+      case thin_protobuf::getStringWire<2>::value:
+        sum += thin_protobuf::loadString(IS).size();
+        break;
+      case thin_protobuf::getDoubleWire<5>::value:
+        sum += static_cast<std::uint64_t>(thin_protobuf::loadDouble(IS));
+        break;
+      case thin_protobuf::getVarIntWire<6>::value:
+        thin_protobuf::skipData(IS, wire);
+        break;
+      default:
+        sum += thin_protobuf::loadVarInt(IS);
+        break;
+    }
+  }
+  return sum;
+}
+
+std::uint64_t decodeFieldsSpan(const std::string& aBuf) {
+  const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(aBuf.data());
+  const std::uint8_t* p_end = p + aBuf.size();
+  std::uint64_t sum = 0;
+  while( p < p_end ) {
+    auto wire = thin_protobuf::loadVarInt(p, p_end);
+    switch( wire ) {
+      case thin_protobuf::getStringWire<2>::value: {
+        std::size_t len = 0;
+        thin_protobuf::loadStringSpan(p, p_end, len);
+        sum += len;
+        break;
+      }
+      case thin_protobuf::getDoubleWire<5>::value:
+        sum += static_cast<std::uint64_t>(thin_protobuf::loadDouble(p, p_end));
+        break;
+      case thin_protobuf::getVarIntWire<6>::value:
+        thin_protobuf::skipData(p, p_end, wire);
+        break;
+      default:
+        sum += thin_protobuf::loadVarInt(p, p_end);
+        break;
+    }
+  }
+  return sum;
+}
+
+}
+
+
+int main(int argc, const char **argv) {
+
+  po::options_description options("Options");
+  options.add_options()
+    ("help,h", "produce this help message.")
+    ("size,s", po::value<std::size_t>()->default_value(64), "Size, in megabytes, of the encoded buffers to decode.")
+    ("repeat,r", po::value<int>()->default_value(3), "Number of times each decoding is repeated (the best time is reported).")
+  ;
+
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, options), vm);
+  po::notify(vm);
+
+  if(vm.count("help")) {
+    std::cout <<
+      "Templight/ThinProtobufBench\n"
+      "  DESCRIPTION: A micro-benchmark of the decoding functions of the thin protobuf library.\n"
+      "  USAGE: templight-thin-protobuf-bench [options]\n" << std::endl;
+    std::cout << options << std::endl;
+    return 0;
+  }
+
+  std::size_t buf_size = vm["size"].as<std::size_t>() * 1000000;
+  int repeat = vm["repeat"].as<int>();
+
+  std::size_t varint_count = 0;
+  std::string varint_buf = makeVarIntBuffer(buf_size, varint_count);
+  std::size_t field_count = 0;
+  std::string field_buf = makeFieldBuffer(buf_size, field_count);
+
+  // Run each decoding a few times and keep the best time:
+  auto runBest = [repeat](const std::string& aName, std::size_t aBytes, std::size_t aCount,
+                          std::function<std::uint64_t()> aDecode) {
+    double best = 0.0;
+    std::uint64_t checksum = 0;
+    for(int i = 0; i < repeat; ++i) {
+      BenchTimer timer;
+      checksum = aDecode();
+      double t = timer.seconds();
+      if( i == 0 || t < best )
+        best = t;
+    }
+    reportResult(aName, aBytes, aCount, best, checksum);
+  };
+
+  std::cout << "Varints (" << varint_count << " values, " << varint_buf.size() << " bytes):" << std::endl;
+  runBest("loadVarInt(istream)", varint_buf.size(), varint_count,
+    [&]() { return decodeVarIntsStream(varint_buf, varint_count); });
+  runBest("byte-wise loop (span)", varint_buf.size(), varint_count,
+    [&]() { return decodeVarIntsSpan<loadVarIntBytewise>(varint_buf); });
+  runBest("loadVarInt(span)", varint_buf.size(), varint_count,
+    [&]() { return decodeVarIntsSpan<thin_protobuf::loadVarInt>(varint_buf); });
+
+  std::cout << "Entry-like fields (" << field_count << " fields, " << field_buf.size() << " bytes):" << std::endl;
+  runBest("istream functions", field_buf.size(), field_count,
+    [&]() { return decodeFieldsStream(field_buf); });
+  runBest("span functions", field_buf.size(), field_count,
+    [&]() { return decodeFieldsSpan(field_buf); });
+
+  return 0;
+}
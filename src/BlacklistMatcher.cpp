@@ -0,0 +1,648 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/BlacklistMatcher.h>
+
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <regex>
+#include <utility>
+#include <vector>
+
+namespace templight {
+
+
+namespace {
+
+typedef std::bitset<256> ByteSet;
+
+const int unbounded = -1;
+
+// Larger repetition counts are left to std::regex, since they are expanded in the NFA:
+const int max_repeat_count = 256;
+const std::size_t max_nfa_size = 1 << 20;
+
+// The number of DFA states beyond which the DFA is discarded and built again:
+const std::size_t max_dfa_states = 4096;
+
+const int dead_state = 0;
+const int start_state = 1;
+
+/* Thrown by the parser on a construct that the automaton cannot express, or on
+ * anything that is not clearly valid, in which case std::regex decides. */
+struct UnsupportedPattern { };
+
+/* The syntax tree of a regular expression. */
+struct PatternNode {
+  enum Kind { Empty, Bytes, Concat, Alternation, Repeat, LineBegin, LineEnd } kind;
+  int set;        // the byte set of a Bytes node.
+  int min_count;  // the repetition counts of a Repeat node.
+  int max_count;
+  std::vector< PatternNode > kids;
+
+  explicit PatternNode(Kind aKind = Empty) : kind(aKind), set(-1), min_count(0), max_count(0) { }
+};
+
+ByteSet makeByteSet(int (*aPredicate)(int)) {
+  ByteSet result;
+  for(int b = 0; b < 256; ++b)
+    if ( aPredicate(b) )
+      result.set(b);
+  return result;
+}
+
+int isWordChar(int c) { return std::isalnum(c) || ( c == '_' ); }
+
+int getHexDigit(char c) {
+  if ( ( c >= '0' ) && ( c <= '9' ) )
+    return c - '0';
+  if ( ( c >= 'a' ) && ( c <= 'f' ) )
+    return c - 'a' + 10;
+  if ( ( c >= 'A' ) && ( c <= 'F' ) )
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* A recursive-descent parser of the ECMAScript grammar of regular expressions,
+ * for the constructs that an automaton can express. */
+class PatternParser {
+public:
+  PatternParser(const std::string& aPattern, std::vector< ByteSet >& aSets) :
+    pattern(aPattern), pos(0), sets(aSets) { }
+
+  PatternNode parse() {
+    PatternNode result = parseAlternation();
+    if ( pos != pattern.size() )
+      throw UnsupportedPattern(); // e.g., an unmatched ')'.
+    return result;
+  }
+
+private:
+  const std::string& pattern;
+  std::size_t pos;
+  std::vector< ByteSet >& sets;
+
+  bool atEnd() const { return pos >= pattern.size(); }
+  char peek() const { return pattern[pos]; }
+  char take() {
+    if ( atEnd() )
+      throw UnsupportedPattern();
+    return pattern[pos++];
+  }
+
+  PatternNode makeBytes(const ByteSet& aSet) {
+    PatternNode result(PatternNode::Bytes);
+    result.set = static_cast<int>(sets.size());
+    sets.push_back(aSet);
+    return result;
+  }
+
+  PatternNode parseAlternation() {
+    PatternNode first = parseConcat();
+    if ( atEnd() || ( peek() != '|' ) )
+      return first;
+    PatternNode result(PatternNode::Alternation);
+    result.kids.push_back(std::move(first));
+    while ( !atEnd() && ( peek() == '|' ) ) {
+      ++pos;
+      result.kids.push_back(parseConcat());
+    }
+    return result;
+  }
+
+  PatternNode parseConcat() {
+    PatternNode result(PatternNode::Concat);
+    while ( !atEnd() && ( peek() != '|' ) && ( peek() != ')' ) )
+      result.kids.push_back(parseRepeat());
+    if ( result.kids.size() == 1 ) {
+      PatternNode only = std::move(result.kids.front());
+      return only;
+    }
+    return result;
+  }
+
+  int parseCount() {
+    if ( atEnd() || !std::isdigit(static_cast<unsigned char>(peek())) )
+      throw UnsupportedPattern();
+    int result = 0;
+    while ( !atEnd() && std::isdigit(static_cast<unsigned char>(peek())) ) {
+      result = std::min(10 * result + ( take() - '0' ), max_repeat_count + 1);
+    }
+    return result;
+  }
+
+  PatternNode parseRepeat() {
+    PatternNode atom = parseAtom();
+    if ( atEnd() )
+      return atom;
+    int min_count = 0, max_count = 0;
+    switch( peek() ) {
+      case '*': min_count = 0; max_count = unbounded; ++pos; break;
+      case '+': min_count = 1; max_count = unbounded; ++pos; break;
+      case '?': min_count = 0; max_count = 1; ++pos; break;
+      case '{':
+        ++pos;
+        min_count = max_count = parseCount();
+        if ( !atEnd() && ( peek() == ',' ) ) {
+          ++pos;
+          max_count = ( !atEnd() && ( peek() == '}' ) ) ? unbounded : parseCount();
+        }
+        if ( ( take() != '}' ) || ( ( max_count != unbounded ) && ( max_count < min_count ) ) )
+          throw UnsupportedPattern();
+        break;
+      default:
+        return atom;
+    }
+    if ( ( atom.kind == PatternNode::LineBegin ) || ( atom.kind == PatternNode::LineEnd ) ||
+         ( min_count > max_repeat_count ) || ( max_count > max_repeat_count ) )
+      throw UnsupportedPattern();
+    // A lazy quantifier matches the same (whole) names as a greedy one:
+    if ( !atEnd() && ( peek() == '?' ) )
+      ++pos;
+    if ( !atEnd() && std::strchr("*+?{", peek()) )
+      throw UnsupportedPattern();
+    PatternNode result(PatternNode::Repeat);
+    result.min_count = min_count;
+    result.max_count = max_count;
+    result.kids.push_back(std::move(atom));
+    return result;
+  }
+
+  PatternNode parseAtom() {
+    char c = take();
+    switch( c ) {
+      case '(': {
+        if ( !atEnd() && ( peek() == '?' ) ) {
+          // Only non-capturing groups, not lookaheads:
+          ++pos;
+          if ( take() != ':' )
+            throw UnsupportedPattern();
+        }
+        PatternNode result = parseAlternation();
+        if ( take() != ')' )
+          throw UnsupportedPattern();
+        return result;
+      }
+      case '[':
+        return makeBytes(parseClass());
+      case '.': {
+        ByteSet any;
+        any.set();
+        any.reset('\n');
+        any.reset('\r');
+        return makeBytes(any);
+      }
+      case '^':
+        return PatternNode(PatternNode::LineBegin);
+      case '$':
+        return PatternNode(PatternNode::LineEnd);
+      case '\\': {
+        ByteSet escaped;
+        parseEscape(escaped, false);
+        return makeBytes(escaped);
+      }
+      case '*':
+      case '+':
+      case '?':
+      case '{':
+        throw UnsupportedPattern();
+      default: {
+        ByteSet literal;
+        literal.set(static_cast<unsigned char>(c));
+        return makeBytes(literal);
+      }
+    }
+  }
+
+  /* Parses an escape (after its '\'), into a set, and returns its byte, or -1 for a class of bytes. */
+  int parseEscape(ByteSet& aSet, bool aInClass) {
+    char c = take();
+    int byte = -1;
+    switch( c ) {
+      case 'd': aSet |= makeByteSet(std::isdigit); return -1;
+      case 'D': aSet |= ~makeByteSet(std::isdigit); return -1;
+      case 'w': aSet |= makeByteSet(isWordChar); return -1;
+      case 'W': aSet |= ~makeByteSet(isWordChar); return -1;
+      case 's': aSet |= makeByteSet(std::isspace); return -1;
+      case 'S': aSet |= ~makeByteSet(std::isspace); return -1;
+      case 'n': byte = '\n'; break;
+      case 't': byte = '\t'; break;
+      case 'r': byte = '\r'; break;
+      case 'f': byte = '\f'; break;
+      case 'v': byte = '\v'; break;
+      case 'b':
+        if ( !aInClass )
+          throw UnsupportedPattern(); // a word boundary.
+        byte = '\b';
+        break;
+      case '0':
+        if ( !atEnd() && std::isdigit(static_cast<unsigned char>(peek())) )
+          throw UnsupportedPattern();
+        byte = 0;
+        break;
+      case 'x':
+      case 'u': {
+        int digits = ( c == 'x' ? 2 : 4 );
+        byte = 0;
+        for(int i = 0; i < digits; ++i) {
+          int h = getHexDigit(take());
+          if ( h < 0 )
+            throw UnsupportedPattern();
+          byte = 16 * byte + h;
+        }
+        if ( byte > 0x7F )
+          throw UnsupportedPattern(); // beyond ASCII, the encoding of the name matters.
+        break;
+      }
+      case 'c': {
+        char letter = take();
+        if ( !std::isalpha(static_cast<unsigned char>(letter)) )
+          throw UnsupportedPattern();
+        byte = letter % 32;
+        break;
+      }
+      default:
+        // Back-references, word boundaries, or unknown escapes:
+        if ( std::isalnum(static_cast<unsigned char>(c)) )
+          throw UnsupportedPattern();
+        byte = static_cast<unsigned char>(c);
+        break;
+    }
+    aSet.set(byte);
+    return byte;
+  }
+
+  /* Parses a named class (after its "[:"), into a set. */
+  void parseNamedClass(ByteSet& aSet) {
+    std::size_t end = pattern.find(":]", pos);
+    if ( end == std::string::npos )
+      throw UnsupportedPattern();
+    std::string name = pattern.substr(pos, end - pos);
+    pos = end + 2;
+    static const std::pair< const char*, int (*)(int) > named_classes[] = {
+      {"alnum", std::isalnum}, {"alpha", std::isalpha}, {"blank", std::isblank},
+      {"cntrl", std::iscntrl}, {"digit", std::isdigit}, {"d", std::isdigit},
+      {"graph", std::isgraph}, {"lower", std::islower}, {"print", std::isprint},
+      {"punct", std::ispunct}, {"space", std::isspace}, {"s", std::isspace},
+      {"upper", std::isupper}, {"xdigit", std::isxdigit}, {"w", isWordChar}
+    };
+    for(const auto& named : named_classes) {
+      if ( name == named.first ) {
+        aSet |= makeByteSet(named.second);
+        return;
+      }
+    }
+    throw UnsupportedPattern();
+  }
+
+  /* Parses an item of a bracket expression, into a set, and returns its byte, or -1 for a class of bytes. */
+  int parseClassAtom(ByteSet& aSet) {
+    char c = take();
+    if ( c == '\\' )
+      return parseEscape(aSet, true);
+    if ( ( c == '[' ) && !atEnd() && std::strchr(":.=", peek()) ) {
+      if ( take() != ':' )
+        throw UnsupportedPattern(); // collating elements and equivalence classes.
+      parseNamedClass(aSet);
+      return -1;
+    }
+    aSet.set(static_cast<unsigned char>(c));
+    return static_cast<unsigned char>(c);
+  }
+
+  /* Parses a bracket expression (after its '['). */
+  ByteSet parseClass() {
+    ByteSet result;
+    bool negated = false;
+    if ( !atEnd() && ( peek() == '^' ) ) {
+      negated = true;
+      ++pos;
+    }
+    if ( !atEnd() && ( peek() == ']' ) )
+      throw UnsupportedPattern();
+    while ( take() != ']' ) {
+      --pos;
+      ByteSet item;
+      int lo = parseClassAtom(item);
+      if ( ( pos + 1 < pattern.size() ) && ( peek() == '-' ) && ( pattern[pos + 1] != ']' ) ) {
+        ++pos;
+        ByteSet ignored;
+        int hi = parseClassAtom(ignored);
+        if ( ( lo < 0 ) || ( hi < lo ) )
+          throw UnsupportedPattern();
+        for(int b = lo; b <= hi; ++b)
+          item.set(b);
+      }
+      result |= item;
+    }
+    if ( negated )
+      result.flip();
+    return result;
+  }
+};
+
+/* A node of the NFA. */
+struct NfaNode {
+  enum Kind { Bytes, Split, LineBegin, LineEnd, Match } kind;
+  int set;  // the byte set of a Bytes node.
+  int out;  // the next node (and the other one, for a Split node).
+  int out1;
+};
+
+}
+
+
+struct BlacklistMatcher::Impl {
+  // The NFA of all the patterns, whose node 0 is the match (the end of every pattern):
+  std::vector< ByteSet > sets;
+  std::vector< NfaNode > nodes;
+  std::vector< int > starts;
+
+  // The patterns that the NFA cannot express:
+  std::vector< std::regex > regexes;
+
+  // The DFA, whose states are sets of NFA nodes, with transitions on classes of bytes:
+  struct DfaState {
+    std::vector< int > nodes;
+    bool accepts; // whether a name that ends in this state matches.
+  };
+  bool dfaIsBuilt;
+  std::uint8_t byteClasses[256];
+  std::vector< std::uint8_t > classBytes; // a byte of each class.
+  std::size_t classCount;
+  std::vector< DfaState > dfaStates;
+  std::vector< int > transitions; // per state and class, -1 if not computed yet.
+  std::map< std::vector< int >, int > dfaStateIDs;
+
+  // The scratch space of the computation of the DFA states:
+  std::vector< int > visitStack;
+  std::vector< unsigned int > visitMarks;
+  unsigned int visitMark;
+  std::vector< int > nextSeeds;
+  std::vector< int > nextNodes;
+
+  Impl() : dfaIsBuilt(false), classCount(0), visitMark(0) {
+    nodes.push_back(NfaNode{NfaNode::Match, -1, -1, -1});
+  }
+
+  int addNode(NfaNode::Kind aKind, int aSet, int aOut, int aOut1) {
+    if ( nodes.size() >= max_nfa_size )
+      throw UnsupportedPattern();
+    nodes.push_back(NfaNode{aKind, aSet, aOut, aOut1});
+    return static_cast<int>(nodes.size() - 1);
+  }
+
+  /* Compiles a syntax tree into NFA nodes, backwards, from the node that follows it. */
+  int compile(const PatternNode& aNode, int aNext) {
+    switch( aNode.kind ) {
+      case PatternNode::Bytes:
+        return addNode(NfaNode::Bytes, aNode.set, aNext, -1);
+      case PatternNode::LineBegin:
+        return addNode(NfaNode::LineBegin, -1, aNext, -1);
+      case PatternNode::LineEnd:
+        return addNode(NfaNode::LineEnd, -1, aNext, -1);
+      case PatternNode::Concat:
+        for(auto it = aNode.kids.rbegin(); it != aNode.kids.rend(); ++it)
+          aNext = compile(*it, aNext);
+        return aNext;
+      case PatternNode::Alternation: {
+        int start = compile(aNode.kids.back(), aNext);
+        for(std::size_t i = aNode.kids.size() - 1; i-- > 0; ) {
+          int alt = compile(aNode.kids[i], aNext);
+          start = addNode(NfaNode::Split, -1, alt, start);
+        }
+        return start;
+      }
+      case PatternNode::Repeat: {
+        const PatternNode& body = aNode.kids.front();
+        int cur = aNext;
+        if ( aNode.max_count == unbounded ) {
+          int loop = addNode(NfaNode::Split, -1, -1, aNext);
+          int body_start = compile(body, loop);
+          nodes[loop].out = body_start;
+          cur = loop;
+        } else {
+          // The optional repetitions, nested like (a(a)?)?:
+          for(int i = aNode.min_count; i < aNode.max_count; ++i) {
+            int body_start = compile(body, cur);
+            cur = addNode(NfaNode::Split, -1, body_start, aNext);
+          }
+        }
+        for(int i = 0; i < aNode.min_count; ++i)
+          cur = compile(body, cur);
+        return cur;
+      }
+      case PatternNode::Empty:
+      default:
+        return aNext;
+    }
+  }
+
+  /* Computes the nodes reachable from seeds without consuming a byte, keeping those
+   * that consume a byte, match, or assert the end (unless at the end), in order. */
+  void computeClosure(const std::vector< int >& aSeeds, bool aAtBegin, bool aAtEnd, std::vector< int >& aResult) {
+    aResult.clear();
+    if ( visitMarks.size() < nodes.size() )
+      visitMarks.resize(nodes.size(), 0);
+    if ( ++visitMark == 0 ) {
+      std::fill(visitMarks.begin(), visitMarks.end(), 0);
+      visitMark = 1;
+    }
+    visitStack.assign(aSeeds.rbegin(), aSeeds.rend());
+    while ( !visitStack.empty() ) {
+      int n = visitStack.back();
+      visitStack.pop_back();
+      if ( visitMarks[n] == visitMark )
+        continue;
+      visitMarks[n] = visitMark;
+      const NfaNode& node = nodes[n];
+      switch( node.kind ) {
+        case NfaNode::Split:
+          visitStack.push_back(node.out1);
+          visitStack.push_back(node.out);
+          break;
+        case NfaNode::LineBegin:
+          if ( aAtBegin )
+            visitStack.push_back(node.out);
+          break;
+        case NfaNode::LineEnd:
+          if ( aAtEnd )
+            visitStack.push_back(node.out);
+          else
+            aResult.push_back(n);
+          break;
+        default:
+          aResult.push_back(n);
+          break;
+      }
+    }
+    std::sort(aResult.begin(), aResult.end());
+  }
+
+  int addDfaState(const std::vector< int >& aNodes, bool aAtBegin) {
+    DfaState state;
+    state.nodes = aNodes;
+    std::vector< int > end_nodes;
+    computeClosure(aNodes, aAtBegin, true, end_nodes);
+    state.accepts = ( !end_nodes.empty() && ( end_nodes.front() == 0 ) );
+    dfaStates.push_back(std::move(state));
+    transitions.resize(dfaStates.size() * classCount, -1);
+    return static_cast<int>(dfaStates.size() - 1);
+  }
+
+  void resetDfa() {
+    dfaStates.clear();
+    transitions.clear();
+    dfaStateIDs.clear();
+    addDfaState(std::vector< int >(), false); // the dead state, from which no pattern can match.
+    std::fill(transitions.begin(), transitions.end(), dead_state);
+    std::vector< int > start_nodes;
+    computeClosure(starts, true, false, start_nodes);
+    addDfaState(start_nodes, true);
+  }
+
+  void buildDfa() {
+    // The classes of bytes that no byte set tells apart:
+    std::vector< int > byte_class(256, 0);
+    std::size_t count = 1;
+    for(const ByteSet& s : sets) {
+      std::map< std::pair< int, bool >, int > refined;
+      for(int b = 0; b < 256; ++b)
+        byte_class[b] = refined.emplace(std::make_pair(byte_class[b], s.test(b)),
+                                        static_cast<int>(refined.size())).first->second;
+      count = refined.size();
+    }
+    classCount = count;
+    classBytes.assign(classCount, 0);
+    for(int b = 255; b >= 0; --b) {
+      byteClasses[b] = static_cast<std::uint8_t>(byte_class[b]);
+      classBytes[byte_class[b]] = static_cast<std::uint8_t>(b);
+    }
+    resetDfa();
+    dfaIsBuilt = true;
+  }
+
+  /* Computes (and caches) the transition of a state on a class of bytes. */
+  int computeTransition(int aState, std::size_t aClass) {
+    nextSeeds.clear();
+    const std::uint8_t byte = classBytes[aClass];
+    for(int n : dfaStates[aState].nodes) {
+      const NfaNode& node = nodes[n];
+      if ( ( node.kind == NfaNode::Bytes ) && sets[node.set].test(byte) )
+        nextSeeds.push_back(node.out);
+    }
+    computeClosure(nextSeeds, false, false, nextNodes);
+    int next = dead_state;
+    if ( !nextNodes.empty() ) {
+      auto it = dfaStateIDs.find(nextNodes);
+      if ( it != dfaStateIDs.end() ) {
+        next = it->second;
+      } else {
+        if ( dfaStates.size() >= max_dfa_states ) {
+          // Start over, from the state being entered:
+          resetDfa();
+          next = addDfaState(nextNodes, false);
+          dfaStateIDs.emplace(nextNodes, next);
+          return next;
+        }
+        next = addDfaState(nextNodes, false);
+        dfaStateIDs.emplace(nextNodes, next);
+      }
+    }
+    transitions[aState * classCount + aClass] = next;
+    return next;
+  }
+};
+
+
+BlacklistMatcher::BlacklistMatcher() : impl(new Impl()) { }
+
+BlacklistMatcher::~BlacklistMatcher() { }
+
+bool BlacklistMatcher::addPattern(const std::string& aPattern) {
+  const std::size_t set_count = impl->sets.size();
+  const std::size_t node_count = impl->nodes.size();
+  try {
+    PatternParser parser(aPattern, impl->sets);
+    PatternNode tree = parser.parse();
+    impl->starts.push_back(impl->compile(tree, 0));
+    impl->dfaIsBuilt = false;
+    return true;
+  } catch(UnsupportedPattern&) {
+    impl->sets.resize(set_count);
+    impl->nodes.resize(node_count);
+  }
+  try {
+    impl->regexes.emplace_back(aPattern);
+    return true;
+  } catch(std::regex_error&) {
+    return false;
+  }
+}
+
+void BlacklistMatcher::clear() {
+  impl.reset(new Impl());
+}
+
+bool BlacklistMatcher::empty() const {
+  return impl->starts.empty() && impl->regexes.empty();
+}
+
+std::size_t BlacklistMatcher::getAutomatonPatternCount() const {
+  return impl->starts.size();
+}
+
+std::size_t BlacklistMatcher::getRegexPatternCount() const {
+  return impl->regexes.size();
+}
+
+bool BlacklistMatcher::matches(const char* aName, std::size_t aSize) const {
+  Impl& m = *impl;
+  if ( !m.starts.empty() ) {
+    if ( !m.dfaIsBuilt )
+      m.buildDfa();
+    int state = start_state;
+    for(const char* p = aName, *p_end = aName + aSize; p != p_end; ++p) {
+      std::size_t c = m.byteClasses[static_cast<unsigned char>(*p)];
+      int next = m.transitions[state * m.classCount + c];
+      state = ( next >= 0 ? next : m.computeTransition(state, c) );
+      if ( state == dead_state )
+        break;
+    }
+    if ( m.dfaStates[state].accepts )
+      return true;
+  }
+  for(const std::regex& re : m.regexes) {
+    if ( std::regex_match(aName, aName + aSize, re) )
+      return true;
+  }
+  return false;
+}
+
+
+}
+
+
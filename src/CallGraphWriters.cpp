@@ -93,6 +93,16 @@ void CallGraphWriter::finalizeTree() {
   writeGraph();
 }
 
+CallGraphWriter::vertex_t CallGraphWriter::findInstantiation(const PrintableEntryBegin& aEntry) const {
+  // Look up by the precomputed hash, and only compare names on hash hits:
+  auto range = inst_map.equal_range(aEntry.getNameHash());
+  for(; range.first != range.second; ++range.first) {
+    if( g[range.first->second].Name == aEntry.getName() )
+      return range.first->second;
+  }
+  return boost::graph_traits<graph_t>::null_vertex();
+}
+
 void CallGraphWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   const PrintableEntryBegin& BegEntry = aNode.start;
   const PrintableEntryEnd&   EndEntry = aNode.finish;
@@ -109,19 +119,14 @@ void CallGraphWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   bool new_vertex = false;
   if( BegEntry.InstantiationKind == MemoizationVal ) {
     // try to find an existing instantiation:
-    auto it = inst_map.find(BegEntry.Name);
-    if( it != inst_map.end() ) {
-      v = it->second;
-    }
+    v = findInstantiation(BegEntry);
   } else if( BegEntry.InstantiationKind == TemplateInstantiationVal ) {
     // Reuse or create a new full instantiation node.
-    auto it = inst_map.find(BegEntry.Name);
-    if( it != inst_map.end() ) {
-      v = it->second;
-    } else {
+    v = findInstantiation(BegEntry);
+    if( v == boost::graph_traits<graph_t>::null_vertex() ) {
       new_vertex = true;
       v = add_vertex(g);
-      inst_map[BegEntry.Name] = v;
+      inst_map.insert(std::make_pair(BegEntry.getNameHash(), v));
     }
     tree_to_graph[aNode.nd_id] = v;
   } else {
@@ -139,8 +144,8 @@ void CallGraphWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   // Fill in profiling data, only for a new vertex or if entry is the "real" entry.
   if( new_vertex || dT_ns > g[v].TimeExclCost ) {
     g[v].InstantiationKind = BegEntry.InstantiationKind;
-    g[v].Name = BegEntry.Name;
-    g[v].CalleeFileName = BegEntry.TempOri_FileName; // Template origin is the "callee"
+    g[v].Name = BegEntry.getName();
+    g[v].CalleeFileName = BegEntry.getTempOriFileName(); // Template origin is the "callee"
     g[v].CalleeLine = BegEntry.TempOri_Line;
     g[v].CalleeColumn = BegEntry.TempOri_Column;
     g[v].TimeExclCost = dT_ns;
@@ -183,7 +188,7 @@ void CallGraphWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   // FIXME (?) Point of instantiation of template should be in the same file as parent template.
   //assert(BegEntry.FileName == g[u].CalleeFileName);
   if( e_added ) {
-    g[e].CallerFileName = BegEntry.FileName; // Point of instantiation is the "caller"
+    g[e].CallerFileName = BegEntry.getFileName(); // Point of instantiation is the "caller"
     g[e].CallerLine = BegEntry.Line;
     g[e].CallerColumn = BegEntry.Column;
     g[e].TimeInclCost   = dT_ns;
@@ -0,0 +1,403 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/CompressedStreams.h>
+
+#include <boost/iostreams/categories.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filter/zstd.hpp>
+#include <boost/iostreams/filtering_streambuf.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <ios>
+
+namespace templight {
+
+
+namespace {
+
+// The ring holds a few blocks, such that the background thread can work ahead:
+const std::size_t ring_block_count = 4;
+const std::size_t ring_block_size = 256 * 1024;
+
+/* A boost.iostreams source device over the compressed input, starting with
+ * the bytes that were already read from it (to detect the compression). */
+class RawSource {
+public:
+  typedef char char_type;
+  typedef boost::iostreams::source_tag category;
+
+  RawSource(const std::string& aPrefix, std::streambuf* aBuf, std::FILE* aFile,
+            const char* aData, std::size_t aSize) :
+    prefix(&aPrefix), prefix_pos(0), buf(aBuf), file(aFile), data(aData), size(aSize) { }
+
+  std::streamsize read(char* s, std::streamsize n) {
+    std::size_t wanted = static_cast<std::size_t>(n);
+    std::size_t got = 0;
+    if ( prefix_pos < prefix->size() ) {
+      got = std::min(wanted, prefix->size() - prefix_pos);
+      std::memcpy(s, prefix->data() + prefix_pos, got);
+      prefix_pos += got;
+      s += got;
+      wanted -= got;
+    }
+    if ( wanted > 0 ) {
+      if ( buf ) {
+        std::streamsize r = buf->sgetn(s, wanted);
+        got += ( r > 0 ? static_cast<std::size_t>(r) : 0 );
+      } else if ( file ) {
+        got += std::fread(s, 1, wanted, file);
+      } else if ( data ) {
+        std::size_t r = std::min(wanted, size);
+        std::memcpy(s, data, r);
+        data += r;
+        size -= r;
+        got += r;
+      }
+    }
+    return ( got > 0 ? static_cast<std::streamsize>(got) : -1 );
+  }
+
+private:
+  const std::string* prefix;
+  std::size_t prefix_pos;
+  std::streambuf* buf;
+  std::FILE* file;
+  const char* data;
+  std::size_t size;
+};
+
+/* A boost.iostreams sink device over a stream-buffer. */
+class StreamBufSink {
+public:
+  typedef char char_type;
+  typedef boost::iostreams::sink_tag category;
+
+  explicit StreamBufSink(std::streambuf* aBuf) : buf(aBuf) { }
+
+  std::streamsize write(const char* s, std::streamsize n) {
+    if ( buf->sputn(s, n) != n )
+      throw std::ios_base::failure("could not write the compressed output");
+    return n;
+  }
+
+private:
+  std::streambuf* buf;
+};
+
+bool hasSuffix(const std::string& aStr, const std::string& aSuffix) {
+  return ( aStr.size() >= aSuffix.size() ) &&
+         ( aStr.compare(aStr.size() - aSuffix.size(), aSuffix.size(), aSuffix) == 0 );
+}
+
+}
+
+
+StreamCompression detectCompression(const char* aData, std::size_t aSize) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(aData);
+  if ( aSize < 4 )
+    return NoCompression;
+  // A protobuf trace file starts with 0x0A (a trace message), so these never clash:
+  if ( ( p[0] == 0x1F ) && ( p[1] == 0x8B ) )
+    return GzipCompression;
+  if ( ( p[0] == 0x28 ) && ( p[1] == 0xB5 ) && ( p[2] == 0x2F ) && ( p[3] == 0xFD ) )
+    return ZstdCompression;
+  return NoCompression;
+}
+
+bool getCompressionByName(const std::string& aName, const std::string& aFilename,
+                          StreamCompression& aResult) {
+  if ( aName == "auto" ) {
+    if ( hasSuffix(aFilename, ".gz") )
+      aResult = GzipCompression;
+    else if ( hasSuffix(aFilename, ".zst") )
+      aResult = ZstdCompression;
+    else
+      aResult = NoCompression;
+  } else if ( aName.empty() || ( aName == "none" ) ) {
+    aResult = NoCompression;
+  } else if ( aName == "gzip" ) {
+    aResult = GzipCompression;
+  } else if ( aName == "zstd" ) {
+    aResult = ZstdCompression;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+DecompressingStreamBuf::DecompressingStreamBuf(StreamCompression aFormat, std::streambuf* aSource,
+                                               const std::string& aPrefix) : format(aFormat) {
+  source.prefix = aPrefix;
+  source.buf = aSource;
+  source.file = nullptr;
+  source.data = nullptr;
+  source.size = 0;
+  start();
+}
+
+DecompressingStreamBuf::DecompressingStreamBuf(StreamCompression aFormat, std::FILE* aSource,
+                                               const std::string& aPrefix) : format(aFormat) {
+  source.prefix = aPrefix;
+  source.buf = nullptr;
+  source.file = aSource;
+  source.data = nullptr;
+  source.size = 0;
+  start();
+}
+
+DecompressingStreamBuf::DecompressingStreamBuf(StreamCompression aFormat,
+                                               const char* aData, std::size_t aSize) : format(aFormat) {
+  source.buf = nullptr;
+  source.file = nullptr;
+  source.data = aData;
+  source.size = aSize;
+  start();
+}
+
+DecompressingStreamBuf::~DecompressingStreamBuf() {
+  {
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    stopping = true;
+  }
+  ring_cv.notify_all();
+  worker.join();
+}
+
+void DecompressingStreamBuf::start() {
+  blocks.resize(ring_block_count, std::vector<char>(ring_block_size));
+  block_sizes.resize(ring_block_count, 0);
+  head = 0;
+  count = 0;
+  holding_head = false;
+  done = false;
+  failed = false;
+  stopping = false;
+  setg(nullptr, nullptr, nullptr);
+  worker = std::thread(&DecompressingStreamBuf::runWorker, this);
+}
+
+bool DecompressingStreamBuf::hasFailed() const {
+  std::lock_guard<std::mutex> lock(ring_mutex);
+  return failed;
+}
+
+void DecompressingStreamBuf::runWorker() {
+  boost::iostreams::filtering_streambuf<boost::iostreams::input> in;
+  if ( format == ZstdCompression )
+    in.push(boost::iostreams::zstd_decompressor());
+  else
+    in.push(boost::iostreams::gzip_decompressor());
+  in.push(RawSource(source.prefix, source.buf, source.file, source.data, source.size));
+  
+  std::size_t tail = 0;
+  bool has_failed = false;
+  while ( true ) {
+    {
+      std::unique_lock<std::mutex> lock(ring_mutex);
+      ring_cv.wait(lock, [this]() { return stopping || ( count < blocks.size() ); });
+      if ( stopping )
+        return;
+    }
+    // Fill a whole block (the block is not in use by the reader until it is counted):
+    std::vector<char>& blk = blocks[tail];
+    std::size_t filled = 0;
+    try {
+      while ( filled < blk.size() ) {
+        // Read in small pieces, such that an error only loses the last piece:
+        std::streamsize r = in.sgetn(&blk[filled], std::min<std::size_t>(blk.size() - filled, 16384));
+        if ( r <= 0 )
+          break;
+        filled += static_cast<std::size_t>(r);
+      }
+    } catch(std::exception&) {
+      has_failed = true; // keep what was decompressed up to the error.
+    }
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    if ( filled > 0 ) {
+      block_sizes[tail] = filled;
+      tail = ( tail + 1 ) % blocks.size();
+      ++count;
+    }
+    if ( has_failed || ( filled < blk.size() ) ) {
+      failed = has_failed;
+      done = true;
+      ring_cv.notify_all();
+      return;
+    }
+    ring_cv.notify_all();
+  }
+}
+
+DecompressingStreamBuf::int_type DecompressingStreamBuf::underflow() {
+  if ( gptr() < egptr() )
+    return traits_type::to_int_type(*gptr());
+  {
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    if ( holding_head ) {
+      // Give the block back to the worker:
+      head = ( head + 1 ) % blocks.size();
+      --count;
+      holding_head = false;
+      ring_cv.notify_all();
+    }
+    ring_cv.wait(lock, [this]() { return done || ( count > 0 ); });
+    if ( count == 0 ) {
+      setg(nullptr, nullptr, nullptr);
+      return traits_type::eof();
+    }
+    holding_head = true;
+  }
+  char* blk = blocks[head].data();
+  setg(blk, blk, blk + block_sizes[head]);
+  return traits_type::to_int_type(*gptr());
+}
+
+
+CompressingStreamBuf::CompressingStreamBuf(StreamCompression aFormat, std::streambuf* aSink, int aLevel) :
+  format(aFormat), sink(aSink), level(aLevel),
+  blocks(ring_block_count, std::vector<char>(ring_block_size)),
+  block_sizes(ring_block_count, 0), head(0), tail(0), count(0), done(false), failed(false) {
+  setp(blocks[tail].data(), blocks[tail].data() + blocks[tail].size());
+  worker = std::thread(&CompressingStreamBuf::runWorker, this);
+}
+
+CompressingStreamBuf::~CompressingStreamBuf() {
+  close();
+}
+
+void CompressingStreamBuf::submitBlock() {
+  std::size_t written = pptr() - pbase();
+  if ( written == 0 )
+    return;
+  std::unique_lock<std::mutex> lock(ring_mutex);
+  block_sizes[tail] = written;
+  tail = ( tail + 1 ) % blocks.size();
+  ++count;
+  ring_cv.notify_all();
+  // Wait for the next block to be free:
+  ring_cv.wait(lock, [this]() { return count < blocks.size(); });
+  setp(blocks[tail].data(), blocks[tail].data() + blocks[tail].size());
+}
+
+CompressingStreamBuf::int_type CompressingStreamBuf::overflow(int_type c) {
+  if ( done )
+    return traits_type::eof();
+  submitBlock();
+  if ( !traits_type::eq_int_type(c, traits_type::eof()) ) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int CompressingStreamBuf::sync() {
+  if ( !done )
+    submitBlock();
+  return 0;
+}
+
+bool CompressingStreamBuf::close() {
+  if ( !done ) {
+    submitBlock();
+    {
+      std::lock_guard<std::mutex> lock(ring_mutex);
+      done = true;
+    }
+    ring_cv.notify_all();
+    worker.join();
+    setp(nullptr, nullptr);
+  }
+  return !hasFailed();
+}
+
+bool CompressingStreamBuf::hasFailed() const {
+  std::lock_guard<std::mutex> lock(ring_mutex);
+  return failed;
+}
+
+void CompressingStreamBuf::runWorker() {
+  try {
+    compressBlocks();
+  } catch(std::exception&) {
+    {
+      std::lock_guard<std::mutex> lock(ring_mutex);
+      failed = true;
+    }
+    // Drop the rest of the output, but keep the ring going, so that writing never blocks:
+    while ( true ) {
+      std::unique_lock<std::mutex> lock(ring_mutex);
+      ring_cv.wait(lock, [this]() { return done || ( count > 0 ); });
+      if ( count == 0 )
+        break;
+      head = ( head + 1 ) % blocks.size();
+      --count;
+      ring_cv.notify_all();
+    }
+  }
+}
+
+void CompressingStreamBuf::compressBlocks() {
+  boost::iostreams::filtering_streambuf<boost::iostreams::output> out;
+  if ( format == ZstdCompression ) {
+    boost::iostreams::zstd_params params;
+    if ( level >= 0 )
+      params.level = level;
+    out.push(boost::iostreams::zstd_compressor(params));
+  } else {
+    boost::iostreams::gzip_params params;
+    if ( level >= 0 )
+      params.level = level;
+    out.push(boost::iostreams::gzip_compressor(params));
+  }
+  out.push(StreamBufSink(sink));
+
+  while ( true ) {
+    std::size_t cur = 0;
+    std::size_t cur_size = 0;
+    {
+      std::unique_lock<std::mutex> lock(ring_mutex);
+      ring_cv.wait(lock, [this]() { return done || ( count > 0 ); });
+      if ( count == 0 )
+        break;
+      cur = head;
+      cur_size = block_sizes[head];
+    }
+    out.sputn(blocks[cur].data(), cur_size);
+    std::lock_guard<std::mutex> lock(ring_mutex);
+    head = ( head + 1 ) % blocks.size();
+    --count;
+    ring_cv.notify_all();
+  }
+
+  // Write the end of the compressed stream:
+  out.reset();
+  if ( sink->pubsync() == -1 )
+    throw std::ios_base::failure("could not flush the compressed output");
+}
+
+
+} // namespace templight
+
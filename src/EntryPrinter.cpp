@@ -22,9 +22,9 @@
 
 #include <templight/EntryPrinter.h>
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
-#include <regex>
 
 namespace templight {
 
@@ -37,6 +37,78 @@ void EntryPrinter::skipEntry() {
   SkippedEndingsCount = 1;
 }
 
+bool EntryPrinter::isBlacklisted(const PrintableEntryBegin &Entry) {
+  if ( Blacklist.empty() )
+    return false;
+  // The same names recur a lot (e.g., memoizations), so, the verdicts are cached, 
+  // by name ids (only valid within a trace) and then, by name hashes:
+  std::uint8_t* id_verdict = nullptr;
+  if ( Entry.Strings && ( Entry.NameID != InvalidStringID ) ) {
+    if ( Entry.Strings != VerdictStrings ) {
+      VerdictStrings = Entry.Strings;
+      VerdictsByID.clear();
+    }
+    if ( VerdictsByID.size() <= Entry.NameID )
+      VerdictsByID.resize(Entry.NameID + 1, 0);
+    id_verdict = &VerdictsByID[Entry.NameID];
+    if ( *id_verdict ) {
+      ++VerdictCacheHits;
+      return ( *id_verdict == 2 );
+    }
+  }
+  // Keep the table of verdicts by hashes at most half full:
+  if ( 2 * ( VerdictCount + 1 ) > VerdictSlots.size() )
+    growVerdictSlots();
+  const std::string& name = Entry.getName();
+  const std::uint64_t hash = Entry.getNameHash();
+  VerdictSlot& slot = findVerdictSlot(hash, name);
+  if ( slot.verdict ) {
+    ++VerdictCacheHits;
+  } else {
+    ++VerdictCacheMisses;
+    slot.hash = hash;
+    slot.name_pos = VerdictNames.size();
+    slot.name_size = name.size();
+    slot.verdict = ( Blacklist.matches(name) ? 2 : 1 );
+    VerdictNames += name;
+    ++VerdictCount;
+  }
+  if ( id_verdict )
+    *id_verdict = slot.verdict;
+  return ( slot.verdict == 2 );
+}
+
+EntryPrinter::VerdictSlot& EntryPrinter::findVerdictSlot(std::uint64_t aHash, const std::string& aName) {
+  // Linear probing, from the slot of the hash to the slot of the name or an empty slot 
+  // (the names are compared on hash hits, since distinct names can have the same hash):
+  const std::size_t mask = VerdictSlots.size() - 1;
+  for(std::size_t i = ( aHash ^ ( aHash >> 32 ) ) & mask; ; i = (i + 1) & mask) {
+    VerdictSlot& slot = VerdictSlots[i];
+    if ( slot.verdict == 0 )
+      return slot;
+    if ( ( slot.hash == aHash ) && ( slot.name_size == aName.size() ) && 
+         ( VerdictNames.compare(slot.name_pos, slot.name_size, aName) == 0 ) )
+      return slot;
+  }
+}
+
+EntryPrinter::VerdictSlot& EntryPrinter::findEmptyVerdictSlot(std::uint64_t aHash) {
+  const std::size_t mask = VerdictSlots.size() - 1;
+  for(std::size_t i = ( aHash ^ ( aHash >> 32 ) ) & mask; ; i = (i + 1) & mask) {
+    if ( VerdictSlots[i].verdict == 0 )
+      return VerdictSlots[i];
+  }
+}
+
+void EntryPrinter::growVerdictSlots() {
+  std::vector<VerdictSlot> old_slots;
+  old_slots.swap(VerdictSlots);
+  VerdictSlots.resize(std::max(old_slots.size() * 2, std::size_t(1024)), VerdictSlot{0, 0, 0, 0});
+  for(const VerdictSlot& slot : old_slots)
+    if ( slot.verdict )
+      findEmptyVerdictSlot(slot.hash) = slot;
+}
+
 bool EntryPrinter::shouldIgnoreEntry(const PrintableEntryBegin &Entry) {
   // Check the black-lists:
   // (1) Is currently ignoring entries?
@@ -45,8 +117,7 @@ bool EntryPrinter::shouldIgnoreEntry(const PrintableEntryBegin &Entry) {
     return true;
   }
   // (2) Regexes:
-  if ( ( CoRegex && ( std::regex_match(Entry.Name, *CoRegex) ) ) || 
-       ( IdRegex && ( std::regex_match(Entry.Name, *IdRegex) ) ) ) {
+  if ( isBlacklisted(Entry) ) {
     skipEntry();
     return true;
   }
@@ -82,6 +153,9 @@ void EntryPrinter::printEntry(const PrintableEntryEnd &Entry) {
 }
 
 void EntryPrinter::initialize(const std::string& SourceName) {
+  // The name ids of the entries start over with each trace:
+  VerdictStrings = nullptr;
+  VerdictsByID.clear();
   if ( p_writer )
     p_writer->initialize(SourceName);
 }
@@ -91,78 +165,114 @@ void EntryPrinter::finalize() {
     p_writer->finalize();
 }
 
-EntryPrinter::EntryPrinter(const std::string &Output) : SkippedEndingsCount(0), TraceOS(0) {
+EntryPrinter::EntryPrinter(const std::string &Output, StreamCompression OutputCompression) : 
+                           SkippedEndingsCount(0), VerdictStrings(nullptr), 
+                           VerdictCount(0), VerdictCacheHits(0), VerdictCacheMisses(0), TraceOS(0), FileOS(0) {
   if ( Output == "-" ) {
-    TraceOS = &std::cout;
+    FileOS = &std::cout;
   } else {
-    TraceOS = new std::ofstream(Output);
-    if ( !TraceOS || !(*TraceOS) ) {
+    if ( OutputCompression != NoCompression )
+      FileOS = new std::ofstream(Output, std::ios_base::out | std::ios_base::binary);
+    else
+      FileOS = new std::ofstream(Output);
+    if ( !FileOS || !(*FileOS) ) {
       std::cerr <<
         "Error: [Templight-Tools] Can not open file to write trace of template instantiations: "
         << Output << std::endl;
-      if( TraceOS )
-        delete TraceOS;
-      TraceOS = nullptr;
+      if( FileOS )
+        delete FileOS;
+      FileOS = nullptr;
       return;
     }
   }
+  if ( OutputCompression != NoCompression ) {
+    // The writers write to a stream that compresses (in a background thread) into the file:
+    CompressedBuf.reset(new CompressingStreamBuf(OutputCompression, FileOS->rdbuf()));
+    TraceOS = new std::ostream(CompressedBuf.get());
+  } else {
+    TraceOS = FileOS;
+  }
 }
 
 EntryPrinter::~EntryPrinter() {
+  closeTraceStream();
+}
+
+bool EntryPrinter::closeTraceStream() {
   p_writer.reset(); // Delete writer before the trace-OS.
+  bool is_written = true;
   if ( TraceOS ) {
     TraceOS->flush();
-    if ( TraceOS != &std::cout )
+    is_written = !TraceOS->fail();
+    if ( CompressedBuf ) {
+      is_written = CompressedBuf->close() && is_written;
       delete TraceOS;
+      CompressedBuf.reset();
+    }
+    TraceOS = nullptr;
+  }
+  if ( FileOS ) {
+    FileOS->flush();
+    is_written = !FileOS->fail() && is_written;
+    if ( FileOS != &std::cout )
+      delete FileOS;
+    FileOS = nullptr;
   }
+  return is_written;
 }
 
 bool EntryPrinter::isValid() const { return static_cast<bool>(p_writer); }
 
 std::ostream* EntryPrinter::getTraceStream() const { return TraceOS; }
 
+unsigned int EntryPrinter::getRequiredFields() const {
+  unsigned int fields = ( p_writer ? p_writer->getRequiredFields() : static_cast<unsigned int>(AllEntryFields) );
+  if ( !Blacklist.empty() )
+    fields |= EntryNameField;
+  return fields;
+}
+
 void EntryPrinter::takeWriter(EntryWriter* aPWriter) {
   p_writer.reset(aPWriter);
 }
 
 void EntryPrinter::readBlacklists(const std::string& BLFilename) {
+  VerdictStrings = nullptr;
+  VerdictsByID.clear();
+  VerdictSlots.clear();
+  VerdictCount = 0;
+  VerdictNames.clear();
+  
   if ( BLFilename.empty() ) {
-    CoRegex.reset();
-    IdRegex.reset();
+    Blacklist.clear();
     return;
   }
   
   std::ifstream file_in(BLFilename.c_str());
   if( ! file_in ) {
     std::cerr << "Error: [Templight-Tools] Could not open the blacklist file!" << std::endl;
-    CoRegex.reset();
-    IdRegex.reset();
+    Blacklist.clear();
     return;
   }
   
-  std::regex findCo("^context ");
-  std::regex findId("^identifier ");
+  Blacklist.clear();
   
-  std::string curLine, CoPattern, IdPattern;
+  std::string curLine;
   
   while( std::getline(file_in, curLine) ) {
-    if( std::regex_match(curLine, findCo) ) {
-      if(!CoPattern.empty())
-        CoPattern += '|';
-      CoPattern += '(';
-      CoPattern.append(curLine.begin()+8, curLine.end());
-      CoPattern += ')';
-    } else if( std::regex_match(curLine, findId) ) {
-      if(!IdPattern.empty())
-        IdPattern += '|';
-      IdPattern += '(';
-      IdPattern.append(curLine.begin()+11, curLine.end());
-      IdPattern += ')';
+    std::string pattern;
+    if( curLine.compare(0, 8, "context ") == 0 ) {
+      pattern = curLine.substr(8);
+    } else if( curLine.compare(0, 11, "identifier ") == 0 ) {
+      pattern = curLine.substr(11);
+    } else {
+      continue;
+    }
+    if( !Blacklist.addPattern(pattern) ) {
+      std::cerr << "Warning: [Templight-Tools] Ignoring the invalid blacklist pattern: " << pattern << std::endl;
     }
   }
   
-  CoRegex.reset(new std::regex(CoPattern));
-  IdRegex.reset(new std::regex(IdPattern));
   return;
 }
 
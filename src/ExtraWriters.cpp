@@ -21,11 +21,15 @@
  */
 
 #include <templight/ExtraWriters.h>
+#include <algorithm>
+#include <sstream>
 
 #include <iostream>
 #include <fstream>
 #include <iomanip>
 #include <vector>
+#include <limits>
+#include <stdexcept>
 
 namespace templight {
 
@@ -95,16 +99,16 @@ void YamlWriter::printEntry(const PrintableEntryBegin& aEntry) {
   OutputOS << 
     "- IsBegin:         true\n"
     "  Kind:            " << GetInstantiationKindString(aEntry.InstantiationKind) << "\n"
-    "  Name:            '" << escapeSingleQuotedScalar(aEntry.Name) << "'\n" 
-    "  Location:        '" << aEntry.FileName << "|" 
+    "  Name:            '" << escapeSingleQuotedScalar(aEntry.getName()) << "'\n" 
+    "  Location:        '" << aEntry.getFileName() << "|" 
                            << aEntry.Line << "|" 
                            << aEntry.Column << "'\n";
   OutputOS << 
     "  TimeStamp:       " << std::fixed << std::setprecision(9) << aEntry.TimeStamp << "\n"
     "  MemoryUsage:     " << aEntry.MemoryUsage << "\n";
-  if( !aEntry.TempOri_FileName.empty() ) {
+  if( !aEntry.getTempOriFileName().empty() ) {
     OutputOS << 
-      "  TemplateOrigin:  '" << aEntry.TempOri_FileName << "|" 
+      "  TemplateOrigin:  '" << aEntry.getTempOriFileName() << "|" 
                              << aEntry.TempOri_Line << "|" 
                              << aEntry.TempOri_Column << "'\n";
   }
@@ -149,20 +153,20 @@ void XmlWriter::finalize() {
 }
 
 void XmlWriter::printEntry(const PrintableEntryBegin& aEntry) {
-  std::string EscapedName = escapeXml(aEntry.Name);
+  std::string EscapedName = escapeXml(aEntry.getName());
   OutputOS << 
     "<TemplateBegin>\n"
     "    <Kind>" << GetInstantiationKindString(aEntry.InstantiationKind) << "</Kind>\n"
     "    <Context context = \"" << EscapedName << "\"/>\n"
-    "    <Location>" << aEntry.FileName << "|" 
+    "    <Location>" << aEntry.getFileName() << "|" 
                      << aEntry.Line << "|" 
                      << aEntry.Column << "</Location>\n";
   OutputOS << 
     "    <TimeStamp time = \"" << std::fixed << std::setprecision(9) << aEntry.TimeStamp << "\"/>\n"
     "    <MemoryUsage bytes = \"" << aEntry.MemoryUsage << "\"/>\n";
-  if( !aEntry.TempOri_FileName.empty() ) {
+  if( !aEntry.getTempOriFileName().empty() ) {
     OutputOS << 
-      "    <TemplateOrigin>" << aEntry.TempOri_FileName << "|" 
+      "    <TemplateOrigin>" << aEntry.getTempOriFileName() << "|" 
                              << aEntry.TempOri_Line << "|" 
                              << aEntry.TempOri_Column << "</TemplateOrigin>\n";
   }
@@ -193,16 +197,16 @@ void TextWriter::printEntry(const PrintableEntryBegin& aEntry) {
   OutputOS << 
     "TemplateBegin\n"
     "  Kind = " << GetInstantiationKindString(aEntry.InstantiationKind) << "\n"
-    "  Name = " << aEntry.Name << "\n"
-    "  Location = " << aEntry.FileName << "|" 
+    "  Name = " << aEntry.getName() << "\n"
+    "  Location = " << aEntry.getFileName() << "|" 
                     << aEntry.Line << "|" 
                     << aEntry.Column << "\n";
   OutputOS << 
     "  TimeStamp = " << std::fixed << std::setprecision(9) << aEntry.TimeStamp << "\n"
     "  MemoryUsage = " << aEntry.MemoryUsage << "\n";
-  if( !aEntry.TempOri_FileName.empty() ) {
+  if( !aEntry.getTempOriFileName().empty() ) {
     OutputOS << 
-      "  TemplateOrigin = " << aEntry.TempOri_FileName << "|" 
+      "  TemplateOrigin = " << aEntry.getTempOriFileName() << "|" 
                             << aEntry.TempOri_Line << "|" 
                             << aEntry.TempOri_Column << "\n";
   }
@@ -217,57 +221,314 @@ void TextWriter::printEntry(const PrintableEntryEnd& aEntry) {
 
 
 
-RecordedDFSEntryTree::RecordedDFSEntryTree() : cur_top(invalid_id) {}
+void EntryAggregate::addChild(const EntryAggregate& aChild, std::uint64_t aChildMemoryUsage) {
+  ExclusiveTime   += aChild.InclusiveTime;
+  ExclusiveMemory += aChild.InclusiveMemory;
+  PeakMemory = std::max(PeakMemory, aChild.PeakMemory + aChildMemoryUsage);
+  SubtreeSize += aChild.SubtreeSize;
+  ++ChildCount;
+}
+
+void EntryAggregate::complete(double aBeginTime, double aEndTime, std::uint64_t aBeginMemory, std::uint64_t aEndMemory) {
+  // The costs of the children were summed into the exclusive costs (see addChild):
+  InclusiveTime = ( aEndTime > aBeginTime ? aEndTime - aBeginTime : 0.0 );
+  ExclusiveTime = ( InclusiveTime > ExclusiveTime ? InclusiveTime - ExclusiveTime : 0.0 );
+  InclusiveMemory = ( aEndMemory > aBeginMemory ? aEndMemory - aBeginMemory : 0 );
+  ExclusiveMemory = ( InclusiveMemory > ExclusiveMemory ? InclusiveMemory - ExclusiveMemory : 0 );
+  PeakMemory = std::max(std::max(PeakMemory, aBeginMemory), aEndMemory) - aBeginMemory;
+  SubtreeSize += 1;
+}
+
+
+
+const std::uint32_t RecordedDFSEntryTree::invalid_node;
+
+RecordedDFSEntryTree::RecordedDFSEntryTree() : cur_top(invalid_id), 
+  name_block_pos(nullptr), name_block_left(0), last_strings(nullptr) {}
 
 void RecordedDFSEntryTree::beginEntry(const PrintableEntryBegin& aEntry) {
-  parent_stack.push_back(EntryTraversalTask(
-    aEntry, parent_stack.size(), ( cur_top == invalid_id ? invalid_id : cur_top)));
-  cur_top = parent_stack.size() - 1;
+  // The node ids, and the end ids (up to the number of nodes), must fit below invalid_node:
+  if ( kinds.size() >= invalid_node - 1 )
+    throw std::length_error("Too many entries to record in a template instantiation tree.");
+  if ( ( aEntry.InstantiationKind < 0 ) || ( aEntry.InstantiationKind > 0xFF ) )
+    throw std::length_error("Invalid instantiation kind for a template instantiation tree.");
+  if ( aEntry.Strings && ( aEntry.Strings != last_strings ) ) {
+    resetStringIDs();
+    last_strings = aEntry.Strings;
+  }
+  kinds.push_back(static_cast<std::uint8_t>(aEntry.InstantiationKind));
+  name_ids.push_back(internName(aEntry));
+  file_ids.push_back(internFileName(aEntry, false));
+  lines.push_back(aEntry.Line);
+  columns.push_back(aEntry.Column);
+  ori_file_ids.push_back(internFileName(aEntry, true));
+  ori_lines.push_back(aEntry.TempOri_Line);
+  ori_columns.push_back(aEntry.TempOri_Column);
+  begin_times.push_back(aEntry.TimeStamp);
+  end_times.push_back(0.0);
+  begin_memory.push_back(aEntry.MemoryUsage);
+  end_memory.push_back(0);
+  parent_ids.push_back(( cur_top == invalid_id ? invalid_node : static_cast<std::uint32_t>(cur_top)));
+  end_ids.push_back(invalid_node);
+  depths.push_back(( cur_top == invalid_id ? 0 : depths[cur_top] + 1 ));
+  cur_top = kinds.size() - 1;
 }
 
 void RecordedDFSEntryTree::endEntry(const PrintableEntryEnd& aEntry) {
-  parent_stack[cur_top].finish = aEntry;
-  parent_stack[cur_top].id_end = parent_stack.size();
-  if ( parent_stack[cur_top].parent_id == invalid_id ) 
+  if ( cur_top == invalid_id )
+    return;
+  end_times[cur_top] = aEntry.TimeStamp;
+  end_memory[cur_top] = aEntry.MemoryUsage;
+  end_ids[cur_top] = static_cast<std::uint32_t>(kinds.size());
+  if ( parent_ids[cur_top] == invalid_node ) 
     cur_top = invalid_id;
   else 
-    cur_top = parent_stack[cur_top].parent_id;
+    cur_top = parent_ids[cur_top];
+}
+
+void RecordedDFSEntryTree::getTask(std::size_t aId, EntryTraversalTask& aTask) const {
+  PrintableEntryBegin& b = aTask.start;
+  b.InstantiationKind = kinds[aId];
+  b.NameID = name_ids[aId];
+  b.FileID = file_ids[aId];
+  b.Line = lines[aId];
+  b.Column = columns[aId];
+  b.TempOri_FileID = ori_file_ids[aId];
+  b.TempOri_Line = ori_lines[aId];
+  b.TempOri_Column = ori_columns[aId];
+  b.TimeStamp = begin_times[aId];
+  b.MemoryUsage = begin_memory[aId];
+  b.NameHash = ( b.NameID == InvalidStringID ? 0 : name_hashes[b.NameID] );
+  b.setStrings(this);
+  aTask.finish.TimeStamp = end_times[aId];
+  aTask.finish.MemoryUsage = end_memory[aId];
+  aTask.nd_id = aId;
+  aTask.id_end = ( end_ids[aId] == invalid_node ? invalid_id : end_ids[aId] );
+  aTask.parent_id = ( parent_ids[aId] == invalid_node ? invalid_id : parent_ids[aId] );
+}
+
+void RecordedDFSEntryTree::computeAggregates(std::vector<EntryAggregate>& aAggregates) const {
+  const std::size_t n = size();
+  aAggregates.assign(n, EntryAggregate());
+  // Children come after their parents, so, in reverse, they are completed before them:
+  for(std::size_t i = n; i-- > 0; ) {
+    aAggregates[i].Depth = depths[i];
+    aAggregates[i].complete(begin_times[i], end_times[i], begin_memory[i], end_memory[i]);
+    if ( parent_ids[i] != invalid_node )
+      aAggregates[parent_ids[i]].addChild(aAggregates[i], begin_memory[i]);
+  }
+}
+
+void RecordedDFSEntryTree::resetStringIDs() {
+  last_strings = nullptr;
+  name_id_map.clear();
+  file_id_map.clear();
+}
+
+void RecordedDFSEntryTree::appendName(std::uint32_t aNameID, std::string& aOut) const {
+  if ( aNameID == InvalidStringID )
+    return;
+  aOut.append(name_starts[aNameID], name_sizes[aNameID]);
+}
+
+void RecordedDFSEntryTree::appendFileName(std::uint32_t aFileID, std::string& aOut) const {
+  if ( aFileID == InvalidStringID )
+    return;
+  aOut += file_names[aFileID];
+}
+
+std::uint32_t RecordedDFSEntryTree::internName(const PrintableEntryBegin& aEntry) {
+  // The same names recur a lot (e.g., memoizations), so, they are looked up 
+  // by the ids of their string table (only valid within a trace) and then, by hashes:
+  std::uint32_t* mapped_id = nullptr;
+  if ( aEntry.Strings ) {
+    if ( aEntry.NameID == InvalidStringID )
+      return InvalidStringID;
+    if ( name_id_map.size() <= aEntry.NameID )
+      name_id_map.resize(aEntry.NameID + 1, InvalidStringID);
+    mapped_id = &name_id_map[aEntry.NameID];
+    if ( *mapped_id != InvalidStringID )
+      return *mapped_id;
+  }
+  // Keep the table of names by hashes at most half full:
+  if ( 2 * ( name_hashes.size() + 1 ) > name_slots.size() )
+    growNameSlots();
+  const std::uint64_t hash = aEntry.getNameHash();
+  const std::string& name = aEntry.getName();
+  NameSlot& slot = findNameSlot(hash, name);
+  if ( slot.id == InvalidStringID ) {
+    // The name ids must fit below InvalidStringID, and the name sizes in 32 bits:
+    if ( name_hashes.size() >= InvalidStringID )
+      throw std::length_error("Too many distinct names to record in a template instantiation tree.");
+    if ( name.size() > std::numeric_limits<std::uint32_t>::max() )
+      throw std::length_error("Too long a name to record in a template instantiation tree.");
+    slot.hash = hash;
+    slot.id = static_cast<std::uint32_t>(name_hashes.size());
+    // Names are appended to the last block, or to a new block (of at least 1 MB) if they don't fit:
+    if ( name.size() > name_block_left ) {
+      name_block_left = std::max(name.size(), std::size_t(1) << 20);
+      name_blocks.emplace_back(new char[name_block_left]);
+      name_block_pos = name_blocks.back().get();
+    }
+    std::copy(name.begin(), name.end(), name_block_pos);
+    name_starts.push_back(name_block_pos);
+    name_sizes.push_back(static_cast<std::uint32_t>(name.size()));
+    name_hashes.push_back(hash);
+    name_block_pos += name.size();
+    name_block_left -= name.size();
+  }
+  if ( mapped_id )
+    *mapped_id = slot.id;
+  return slot.id;
+}
+
+std::uint32_t RecordedDFSEntryTree::internFileName(const PrintableEntryBegin& aEntry, bool aIsOrigin) {
+  // The filenames are few, they are looked up by the ids of their string table, and then, by value:
+  const std::uint32_t file_id = ( aIsOrigin ? aEntry.TempOri_FileID : aEntry.FileID );
+  std::uint32_t* mapped_id = nullptr;
+  if ( aEntry.Strings ) {
+    if ( file_id == InvalidStringID )
+      return InvalidStringID;
+    if ( file_id_map.size() <= file_id )
+      file_id_map.resize(file_id + 1, InvalidStringID);
+    mapped_id = &file_id_map[file_id];
+    if ( *mapped_id != InvalidStringID )
+      return *mapped_id;
+  }
+  const std::string& file_name = ( aIsOrigin ? aEntry.getTempOriFileName() : aEntry.getFileName() );
+  if ( file_name.empty() )
+    return InvalidStringID;
+  auto it = file_index.find(file_name);
+  if ( it == file_index.end() ) {
+    it = file_index.insert(std::make_pair(file_name, static_cast<std::uint32_t>(file_names.size()))).first;
+    file_names.push_back(file_name);
+  }
+  if ( mapped_id )
+    *mapped_id = it->second;
+  return it->second;
+}
+
+RecordedDFSEntryTree::NameSlot& RecordedDFSEntryTree::findNameSlot(std::uint64_t aHash, const std::string& aName) {
+  // Linear probing, from the slot of the hash to the slot of the name or an empty slot
+  // (names are compared on hash hits, since distinct names can have the same hash):
+  const std::size_t mask = name_slots.size() - 1;
+  for(std::size_t i = ( aHash ^ ( aHash >> 32 ) ) & mask; ; i = (i + 1) & mask) {
+    NameSlot& slot = name_slots[i];
+    if ( slot.id == InvalidStringID )
+      return slot;
+    if ( ( slot.hash == aHash ) && ( name_sizes[slot.id] == aName.size() ) && 
+         std::equal(aName.begin(), aName.end(), name_starts[slot.id]) )
+      return slot;
+  }
+}
+
+RecordedDFSEntryTree::NameSlot& RecordedDFSEntryTree::findEmptyNameSlot(std::uint64_t aHash) {
+  const std::size_t mask = name_slots.size() - 1;
+  for(std::size_t i = ( aHash ^ ( aHash >> 32 ) ) & mask; ; i = (i + 1) & mask) {
+    if ( name_slots[i].id == InvalidStringID )
+      return name_slots[i];
+  }
+}
+
+void RecordedDFSEntryTree::growNameSlots() {
+  std::vector<NameSlot> old_slots;
+  old_slots.swap(name_slots);
+  name_slots.resize(std::max(old_slots.size() * 2, std::size_t(1024)), NameSlot{0, InvalidStringID});
+  for(const NameSlot& slot : old_slots)
+    if ( slot.id != InvalidStringID )
+      findEmptyNameSlot(slot.hash) = slot;
 }
 
 
 
-TreeWriter::TreeWriter(std::ostream& aOS) : 
-  EntryWriter(aOS), tree() { }
+TreeWriter::TreeWriter(std::ostream& aOS, bool aStreaming) : 
+  EntryWriter(aOS), tree(), streaming(aStreaming), trace_start(0), open_count(0), node_count(0) { }
 
 TreeWriter::~TreeWriter() { }
 
 void TreeWriter::printEntry(const PrintableEntryBegin& aEntry) {
-  tree.beginEntry(aEntry);
+  if ( !streaming ) {
+    tree.beginEntry(aEntry);
+    return;
+  }
+  // The open nodes are kept in a stack whose elements are reused:
+  if ( open_count == open_nodes.size() )
+    open_nodes.push_back(EntryTraversalTask(PrintableEntryBegin(), 0, 0));
+  EntryTraversalTask& node = open_nodes[open_count];
+  node.start = aEntry;
+  // The open nodes could outlive the trace of the reader that produced them:
+  node.start.detachStrings();
+  node.finish = PrintableEntryEnd{0.0, 0};
+  node.costs = EntryAggregate();
+  node.costs.Depth = static_cast<std::uint32_t>(open_count);
+  node.nd_id = node_count++;
+  node.id_end = EntryTraversalTask::invalid_id;
+  node.parent_id = ( open_count ? open_nodes[open_count - 1].nd_id : EntryTraversalTask::invalid_id );
+  ++open_count;
 }
 
 void TreeWriter::printEntry(const PrintableEntryEnd& aEntry) {
-  tree.endEntry(aEntry);
+  if ( !streaming ) {
+    tree.endEntry(aEntry);
+    return;
+  }
+  if ( !open_count )
+    return;
+  open_nodes[open_count - 1].finish = aEntry;
+  open_nodes[open_count - 1].id_end = node_count;
+  writeStreamedNode();
+}
+
+void TreeWriter::writeStreamedNode() {
+  // All the children of the node were written, so, its costs can be aggregated:
+  EntryTraversalTask& node = open_nodes[--open_count];
+  node.costs.complete(node.start.TimeStamp, node.finish.TimeStamp, node.start.MemoryUsage, node.finish.MemoryUsage);
+  if ( open_count )
+    open_nodes[open_count - 1].costs.addChild(node.costs, node.start.MemoryUsage);
+  openPrintedTreeNode(node);
+  closePrintedTreeNode(node);
 }
 
 void TreeWriter::initialize(const std::string& aSourceName) {
+  tree.resetStringIDs();
+  // The tree keeps the nodes of the previous traces (whose ids carry on), but only writes this one:
+  trace_start = tree.size();
   this->initializeTree(aSourceName);
 }
 
 void TreeWriter::finalize() {
-  std::vector<std::size_t> open_set;
-  std::vector<EntryTraversalTask>& t = tree.parent_stack;
+  if ( streaming ) {
+    // The nodes left open (in an incomplete trace) are written without their end:
+    while ( open_count )
+      writeStreamedNode();
+    this->finalizeTree();
+    return;
+  }
+  
+  // The open nodes are reconstructed into a stack of tasks, whose 
+  // elements are reused (along with their strings' capacity):
+  std::vector<EntryTraversalTask> open_set;
+  std::size_t open_count = 0;
+  std::vector<EntryAggregate> aggregates;
+  if ( this->needsAggregates() )
+    tree.computeAggregates(aggregates);
   
-  for(std::size_t i = 0, i_end = t.size(); i != i_end; ++i ) {
-    while ( !open_set.empty() && (i >= t[open_set.back()].id_end) ) {
-      closePrintedTreeNode(t[open_set.back()]);
-      open_set.pop_back();
+  for(std::size_t i = trace_start, i_end = tree.size(); i != i_end; ++i ) {
+    while ( open_count && (i >= open_set[open_count - 1].id_end) ) {
+      closePrintedTreeNode(open_set[open_count - 1]);
+      --open_count;
     }
-    openPrintedTreeNode(t[i]);
-    open_set.push_back(i);
+    if ( open_count == open_set.size() )
+      open_set.push_back(EntryTraversalTask(PrintableEntryBegin(), 0, 0));
+    tree.getTask(i, open_set[open_count]);
+    if ( !aggregates.empty() )
+      open_set[open_count].costs = aggregates[i];
+    openPrintedTreeNode(open_set[open_count]);
+    ++open_count;
   }
-  while ( !open_set.empty() ) {
-    closePrintedTreeNode(t[open_set.back()]);
-    open_set.pop_back();
+  while ( open_count ) {
+    closePrintedTreeNode(open_set[open_count - 1]);
+    --open_count;
   }
   
   this->finalizeTree();
@@ -294,24 +555,31 @@ void NestedXMLWriter::finalizeTree() {
 void NestedXMLWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   const PrintableEntryBegin& BegEntry = aNode.start;
   const PrintableEntryEnd&   EndEntry = aNode.finish;
-  std::string EscapedName = escapeXml(BegEntry.Name);
+  std::string EscapedName = escapeXml(BegEntry.getName());
   
   OutputOS << 
     "<Entry Kind=\"" << GetInstantiationKindString(BegEntry.InstantiationKind) 
     << "\" Name=\"" << EscapedName << "\" ";
   OutputOS << 
-    "Location=\"" << BegEntry.FileName << "|" 
+    "Location=\"" << BegEntry.getFileName() << "|" 
                   << BegEntry.Line << "|" 
                   << BegEntry.Column << "\" ";
-  if( !BegEntry.TempOri_FileName.empty() ) {
+  if( !BegEntry.getTempOriFileName().empty() ) {
     OutputOS << 
-      "TemplateOrigin=\"" << BegEntry.TempOri_FileName << "|" 
+      "TemplateOrigin=\"" << BegEntry.getTempOriFileName() << "|" 
                           << BegEntry.TempOri_Line << "|" 
                           << BegEntry.TempOri_Column << "\" ";
   }
   OutputOS << 
     "Time=\"" << std::fixed << std::setprecision(9) << (EndEntry.TimeStamp - BegEntry.TimeStamp) 
-    << "\" Memory=\"" << (EndEntry.MemoryUsage - BegEntry.MemoryUsage) << "\">\n";
+    << "\" Memory=\"" << (EndEntry.MemoryUsage - BegEntry.MemoryUsage) << "\" ";
+  OutputOS << 
+    "ExclusiveTime=\"" << aNode.costs.ExclusiveTime 
+    << "\" ExclusiveMemory=\"" << aNode.costs.ExclusiveMemory 
+    << "\" PeakMemory=\"" << aNode.costs.PeakMemory 
+    << "\" SubtreeSize=\"" << aNode.costs.SubtreeSize 
+    << "\" Depth=\"" << aNode.costs.Depth 
+    << "\" ChildCount=\"" << aNode.costs.ChildCount << "\">\n";
   
   // Print only first part (heading).
 }
@@ -323,8 +591,8 @@ void NestedXMLWriter::closePrintedTreeNode(const EntryTraversalTask& aNode) {
 
 
 
-GraphMLWriter::GraphMLWriter(std::ostream& aOS) : 
-  TreeWriter(aOS), last_edge_id(0) {
+GraphMLWriter::GraphMLWriter(std::ostream& aOS, bool aStreaming) : 
+  TreeWriter(aOS, aStreaming), last_edge_id(0) {
   OutputOS <<
     "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
     "<graphml xmlns=\"http://graphml.graphdrawing.org/xmlns\""
@@ -341,7 +609,19 @@ GraphMLWriter::GraphMLWriter(std::ostream& aOS) :
     "<key id=\"d4\" for=\"node\" attr.name=\"Memory\" attr.type=\"long\">\n"
       "<default>0</default>\n"
     "</key>\n"
-    "<key id=\"d5\" for=\"node\" attr.name=\"TemplateOrigin\" attr.type=\"string\"/>\n";
+    "<key id=\"d5\" for=\"node\" attr.name=\"TemplateOrigin\" attr.type=\"string\"/>\n"
+    "<key id=\"d6\" for=\"node\" attr.name=\"ExclusiveTime\" attr.type=\"double\">\n"
+      "<default>0.0</default>\n"
+    "</key>\n"
+    "<key id=\"d7\" for=\"node\" attr.name=\"ExclusiveMemory\" attr.type=\"long\">\n"
+      "<default>0</default>\n"
+    "</key>\n"
+    "<key id=\"d8\" for=\"node\" attr.name=\"PeakMemory\" attr.type=\"long\">\n"
+      "<default>0</default>\n"
+    "</key>\n"
+    "<key id=\"d9\" for=\"node\" attr.name=\"SubtreeSize\" attr.type=\"long\"/>\n"
+    "<key id=\"d10\" for=\"node\" attr.name=\"Depth\" attr.type=\"int\"/>\n"
+    "<key id=\"d11\" for=\"node\" attr.name=\"ChildCount\" attr.type=\"int\"/>\n";
 }
 
 GraphMLWriter::~GraphMLWriter() {
@@ -362,22 +642,29 @@ void GraphMLWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   
   OutputOS << "<node id=\"n" << aNode.nd_id << "\">\n";
   
-  std::string EscapedName = escapeXml(BegEntry.Name);
+  std::string EscapedName = escapeXml(BegEntry.getName());
   OutputOS << 
     "  <data key=\"d0\">" << GetInstantiationKindString(BegEntry.InstantiationKind) << "</data>\n"
     "  <data key=\"d1\">\"" << EscapedName <<"\"</data>\n"
-    "  <data key=\"d2\">\"" << BegEntry.FileName << "|" 
+    "  <data key=\"d2\">\"" << BegEntry.getFileName() << "|" 
                             << BegEntry.Line << "|" 
                             << BegEntry.Column << "\"</data>\n";
   OutputOS << 
     "  <data key=\"d3\">" << std::fixed << std::setprecision(9) << (EndEntry.TimeStamp - BegEntry.TimeStamp) << "</data>\n"
     "  <data key=\"d4\">" << (EndEntry.MemoryUsage - BegEntry.MemoryUsage) << "</data>\n";
-  if( !BegEntry.TempOri_FileName.empty() ) {
+  if( !BegEntry.getTempOriFileName().empty() ) {
     OutputOS << 
-      "  <data key=\"d5\">\"" << BegEntry.TempOri_FileName << "|" 
+      "  <data key=\"d5\">\"" << BegEntry.getTempOriFileName() << "|" 
                               << BegEntry.TempOri_Line << "|" 
                               << BegEntry.TempOri_Column << "\"</data>\n";
   }
+  OutputOS << 
+    "  <data key=\"d6\">" << aNode.costs.ExclusiveTime << "</data>\n"
+    "  <data key=\"d7\">" << aNode.costs.ExclusiveMemory << "</data>\n"
+    "  <data key=\"d8\">" << aNode.costs.PeakMemory << "</data>\n"
+    "  <data key=\"d9\">" << aNode.costs.SubtreeSize << "</data>\n"
+    "  <data key=\"d10\">" << aNode.costs.Depth << "</data>\n"
+    "  <data key=\"d11\">" << aNode.costs.ChildCount << "</data>\n";
   
   OutputOS << "</node>\n";
   if ( aNode.parent_id == RecordedDFSEntryTree::invalid_id )
@@ -394,8 +681,8 @@ void GraphMLWriter::closePrintedTreeNode(const EntryTraversalTask& aNode) {}
 
 
 
-GraphVizWriter::GraphVizWriter(std::ostream& aOS) : 
-  TreeWriter(aOS) { }
+GraphVizWriter::GraphVizWriter(std::ostream& aOS, bool aStreaming) : 
+  TreeWriter(aOS, aStreaming) { }
 
 GraphVizWriter::~GraphVizWriter() {}
 
@@ -411,15 +698,15 @@ void GraphVizWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
   const PrintableEntryBegin& BegEntry = aNode.start;
   const PrintableEntryEnd&   EndEntry = aNode.finish;
   
-  std::string EscapedName = escapeXml(BegEntry.Name);
+  std::string EscapedName = escapeXml(BegEntry.getName());
   OutputOS 
     << "n" << aNode.nd_id << " [label = "
     << "\"" << GetInstantiationKindString(BegEntry.InstantiationKind) << "\\n"
     << EscapedName << "\\n"
-    << "At " << BegEntry.FileName << " Line " << BegEntry.Line << " Column " << BegEntry.Column << "\\n";
-  if( !BegEntry.TempOri_FileName.empty() ) {
+    << "At " << BegEntry.getFileName() << " Line " << BegEntry.Line << " Column " << BegEntry.Column << "\\n";
+  if( !BegEntry.getTempOriFileName().empty() ) {
     OutputOS << 
-      "From " << BegEntry.TempOri_FileName 
+      "From " << BegEntry.getTempOriFileName() 
       << " Line " << BegEntry.TempOri_Line 
       << " Column " << BegEntry.TempOri_Column << "\\n";
   }
@@ -436,5 +723,102 @@ void GraphVizWriter::openPrintedTreeNode(const EntryTraversalTask& aNode) {
 void GraphVizWriter::closePrintedTreeNode(const EntryTraversalTask& aNode) {}
 
 
+
+
+TopWriter::TopWriter(std::ostream& aOS, std::size_t aCount) : 
+  EntryWriter(aOS), count(aCount), open_count(0), entry_count(0) { }
+
+TopWriter::~TopWriter() { }
+
+void TopWriter::initialize(const std::string& aSourceName) {
+  source_name = aSourceName;
+  open_count = 0;
+  entry_count = 0;
+  time_heap.clear();
+  memory_heap.clear();
+}
+
+void TopWriter::finalize() {
+  // The entries left open (in an incomplete trace) have no costs, and are not ranked.
+  open_count = 0;
+  OutputOS << "SourceFile = " << source_name << "\n";
+  writeTable(time_heap, "exclusive time");
+  writeTable(memory_heap, "exclusive memory");
+}
+
+void TopWriter::printEntry(const PrintableEntryBegin& aEntry) {
+  if ( open_count == open_entries.size() )
+    open_entries.push_back(OpenEntry());
+  OpenEntry& entry = open_entries[open_count++];
+  // The strings are only materialized for the entries that get ranked:
+  entry.start = aEntry;
+  entry.costs = EntryAggregate();
+}
+
+void TopWriter::printEntry(const PrintableEntryEnd& aEntry) {
+  if ( !open_count )
+    return;
+  OpenEntry& entry = open_entries[--open_count];
+  entry.costs.complete(entry.start.TimeStamp, aEntry.TimeStamp, entry.start.MemoryUsage, aEntry.MemoryUsage);
+  if ( open_count )
+    open_entries[open_count - 1].costs.addChild(entry.costs, entry.start.MemoryUsage);
+  rankEntry(time_heap, entry.costs.ExclusiveTime, entry);
+  rankEntry(memory_heap, static_cast<double>(entry.costs.ExclusiveMemory), entry);
+  ++entry_count;
+}
+
+void TopWriter::rankEntry(std::vector<RankedEntry>& aHeap, double aKey, const OpenEntry& aEntry) {
+  if ( count == 0 )
+    return;
+  // The front of the heap is the lowest ranked entry, which the new entry must outrank:
+  RankedEntry ranked;
+  ranked.key = aKey;
+  ranked.ordinal = entry_count;
+  if ( ( aHeap.size() == count ) && !( ranked < aHeap.front() ) )
+    return;
+  ranked.costs = aEntry.costs;
+  ranked.kind = aEntry.start.InstantiationKind;
+  ranked.name = aEntry.start.getName();
+  std::stringstream ss;
+  ss << aEntry.start.getFileName() << "|" << aEntry.start.Line << "|" << aEntry.start.Column;
+  ranked.location = ss.str();
+  if ( !aEntry.start.getTempOriFileName().empty() ) {
+    ss.str("");
+    ss << aEntry.start.getTempOriFileName() << "|" << aEntry.start.TempOri_Line << "|" << aEntry.start.TempOri_Column;
+    ranked.origin = ss.str();
+  } else {
+    ranked.origin = "-";
+  }
+  if ( aHeap.size() == count ) {
+    std::pop_heap(aHeap.begin(), aHeap.end());
+    aHeap.back() = std::move(ranked);
+  } else {
+    aHeap.push_back(std::move(ranked));
+  }
+  std::push_heap(aHeap.begin(), aHeap.end());
+}
+
+void TopWriter::writeTable(std::vector<RankedEntry>& aHeap, const char* aTitle) {
+  std::sort_heap(aHeap.begin(), aHeap.end());
+  OutputOS << "Top " << aHeap.size() << " entries by " << aTitle << ":\n";
+  OutputOS << 
+    std::setw(6) << "Rank" << std::setw(16) << "Excl. Time (s)" << std::setw(16) << "Incl. Time (s)"
+    << std::setw(16) << "Excl. Memory" << std::setw(16) << "Incl. Memory"
+    << "  Kind  Location  TemplateOrigin  Name\n";
+  for(std::size_t i = 0; i < aHeap.size(); ++i) {
+    const RankedEntry& entry = aHeap[i];
+    OutputOS << 
+      std::setw(6) << (i + 1) 
+      << std::fixed << std::setprecision(9) 
+      << std::setw(16) << entry.costs.ExclusiveTime << std::setw(16) << entry.costs.InclusiveTime
+      << std::setw(16) << entry.costs.ExclusiveMemory << std::setw(16) << entry.costs.InclusiveMemory
+      << "  " << GetInstantiationKindString(entry.kind) 
+      << "  " << entry.location << "  " << entry.origin << "  " << entry.name << "\n";
+  }
+  OutputOS << "\n";
+  aHeap.clear();
+}
+
+
 }
 
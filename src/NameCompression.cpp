@@ -0,0 +1,273 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/NameCompression.h>
+
+#include <zlib.h>
+
+#ifdef TEMPLIGHT_HAS_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace templight {
+
+
+namespace {
+
+const int name_zlib_level = Z_BEST_COMPRESSION;
+
+// The largest decompressed name, since the sizes in the (untrusted) compressed names are not:
+const std::size_t name_max_size = 1 << 24;
+
+#ifdef TEMPLIGHT_HAS_ZSTD
+const int name_zstd_level = 3;
+#endif
+
+bool isZstdFrame(const char* aData, std::size_t aSize) {
+  // The magic number of zstd frames (0xFD2FB528, little-endian):
+  return ( aSize >= 4 ) && ( std::memcmp(aData, "\x28\xB5\x2F\xFD", 4) == 0 );
+}
+
+}
+
+
+bool hasZstdNameCompression() {
+#ifdef TEMPLIGHT_HAS_ZSTD
+  return true;
+#else
+  return false;
+#endif
+}
+
+
+struct NameCompressor::Impl {
+  z_stream zs;
+#ifdef TEMPLIGHT_HAS_ZSTD
+  ZSTD_CCtx* cctx;
+  ZSTD_CDict* cdict;
+#endif
+
+  Impl() {
+    std::memset(&zs, 0, sizeof(zs));
+    if ( deflateInit(&zs, name_zlib_level) != Z_OK )
+      throw std::runtime_error("Could not initialize the zlib compressor of template names.");
+#ifdef TEMPLIGHT_HAS_ZSTD
+    cctx = ZSTD_createCCtx();
+    cdict = nullptr;
+    if ( !cctx ) {
+      deflateEnd(&zs);
+      throw std::runtime_error("Could not initialize the zstd compressor of template names.");
+    }
+#endif
+  };
+  ~Impl() {
+    deflateEnd(&zs);
+#ifdef TEMPLIGHT_HAS_ZSTD
+    ZSTD_freeCDict(cdict);
+    ZSTD_freeCCtx(cctx);
+#endif
+  };
+};
+
+NameCompressor::NameCompressor() : impl(new Impl()) { }
+
+NameCompressor::~NameCompressor() { }
+
+bool NameCompressor::train(const std::string& aSamples, const std::vector<std::size_t>& aSampleSizes,
+                           std::size_t aMaxSize) {
+  clear();
+#ifdef TEMPLIGHT_HAS_ZSTD
+  if ( aSampleSizes.empty() )
+    return false;
+  std::string dict(aMaxSize, '\0');
+  std::size_t dict_size = ZDICT_trainFromBuffer(&dict[0], dict.size(), aSamples.data(),
+                                                aSampleSizes.data(), static_cast<unsigned int>(aSampleSizes.size()));
+  if ( ZDICT_isError(dict_size) )
+    return false;
+  dict.resize(dict_size);
+  impl->cdict = ZSTD_createCDict(dict.data(), dict.size(), name_zstd_level);
+  if ( !impl->cdict )
+    return false;
+  // The frames only need the size of the name, the dictionary is known from the trace:
+  if ( ZSTD_isError(ZSTD_CCtx_reset(impl->cctx, ZSTD_reset_session_and_parameters)) || 
+       ZSTD_isError(ZSTD_CCtx_setParameter(impl->cctx, ZSTD_c_contentSizeFlag, 1)) || 
+       ZSTD_isError(ZSTD_CCtx_setParameter(impl->cctx, ZSTD_c_checksumFlag, 0)) || 
+       ZSTD_isError(ZSTD_CCtx_setParameter(impl->cctx, ZSTD_c_dictIDFlag, 0)) || 
+       ZSTD_isError(ZSTD_CCtx_refCDict(impl->cctx, impl->cdict)) ) {
+    clear();
+    return false;
+  }
+  dictionary.swap(dict);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void NameCompressor::clear() {
+  dictionary.clear();
+#ifdef TEMPLIGHT_HAS_ZSTD
+  ZSTD_CCtx_reset(impl->cctx, ZSTD_reset_session_and_parameters);
+  ZSTD_freeCDict(impl->cdict);
+  impl->cdict = nullptr;
+#endif
+}
+
+bool NameCompressor::compress(const char* aName, std::size_t aSize, std::string& aOut) {
+#ifdef TEMPLIGHT_HAS_ZSTD
+  if ( impl->cdict ) {
+    aOut.resize(ZSTD_compressBound(aSize));
+    std::size_t out_size = ZSTD_compress2(impl->cctx, &aOut[0], aOut.size(), aName, aSize);
+    if ( ZSTD_isError(out_size) ) {
+      aOut.clear();
+      return false;
+    }
+    aOut.resize(out_size);
+    return true;
+  }
+#endif
+  z_stream& zs = impl->zs;
+  aOut.clear();
+  if ( ( aSize > std::numeric_limits<uInt>::max() ) || ( deflateReset(&zs) != Z_OK ) )
+    return false;
+  aOut.resize(deflateBound(&zs, aSize));
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(aName));
+  zs.avail_in = static_cast<uInt>(aSize);
+  zs.next_out = reinterpret_cast<Bytef*>(&aOut[0]);
+  zs.avail_out = static_cast<uInt>(aOut.size());
+  // The output has room for the whole stream (see deflateBound), so, it must end at once:
+  if ( deflate(&zs, Z_FINISH) != Z_STREAM_END ) {
+    aOut.clear();
+    return false;
+  }
+  aOut.resize(zs.total_out);
+  return true;
+}
+
+
+struct NameDecompressor::Impl {
+  z_stream zs;
+#ifdef TEMPLIGHT_HAS_ZSTD
+  ZSTD_DCtx* dctx;
+  ZSTD_DDict* ddict;
+#endif
+
+  Impl() {
+    std::memset(&zs, 0, sizeof(zs));
+    if ( inflateInit(&zs) != Z_OK )
+      throw std::runtime_error("Could not initialize the zlib decompressor of template names.");
+#ifdef TEMPLIGHT_HAS_ZSTD
+    dctx = ZSTD_createDCtx();
+    ddict = nullptr;
+    if ( !dctx ) {
+      inflateEnd(&zs);
+      throw std::runtime_error("Could not initialize the zstd decompressor of template names.");
+    }
+#endif
+  };
+  ~Impl() {
+    inflateEnd(&zs);
+#ifdef TEMPLIGHT_HAS_ZSTD
+    ZSTD_freeDDict(ddict);
+    ZSTD_freeDCtx(dctx);
+#endif
+  };
+};
+
+NameDecompressor::NameDecompressor() : impl(new Impl()) { }
+
+NameDecompressor::~NameDecompressor() { }
+
+bool NameDecompressor::setDictionary(const char* aData, std::size_t aSize) {
+  clear();
+#ifdef TEMPLIGHT_HAS_ZSTD
+  impl->ddict = ZSTD_createDDict(aData, aSize);
+  return ( impl->ddict != nullptr );
+#else
+  return false;
+#endif
+}
+
+void NameDecompressor::clear() {
+#ifdef TEMPLIGHT_HAS_ZSTD
+  ZSTD_freeDDict(impl->ddict);
+  impl->ddict = nullptr;
+#endif
+}
+
+bool NameDecompressor::decompress(const char* aData, std::size_t aSize, std::string& aOut) {
+  aOut.clear();
+  if ( isZstdFrame(aData, aSize) ) {
+#ifdef TEMPLIGHT_HAS_ZSTD
+    unsigned long long name_size = ZSTD_getFrameContentSize(aData, aSize);
+    if ( ( name_size == ZSTD_CONTENTSIZE_UNKNOWN ) || ( name_size == ZSTD_CONTENTSIZE_ERROR ) || 
+         ( name_size > name_max_size ) )
+      return false;
+    aOut.resize(name_size);
+    std::size_t out_size = ( impl->ddict ?
+      ZSTD_decompress_usingDDict(impl->dctx, &aOut[0], aOut.size(), aData, aSize, impl->ddict) :
+      ZSTD_decompressDCtx(impl->dctx, &aOut[0], aOut.size(), aData, aSize) );
+    if ( ZSTD_isError(out_size) ) {
+      aOut.clear();
+      return false;
+    }
+    aOut.resize(out_size);
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // A zlib stream, whose size is not known in advance:
+  z_stream& zs = impl->zs;
+  if ( inflateReset(&zs) != Z_OK )
+    return false;
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(aData));
+  zs.avail_in = static_cast<uInt>(aSize);
+  aOut.resize(std::min(4 * aSize + 64, name_max_size));
+  while ( true ) {
+    zs.next_out = reinterpret_cast<Bytef*>(&aOut[zs.total_out]);
+    zs.avail_out = static_cast<uInt>(aOut.size() - zs.total_out);
+    int ret = inflate(&zs, Z_FINISH);
+    if ( ret == Z_STREAM_END )
+      break;
+    if ( ( ( ret != Z_BUF_ERROR ) && ( ret != Z_OK ) ) || ( zs.avail_in == 0 && zs.avail_out != 0 ) || 
+         ( aOut.size() >= name_max_size ) ) {
+      aOut.clear();
+      return false;
+    }
+    aOut.resize(std::min(2 * aOut.size(), name_max_size));
+  }
+  aOut.resize(zs.total_out);
+  return true;
+}
+
+
+}
+
+
@@ -0,0 +1,298 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/CompressedStreams.h>
+#include <templight/ParallelProtobufReader.h>
+#include <templight/ThinProtobuf.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+
+namespace templight {
+
+
+/* The entries of a trace, decoded by a worker. The reader is kept alive
+ * because the entries refer to its string tables. */
+struct ParallelProtobufReader::DecodedTrace {
+  ProtobufReader reader;
+  bool has_header;
+  EntryBatch entries;
+
+  DecodedTrace() : has_header(false) { }
+};
+
+
+namespace {
+
+unsigned int getThreadCount(unsigned int aThreadCount) {
+  if ( aThreadCount == 0 )
+    aThreadCount = std::thread::hardware_concurrency();
+  return ( aThreadCount == 0 ? 1 : aThreadCount );
+}
+
+}
+
+
+std::vector<ParallelProtobufReader::TraceSpan>
+    ParallelProtobufReader::findTraces(const char* aData, std::size_t aSize) {
+  std::vector<TraceSpan> result;
+  if ( detectCompression(aData, aSize) != NoCompression )
+    return result; // compressed traces can only be read as a stream.
+  const std::uint8_t* p_begin = reinterpret_cast<const std::uint8_t*>(aData);
+  const std::uint8_t* p = p_begin;
+  const std::uint8_t* p_end = p_begin + aSize;
+  bool extends_last = false;
+  std::size_t dict_offset = 0;
+  std::size_t dict_size = 0;
+  while ( p < p_end ) {
+    const std::uint8_t* p_msg = p;
+    auto cur_wire = thin_protobuf::loadVarInt(p, p_end);
+    if ( cur_wire == thin_protobuf::getStringWire<2>::value ) {
+      // The shared dictionary of the traces that follow:
+      dict_offset = thin_protobuf::loadStringSpan(p, p_end, dict_size) - p_begin;
+      extends_last = false;
+      continue;
+    }
+    if ( cur_wire != thin_protobuf::getStringWire<1>::value ) {
+      // ignore for fwd-compat, but a reader stops at those, so, no trace can extend over it:
+      thin_protobuf::skipData(p, p_end, cur_wire);
+      extends_last = false;
+      continue;
+    }
+    std::size_t cur_size = 0;
+    const std::uint8_t* p_trace = thin_protobuf::loadStringSpan(p, p_end, cur_size);
+    bool has_header = ( cur_size > 0 ) &&
+      ( *p_trace == thin_protobuf::getStringWire<1>::value );
+    if ( extends_last && !has_header ) {
+      result.back().size = p - p_begin - result.back().offset;
+    } else {
+      TraceSpan span;
+      span.offset = p_msg - p_begin;
+      span.size = p - p_msg;
+      span.dictionary_offset = dict_offset;
+      span.dictionary_size = dict_size;
+      result.push_back(span);
+      extends_last = true;
+    }
+  }
+  return result;
+}
+
+
+void ParallelProtobufReader::decodeTrace(const char* aData, const TraceSpan& aSpan,
+                                         unsigned int aRequiredFields, DecodedTrace& aTrace) {
+  ProtobufReader& r = aTrace.reader;
+  r.setRequiredFields(aRequiredFields);
+  ProtobufReader::LastChunkType chunk = r.startOnMemory(aData + aSpan.offset, aSpan.size);
+  if ( chunk == ProtobufReader::Header ) {
+    aTrace.has_header = true;
+    if ( aSpan.dictionary_size > 0 )
+      r.setSharedDictionary(aData + aSpan.dictionary_offset, aSpan.dictionary_size);
+    chunk = r.next();
+  }
+  // A second header within the same trace message would reset the dictionaries, so, stop there:
+  while ( ( chunk != ProtobufReader::EndOfFile ) && ( chunk != ProtobufReader::Header ) ) {
+    if ( chunk == ProtobufReader::BeginEntry )
+      aTrace.entries.addBegin(r.LastBeginEntry);
+    else if ( chunk == ProtobufReader::EndEntry )
+      aTrace.entries.addEnd(r.LastEndEntry);
+    chunk = r.next();
+  }
+}
+
+
+ParallelProtobufReader::ParallelProtobufReader(unsigned int aThreadCount) :
+  LastChunk(ProtobufReader::EndOfFile), Version(0),
+  thread_count(getThreadCount(aThreadCount)), required_fields(AllEntryFields), data(nullptr), cur_entry(0),
+  next_to_deliver(0), next_to_decode(0), input_failed(false), stopping(false) { }
+
+ParallelProtobufReader::~ParallelProtobufReader() {
+  stopWorkers();
+}
+
+void ParallelProtobufReader::stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(decode_mutex);
+    stopping = true;
+  }
+  decode_cv.notify_all();
+  for(std::thread& t : workers)
+    t.join();
+  workers.clear();
+  stopping = false;
+}
+
+void ParallelProtobufReader::runWorker() {
+  // Decode at most a couple of traces per worker ahead of the one being delivered:
+  const std::size_t max_ahead = 2 * thread_count;
+  std::unique_lock<std::mutex> lock(decode_mutex);
+  while ( true ) {
+    decode_cv.wait(lock, [this, max_ahead]() {
+      return stopping || ( next_to_decode >= traces.size() ) ||
+             ( next_to_decode < next_to_deliver + max_ahead ); });
+    if ( stopping || ( next_to_decode >= traces.size() ) )
+      return;
+    std::size_t i = next_to_decode++;
+    lock.unlock();
+    std::unique_ptr<DecodedTrace> result(new DecodedTrace());
+    decodeTrace(data, traces[i], required_fields, *result);
+    lock.lock();
+    decoded[i] = std::move(result);
+    decode_cv.notify_all();
+  }
+}
+
+ParallelProtobufReader::LastChunkType
+    ParallelProtobufReader::startOnFile(const std::string& aFilename) {
+  stopWorkers();
+  std::unique_ptr<boost::iostreams::mapped_file_source> new_mapping;
+  try {
+    new_mapping.reset(new boost::iostreams::mapped_file_source(aFilename));
+  } catch(std::exception&) {
+    new_mapping.reset();
+  }
+  if ( !new_mapping || !new_mapping->is_open() ) {
+    mapping.reset();
+    return startOnMemory(nullptr, 0);
+  }
+  startOnMemory(new_mapping->data(), new_mapping->size());
+  mapping = std::move(new_mapping);
+  return LastChunk;
+}
+
+ParallelProtobufReader::LastChunkType
+    ParallelProtobufReader::startOnMemory(const char* aData, std::size_t aSize) {
+  stopWorkers();
+  data = aData;
+  traces = findTraces(aData, aSize);
+  decoded.clear();
+  decoded.resize(traces.size());
+  cur_trace.reset();
+  cur_entry = 0;
+  next_to_deliver = 0;
+  next_to_decode = 0;
+  input_failed = false;
+  for(std::size_t i = 0, i_end = std::min<std::size_t>(thread_count, traces.size()); i < i_end; ++i)
+    workers.emplace_back(&ParallelProtobufReader::runWorker, this);
+  return next();
+}
+
+ParallelProtobufReader::LastChunkType ParallelProtobufReader::next() {
+  while ( true ) {
+    if ( cur_trace && ( cur_entry < cur_trace->entries.size() ) ) {
+      const EntryBatch& b = cur_trace->entries;
+      std::size_t i = cur_entry++;
+      if ( b.IsBegin[i] ) {
+        LastBeginEntry.InstantiationKind = b.Kind[i];
+        LastBeginEntry.Line = b.Line[i];
+        LastBeginEntry.Column = b.Column[i];
+        LastBeginEntry.TimeStamp = b.TimeStamp[i];
+        LastBeginEntry.MemoryUsage = b.MemoryUsage[i];
+        LastBeginEntry.TempOri_Line = b.TempOri_Line[i];
+        LastBeginEntry.TempOri_Column = b.TempOri_Column[i];
+        LastBeginEntry.NameID = b.NameID[i];
+        LastBeginEntry.FileID = b.FileID[i];
+        LastBeginEntry.TempOri_FileID = b.TempOri_FileID[i];
+        LastBeginEntry.NameHash = b.NameHash[i];
+        LastBeginEntry.setStrings(&cur_trace->reader);
+        LastChunk = ProtobufReader::BeginEntry;
+      } else {
+        LastEndEntry.TimeStamp = b.TimeStamp[i];
+        LastEndEntry.MemoryUsage = b.MemoryUsage[i];
+        LastChunk = ProtobufReader::EndEntry;
+      }
+      return LastChunk;
+    }
+
+    // Move on to the next trace, and let the workers decode further ahead:
+    cur_trace.reset();
+    cur_entry = 0;
+    if ( next_to_deliver >= traces.size() ) {
+      LastChunk = ProtobufReader::EndOfFile;
+      return LastChunk;
+    }
+    {
+      std::unique_lock<std::mutex> lock(decode_mutex);
+      std::size_t i = next_to_deliver;
+      decode_cv.wait(lock, [this, i]() { return static_cast<bool>(decoded[i]); });
+      cur_trace = std::move(decoded[i]);
+      ++next_to_deliver;
+    }
+    decode_cv.notify_all();
+    if ( cur_trace->reader.hasFailed() )
+      input_failed = true;
+
+    if ( cur_trace->has_header ) {
+      Version = cur_trace->reader.Version;
+      SourceName = cur_trace->reader.SourceName;
+      LastChunk = ProtobufReader::Header;
+      return LastChunk;
+    }
+  }
+}
+
+void ParallelProtobufReader::decodeTraces(const char* aData, std::size_t aSize,
+                                          const std::function< EntryWriter*(std::size_t) >& aMakeWriter,
+                                          unsigned int aThreadCount) {
+  std::vector<TraceSpan> spans = findTraces(aData, aSize);
+  std::atomic<std::size_t> next_trace(0);
+
+  auto run = [&]() {
+    std::size_t i = 0;
+    while ( ( i = next_trace++ ) < spans.size() ) {
+      std::unique_ptr<EntryWriter> writer(aMakeWriter(i));
+      if ( !writer )
+        continue;
+      ProtobufReader r;
+      r.setRequiredFields(writer->getRequiredFields());
+      ProtobufReader::LastChunkType chunk = r.startOnMemory(aData + spans[i].offset, spans[i].size);
+      writer->initialize(chunk == ProtobufReader::Header ? r.SourceName : std::string());
+      if ( chunk == ProtobufReader::Header ) {
+        if ( spans[i].dictionary_size > 0 )
+          r.setSharedDictionary(aData + spans[i].dictionary_offset, spans[i].dictionary_size);
+        chunk = r.next();
+      }
+      while ( ( chunk != ProtobufReader::EndOfFile ) && ( chunk != ProtobufReader::Header ) ) {
+        if ( chunk == ProtobufReader::BeginEntry )
+          writer->printEntry(r.LastBeginEntry);
+        else if ( chunk == ProtobufReader::EndEntry )
+          writer->printEntry(r.LastEndEntry);
+        chunk = r.next();
+      }
+      writer->finalize();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for(std::size_t i = 1, i_end = std::min<std::size_t>(getThreadCount(aThreadCount), spans.size()); i < i_end; ++i)
+    pool.emplace_back(run);
+  run();
+  for(std::thread& t : pool)
+    t.join();
+}
+
+
+} // namespace templight
+
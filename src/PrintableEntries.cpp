@@ -24,6 +24,107 @@
 
 namespace templight {
 
+
+namespace {
+
+const std::uint64_t hash_modulus = (std::uint64_t(1) << 61) - 1;
+const std::uint64_t hash_base = 0x100000001B3ULL;
+
+std::uint64_t reduceMod61(std::uint64_t x) {
+  x = (x & hash_modulus) + (x >> 61);
+  return ( x >= hash_modulus ? x - hash_modulus : x );
+}
+
+/* Multiplies two residues modulo 2^61-1, using 2^64 = 8 and 2^61 = 1 (mod 2^61-1). */
+std::uint64_t mulMod61(std::uint64_t a, std::uint64_t b) {
+  std::uint64_t a_hi = a >> 32, a_lo = a & 0xFFFFFFFF;
+  std::uint64_t b_hi = b >> 32, b_lo = b & 0xFFFFFFFF;
+  std::uint64_t hh = a_hi * b_hi;
+  std::uint64_t mid = a_hi * b_lo + a_lo * b_hi;
+  std::uint64_t ll = a_lo * b_lo;
+  std::uint64_t r = (hh << 3) + (mid >> 29) + ((mid & 0x1FFFFFFF) << 32) 
+                  + (ll >> 61) + (ll & hash_modulus);
+  return reduceMod61(r);
+}
+
+}
+
+void EntryNameHash::append(const char* aStr, std::size_t aLen) {
+  for(std::size_t i = 0; i < aLen; ++i) {
+    // Offset the characters by one, such that leading nul characters change the hash:
+    value = reduceMod61(mulMod61(value, hash_base) + std::uint8_t(aStr[i]) + 1);
+    power = mulMod61(power, hash_base);
+  }
+}
+
+void EntryNameHash::append(const EntryNameHash& aSuffix) {
+  value = reduceMod61(mulMod61(value, aSuffix.power) + aSuffix.value);
+  power = mulMod61(power, aSuffix.power);
+}
+
+std::uint64_t EntryNameHash::get() const {
+  // Mix the bits (splitmix64 finalizer), so that the hash spreads over all 64 bits:
+  std::uint64_t z = value + 0x9E3779B97F4A7C15ULL * power;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+
+namespace {
+
+const std::uint8_t name_materialized = 1;
+const std::uint8_t file_materialized = 2;
+const std::uint8_t tempori_file_materialized = 4;
+
+}
+
+const std::string& PrintableEntryBegin::getName() const {
+  if ( Strings && !(Materialized & name_materialized) ) {
+    Name.clear();
+    Strings->appendName(NameID, Name);
+    Materialized |= name_materialized;
+  }
+  return Name;
+}
+
+const std::string& PrintableEntryBegin::getFileName() const {
+  if ( Strings && !(Materialized & file_materialized) ) {
+    FileName.clear();
+    Strings->appendFileName(FileID, FileName);
+    Materialized |= file_materialized;
+  }
+  return FileName;
+}
+
+const std::string& PrintableEntryBegin::getTempOriFileName() const {
+  if ( Strings && !(Materialized & tempori_file_materialized) ) {
+    TempOri_FileName.clear();
+    Strings->appendFileName(TempOri_FileID, TempOri_FileName);
+    Materialized |= tempori_file_materialized;
+  }
+  return TempOri_FileName;
+}
+
+std::uint64_t PrintableEntryBegin::getNameHash() const {
+  if ( NameHash == 0 ) {
+    const std::string& cur_name = getName();
+    return EntryNameHash(cur_name.data(), cur_name.size()).get();
+  }
+  return NameHash;
+}
+
+void PrintableEntryBegin::detachStrings() {
+  if ( !Strings )
+    return;
+  getName();
+  getFileName();
+  getTempOriFileName();
+  NameHash = getNameHash();
+  Strings = nullptr;
+  Materialized = 0;
+}
+
 const char* GetInstantiationKindString(int inst_kind) {
   switch (inst_kind) {
     case 0:
@@ -80,5 +181,65 @@ const char* GetInstantiationKindString(int inst_kind) {
   return "UnknownInstantiationKind";
 }
 
+
+void EntryBatch::clear() {
+  IsBegin.clear();
+  Kind.clear();
+  NameID.clear();
+  NameHash.clear();
+  FileID.clear();
+  Line.clear();
+  Column.clear();
+  TimeStamp.clear();
+  MemoryUsage.clear();
+  TempOri_FileID.clear();
+  TempOri_Line.clear();
+  TempOri_Column.clear();
+}
+
+void EntryBatch::reserve(std::size_t aCount) {
+  IsBegin.reserve(aCount);
+  Kind.reserve(aCount);
+  NameID.reserve(aCount);
+  NameHash.reserve(aCount);
+  FileID.reserve(aCount);
+  Line.reserve(aCount);
+  Column.reserve(aCount);
+  TimeStamp.reserve(aCount);
+  MemoryUsage.reserve(aCount);
+  TempOri_FileID.reserve(aCount);
+  TempOri_Line.reserve(aCount);
+  TempOri_Column.reserve(aCount);
 }
 
+void EntryBatch::addBegin(const PrintableEntryBegin& aEntry) {
+  IsBegin.push_back(1);
+  Kind.push_back(aEntry.InstantiationKind);
+  NameID.push_back(aEntry.NameID);
+  NameHash.push_back(aEntry.NameHash);
+  FileID.push_back(aEntry.FileID);
+  Line.push_back(aEntry.Line);
+  Column.push_back(aEntry.Column);
+  TimeStamp.push_back(aEntry.TimeStamp);
+  MemoryUsage.push_back(aEntry.MemoryUsage);
+  TempOri_FileID.push_back(aEntry.TempOri_FileID);
+  TempOri_Line.push_back(aEntry.TempOri_Line);
+  TempOri_Column.push_back(aEntry.TempOri_Column);
+}
+
+void EntryBatch::addEnd(const PrintableEntryEnd& aEntry) {
+  IsBegin.push_back(0);
+  Kind.push_back(0);
+  NameID.push_back(InvalidStringID);
+  NameHash.push_back(0);
+  FileID.push_back(InvalidStringID);
+  Line.push_back(0);
+  Column.push_back(0);
+  TimeStamp.push_back(aEntry.TimeStamp);
+  MemoryUsage.push_back(aEntry.MemoryUsage);
+  TempOri_FileID.push_back(InvalidStringID);
+  TempOri_Line.push_back(0);
+  TempOri_Column.push_back(0);
+}
+
+}
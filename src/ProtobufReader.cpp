@@ -23,32 +23,100 @@
 #include <templight/ProtobufReader.h>
 #include <templight/ThinProtobuf.h>
 
+#include <boost/iostreams/device/mapped_file.hpp>
+
 #include <vector>
 #include <algorithm>
 #include <string>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <exception>
+#include <utility>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 namespace templight {
 
 
-ProtobufReader::ProtobufReader() { }
+namespace {
+
+using thin_protobuf::loadVarInt;
+using thin_protobuf::loadVarIntAs;
+using thin_protobuf::loadDouble;
+using thin_protobuf::skipData;
+
+// Read streams by blocks of 1 MB (or more, for larger chunks):
+const std::size_t stream_block_size = 1024 * 1024;
+
+// The offset of a shared dictionary that is not (or not known to be) in the input:
+const std::uint64_t no_dictionary_offset = ~std::uint64_t(0);
+
+boost::string_ref loadStringRef(const std::uint8_t*& p, const std::uint8_t* p_end) {
+  std::size_t u = 0;
+  const std::uint8_t* p_start = thin_protobuf::loadStringSpan(p, p_end, u);
+  return boost::string_ref(reinterpret_cast<const char*>(p_start), u);
+}
+
+// A fast hash of the bytes of a name (by words), only to look up the inline names, 
+// whereas the hash of the entries (see EntryNameHash) is only computed if asked for:
+std::uint64_t hashNameBytes(boost::string_ref aName) {
+  const char* p = aName.data();
+  std::size_t n = aName.size();
+  std::uint64_t h = 0x9E3779B97F4A7C15ULL * ( n + 1 );
+  for(; n >= 8; p += 8, n -= 8) {
+    std::uint64_t w;
+    std::memcpy(&w, p, 8);
+    h = ( h ^ w ) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 31;
+  }
+  if ( n > 0 ) {
+    std::uint64_t w = 0;
+    std::memcpy(&w, p, n);
+    h = ( h ^ w ) * 0xBF58476D1CE4E5B9ULL;
+  }
+  h = ( h ^ ( h >> 27 ) ) * 0x94D049BB133111EBULL;
+  return h ^ ( h >> 31 );
+}
+
+} // anonymous
+
 
-void ProtobufReader::loadHeader(std::streampos buf_limit) {
+ProtobufReader::ProtobufReader() : 
+  in_buf(nullptr), in_file(nullptr), blk_cur(nullptr), blk_end(nullptr), 
+  blk_offset(0), blk_trace_end(0), in_eof(false), in_truncated(false), stream_start(-1), 
+  mem_begin(nullptr), mem_size(0), 
+  mem_cur(nullptr), mem_end(nullptr), mem_trace_end(nullptr), 
+  inlineNameCount(0), nameBlockPos(nullptr), nameBlockLeft(0), sharedNameBlockCount(0), 
+  sharedNameCount(0), sharedMarkerCount(0), sharedDictionaryCount(0), sharedFileCount(0), 
+  sharedDictionaryOffset(no_dictionary_offset), expansionCacheSize(0), expansionCacheLimit(16 * 1024 * 1024), 
+  skippedEntryCount(0), requiredFields(AllEntryFields), LastChunk(ProtobufReader::EndOfFile) { }
+
+ProtobufReader::~ProtobufReader() { }
+
+void ProtobufReader::loadHeader(const std::uint8_t* p, const std::uint8_t* p_end) {
   // Set default values:
   Version = 0;
   SourceName = "";
   
-  while ( buffer->tellg() < buf_limit ) {
-    auto cur_wire = thin_protobuf::loadVarInt(*buffer);
+  // A header marks the start of a new trace, with its own dictionaries:
+  clearNameTables();
+  
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
     switch( cur_wire ) {
       case thin_protobuf::getVarIntWire<1>::value:
-        Version = thin_protobuf::loadVarIntAs<unsigned int>(*buffer);
+        Version = loadVarIntAs<unsigned int>(p, p_end);
         break;
       case thin_protobuf::getStringWire<2>::value:
-        SourceName = thin_protobuf::loadString(*buffer);
+        SourceName = loadStringRef(p, p_end).to_string();
         break;
       default:
-        thin_protobuf::skipData(*buffer, cur_wire);
+        skipData(p, p_end, cur_wire);
         break;
     }
   }
@@ -56,177 +124,469 @@ void ProtobufReader::loadHeader(std::streampos buf_limit) {
   LastChunk = ProtobufReader::Header;
 }
 
-void ProtobufReader::loadDictionaryEntry(std::streampos buf_limit) {
-  // Set default values:
-  std::string name = "";
-  std::vector<std::size_t> markers;
+void ProtobufReader::clearNameTables() {
+  // The string tables start with the entries of the shared dictionary (if any), which are kept:
+  fileNameMap.resize(sharedFileCount);
+  templateNameMap.resize(sharedNameCount);
+  templateMarkerStarts.resize(sharedNameCount);
+  templateMarkers.resize(sharedMarkerCount);
+  templateNameLengths.resize(sharedNameCount);
+  templateNameHashes.resize(sharedNameCount);
+  templateNameIsEntry.resize(sharedNameCount);
+  dictionaryNameIDs.resize(sharedDictionaryCount);
+  // The shared dictionary has no inline names, and its copied names are in its own blocks:
+  std::fill(inlineNameSlots.begin(), inlineNameSlots.end(), InlineNameSlot{0, InvalidStringID});
+  inlineNameCount = 0;
+  nameBlocks.resize(sharedNameBlockCount);
+  nameBlockPos = nullptr;
+  nameBlockLeft = 0;
+  blockNameIDs.clear();
+  nameDecompressor.clear();
+  for(auto it = expansionLRU.begin(); it != expansionLRU.end(); ) {
+    if ( *it < sharedNameCount ) {
+      ++it;
+      continue;
+    }
+    auto it_cached = expansionCache.find(*it);
+    expansionCacheSize -= it_cached->second.name.size();
+    expansionCache.erase(it_cached);
+    it = expansionLRU.erase(it);
+  }
+}
+
+void ProtobufReader::clearSharedDictionary() {
+  sharedNameCount = 0;
+  sharedMarkerCount = 0;
+  sharedDictionaryCount = 0;
+  sharedFileCount = 0;
+  sharedDictionaryOffset = no_dictionary_offset;
+  sharedNameBlockCount = 0;
+  clearNameTables();
+}
+
+void ProtobufReader::loadSharedDictionary(const std::uint8_t* p, const std::uint8_t* p_end, std::uint64_t aOffset) {
   
-  while ( buffer->tellg() < buf_limit ) {
-    auto cur_wire = thin_protobuf::loadVarInt(*buffer);
+  /*
+  message TemplightDictionary {
+    repeated string file_names = 1;
+    repeated DictionaryEntry names = 3;
+  }
+  */
+  
+  // A shared dictionary replaces the previous one (if any), for the traces that follow it:
+  clearSharedDictionary();
+  
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
     switch( cur_wire ) {
       case thin_protobuf::getStringWire<1>::value:
-        name = thin_protobuf::loadString(*buffer);
+        fileNameMap.push_back(loadStringRef(p, p_end).to_string());
         break;
-      case thin_protobuf::getVarIntWire<2>::value:
-        markers.push_back(thin_protobuf::loadVarIntAs<std::size_t>(*buffer));
+      case thin_protobuf::getStringWire<3>::value: {
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = thin_protobuf::loadStringSpan(p, p_end, cur_size);
+        loadDictionaryEntry(p_sub, p_sub + cur_size);
         break;
+      }
       default:
-        thin_protobuf::skipData(*buffer, cur_wire);
+        skipData(p, p_end, cur_wire);
         break;
     }
   }
   
-  std::string::iterator it_name = std::find(name.begin(), name.end(), '\0');
-  std::vector<std::size_t>::iterator it_mark = markers.begin();
-  while ( ( it_name != name.end() ) && ( it_mark != markers.end() ) ) {
-    std::size_t offset = it_name - name.begin();
-    name.replace(it_name, it_name + 1, templateNameMap[*it_mark]);
-    it_name = std::find(name.begin() + offset, name.end(), '\0');
-    ++it_mark;
+  // The names of the shared dictionary are kept across traces, and so, they cannot stay in the block:
+  releaseBlockNames();
+  sharedNameBlockCount = nameBlocks.size();
+  nameBlockLeft = 0;
+  
+  sharedNameCount = templateNameMap.size();
+  sharedMarkerCount = templateMarkers.size();
+  sharedDictionaryCount = dictionaryNameIDs.size();
+  sharedFileCount = fileNameMap.size();
+  sharedDictionaryOffset = aOffset;
+}
+
+void ProtobufReader::setSharedDictionary(const char* aData, std::size_t aSize) {
+  const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(aData);
+  loadSharedDictionary(p, p + aSize, no_dictionary_offset);
+}
+
+bool ProtobufReader::restoreSharedDictionary(const ProtobufTraceIndex::Trace& aTrace) {
+  if ( aTrace.dictionary_size == 0 ) {
+    clearSharedDictionary();
+    return true;
+  }
+  if ( aTrace.dictionary_offset == sharedDictionaryOffset ) {
+    clearNameTables();
+    return true;
+  }
+  if ( !seekTo(aTrace.dictionary_offset, aTrace.dictionary_offset + aTrace.dictionary_size) )
+    return false;
+  std::size_t dict_size = static_cast<std::size_t>(aTrace.dictionary_size);
+  if ( isStreaming() ) {
+    if ( !fillBlock(dict_size) )
+      return false;
+    loadSharedDictionary(blk_cur, blk_cur + dict_size, aTrace.dictionary_offset);
+  } else {
+    loadSharedDictionary(mem_cur, mem_cur + dict_size, aTrace.dictionary_offset);
+  }
+  return true;
+}
+
+void ProtobufReader::addTemplateName(boost::string_ref aMarkedName, std::size_t aMarkerStart) {
+  // Compute the hash and length of the expanded name from its parts, without expanding it:
+  EntryNameHash name_hash;
+  std::size_t name_len = 0;
+  const char* it_piece = aMarkedName.begin();
+  std::size_t m = aMarkerStart;
+  for(; m < templateMarkers.size(); ++m) {
+    const char* it = std::find(it_piece, aMarkedName.end(), '\0');
+    if ( it == aMarkedName.end() )
+      break;
+    name_hash.append(it_piece, it - it_piece);
+    name_len += it - it_piece;
+    if ( templateMarkers[m] != InvalidStringID ) {
+      name_hash.append(templateNameHashes[templateMarkers[m]]);
+      name_len += templateNameLengths[templateMarkers[m]];
+    }
+    it_piece = it + 1;
+  }
+  name_hash.append(it_piece, aMarkedName.end() - it_piece);
+  name_len += aMarkedName.end() - it_piece;
+  templateMarkers.resize(m); // drop extra markers, if any.
+  
+  templateMarkerStarts.push_back(aMarkerStart);
+  templateNameLengths.push_back(name_len);
+  templateNameHashes.push_back(name_hash);
+  templateNameIsEntry.push_back(true);
+  templateNameMap.push_back(storeName(aMarkedName, templateNameMap.size()));
+}
+
+void ProtobufReader::loadDictionaryEntry(const std::uint8_t* p, const std::uint8_t* p_end) {
+  // Set default values:
+  boost::string_ref name;
+  std::size_t marker_start = templateMarkers.size();
+  
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getStringWire<1>::value:
+        name = loadStringRef(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<2>::value: {
+        // Markers can only refer to earlier entries, which keeps the dictionary a DAG:
+        auto dict_id = loadVarIntAs<std::size_t>(p, p_end);
+        templateMarkers.push_back( dict_id < dictionaryNameIDs.size() ? 
+          dictionaryNameIDs[dict_id] : InvalidStringID );
+        break;
+      }
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
   }
   
-  templateNameMap.push_back(name);
+  dictionaryNameIDs.push_back(templateNameMap.size());
+  addTemplateName(name, marker_start);
   
 }
 
-static void loadLocation(std::istream* buffer, 
-                         std::streampos buf_limit, 
-                         std::vector<std::string>& fileNameMap,
-                         std::string& FileName, int& Line, int& Column) {
+std::uint32_t ProtobufReader::internName(boost::string_ref aName) {
+  // Keep the table of inline names at most half full:
+  if ( 2 * ( inlineNameCount + 1 ) > inlineNameSlots.size() )
+    growInlineNameSlots();
+  const std::uint64_t h = hashNameBytes(aName);
+  InlineNameSlot& slot = findInlineNameSlot(h, aName);
+  if ( slot.id != InvalidStringID )
+    return slot.id;
+  std::uint32_t id = templateNameMap.size();
+  templateMarkerStarts.push_back(templateMarkers.size());
+  templateNameLengths.push_back(aName.size());
+  templateNameHashes.push_back(EntryNameHash()); // not needed (no markers refer to inline names).
+  templateNameIsEntry.push_back(false);
+  templateNameMap.push_back(storeName(aName, id));
+  slot.hash = h;
+  slot.id = id;
+  ++inlineNameCount;
+  return id;
+}
+
+ProtobufReader::InlineNameSlot& ProtobufReader::findInlineNameSlot(std::uint64_t aHash, boost::string_ref aName) {
+  // Linear probing, from the slot of the hash to the slot of the name or an empty slot:
+  const std::size_t mask = inlineNameSlots.size() - 1;
+  for(std::size_t i = aHash & mask; ; i = (i + 1) & mask) {
+    InlineNameSlot& slot = inlineNameSlots[i];
+    if ( slot.id == InvalidStringID )
+      return slot;
+    if ( ( slot.hash == aHash ) && ( templateNameMap[slot.id] == aName ) )
+      return slot;
+  }
+}
+
+ProtobufReader::InlineNameSlot& ProtobufReader::findEmptyInlineNameSlot(std::uint64_t aHash) {
+  const std::size_t mask = inlineNameSlots.size() - 1;
+  for(std::size_t i = aHash & mask; ; i = (i + 1) & mask) {
+    if ( inlineNameSlots[i].id == InvalidStringID )
+      return inlineNameSlots[i];
+  }
+}
+
+void ProtobufReader::growInlineNameSlots() {
+  std::vector< InlineNameSlot > old_slots;
+  old_slots.swap(inlineNameSlots);
+  inlineNameSlots.resize(std::max(old_slots.size() * 2, std::size_t(1024)), InlineNameSlot{0, InvalidStringID});
+  for(const InlineNameSlot& slot : old_slots)
+    if ( slot.id != InvalidStringID )
+      findEmptyInlineNameSlot(slot.hash) = slot;
+}
+
+boost::string_ref ProtobufReader::storeName(boost::string_ref aName, std::uint32_t aNameID) {
+  if ( aName.empty() )
+    return boost::string_ref();
+  // Names in the memory span stay valid, and names in the block, until it is refilled:
+  const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(aName.data());
+  if ( !isStreaming() && mem_begin && ( p >= mem_begin ) && ( p + aName.size() <= mem_begin + mem_size ) )
+    return aName;
+  if ( isStreaming() && ( p >= block.data() ) && ( p + aName.size() <= block.data() + block.size() ) ) {
+    blockNameIDs.push_back(aNameID);
+    return aName;
+  }
+  return copyName(aName);
+}
+
+boost::string_ref ProtobufReader::copyName(boost::string_ref aName) {
+  // Names are appended to the last block, or to a new block (of at least 1 MB) if they don't fit:
+  if ( aName.size() > nameBlockLeft ) {
+    nameBlockLeft = std::max(aName.size(), std::size_t(1) << 20);
+    nameBlocks.emplace_back(new char[nameBlockLeft]);
+    nameBlockPos = nameBlocks.back().get();
+  }
+  std::copy(aName.begin(), aName.end(), nameBlockPos);
+  boost::string_ref result(nameBlockPos, aName.size());
+  nameBlockPos += aName.size();
+  nameBlockLeft -= aName.size();
+  return result;
+}
+
+void ProtobufReader::releaseBlockNames() {
+  for(std::uint32_t id : blockNameIDs)
+    templateNameMap[id] = copyName(templateNameMap[id]);
+  blockNameIDs.clear();
+}
+
+std::size_t ProtobufReader::getMarkerEnd(std::uint32_t aNameID) const {
+  if ( aNameID + 1 < templateMarkerStarts.size() )
+    return templateMarkerStarts[aNameID + 1];
+  return templateMarkers.size();
+}
+
+void ProtobufReader::expandName(std::uint32_t aNameID, std::string& aOut) const {
+  // The names of a trace can be nested arbitrarily deep, so, they are expanded with an 
+  // explicit stack, and markers can only refer to lower ids (as loadDictionaryEntry 
+  // ensures), which rules out cycles (other markers are dropped):
+  expansionStack.clear();
+  expansionStack.push_back(ExpansionFrame{aNameID, templateNameMap[aNameID].begin(), templateMarkerStarts[aNameID]});
+  while ( !expansionStack.empty() ) {
+    ExpansionFrame& frame = expansionStack.back();
+    boost::string_ref name = templateNameMap[frame.name_id];
+    if ( frame.marker == getMarkerEnd(frame.name_id) ) {
+      aOut.append(frame.piece, name.end());
+      expansionStack.pop_back();
+      continue;
+    }
+    const char* pos = std::find(frame.piece, name.end(), '\0'); // there is one per marker.
+    aOut.append(frame.piece, pos);
+    frame.piece = pos + 1;
+    std::uint32_t sub_id = templateMarkers[frame.marker++];
+    if ( ( sub_id == InvalidStringID ) || ( sub_id >= frame.name_id ) )
+      continue;
+    if ( templateMarkerStarts[sub_id] == getMarkerEnd(sub_id) ) {
+      aOut.append(templateNameMap[sub_id].begin(), templateNameMap[sub_id].end());
+      continue;
+    }
+    auto it = expansionCache.find(sub_id);
+    if ( it != expansionCache.end() )
+      aOut += it->second.name;
+    else
+      expansionStack.push_back(ExpansionFrame{sub_id, templateNameMap[sub_id].begin(), templateMarkerStarts[sub_id]});
+  }
+}
+
+void ProtobufReader::cacheExpansion(std::uint32_t aNameID, const char* aName, std::size_t aSize) const {
+  if ( aSize > expansionCacheLimit )
+    return;
+  while ( expansionCacheSize + aSize > expansionCacheLimit ) {
+    auto it = expansionCache.find(expansionLRU.back());
+    expansionCacheSize -= it->second.name.size();
+    expansionCache.erase(it);
+    expansionLRU.pop_back();
+  }
+  expansionLRU.push_front(aNameID);
+  CachedExpansion& cached = expansionCache[aNameID];
+  cached.name.assign(aName, aSize);
+  cached.lru_it = expansionLRU.begin();
+  expansionCacheSize += aSize;
+}
+
+void ProtobufReader::loadLocation(const std::uint8_t* p, const std::uint8_t* p_end, 
+                                  std::uint32_t& FileID, int& Line, int& Column) {
   // Set default values:
-  FileName = "";
-  std::size_t FileID = std::numeric_limits<std::size_t>::max();
+  boost::string_ref FileName;
+  FileID = InvalidStringID;
   Line = 0;
   Column = 0;
   
-  while ( buffer->tellg() < buf_limit ) {
-    auto cur_wire = thin_protobuf::loadVarInt(*buffer);
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
     switch( cur_wire ) {
       case thin_protobuf::getStringWire<1>::value:
-        FileName = thin_protobuf::loadString(*buffer);
+        FileName = loadStringRef(p, p_end);
         break;
       case thin_protobuf::getVarIntWire<2>::value:
-        FileID = thin_protobuf::loadVarIntAs<std::size_t>(*buffer);
+        FileID = loadVarIntAs<std::uint32_t>(p, p_end);
         break;
       case thin_protobuf::getVarIntWire<3>::value:
-        Line = thin_protobuf::loadVarIntAs<int>(*buffer);
+        Line = loadVarIntAs<int>(p, p_end);
         break;
       case thin_protobuf::getVarIntWire<4>::value:
-        Column = thin_protobuf::loadVarIntAs<int>(*buffer);
+        Column = loadVarIntAs<int>(p, p_end);
         break;
       default:
-        thin_protobuf::skipData(*buffer, cur_wire);
+        skipData(p, p_end, cur_wire);
         break;
     }
   }
   
-  if ( FileID != std::numeric_limits<std::size_t>::max() ) {
+  if ( FileID != InvalidStringID ) {
     if ( fileNameMap.size() <= FileID )
       fileNameMap.resize(FileID + 1);
-    if ( !FileName.empty() ) {
-      fileNameMap[FileID] = FileName;  // overwrite existing names, if any, but there shouldn't be.
-    } else {
-      FileName = fileNameMap[FileID];
-    }
+    if ( !FileName.empty() )
+      fileNameMap[FileID].assign(FileName.data(), FileName.size());  // overwrite existing names, if any, but there shouldn't be.
   } // else we don't care?
   
 }
 
-void ProtobufReader::loadTemplateName(std::streampos buf_limit) {
+void ProtobufReader::loadTemplateName(const std::uint8_t* p, const std::uint8_t* p_end) {
   // Set default values:
-  LastBeginEntry.Name = "";
+  LastBeginEntry.NameID = InvalidStringID;
   
-  while ( buffer->tellg() < buf_limit ) {
-    auto cur_wire = thin_protobuf::loadVarInt(*buffer);
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
     switch( cur_wire ) {
       case thin_protobuf::getStringWire<1>::value:
-        LastBeginEntry.Name = thin_protobuf::loadString(*buffer);
+        LastBeginEntry.NameID = internName(loadStringRef(p, p_end));
         break;
-#if 0
       case thin_protobuf::getStringWire<2>::value: {
-        LastBeginEntry.Name = thin_protobuf::loadString(*buffer);
-        llvm::SmallVector<char,32> UBuf;
-        if ( llvm::zlib::uncompress(LastBeginEntry.Name, UBuf, LastBeginEntry.Name.size() * 2) 
-                == llvm::zlib::StatusOK )
-          LastBeginEntry.Name.assign(UBuf.begin(), UBuf.end());
-        else
-          LastBeginEntry.Name = "";
+        boost::string_ref compressed = loadStringRef(p, p_end);
+        if ( nameDecompressor.decompress(compressed.data(), compressed.size(), decompressedName) )
+          LastBeginEntry.NameID = internName(decompressedName);
         break;
       }
-#endif
       case thin_protobuf::getVarIntWire<3>::value: {
-        LastBeginEntry.Name = templateNameMap[thin_protobuf::loadVarIntAs<std::size_t>(*buffer)];
+        auto dict_id = loadVarIntAs<std::size_t>(p, p_end);
+        LastBeginEntry.NameID = ( dict_id < dictionaryNameIDs.size() ? 
+          dictionaryNameIDs[dict_id] : InvalidStringID );
         break;
       }
       default:
-        thin_protobuf::skipData(*buffer, cur_wire);
+        skipData(p, p_end, cur_wire);
         break;
     }
   }
   
 }
 
-void ProtobufReader::loadBeginEntry(std::streampos buf_limit) {
+void ProtobufReader::loadBeginEntry(const std::uint8_t* p, const std::uint8_t* p_end) {
   // Set default values:
   LastBeginEntry.InstantiationKind = 0;
-  LastBeginEntry.Name = "";
+  LastBeginEntry.Line = 0;
+  LastBeginEntry.Column = 0;
   LastBeginEntry.TimeStamp = 0.0;
   LastBeginEntry.MemoryUsage = 0;
+  LastBeginEntry.TempOri_Line = 0;
+  LastBeginEntry.TempOri_Column = 0;
+  LastBeginEntry.NameID = LastBeginEntry.FileID = LastBeginEntry.TempOri_FileID = InvalidStringID;
+  
+  // The unneeded fields are skipped (see setRequiredFields), except for the filenames 
+  // of the unneeded locations, if the other locations (that can refer to them) are needed:
+  std::uint32_t unused_file_id = InvalidStringID;
+  int unused_line = 0, unused_column = 0;
   
-  while ( buffer->tellg() < buf_limit ) {
-    auto cur_wire = thin_protobuf::loadVarInt(*buffer);
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
     switch( cur_wire ) {
       case thin_protobuf::getVarIntWire<1>::value:
-        LastBeginEntry.InstantiationKind = thin_protobuf::loadVarIntAs<int>(*buffer);
+        LastBeginEntry.InstantiationKind = loadVarIntAs<int>(p, p_end);
         break;
       case thin_protobuf::getStringWire<2>::value: {
-        auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-        loadTemplateName(buffer->tellg() + cur_size);
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = thin_protobuf::loadStringSpan(p, p_end, cur_size);
+        if ( requiredFields & EntryNameField )
+          loadTemplateName(p_sub, p_sub + cur_size);
         break;
       }
       case thin_protobuf::getStringWire<3>::value: {
-        auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-        loadLocation(buffer, buffer->tellg() + cur_size, fileNameMap, 
-          LastBeginEntry.FileName, LastBeginEntry.Line, LastBeginEntry.Column);
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = thin_protobuf::loadStringSpan(p, p_end, cur_size);
+        if ( requiredFields & EntryLocationField )
+          loadLocation(p_sub, p_sub + cur_size, 
+            LastBeginEntry.FileID, LastBeginEntry.Line, LastBeginEntry.Column);
+        else if ( requiredFields & EntryOriginField )
+          loadLocation(p_sub, p_sub + cur_size, unused_file_id, unused_line, unused_column);
         break;
       }
       case thin_protobuf::getDoubleWire<4>::value:
-        LastBeginEntry.TimeStamp = thin_protobuf::loadDouble(*buffer);
+        LastBeginEntry.TimeStamp = loadDouble(p, p_end);
         break;
       case thin_protobuf::getVarIntWire<5>::value:
-        LastBeginEntry.MemoryUsage = thin_protobuf::loadVarInt(*buffer);
+        if ( requiredFields & EntryMemoryField )
+          LastBeginEntry.MemoryUsage = loadVarInt(p, p_end);
+        else
+          skipData(p, p_end, cur_wire);
         break;
       case thin_protobuf::getStringWire<6>::value: {
-        auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-        loadLocation(buffer, buffer->tellg() + cur_size, fileNameMap, 
-          LastBeginEntry.TempOri_FileName, LastBeginEntry.TempOri_Line, LastBeginEntry.TempOri_Column);
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = thin_protobuf::loadStringSpan(p, p_end, cur_size);
+        if ( requiredFields & EntryOriginField )
+          loadLocation(p_sub, p_sub + cur_size, 
+            LastBeginEntry.TempOri_FileID, LastBeginEntry.TempOri_Line, LastBeginEntry.TempOri_Column);
+        else if ( requiredFields & EntryLocationField )
+          loadLocation(p_sub, p_sub + cur_size, unused_file_id, unused_line, unused_column);
         break;
       }
       default:
-        thin_protobuf::skipData(*buffer, cur_wire);
+        skipData(p, p_end, cur_wire);
         break;
     }
   }
   
+  // The strings are materialized on demand, from the ids, and so are the hashes of inline names:
+  LastBeginEntry.NameHash = ( ( LastBeginEntry.NameID < templateNameHashes.size() ) && 
+    templateNameIsEntry[LastBeginEntry.NameID] ? templateNameHashes[LastBeginEntry.NameID].get() : 0 );
+  LastBeginEntry.setStrings(this);
+  
   LastChunk = ProtobufReader::BeginEntry;
 }
 
-void ProtobufReader::loadEndEntry(std::streampos buf_limit) {
+void ProtobufReader::loadEndEntry(const std::uint8_t* p, const std::uint8_t* p_end) {
   // Set default values:
   LastEndEntry.TimeStamp = 0.0;
   LastEndEntry.MemoryUsage = 0;
   
-  while ( buffer->tellg() < buf_limit ) {
-    auto cur_wire = thin_protobuf::loadVarInt(*buffer);
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
     switch( cur_wire ) {
       case thin_protobuf::getDoubleWire<1>::value:
-        LastEndEntry.TimeStamp = thin_protobuf::loadDouble(*buffer);
+        LastEndEntry.TimeStamp = loadDouble(p, p_end);
         break;
       case thin_protobuf::getVarIntWire<2>::value:
-        LastEndEntry.MemoryUsage = thin_protobuf::loadVarInt(*buffer);
+        if ( requiredFields & EntryMemoryField )
+          LastEndEntry.MemoryUsage = loadVarInt(p, p_end);
+        else
+          skipData(p, p_end, cur_wire);
         break;
       default:
-        thin_protobuf::skipData(*buffer, cur_wire);
+        skipData(p, p_end, cur_wire);
         break;
     }
   }
@@ -234,71 +594,566 @@ void ProtobufReader::loadEndEntry(std::streampos buf_limit) {
   LastChunk = ProtobufReader::EndEntry;
 }
 
+void ProtobufReader::skipBeginEntry(const std::uint8_t* p, const std::uint8_t* p_end) {
+  // Only the filenames are loaded, since later entries refer to them by id (if needed):
+  if ( !( requiredFields & ( EntryLocationField | EntryOriginField ) ) )
+    return;
+  std::uint32_t file_id = InvalidStringID;
+  int line = 0, column = 0;
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getStringWire<3>::value:
+      case thin_protobuf::getStringWire<6>::value: {
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = thin_protobuf::loadStringSpan(p, p_end, cur_size);
+        loadLocation(p_sub, p_sub + cur_size, file_id, line, column);
+        break;
+      }
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
+  }
+}
+
+void ProtobufReader::skipEntrySubtree() {
+  // Skip the chunks up to the end entry that matches the last beginning entry:
+  std::size_t depth = 1;
+  ++skippedEntryCount;
+  while ( depth > 0 ) {
+    if ( isStreaming() ) {
+      if ( ( getStreamPos() >= blk_trace_end ) || !fillBlock(1) )
+        return;
+    } else if ( !mem_cur || ( mem_cur >= mem_trace_end ) ) {
+      return;
+    }
+    
+    std::uint64_t cur_wire = 0;
+    const std::uint8_t* p = nullptr;
+    const std::uint8_t* p_end = nullptr;
+    if ( !readTraceChunk(cur_wire, p, p_end) )
+      continue;
+    
+    switch(cur_wire) {
+      case thin_protobuf::getStringWire<2>::value: {
+        cur_wire = loadVarInt(p, p_end);
+        /* cur_size = */ loadVarInt(p, p_end);
+        if ( cur_wire == thin_protobuf::getStringWire<1>::value ) {
+          skipBeginEntry(p, p_end);
+          ++depth;
+          ++skippedEntryCount;
+        } else if ( cur_wire == thin_protobuf::getStringWire<2>::value ) {
+          --depth;
+        }
+        break;
+      };
+      case thin_protobuf::getStringWire<3>::value: {
+        loadDictionaryEntry(p, p_end);
+        break;
+      };
+      case thin_protobuf::getStringWire<4>::value: {
+        nameDecompressor.setDictionary(reinterpret_cast<const char*>(p), p_end - p);
+        break;
+      };
+      default:
+        break;
+    }
+  }
+}
+
+void ProtobufReader::resetBlock(std::uint64_t aOffset) {
+  releaseBlockNames();
+  blk_cur = blk_end = block.data();
+  blk_offset = aOffset;
+  blk_trace_end = 0;
+  in_eof = false;
+}
+
+std::size_t ProtobufReader::readInput(std::uint8_t* aDest, std::size_t aSize) {
+  if ( in_file )
+    return std::fread(aDest, 1, aSize, in_file);
+  if ( in_buf ) {
+    std::streamsize got = in_buf->sgetn(reinterpret_cast<char*>(aDest), aSize);
+    return ( got > 0 ? static_cast<std::size_t>(got) : 0 );
+  }
+  return 0;
+}
+
+bool ProtobufReader::fillBlock(std::size_t aMinSize) {
+  std::size_t avail = blk_end - blk_cur;
+  if ( avail >= aMinSize )
+    return true;
+  if ( in_eof )
+    return false;
+  // Move the unread bytes to the front of the block, and refill it:
+  releaseBlockNames();
+  blk_offset += blk_cur - block.data();
+  if ( avail > 0 )
+    std::memmove(block.data(), blk_cur, avail);
+  if ( block.size() < stream_block_size )
+    block.resize(stream_block_size);
+  std::size_t filled = avail;
+  while ( filled < aMinSize ) {
+    // Grow the block as it fills up, not by the size asked for, which is untrusted:
+    if ( filled == block.size() )
+      block.resize(std::min(aMinSize, 2 * block.size()));
+    std::size_t got = readInput(block.data() + filled, block.size() - filled);
+    if ( got == 0 ) {
+      in_eof = true;
+      break;
+    }
+    filled += got;
+  }
+  blk_cur = block.data();
+  blk_end = blk_cur + filled;
+  return ( filled >= aMinSize );
+}
+
+void ProtobufReader::skipStreamData(std::uint64_t wire) {
+  if ( ( wire & 0x7 ) != 2 ) {
+    fillBlock(10);
+    skipData(blk_cur, blk_end, wire);
+    return;
+  }
+  // Skip a string without pulling it all into the block:
+  auto cur_size = loadVarInt(blk_cur, blk_end);
+  while ( cur_size > 0 ) {
+    if ( ( blk_cur == blk_end ) && !fillBlock(1) )
+      return;
+    std::size_t skipped = std::min<std::uint64_t>(cur_size, blk_end - blk_cur);
+    blk_cur += skipped;
+    cur_size -= skipped;
+  }
+}
+
+void ProtobufReader::detectStreamCompression() {
+  fillBlock(4);
+  std::size_t avail = blk_end - blk_cur;
+  StreamCompression compression = detectCompression(reinterpret_cast<const char*>(blk_cur), avail);
+  if ( compression == NoCompression )
+    return;
+  // Hand over the bytes already read to the decompressor, and read from it instead:
+  std::string prefix(reinterpret_cast<const char*>(blk_cur), avail);
+  if ( in_file )
+    decompressor.reset(new DecompressingStreamBuf(compression, in_file, prefix));
+  else
+    decompressor.reset(new DecompressingStreamBuf(compression, in_buf, prefix));
+  in_buf = decompressor.get();
+  in_file = nullptr;
+  stream_start = -1;
+  resetBlock(0);
+}
+
+bool ProtobufReader::readTraceChunk(std::uint64_t& wire, 
+                                    const std::uint8_t*& p, const std::uint8_t*& p_end) {
+  bool is_known = false;
+  if ( isStreaming() ) {
+    fillBlock(20); // enough for the wire and the size.
+    wire = loadVarInt(blk_cur, blk_end);
+    switch( wire ) {
+      case thin_protobuf::getStringWire<1>::value:
+      case thin_protobuf::getStringWire<2>::value:
+      case thin_protobuf::getStringWire<3>::value:
+      case thin_protobuf::getStringWire<4>::value: {
+        auto cur_size = loadVarIntAs<std::size_t>(blk_cur, blk_end);
+        // Decode the chunk in-place, in the block:
+        fillBlock(cur_size);
+        cur_size = std::min<std::size_t>(cur_size, blk_end - blk_cur);
+        p = blk_cur;
+        p_end = p + cur_size;
+        blk_cur += cur_size;
+        return true;
+      }
+      default: // ignore for fwd-compat.
+        skipStreamData(wire);
+        return false;
+    }
+  }
+  wire = loadVarInt(mem_cur, mem_trace_end);
+  switch( wire ) {
+    case thin_protobuf::getStringWire<1>::value:
+    case thin_protobuf::getStringWire<2>::value:
+    case thin_protobuf::getStringWire<3>::value:
+    case thin_protobuf::getStringWire<4>::value:
+      is_known = true;
+      break;
+    default:
+      break;
+  }
+  if ( !is_known ) { // ignore for fwd-compat.
+    skipData(mem_cur, mem_trace_end, wire);
+    return false;
+  }
+  std::size_t cur_size = 0;
+  p = thin_protobuf::loadStringSpan(mem_cur, mem_trace_end, cur_size);
+  p_end = p + cur_size;
+  return true;
+}
+
+ProtobufReader::LastChunkType ProtobufReader::startOnTrace() {
+  if ( isStreaming() ) {
+    fillBlock(20); // enough for the wire and the size.
+    while ( blk_cur < blk_end ) {
+      auto cur_wire = loadVarInt(blk_cur, blk_end);
+      if ( cur_wire == thin_protobuf::getStringWire<1>::value ) {
+        auto cur_size = loadVarInt(blk_cur, blk_end);
+        blk_trace_end = getStreamPos() + cur_size;
+        return next();
+      }
+      if ( cur_wire != thin_protobuf::getStringWire<2>::value )
+        break;
+      // optional TemplightDictionary dictionary = 2;  (of the traces that follow)
+      auto cur_size = loadVarIntAs<std::size_t>(blk_cur, blk_end);
+      std::uint64_t dict_offset = getStreamPos();
+      fillBlock(cur_size);
+      cur_size = std::min<std::size_t>(cur_size, blk_end - blk_cur);
+      loadSharedDictionary(blk_cur, blk_cur + cur_size, dict_offset);
+      blk_cur += cur_size;
+      fillBlock(20);
+    }
+    // Stay on the stream, in case of a seek:
+    blk_cur = blk_end;
+    blk_trace_end = 0;
+    in_eof = true;
+  } else if ( mem_cur ) {
+    while ( mem_cur < mem_end ) {
+      auto cur_wire = loadVarInt(mem_cur, mem_end);
+      if ( cur_wire == thin_protobuf::getStringWire<1>::value ) {
+        std::uint64_t cur_size = loadVarInt(mem_cur, mem_end);
+        if ( cur_size > static_cast<std::uint64_t>(mem_end - mem_cur) ) {
+          in_truncated = true;
+          cur_size = mem_end - mem_cur;
+        }
+        // Decode the trace's chunks in-place:
+        mem_trace_end = mem_cur + cur_size;
+        return next();
+      }
+      if ( cur_wire != thin_protobuf::getStringWire<2>::value )
+        break;
+      // optional TemplightDictionary dictionary = 2;  (of the traces that follow)
+      std::size_t cur_size = 0;
+      const std::uint8_t* p_dict = thin_protobuf::loadStringSpan(mem_cur, mem_end, cur_size);
+      loadSharedDictionary(p_dict, p_dict + cur_size, 
+                           mem_begin ? static_cast<std::uint64_t>(p_dict - mem_begin) : no_dictionary_offset);
+    }
+  }
+  mem_cur = mem_end = mem_trace_end = nullptr;
+  LastChunk = ProtobufReader::EndOfFile;
+  return LastChunk;
+}
+
 ProtobufReader::LastChunkType 
     ProtobufReader::startOnBuffer(std::istream& aBuffer) {
-  buffer = &aBuffer;
-  fileNameMap.clear();
-  auto cur_wire = thin_protobuf::loadVarInt(*buffer);
-  if ( cur_wire != thin_protobuf::getStringWire<1>::value ) {
-    buffer = nullptr;
-    next_start = 0;
-    LastChunk = ProtobufReader::EndOfFile;
+  decompressor.reset();
+  mapping.reset();
+  if ( &aBuffer != owned_buffer.get() )
+    owned_buffer.reset();
+  mem_cur = mem_end = mem_trace_end = nullptr;
+  mem_begin = nullptr;
+  mem_size = 0;
+  in_file = nullptr;
+  in_buf = aBuffer.rdbuf();
+  in_truncated = false;
+  clearSharedDictionary();
+  // Only needed to seek later, and invalid for streams that cannot seek:
+  stream_start = in_buf->pubseekoff(0, std::ios_base::cur, std::ios_base::in);
+  resetBlock(0);
+  detectStreamCompression();
+  return startOnTrace();
+}
+
+ProtobufReader::LastChunkType ProtobufReader::startOnStdin() {
+#ifdef _WIN32
+  _setmode(_fileno(stdin), _O_BINARY);
+#endif
+  decompressor.reset();
+  mapping.reset();
+  owned_buffer.reset();
+  mem_cur = mem_end = mem_trace_end = nullptr;
+  mem_begin = nullptr;
+  mem_size = 0;
+  in_buf = nullptr;
+  in_file = stdin;
+  stream_start = -1;
+  in_truncated = false;
+  clearSharedDictionary();
+  resetBlock(0);
+  detectStreamCompression();
+  return startOnTrace();
+}
+
+ProtobufReader::LastChunkType 
+    ProtobufReader::startOnFile(const std::string& aFilename) {
+  std::unique_ptr<boost::iostreams::mapped_file_source> new_mapping;
+  try {
+    new_mapping.reset(new boost::iostreams::mapped_file_source(aFilename));
+  } catch(std::exception&) {
+    new_mapping.reset();
+  }
+  if ( new_mapping && new_mapping->is_open() ) {
+    startOnMemory(new_mapping->data(), new_mapping->size());
+    mapping = std::move(new_mapping);
     return LastChunk;
   }
-  auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-  next_start = buffer->tellg() + cur_size;
-  return next();
+  // Could not map the file (e.g., empty file, or a pipe), so, read it as a stream:
+  owned_buffer.reset(new std::ifstream(aFilename, std::ios_base::in | std::ios_base::binary));
+  return startOnBuffer(*owned_buffer);
+}
+
+ProtobufReader::LastChunkType 
+    ProtobufReader::startOnMemory(const char* aData, std::size_t aSize) {
+  decompressor.reset();
+  mapping.reset();
+  owned_buffer.reset();
+  in_buf = nullptr;
+  in_file = nullptr;
+  stream_start = -1;
+  in_truncated = false;
+  clearSharedDictionary();
+  StreamCompression compression = detectCompression(aData, aSize);
+  if ( compression != NoCompression ) {
+    // Decompress the span as a stream (but still in a background thread):
+    mem_cur = mem_end = mem_trace_end = nullptr;
+    mem_begin = nullptr;
+    mem_size = 0;
+    decompressor.reset(new DecompressingStreamBuf(compression, aData, aSize));
+    in_buf = decompressor.get();
+    resetBlock(0);
+    return startOnTrace();
+  }
+  mem_begin = mem_cur = reinterpret_cast<const std::uint8_t*>(aData);
+  mem_size = aSize;
+  mem_end = mem_cur + aSize;
+  mem_trace_end = mem_cur;
+  return startOnTrace();
 }
 
 ProtobufReader::LastChunkType ProtobufReader::next() {
-  if ( !buffer || !(*buffer) || (buffer->tellg() >= next_start) ) {
-    if ( !buffer || !(*buffer) ) {
-      buffer = nullptr;
-      next_start = 0;
+  while ( true ) {
+    if ( isStreaming() ) {
+      if ( getStreamPos() >= blk_trace_end )
+        return startOnTrace();
+      if ( !fillBlock(1) ) {
+        in_truncated = true;
+        return startOnTrace();
+      }
+    } else if ( mem_cur ) {
+      if ( mem_cur >= mem_trace_end )
+        return startOnTrace();
+    } else {
       LastChunk = ProtobufReader::EndOfFile;
       return LastChunk;
-    } else {
-      return startOnBuffer(*buffer);
     }
-  }
-  auto cur_wire = thin_protobuf::loadVarInt(*buffer);
-  switch(cur_wire) {
-    case thin_protobuf::getStringWire<1>::value: {
-      auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-      loadHeader(buffer->tellg() + cur_size);
-      return LastChunk;
-    };
-    case thin_protobuf::getStringWire<2>::value: {
-      auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-      std::streampos cur_limit = buffer->tellg() + cur_size;
-      cur_wire = thin_protobuf::loadVarInt(*buffer);
-      /* cur_size = */ thin_protobuf::loadVarInt(*buffer);
-      switch( cur_wire ) {
-        case thin_protobuf::getStringWire<1>::value:
-          loadBeginEntry(cur_limit);
-          break;
-        case thin_protobuf::getStringWire<2>::value:
-          loadEndEntry(cur_limit);
-          break;
-        default: // ignore for fwd-compat.
-          // FIXME It's weird that nothing is done here.
-          break;
+    
+    std::uint64_t cur_wire = 0;
+    const std::uint8_t* p = nullptr;
+    const std::uint8_t* p_end = nullptr;
+    if ( !readTraceChunk(cur_wire, p, p_end) )
+      continue;
+    
+    switch(cur_wire) {
+      case thin_protobuf::getStringWire<1>::value: {
+        loadHeader(p, p_end);
+        return LastChunk;
+      };
+      case thin_protobuf::getStringWire<2>::value: {
+        cur_wire = loadVarInt(p, p_end);
+        /* cur_size = */ loadVarInt(p, p_end);
+        switch( cur_wire ) {
+          case thin_protobuf::getStringWire<1>::value:
+            loadBeginEntry(p, p_end);
+            if ( entryFilter && entryFilter(LastBeginEntry) ) {
+              skipEntrySubtree();
+              continue;
+            }
+            break;
+          case thin_protobuf::getStringWire<2>::value:
+            loadEndEntry(p, p_end);
+            break;
+          default: // ignore for fwd-compat.
+            LastChunk = ProtobufReader::Other;
+            break;
+        };
+        return LastChunk;
+      };
+      case thin_protobuf::getStringWire<3>::value: {
+        loadDictionaryEntry(p, p_end);
+        LastChunk = ProtobufReader::Other;
+        return LastChunk;
       };
+      case thin_protobuf::getStringWire<4>::value: {
+        // The dictionary of the compressed names that follow:
+        nameDecompressor.setDictionary(reinterpret_cast<const char*>(p), p_end - p);
+        LastChunk = ProtobufReader::Other;
+        return LastChunk;
+      };
+      default:
+        break;
+    }
+  }
+}
+
+bool ProtobufReader::seekTo(std::uint64_t aOffset, std::uint64_t aEnd) {
+  if ( isStreaming() ) {
+    if ( !in_buf || ( stream_start == std::streampos(-1) ) )
+      return false;
+    if ( in_buf->pubseekpos(stream_start + std::streamoff(aOffset), std::ios_base::in) == std::streampos(-1) )
+      return false;
+    resetBlock(aOffset);
+    blk_trace_end = aEnd;
+    return true;
+  } else if ( mem_begin ) {
+    if ( ( aOffset > aEnd ) || ( aEnd > mem_size ) )
+      return false;
+    mem_cur = mem_begin + aOffset;
+    mem_end = mem_begin + mem_size;
+    mem_trace_end = mem_begin + aEnd;
+    return true;
+  }
+  return false;
+}
+
+ProtobufReader::LastChunkType 
+    ProtobufReader::seekToTrace(const ProtobufTraceIndex& aIndex, std::size_t aTrace) {
+  LastChunk = ProtobufReader::EndOfFile;
+  if ( aTrace >= aIndex.Traces.size() )
+    return LastChunk;
+  if ( mem_begin && ( mem_size != aIndex.FileSize ) )
+    return LastChunk; // the index is not for this input.
+  const ProtobufTraceIndex::Trace& t = aIndex.Traces[aTrace];
+  // In case the trace has no header:
+  if ( !restoreSharedDictionary(t) || !seekTo(t.offset, t.message_end) )
+    return LastChunk;
+  Version = t.version;
+  SourceName = t.source_name;
+  return next();
+}
+
+ProtobufReader::LastChunkType 
+    ProtobufReader::seekToEntry(const ProtobufTraceIndex& aIndex, std::size_t aTrace, std::uint64_t aEntry) {
+  // The filter would skip some of the entries that are counted to reach the entry:
+  struct FilterSuspension {
+    EntryFilter& filter;
+    EntryFilter saved;
+    explicit FilterSuspension(EntryFilter& aFilter) : filter(aFilter) { saved.swap(filter); }
+    ~FilterSuspension() { saved.swap(filter); }
+  } suspension(entryFilter);
+  
+  LastChunk = ProtobufReader::EndOfFile;
+  if ( ( aTrace >= aIndex.Traces.size() ) || ( aEntry >= aIndex.Traces[aTrace].entry_count ) )
+    return LastChunk;
+  const ProtobufTraceIndex::Checkpoint* cp = aIndex.findCheckpoint(aTrace, aEntry);
+  std::uint64_t cur_entry = 0;
+  if ( !cp ) {
+    if ( seekToTrace(aIndex, aTrace) == ProtobufReader::Header )
+      next();
+  } else {
+    if ( mem_begin && ( mem_size != aIndex.FileSize ) )
+      return LastChunk; // the index is not for this input.
+    const ProtobufTraceIndex::Trace& t = aIndex.Traces[aTrace];
+    if ( !restoreSharedDictionary(t) )
       return LastChunk;
-    };
-    case thin_protobuf::getStringWire<3>::value: {
-      auto cur_size = thin_protobuf::loadVarIntAs<std::streamoff>(*buffer);
-      loadDictionaryEntry(buffer->tellg() + cur_size);
-      LastChunk = ProtobufReader::Other;
+    Version = t.version;
+    SourceName = t.source_name;
+    // Restore the string tables as they were at the checkpoint:
+    for(std::uint64_t def_offset : t.definitions) {
+      if ( def_offset >= cp->offset )
+        break;
+      if ( !seekTo(def_offset, aIndex.FileSize) ) {
+        LastChunk = ProtobufReader::EndOfFile;
+        return LastChunk;
+      }
+      next();
+    }
+    if ( !seekTo(cp->offset, cp->message_end) ) {
+      LastChunk = ProtobufReader::EndOfFile;
       return LastChunk;
-    };
-    default: { // ignore for fwd-compat.
-      thin_protobuf::skipData(*buffer, cur_wire);
-      return next(); // tail-call
-    };
+    }
+    next();
+    cur_entry = cp->entry;
   }
+  while ( ( LastChunk != ProtobufReader::EndOfFile ) && ( LastChunk != ProtobufReader::Header ) ) {
+    if ( ( LastChunk == ProtobufReader::BeginEntry ) || ( LastChunk == ProtobufReader::EndEntry ) ) {
+      if ( cur_entry == aEntry )
+        return LastChunk;
+      ++cur_entry;
+    }
+    next();
+  }
+  LastChunk = ProtobufReader::EndOfFile;
+  return LastChunk;
+}
+
+std::string ProtobufReader::getName(std::uint32_t aNameID) const {
+  std::string result;
+  appendName(aNameID, result);
+  return result;
 }
 
+boost::string_ref ProtobufReader::getNameRef(std::uint32_t aNameID) const {
+  if ( ( aNameID >= templateNameMap.size() ) || ( templateMarkerStarts[aNameID] != getMarkerEnd(aNameID) ) )
+    return boost::string_ref();
+  return templateNameMap[aNameID];
+}
 
-} // namespace templight
+const std::string& ProtobufReader::getFileName(std::uint32_t aFileID) const {
+  static const std::string empty_str;
+  if ( aFileID < fileNameMap.size() )
+    return fileNameMap[aFileID];
+  return empty_str;
+}
 
+void ProtobufReader::appendName(std::uint32_t aNameID, std::string& aOut) const {
+  if ( aNameID >= templateNameMap.size() )
+    return;
+  if ( templateMarkerStarts[aNameID] == getMarkerEnd(aNameID) ) {
+    boost::string_ref name = getNameRef(aNameID);
+    aOut.append(name.begin(), name.end());
+    return;
+  }
+  auto it = expansionCache.find(aNameID);
+  if ( it != expansionCache.end() ) {
+    expansionLRU.splice(expansionLRU.begin(), expansionLRU, it->second.lru_it);
+    aOut += it->second.name;
+    return;
+  }
+  std::size_t start = aOut.size();
+  aOut.reserve(start + templateNameLengths[aNameID]);
+  expandName(aNameID, aOut);
+  cacheExpansion(aNameID, aOut.data() + start, aOut.size() - start);
+}
+
+void ProtobufReader::appendFileName(std::uint32_t aFileID, std::string& aOut) const {
+  if ( aFileID < fileNameMap.size() )
+    aOut += fileNameMap[aFileID];
+}
+
+bool ProtobufReader::getDictionaryEntry(std::uint32_t aNameID, const char*& aMarkedName, std::size_t& aMarkedSize, 
+                                        const std::uint32_t*& aMarkers, std::size_t& aMarkerCount) const {
+  if ( ( aNameID >= templateNameMap.size() ) || !templateNameIsEntry[aNameID] )
+    return false;
+  aMarkedName = templateNameMap[aNameID].data();
+  aMarkedSize = templateNameMap[aNameID].size();
+  aMarkers = templateMarkers.data() + templateMarkerStarts[aNameID];
+  aMarkerCount = getMarkerEnd(aNameID) - templateMarkerStarts[aNameID];
+  return true;
+}
+
+void ProtobufReader::setEntryFilter(EntryFilter aFilter) {
+  entryFilter = std::move(aFilter);
+}
+
+void ProtobufReader::setRequiredFields(unsigned int aFields) {
+  requiredFields = aFields;
+}
+
+void ProtobufReader::setNameCacheLimit(std::size_t aBytes) {
+  expansionCacheLimit = aBytes;
+  expansionCache.clear();
+  expansionLRU.clear();
+  expansionCacheSize = 0;
+}
+
+
+} // namespace templight
@@ -0,0 +1,469 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/CompressedStreams.h>
+#include <templight/ProtobufTraceIndex.h>
+#include <templight/ThinProtobuf.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+
+namespace templight {
+
+
+namespace {
+
+using thin_protobuf::loadVarInt;
+using thin_protobuf::loadVarIntAs;
+using thin_protobuf::loadStringSpan;
+using thin_protobuf::skipData;
+
+const unsigned int index_version = 3;
+
+// The amount of bytes at the start of a trace file that its index checks (which covers its first header):
+const std::size_t head_hash_size = 1 << 16;
+
+std::uint64_t hashHead(const char* aData, std::size_t aSize) {
+  // FNV-1a, over 8 bytes at a time:
+  aSize = std::min(aSize, head_hash_size);
+  std::uint64_t h = 0xCBF29CE484222325ULL ^ aSize;
+  for(; aSize >= 8; aData += 8, aSize -= 8) {
+    std::uint64_t w;
+    std::memcpy(&w, aData, 8);
+    h = (h ^ w) * 0x100000001B3ULL;
+    h ^= h >> 29;
+  }
+  for(; aSize > 0; ++aData, --aSize)
+    h = (h ^ std::uint8_t(*aData)) * 0x100000001B3ULL;
+  return h ^ (h >> 32);
+}
+
+bool getFileTime(const std::string& aFilename, std::int64_t& aTime) {
+  boost::system::error_code ec;
+  std::time_t t = boost::filesystem::last_write_time(aFilename, ec);
+  if ( ec )
+    return false;
+  aTime = static_cast<std::int64_t>(t);
+  return true;
+}
+
+/* Tells if a source location message defines a filename (which then gets its file-id). */
+bool definesFileName(const std::uint8_t* p, const std::uint8_t* p_end) {
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    if ( cur_wire == thin_protobuf::getStringWire<1>::value ) {
+      std::size_t cur_size = 0;
+      loadStringSpan(p, p_end, cur_size);
+      if ( cur_size > 0 )
+        return true;
+    } else {
+      skipData(p, p_end, cur_wire);
+    }
+  }
+  return false;
+}
+
+/* Tells if a beginning entry message defines a filename, in its location or template origin. */
+bool beginDefinesFileName(const std::uint8_t* p, const std::uint8_t* p_end) {
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getStringWire<3>::value:
+      case thin_protobuf::getStringWire<6>::value: {
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = loadStringSpan(p, p_end, cur_size);
+        if ( definesFileName(p_sub, p_sub + cur_size) )
+          return true;
+        break;
+      }
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
+  }
+  return false;
+}
+
+void loadHeader(const std::uint8_t* p, const std::uint8_t* p_end, ProtobufTraceIndex::Trace& aTrace) {
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getVarIntWire<1>::value:
+        aTrace.version = loadVarIntAs<unsigned int>(p, p_end);
+        break;
+      case thin_protobuf::getStringWire<2>::value:
+        aTrace.source_name = thin_protobuf::loadString(p, p_end);
+        break;
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
+  }
+}
+
+ProtobufTraceIndex::Trace makeTrace(std::uint64_t aOffset, std::uint64_t aMessageEnd) {
+  ProtobufTraceIndex::Trace result;
+  result.offset = aOffset;
+  result.message_end = aMessageEnd;
+  result.version = 0;
+  result.entry_count = 0;
+  result.dictionary_offset = 0;
+  result.dictionary_size = 0;
+  return result;
+}
+
+void loadCheckpoint(const std::uint8_t* p, const std::uint8_t* p_end, ProtobufTraceIndex::Checkpoint& aCheckpoint) {
+  aCheckpoint.entry = aCheckpoint.offset = aCheckpoint.message_end = 0;
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getVarIntWire<1>::value:
+        aCheckpoint.entry = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<2>::value:
+        aCheckpoint.offset = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<3>::value:
+        aCheckpoint.message_end = loadVarInt(p, p_end);
+        break;
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
+  }
+}
+
+void loadTrace(const std::uint8_t* p, const std::uint8_t* p_end, ProtobufTraceIndex::Trace& aTrace) {
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getVarIntWire<1>::value:
+        aTrace.offset = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<2>::value:
+        aTrace.message_end = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<3>::value:
+        aTrace.version = loadVarIntAs<unsigned int>(p, p_end);
+        break;
+      case thin_protobuf::getStringWire<4>::value:
+        aTrace.source_name = thin_protobuf::loadString(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<5>::value:
+        aTrace.entry_count = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getStringWire<6>::value: {
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = loadStringSpan(p, p_end, cur_size);
+        const std::uint8_t* p_sub_end = p_sub + cur_size;
+        std::uint64_t offset = 0;
+        while ( p_sub < p_sub_end ) {
+          offset += loadVarInt(p_sub, p_sub_end);
+          aTrace.definitions.push_back(offset);
+        }
+        break;
+      }
+      case thin_protobuf::getStringWire<7>::value: {
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = loadStringSpan(p, p_end, cur_size);
+        ProtobufTraceIndex::Checkpoint cp;
+        loadCheckpoint(p_sub, p_sub + cur_size, cp);
+        aTrace.checkpoints.push_back(cp);
+        break;
+      }
+      case thin_protobuf::getVarIntWire<8>::value:
+        aTrace.dictionary_offset = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<9>::value:
+        aTrace.dictionary_size = loadVarInt(p, p_end);
+        break;
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
+  }
+}
+
+}
+
+
+void ProtobufTraceIndex::build(const char* aData, std::size_t aSize, unsigned int aStride) {
+  FileSize = aSize;
+  FileTime = 0;
+  HeadHash = hashHead(aData, aSize);
+  Stride = ( aStride == 0 ? 1 : aStride );
+  Traces.clear();
+
+  const std::uint8_t* p_begin = reinterpret_cast<const std::uint8_t*>(aData);
+  const std::uint8_t* p = p_begin;
+  const std::uint8_t* p_end = p_begin + aSize;
+  Trace* cur_trace = nullptr;
+  std::size_t depth = 0;
+  std::uint64_t top_count = 0;
+  std::uint64_t dict_offset = 0;
+  std::uint64_t dict_size = 0;
+
+  while ( p < p_end ) {
+    // A reader stops at anything other than a trace message or a shared dictionary:
+    auto cur_wire = loadVarInt(p, p_end);
+    if ( cur_wire == thin_protobuf::getStringWire<2>::value ) {
+      // The shared dictionary of the traces that follow, which ends the current trace:
+      std::size_t cur_size = 0;
+      dict_offset = loadStringSpan(p, p_end, cur_size) - p_begin;
+      dict_size = cur_size;
+      cur_trace = nullptr;
+      continue;
+    }
+    if ( cur_wire != thin_protobuf::getStringWire<1>::value )
+      break;
+    std::size_t cur_size = 0;
+    const std::uint8_t* q = loadStringSpan(p, p_end, cur_size);
+    const std::uint8_t* q_end = q + cur_size;
+    std::uint64_t msg_end = p - p_begin;
+
+    // Mirror the chunks that ProtobufReader::next() decodes:
+    while ( q < q_end ) {
+      std::uint64_t chunk_offset = q - p_begin;
+      auto chunk_wire = loadVarInt(q, q_end);
+      switch( chunk_wire ) {
+        case thin_protobuf::getStringWire<1>::value:
+        case thin_protobuf::getStringWire<2>::value:
+        case thin_protobuf::getStringWire<3>::value:
+        case thin_protobuf::getStringWire<4>::value:
+          break;
+        default: // ignore for fwd-compat.
+          skipData(q, q_end, chunk_wire);
+          continue;
+      }
+      std::size_t chunk_size = 0;
+      const std::uint8_t* c = loadStringSpan(q, q_end, chunk_size);
+      const std::uint8_t* c_end = c + chunk_size;
+
+      if ( chunk_wire == thin_protobuf::getStringWire<1>::value ) {
+        Traces.push_back(makeTrace(chunk_offset, msg_end));
+        cur_trace = &Traces.back();
+        cur_trace->dictionary_offset = dict_offset;
+        cur_trace->dictionary_size = dict_size;
+        loadHeader(c, c_end, *cur_trace);
+        depth = 0;
+        top_count = 0;
+        continue;
+      }
+      if ( !cur_trace ) { // a trace without header.
+        Traces.push_back(makeTrace(chunk_offset, msg_end));
+        cur_trace = &Traces.back();
+        cur_trace->dictionary_offset = dict_offset;
+        cur_trace->dictionary_size = dict_size;
+      }
+      if ( ( chunk_wire == thin_protobuf::getStringWire<3>::value ) || 
+           ( chunk_wire == thin_protobuf::getStringWire<4>::value ) ) {
+        cur_trace->definitions.push_back(chunk_offset);
+        continue;
+      }
+
+      auto entry_wire = loadVarInt(c, c_end);
+      /* entry_size = */ loadVarInt(c, c_end);
+      if ( entry_wire == thin_protobuf::getStringWire<1>::value ) {
+        if ( beginDefinesFileName(c, c_end) )
+          cur_trace->definitions.push_back(chunk_offset);
+        if ( ( depth == 0 ) && ( top_count++ % Stride == 0 ) ) {
+          Checkpoint cp;
+          cp.entry = cur_trace->entry_count;
+          cp.offset = chunk_offset;
+          cp.message_end = msg_end;
+          cur_trace->checkpoints.push_back(cp);
+        }
+        ++depth;
+        ++cur_trace->entry_count;
+      } else if ( entry_wire == thin_protobuf::getStringWire<2>::value ) {
+        if ( depth > 0 )
+          --depth;
+        ++cur_trace->entry_count;
+      }
+    }
+  }
+}
+
+bool ProtobufTraceIndex::buildFromFile(const std::string& aFilename, unsigned int aStride) {
+  std::unique_ptr<boost::iostreams::mapped_file_source> mapping;
+  try {
+    mapping.reset(new boost::iostreams::mapped_file_source(aFilename));
+  } catch(std::exception&) {
+    return false;
+  }
+  if ( !mapping->is_open() || 
+       ( detectCompression(mapping->data(), mapping->size()) != NoCompression ) )
+    return false; // compressed traces cannot be seeked.
+  build(mapping->data(), mapping->size(), aStride);
+  return getFileTime(aFilename, FileTime);
+}
+
+void ProtobufTraceIndex::save(std::ostream& aOS) const {
+  thin_protobuf::saveVarInt(aOS, 1, index_version); // version
+  thin_protobuf::saveVarInt(aOS, 2, FileSize);      // file_size
+  thin_protobuf::saveVarInt(aOS, 3, Stride);        // stride
+  if ( FileTime != 0 )
+    thin_protobuf::saveVarInt(aOS, 5, static_cast<std::uint64_t>(FileTime)); // file_time
+  thin_protobuf::saveVarInt(aOS, 6, HeadHash);      // head_hash
+  for(const Trace& t : Traces) {
+    std::ostringstream OS_trace;
+    thin_protobuf::saveVarInt(OS_trace, 1, t.offset);      // offset
+    thin_protobuf::saveVarInt(OS_trace, 2, t.message_end); // message_end
+    thin_protobuf::saveVarInt(OS_trace, 3, t.version);     // version
+    if ( !t.source_name.empty() )
+      thin_protobuf::saveString(OS_trace, 4, t.source_name); // source_file
+    thin_protobuf::saveVarInt(OS_trace, 5, t.entry_count); // entry_count
+    if ( !t.definitions.empty() ) {
+      std::ostringstream OS_defs;
+      std::uint64_t prev = 0;
+      for(std::uint64_t d : t.definitions) {
+        thin_protobuf::saveVarInt(OS_defs, d - prev);
+        prev = d;
+      }
+      thin_protobuf::saveString(OS_trace, 6, OS_defs.str()); // definitions
+    }
+    for(const Checkpoint& cp : t.checkpoints) {
+      std::ostringstream OS_cp;
+      thin_protobuf::saveVarInt(OS_cp, 1, cp.entry);       // entry
+      thin_protobuf::saveVarInt(OS_cp, 2, cp.offset);      // offset
+      thin_protobuf::saveVarInt(OS_cp, 3, cp.message_end); // message_end
+      thin_protobuf::saveString(OS_trace, 7, OS_cp.str()); // checkpoints
+    }
+    if ( t.dictionary_size > 0 ) {
+      thin_protobuf::saveVarInt(OS_trace, 8, t.dictionary_offset); // dictionary_offset
+      thin_protobuf::saveVarInt(OS_trace, 9, t.dictionary_size);   // dictionary_size
+    }
+    thin_protobuf::saveString(aOS, 4, OS_trace.str()); // traces
+  }
+  thin_protobuf::saveVarInt(aOS, 7, Traces.size()); // trace_count
+}
+
+bool ProtobufTraceIndex::load(std::istream& aIS) {
+  FileSize = 0;
+  FileTime = 0;
+  HeadHash = 0;
+  Stride = 0;
+  Traces.clear();
+
+  std::string contents((std::istreambuf_iterator<char>(aIS)), std::istreambuf_iterator<char>());
+  const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(contents.data());
+  const std::uint8_t* p_end = p + contents.size();
+  unsigned int version = 0;
+  std::uint64_t trace_count = ~std::uint64_t(0);
+  while ( p < p_end ) {
+    auto cur_wire = loadVarInt(p, p_end);
+    switch( cur_wire ) {
+      case thin_protobuf::getVarIntWire<1>::value:
+        version = loadVarIntAs<unsigned int>(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<2>::value:
+        FileSize = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<3>::value:
+        Stride = loadVarIntAs<unsigned int>(p, p_end);
+        break;
+      case thin_protobuf::getStringWire<4>::value: {
+        std::size_t cur_size = 0;
+        const std::uint8_t* p_sub = loadStringSpan(p, p_end, cur_size);
+        Traces.push_back(makeTrace(0, 0));
+        loadTrace(p_sub, p_sub + cur_size, Traces.back());
+        break;
+      }
+      case thin_protobuf::getVarIntWire<5>::value:
+        FileTime = static_cast<std::int64_t>(loadVarInt(p, p_end));
+        break;
+      case thin_protobuf::getVarIntWire<6>::value:
+        HeadHash = loadVarInt(p, p_end);
+        break;
+      case thin_protobuf::getVarIntWire<7>::value:
+        trace_count = loadVarInt(p, p_end);
+        break;
+      default:
+        skipData(p, p_end, cur_wire);
+        break;
+    }
+  }
+
+  // The count of traces comes last, such that a truncated sidecar lacks it (or the traces it counts):
+  if ( ( version != index_version ) || ( trace_count != Traces.size() ) ) {
+    Traces.clear();
+    return false;
+  }
+  return true;
+}
+
+bool ProtobufTraceIndex::saveToFile(const std::string& aFilename) const {
+  std::ofstream OS(aFilename, std::ios_base::out | std::ios_base::binary);
+  if ( !OS )
+    return false;
+  save(OS);
+  return static_cast<bool>(OS);
+}
+
+bool ProtobufTraceIndex::loadFromFile(const std::string& aFilename) {
+  std::ifstream IS(aFilename, std::ios_base::in | std::ios_base::binary);
+  if ( !IS )
+    return false;
+  return load(IS);
+}
+
+bool ProtobufTraceIndex::isUpToDate(const std::string& aFilename) const {
+  boost::system::error_code ec;
+  std::uint64_t file_size = boost::filesystem::file_size(aFilename, ec);
+  std::int64_t file_time = 0;
+  if ( ec || ( file_size != FileSize ) || !getFileTime(aFilename, file_time) || ( file_time != FileTime ) )
+    return false;
+  // The size and time of a rewritten file can be the same (e.g., within the time resolution):
+  std::ifstream IS(aFilename, std::ios_base::in | std::ios_base::binary);
+  std::string head(std::min<std::uint64_t>(file_size, head_hash_size), '\0');
+  if ( !IS.read(&head[0], head.size()) )
+    return false;
+  return ( hashHead(head.data(), head.size()) == HeadHash );
+}
+
+std::string ProtobufTraceIndex::getSidecarName(const std::string& aTraceFilename) {
+  return aTraceFilename + ".idx";
+}
+
+const ProtobufTraceIndex::Checkpoint*
+    ProtobufTraceIndex::findCheckpoint(std::size_t aTrace, std::uint64_t aEntry) const {
+  if ( aTrace >= Traces.size() )
+    return nullptr;
+  const std::vector<Checkpoint>& cps = Traces[aTrace].checkpoints;
+  auto it = std::upper_bound(cps.begin(), cps.end(), aEntry,
+    [](std::uint64_t e, const Checkpoint& cp) { return e < cp.entry; });
+  if ( it == cps.begin() )
+    return nullptr;
+  return &*(--it);
+}
+
+
+} // namespace templight
+
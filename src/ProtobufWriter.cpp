@@ -26,52 +26,221 @@
 
 #include <iostream>
 #include <fstream>
-#include <sstream>
 
+#include <algorithm>
 #include <vector>
 #include <string>
+#include <cstring>
 #include <cstdint>
 
 namespace templight {
 
 
-ProtobufWriter::ProtobufWriter(std::ostream& aOS, int aCompressLevel) : 
-  EntryWriter(aOS), compressionMode(aCompressLevel) { }
+namespace {
+
+const std::size_t no_cached_id = ~std::size_t(0);
+
+const std::size_t patched_length_width = 10; // enough for any length.
+
+const std::size_t name_arena_block_size = 1 << 16;
+
+// The amount of names to train the dictionary of names on, and the size of that dictionary:
+const std::size_t name_training_size = 4 << 20;
+const std::size_t name_dictionary_size = 64 << 10;
+
+const std::size_t no_name_pos = ~std::size_t(0);
+
+std::uint64_t hashTemplateName(const char* aName, std::size_t aSize) {
+  // FNV-1a, over 8 bytes at a time:
+  std::uint64_t h = 0xCBF29CE484222325ULL ^ aSize;
+  for(; aSize >= 8; aName += 8, aSize -= 8) {
+    std::uint64_t w;
+    std::memcpy(&w, aName, 8);
+    h = (h ^ w) * 0x100000001B3ULL;
+    h ^= h >> 29;
+  }
+  for(; aSize > 0; ++aName, --aSize)
+    h = (h ^ std::uint8_t(*aName)) * 0x100000001B3ULL;
+  return h ^ (h >> 32);
+}
+
+bool precededBy(const char* aName, std::size_t aPos, const char* aPrefix, std::size_t aPrefixSize) {
+  return ( aPos >= aPrefixSize ) && ( std::memcmp(aName + aPos - aPrefixSize, aPrefix, aPrefixSize) == 0 );
+}
+
+}
+
+ProtobufWriter::ProtobufWriter(std::ostream& aOS, int aCompressLevel, std::size_t aSegmentSize) : 
+  EntryWriter(aOS), templateNameCount(0), templateNameArenaNext(nullptr), templateNameArenaLeft(0), 
+  sharedTemplateNameCount(0), sharedEmptyFileID(no_cached_id), compressionMode(aCompressLevel), emptyFileID(no_cached_id), segmentSize(aSegmentSize), 
+  segmentMode(NotSegmented), patchPos(-1), segmentedLength(0), nameTraining(false), 
+  idSource(nullptr) { }
 
 void ProtobufWriter::initialize(const std::string& aSourceName) {
   
-  std::string hdr_contents;
-  {
-    std::ostringstream OS_inner;
-    
-    /*
+  // The dictionaries (and the ids of the entries' string tables) are only valid for one trace, 
+  // beyond the shared dictionary (if any):
+  buffer.clear();
+  segmentMode = NotSegmented;
+  fileNameMap = sharedFileNameMap;
+  templateNameSlots = sharedTemplateNameSlots;
+  templateNameCount = sharedTemplateNameCount;
+  templateNameArena.clear();
+  templateNameArenaNext = nullptr;
+  templateNameArenaLeft = 0;
+  emptyFileID = sharedEmptyFileID;
+  idSource = nullptr;
+  fileIDCache.clear();
+  nameIDCache.clear();
+  nameCompressor.clear();
+  // Without zstd, there is no dictionary to train, so the entries need not be held back:
+  nameTraining = ( compressionMode == 3 ) && hasZstdNameCompression();
+  
+  /*
   message TemplightHeader {
     required uint32 version = 1;
     optional string source_file = 2;
   }
-    */
-    
-    thin_protobuf::saveVarInt(OS_inner, 1, 1); // version
-    if ( !aSourceName.empty() ) 
-      thin_protobuf::saveString(OS_inner, 2, aSourceName); // source_file
-    
-    hdr_contents = OS_inner.str();
-  }
+  */
+  
+  std::size_t hdr_size = thin_protobuf::getVarIntFieldSize(1, 1);
+  if ( !aSourceName.empty() ) 
+    hdr_size += thin_protobuf::getStringFieldSize(2, aSourceName.size());
   
-  std::ostringstream OS;
   // required TemplightHeader header = 1;
-  thin_protobuf::saveString(OS, 1, hdr_contents);
-  buffer += OS.str();
+  thin_protobuf::saveStringHeader(buffer, 1, hdr_size);
+  thin_protobuf::saveVarInt(buffer, 1, 1); // version
+  if ( !aSourceName.empty() ) 
+    thin_protobuf::saveString(buffer, 2, aSourceName); // source_file
+  
+}
+
+void ProtobufWriter::writeSharedDictionary(const std::vector<std::string>& aNames, 
+                                           const std::vector<std::string>& aFileNames) {
+  
+  /*
+  message TemplightDictionary {
+    repeated string file_names = 1;
+    repeated DictionaryEntry names = 3;
+  }
+  */
+  
+  // The new shared dictionary replaces the previous one, so, start from empty tables:
+  sharedFileNameMap.clear();
+  sharedTemplateNameSlots.clear();
+  sharedTemplateNameCount = 0;
+  sharedTemplateNameArena.clear();
+  sharedEmptyFileID = no_cached_id;
+  initialize();
+  buffer.clear();
+  
+  for(const std::string& file_name : aFileNames) {
+    if ( !fileNameMap.emplace(file_name, fileNameMap.size()).second )
+      continue;
+    if ( file_name.empty() )
+      emptyFileID = fileNameMap.size() - 1;
+    thin_protobuf::saveString(buffer, 1, file_name); // file_names
+  }
+  if ( compressionMode == 2 ) {
+    for(const std::string& name : aNames)
+      createDictionaryEntry(name.data(), name.size()); // names
+  }
   
+  // optional TemplightDictionary dictionary = 2;
+  thin_protobuf::saveString(OutputOS, 2, buffer);
+  buffer.clear();
+  
+  sharedFileNameMap = fileNameMap;
+  sharedTemplateNameSlots = templateNameSlots;
+  sharedTemplateNameCount = templateNameCount;
+  sharedTemplateNameArena.swap(templateNameArena);
+  templateNameArenaNext = nullptr;
+  templateNameArenaLeft = 0;
+  sharedEmptyFileID = emptyFileID;
+}
+
+void ProtobufWriter::finishNameTraining() {
+  nameTraining = false;
+  if ( nameCompressor.train(trainingNames, trainingNameSizes, name_dictionary_size) ) {
+    // optional bytes name_dictionary = 4;
+    thin_protobuf::saveString(buffer, 4, nameCompressor.getDictionary());
+  }
+  std::size_t i_begin = 0, i_end = 0;
+  for(bool is_begin : trainingIsBegin) {
+    if ( is_begin )
+      printEntry(trainingBegins[i_begin++]);
+    else
+      printEntry(trainingEnds[i_end++]);
+  }
+  std::string().swap(trainingNames);
+  std::vector< std::size_t >().swap(trainingNameSizes);
+  std::vector< bool >().swap(trainingIsBegin);
+  std::vector< PrintableEntryBegin >().swap(trainingBegins);
+  std::vector< PrintableEntryEnd >().swap(trainingEnds);
 }
 
 void ProtobufWriter::finalize() {
-  // repeated TemplightTrace traces = 1;
-  thin_protobuf::saveString(OutputOS, 1, buffer);
+  if ( nameTraining )
+    finishNameTraining();
+  switch( segmentMode ) {
+    case PatchedSegments: {
+      OutputOS.write(buffer.data(), buffer.size());
+      segmentedLength += buffer.size();
+      std::streampos end_pos = OutputOS.tellp();
+      OutputOS.seekp(patchPos);
+      thin_protobuf::savePaddedVarInt(OutputOS, segmentedLength, patched_length_width);
+      OutputOS.seekp(end_pos);
+      break;
+    }
+    case ContinuedSegments:
+      if ( buffer.empty() )
+        break;
+      // fall-through: the last segment.
+    case NotSegmented:
+    default:
+      // repeated TemplightTrace traces = 1;
+      thin_protobuf::saveString(OutputOS, 1, buffer);
+      break;
+  }
+  buffer.clear();
+  segmentMode = NotSegmented;
+}
+
+void ProtobufWriter::writeSegment() {
+  if ( segmentMode == NotSegmented ) {
+    // Start the message with a length to back-patch, if the output can seek back to it:
+    std::streampos start_pos = OutputOS.tellp();
+    if ( start_pos != std::streampos(-1) ) {
+      // repeated TemplightTrace traces = 1;
+      thin_protobuf::saveVarInt(OutputOS, (1 << 3) | 2);
+      patchPos = OutputOS.tellp();
+      thin_protobuf::savePaddedVarInt(OutputOS, 0, patched_length_width);
+      segmentedLength = 0;
+      segmentMode = PatchedSegments;
+    } else {
+      segmentMode = ContinuedSegments;
+    }
+  }
+  if ( segmentMode == PatchedSegments ) {
+    OutputOS.write(buffer.data(), buffer.size());
+    segmentedLength += buffer.size();
+  } else {
+    // A trace message without a header, which continues the trace:
+    thin_protobuf::saveString(OutputOS, 1, buffer);
+  }
+  buffer.clear();
 }
 
-std::string ProtobufWriter::printEntryLocation(
-    const std::string& FileName, int Line, int Column) {
+std::size_t ProtobufWriter::getCachedFileID(const PrintableEntryBegin& aEntry, std::uint32_t aFileID) const {
+  if ( ( aFileID != InvalidStringID ) && aEntry.Strings && ( aEntry.Strings == idSource ) && 
+       ( aFileID < fileIDCache.size() ) )
+    return fileIDCache[aFileID];
+  return no_cached_id;
+}
+
+void ProtobufWriter::resolveEntryLocation(const PrintableEntryBegin& aEntry, std::uint32_t aFileID, 
+    const std::string& (PrintableEntryBegin::*aGetFileName)() const, int Line, int Column, 
+    ResolvedLocation& aLoc) {
   
   /*
   message SourceLocation {
@@ -82,197 +251,363 @@ std::string ProtobufWriter::printEntryLocation(
   }
   */
   
-  std::ostringstream OS_inner;
-  
-  std::unordered_map< std::string, std::size_t >::iterator 
-    it = fileNameMap.find(FileName);
-  
-  if ( it == fileNameMap.end() ) {
-    thin_protobuf::saveString(OS_inner, 1, FileName); // file_name
-    std::size_t file_id = fileNameMap.size();
-    thin_protobuf::saveVarInt(OS_inner, 2, file_id);     // file_id
-    fileNameMap[FileName] = file_id;
-  } else {
-    thin_protobuf::saveVarInt(OS_inner, 2, it->second);     // file_id
+  aLoc.new_file_name = nullptr;
+  aLoc.file_id = getCachedFileID(aEntry, aFileID);
+  if ( aLoc.file_id == no_cached_id ) {
+    const std::string& FileName = (aEntry.*aGetFileName)();
+    std::unordered_map< std::string, std::size_t >::iterator 
+      it = fileNameMap.find(FileName);
+    
+    if ( it == fileNameMap.end() ) {
+      aLoc.file_id = fileNameMap.size();
+      aLoc.new_file_name = &(fileNameMap.emplace(FileName, aLoc.file_id).first->first);
+      if ( FileName.empty() )
+        emptyFileID = aLoc.file_id;
+    } else {
+      aLoc.file_id = it->second;
+    }
+    
+    if ( ( aFileID != InvalidStringID ) && aEntry.Strings && ( aEntry.Strings == idSource ) ) {
+      if ( fileIDCache.size() <= aFileID )
+        fileIDCache.resize(aFileID + 1, no_cached_id);
+      fileIDCache[aFileID] = aLoc.file_id;
+    }
   }
   
-  thin_protobuf::saveVarInt(OS_inner, 3, Line);     // line
-  thin_protobuf::saveVarInt(OS_inner, 4, Column);   // column
-  
-  return OS_inner.str();
+  aLoc.line = static_cast<std::uint64_t>(Line);
+  aLoc.column = static_cast<std::uint64_t>(Column);
+  aLoc.size = thin_protobuf::getVarIntFieldSize(2, aLoc.file_id) + 
+              thin_protobuf::getVarIntFieldSize(3, aLoc.line) + 
+              thin_protobuf::getVarIntFieldSize(4, aLoc.column);
+  if ( aLoc.new_file_name )
+    aLoc.size += thin_protobuf::getStringFieldSize(1, aLoc.new_file_name->size());
 }
 
-static void trimSpaces(std::string::iterator& it, std::string::iterator& it_end) {
-  while ( it < it_end ) {
-    if ( *it == ' ' )
-      ++it;
-    else if ( *it_end == ' ' )
-      --it_end;
-    else
-      break;
+bool ProtobufWriter::hasTempOriFileName(const PrintableEntryBegin& aEntry) const {
+  // Avoid materializing the filename when its id is known:
+  std::size_t file_id = getCachedFileID(aEntry, aEntry.TempOri_FileID);
+  if ( file_id != no_cached_id )
+    return ( file_id != emptyFileID );
+  return !aEntry.getTempOriFileName().empty();
+}
+
+void ProtobufWriter::saveEntryLocation(unsigned int aTag, const ResolvedLocation& aLoc) {
+  thin_protobuf::saveStringHeader(buffer, aTag, aLoc.size);
+  if ( aLoc.new_file_name )
+    thin_protobuf::saveString(buffer, 1, *aLoc.new_file_name); // file_name
+  thin_protobuf::saveVarInt(buffer, 2, aLoc.file_id);           // file_id
+  thin_protobuf::saveVarInt(buffer, 3, aLoc.line);              // line
+  thin_protobuf::saveVarInt(buffer, 4, aLoc.column);            // column
+}
+
+ProtobufWriter::TemplateNameSlot& ProtobufWriter::findTemplateNameSlot(std::uint64_t aHash, 
+                                                                     const char* aName, std::size_t aSize) {
+  // Linear probing, from the slot of the hash to the slot of the name or an empty slot:
+  const std::size_t mask = templateNameSlots.size() - 1;
+  for(std::size_t i = aHash & mask; ; i = (i + 1) & mask) {
+    TemplateNameSlot& slot = templateNameSlots[i];
+    if ( ( slot.id == no_cached_id ) || 
+         ( ( slot.hash == aHash ) && ( slot.size == aSize ) && ( std::memcmp(slot.data, aName, aSize) == 0 ) ) )
+      return slot;
   }
-  ++it_end;
 }
 
-std::size_t ProtobufWriter::createDictionaryEntry(const std::string& NameOrig) {
-  std::unordered_map< std::string, std::size_t >::iterator 
-    it_found = templateNameMap.find(NameOrig);
-  if ( it_found != templateNameMap.end() )
-    return it_found->second;
-  
-  // FIXME: Convert this code to being constructive of "Name", instead of destructive (replacing sub-strings with '\0' characters).
-  std::string Name = NameOrig;
-  std::string::iterator it_open = Name.end();
-  std::string::iterator it_colon_lo = Name.begin();
-  int srch_state = 0;
-  std::vector<std::size_t> markers;
-  for(std::string::iterator it = Name.begin(); it != Name.end(); ++it) {
+void ProtobufWriter::growTemplateNameSlots() {
+  std::vector< TemplateNameSlot > old_slots;
+  old_slots.swap(templateNameSlots);
+  TemplateNameSlot empty_slot = { 0, nullptr, 0, no_cached_id };
+  templateNameSlots.resize(std::max(old_slots.size() * 2, std::size_t(1024)), empty_slot);
+  for(const TemplateNameSlot& slot : old_slots)
+    if ( slot.id != no_cached_id )
+      findTemplateNameSlot(slot.hash, slot.data, slot.size) = slot;
+}
+
+const char* ProtobufWriter::storeTemplateName(const char* aName, std::size_t aSize) {
+  if ( templateNameArenaLeft < aSize ) {
+    std::size_t block_size = std::max(aSize, name_arena_block_size);
+    templateNameArena.emplace_back(new char[block_size]);
+    templateNameArenaNext = templateNameArena.back().get();
+    templateNameArenaLeft = block_size;
+  }
+  char* p = templateNameArenaNext;
+  std::memcpy(p, aName, aSize);
+  templateNameArenaNext += aSize;
+  templateNameArenaLeft -= aSize;
+  return p;
+}
+
+std::size_t ProtobufWriter::createDictionaryEntry(const char* aName, std::size_t aSize) {
+  // Keep the table at most half full:
+  if ( 2 * ( templateNameCount + 1 ) > templateNameSlots.size() )
+    growTemplateNameSlots();
+  const std::uint64_t hash = hashTemplateName(aName, aSize);
+  {
+    const TemplateNameSlot& slot = findTemplateNameSlot(hash, aName, aSize);
+    if ( slot.id != no_cached_id )
+      return slot.id;
+  }
+  
+  /* The name is split, in a single pass, into the parts before "::" separators 
+   * and the arguments of its top-level template argument lists, each of which 
+   * becomes a (recursively split) dictionary entry, and the marked name is the 
+   * name with each of these parts replaced by a '\0' marker. The marked name 
+   * and the markers are built on top of the stacks shared by the nested entries. */
+  const std::size_t marked_start = markedNameStack.size();
+  const std::size_t markers_start = markerStack.size();
+  std::size_t copied = 0;     // the end of the part of the name already in the marked name.
+  std::size_t open = no_name_pos;          // the last '<' or ',' of the argument list.
+  std::size_t colon_lo = 0;   // the start of the part after the last "::" (if any).
+  int srch_state = 0;         // 0: outside the argument list, 1: in it, 2+: in nested lists.
+  
+  // Replaces the part [lo, hi) of the name with a marker of its dictionary entry:
+  auto add_marker = [&](std::size_t lo, std::size_t hi) {
+    std::size_t id = createDictionaryEntry(aName + lo, hi - lo);
+    markerStack.push_back(id);
+    markedNameStack.append(aName + copied, lo - copied);
+    markedNameStack.push_back('\0');
+    copied = hi;
+  };
+  
+  for(std::size_t i = 0; i < aSize; ++i) {
+    const char c = aName[i];
     switch(srch_state) {
       case 0: 
-        if ( *it == '<' ) {
+        if ( c == '<' ) {
           // check for "operator<<", "operator<" and "operator<="
-          if ( std::string(it - 8, it + 1) == "operator<" ) {
-            it_open = Name.end();
-            srch_state = 0;
+          if ( precededBy(aName, i + 1, "operator<", 9) ) {
+            open = no_name_pos;
           } else {
-            it_open = it;
+            open = i;
             ++srch_state;
           }
-        } else if ( (*it == ':') && (it + 1 < Name.end()) && (*(it+1) == ':') ) {
-          if ( it_colon_lo < it ) {
-            markers.push_back( createDictionaryEntry(std::string(it_colon_lo, it)) );
-            std::size_t offset_lo  = it_colon_lo - Name.begin();
-            Name.replace(it_colon_lo, it, 1, '\0');
-            it = Name.begin() + offset_lo + 2;
-          } else {
-            it += 1;
-          }
-          it_colon_lo = it + 1;
-          it_open = Name.end();
+        } else if ( ( c == ':' ) && ( i + 1 < aSize ) && ( aName[i + 1] == ':' ) ) {
+          if ( colon_lo < i )
+            add_marker(colon_lo, i);
+          ++i;
+          colon_lo = i + 1;
+          open = no_name_pos;
         }
         break;
       case 1:
-        if ( *it == '<' ) {
+        if ( c == '<' ) {
           // check for "operator<<" and "operator<"
-          if ( std::string(it - 10, it + 1) == "operator<<<" ) {
-            it_open = it;
-            srch_state = 1;
-          } else {
+          if ( precededBy(aName, i + 1, "operator<<<", 11) ) 
+            open = i;
+          else
             ++srch_state;
+        } else if ( ( c == ',' ) || ( c == '>' ) ) {
+          if ( ( colon_lo != no_name_pos ) && ( colon_lo < open ) )
+            add_marker(colon_lo, open);
+          // The argument, without its surrounding spaces (but a blank argument keeps one):
+          std::size_t lo = open + 1;
+          std::size_t hi = i;
+          while ( ( lo + 1 < hi ) && ( ( aName[lo] == ' ' ) || ( aName[hi - 1] == ' ' ) ) ) {
+            if ( aName[lo] == ' ' )
+              ++lo;
+            else
+              --hi;
           }
-        } else if ( ( *it == ',' ) || ( *it == '>' ) ) {
-          if ( it_colon_lo < it_open ) {
-            std::size_t offset_end = it - it_open;
-            std::size_t offset_lo  = it_colon_lo - Name.begin();
-            markers.push_back( createDictionaryEntry(std::string(it_colon_lo, it_open)) );
-            Name.replace(it_colon_lo, it_open, 1, '\0');
-            it_open = Name.begin() + offset_lo + 1;
-            it = it_open + offset_end;
-            it_colon_lo = Name.end();
-          }
-          std::string::iterator it_lo = it_open + 1;
-          std::string::iterator it_hi = it - 1;
-          trimSpaces(it_lo, it_hi);
-          // Create or find the marker entry:
-          markers.push_back( createDictionaryEntry(std::string(it_lo, it_hi)) );
-          std::size_t offset_end = it - it_hi;
-          std::size_t offset_lo  = it_lo - Name.begin();
-          Name.replace(it_lo, it_hi, 1, '\0');
-          it = Name.begin() + offset_lo + 1 + offset_end;
-          it_open = it;
-          it_colon_lo = Name.end();
-          if ( *it == '>' ) {
-            it_open = Name.end();
+          add_marker(lo, hi);
+          open = i;
+          colon_lo = no_name_pos;
+          if ( c == '>' ) {
+            open = no_name_pos;
             srch_state = 0;
-            it_colon_lo = it + 1;
+            colon_lo = i + 1;
           }
         }
         break;
       default:
-        if ( *it == '<' ) {
+        if ( c == '<' ) {
           ++srch_state;
-        } else if ( *it == '>' ) {
+        } else if ( c == '>' ) {
           --srch_state;
         }
         break;
     }
   }
-  if ( !markers.empty() && it_colon_lo != Name.end() ) {
-    markers.push_back( createDictionaryEntry(std::string(it_colon_lo, Name.end())) );
-    Name.replace(it_colon_lo, Name.end(), 1, '\0');
-  }
+  if ( ( markerStack.size() > markers_start ) && ( colon_lo != no_name_pos ) && ( colon_lo != aSize ) )
+    add_marker(colon_lo, aSize);
+  markedNameStack.append(aName + copied, aSize - copied);
   
+  const std::size_t id = saveDictionaryEntry(markedNameStack.data() + marked_start, 
+                                             markedNameStack.size() - marked_start, markers_start);
+  markedNameStack.resize(marked_start);
+  
+  // The slot is looked up again, since the nested entries can have taken it or grown the table:
+  TemplateNameSlot& slot = findTemplateNameSlot(hash, aName, aSize);
+  slot.hash = hash;
+  slot.data = storeTemplateName(aName, aSize);
+  slot.size = aSize;
+  slot.id = id;
+  
+  return id;
+}
+
+std::size_t ProtobufWriter::saveDictionaryEntry(const char* aMarkedName, std::size_t aSize, 
+                                                std::size_t aMarkersStart) {
   /*
   message DictionaryEntry {
     required string marked_name = 1;
     repeated uint32 marker_ids = 2;
   }
   */
-  std::ostringstream OS_dict;
-  thin_protobuf::saveString(OS_dict, 1, Name); // marked_name
-  for(std::vector<std::size_t>::iterator mk = markers.begin(),
-      mk_end = markers.end(); mk != mk_end; ++mk) {
-    thin_protobuf::saveVarInt(OS_dict, 2, *mk); // marker_ids
+  std::size_t dict_size = thin_protobuf::getStringFieldSize(1, aSize);
+  for(std::size_t j = aMarkersStart; j < markerStack.size(); ++j)
+    dict_size += thin_protobuf::getVarIntFieldSize(2, markerStack[j]);
+  
+  // repeated DictionaryEntry names = 3;
+  thin_protobuf::saveStringHeader(buffer, 3, dict_size);
+  thin_protobuf::saveString(buffer, 1, aMarkedName, aSize); // marked_name
+  for(std::size_t j = aMarkersStart; j < markerStack.size(); ++j)
+    thin_protobuf::saveVarInt(buffer, 2, markerStack[j]); // marker_ids
+  markerStack.resize(aMarkersStart);
+  
+  return templateNameCount++;
+}
+
+std::size_t ProtobufWriter::copyDictionaryEntry(std::uint32_t aNameID) {
+  if ( ( aNameID < nameIDCache.size() ) && ( nameIDCache[aNameID] != no_cached_id ) )
+    return nameIDCache[aNameID];
+  
+  const char* marked_name = nullptr;
+  std::size_t marked_size = 0;
+  const std::uint32_t* markers = nullptr;
+  std::size_t marker_count = 0;
+  if ( !idSource->getDictionaryEntry(aNameID, marked_name, marked_size, markers, marker_count) )
+    return no_cached_id;
+  
+  // The name can already be an entry (e.g., created by splitting up another name):
+  std::string name;
+  idSource->appendName(aNameID, name);
+  if ( 2 * ( templateNameCount + 1 ) > templateNameSlots.size() )
+    growTemplateNameSlots();
+  const std::uint64_t hash = hashTemplateName(name.data(), name.size());
+  std::size_t id = findTemplateNameSlot(hash, name.data(), name.size()).id;
+  if ( id != no_cached_id ) {
+    if ( nameIDCache.size() <= aNameID )
+      nameIDCache.resize(aNameID + 1, no_cached_id);
+    nameIDCache[aNameID] = id;
+    return id;
   }
-  std::string dict_entry = OS_dict.str();
   
-  std::size_t id = templateNameMap.size();
-  templateNameMap[NameOrig] = id;
+  // Copy the entry as it is, with the ids that its sub-names have in this dictionary:
+  const std::size_t markers_start = markerStack.size();
+  for(std::size_t j = 0; j < marker_count; ++j) {
+    std::size_t id = ( markers[j] == InvalidStringID ? no_cached_id : copyDictionaryEntry(markers[j]) );
+    if ( id == no_cached_id ) {
+      // Sub-names that are not dictionary entries are split up like any other name:
+      std::string sub_name;
+      if ( markers[j] != InvalidStringID )
+        idSource->appendName(markers[j], sub_name);
+      id = createDictionaryEntry(sub_name.data(), sub_name.size());
+    }
+    markerStack.push_back(id);
+  }
+  id = saveDictionaryEntry(marked_name, marked_size, markers_start);
   
-  std::ostringstream OS_outer;
-  // repeated DictionaryEntry names = 3;
-  thin_protobuf::saveString(OS_outer, 3, dict_entry);
-  buffer += OS_outer.str();
+  // Register the name, as for the entries created from names (see createDictionaryEntry):
+  TemplateNameSlot& slot = findTemplateNameSlot(hash, name.data(), name.size());
+  slot.hash = hash;
+  slot.data = storeTemplateName(name.data(), name.size());
+  slot.size = name.size();
+  slot.id = id;
   
+  if ( nameIDCache.size() <= aNameID )
+    nameIDCache.resize(aNameID + 1, no_cached_id);
+  nameIDCache[aNameID] = id;
+  return id;
+}
+
+std::size_t ProtobufWriter::lookupDictionaryEntry(const PrintableEntryBegin& aEntry) {
+  std::uint32_t name_id = aEntry.NameID;
+  if ( ( name_id == InvalidStringID ) || !aEntry.Strings || ( aEntry.Strings != idSource ) )
+    return createDictionaryEntry(aEntry.getName().data(), aEntry.getName().size());
+  // With a shared dictionary, names are split up, to find the entries that it already has:
+  std::size_t id = no_cached_id;
+  if ( sharedTemplateNameCount == 0 )
+    id = copyDictionaryEntry(name_id);
+  else if ( name_id < nameIDCache.size() )
+    id = nameIDCache[name_id];
+  if ( id == no_cached_id ) {
+    id = createDictionaryEntry(aEntry.getName().data(), aEntry.getName().size());
+    if ( nameIDCache.size() <= name_id )
+      nameIDCache.resize(name_id + 1, no_cached_id);
+    nameIDCache[name_id] = id;
+  }
   return id;
 }
 
-std::string ProtobufWriter::printTemplateName(const std::string& Name) {
+void ProtobufWriter::printEntry(const PrintableEntryBegin& aEntry) {
+  
+  if ( nameTraining ) {
+    // Hold back the entry until the dictionary of names is trained:
+    const std::string& name = aEntry.getName();
+    trainingNames += name;
+    trainingNameSizes.push_back(name.size());
+    trainingIsBegin.push_back(true);
+    trainingBegins.push_back(aEntry);
+    trainingBegins.back().detachStrings();
+    if ( trainingNames.size() >= name_training_size )
+      finishNameTraining();
+    return;
+  }
+  
+  if ( idSource == nullptr )
+    idSource = aEntry.Strings;
+  
+  // Resolve the name and locations first, since this can add dictionary 
+  // entries to the buffer, which must precede the entry:
   
   /*
   message TemplateName {
     optional string name = 1;
     optional bytes compressed_name = 2;
+    optional uint32 dict_id = 3;
   }
   */
   
-  std::ostringstream OS_inner;
-  
+  const std::string* name = nullptr;
+  unsigned int name_tag = 3;
+  std::size_t dict_id = 0;
+  std::size_t name_size = 0;
   switch( compressionMode ) {
-#if 0
-    case 1: { // zlib-compressed name:
-      llvm::SmallVector<char, 32> CompressedBuffer;
-      if ( llvm::zlib::compress(llvm::StringRef(Name), CompressedBuffer) 
-                == llvm::zlib::StatusOK ) {
-        // optional bytes compressed_name = 2;
-        thin_protobuf::saveString(OS_inner, 2, 
-          llvm::StringRef(CompressedBuffer.begin(), CompressedBuffer.size()));
-        break;
-      } // else, go to case 0:
-    }
-#endif
     case 0:
-      // optional string name = 1;
-      thin_protobuf::saveString(OS_inner, 1, Name); // name
+      name = &aEntry.getName();
+      name_tag = 1;
+      break;
+    case 1:
+    case 3:
+      name = &aEntry.getName();
+      name_tag = 1;
+      // Names that cannot be compressed are stored plain:
+      if ( ( ( compressionMode == 1 ) || nameCompressor.hasDictionary() ) && 
+           nameCompressor.compress(name->data(), name->size(), compressedName) ) {
+        name = &compressedName;
+        name_tag = 2;
+      }
       break;
     case 2:
     default:
-      // optional uint32 dict_id = 3;
-      thin_protobuf::saveVarInt(OS_inner, 3, 
-        createDictionaryEntry(Name));
+      dict_id = lookupDictionaryEntry(aEntry);
       break;
   }
+  if ( name )
+    name_size = thin_protobuf::getStringFieldSize(name_tag, name->size());
+  else
+    name_size = thin_protobuf::getVarIntFieldSize(3, dict_id);
   
-  return OS_inner.str();
-}
-
-void ProtobufWriter::printEntry(const PrintableEntryBegin& aEntry) {
+  ResolvedLocation loc;
+  resolveEntryLocation(aEntry, aEntry.FileID, &PrintableEntryBegin::getFileName, 
+                       aEntry.Line, aEntry.Column, loc);
   
-  std::string entry_contents;
-  {
-    std::ostringstream OS_inner;
-    
-    /*
+  ResolvedLocation ori;
+  bool has_ori = hasTempOriFileName(aEntry);
+  if ( has_ori )
+    resolveEntryLocation(aEntry, aEntry.TempOri_FileID, &PrintableEntryBegin::getTempOriFileName, 
+                         aEntry.TempOri_Line, aEntry.TempOri_Column, ori);
+  
+  /*
   message Begin {
     required InstantiationKind kind = 1;
     required string name = 2;
@@ -281,94 +616,72 @@ void ProtobufWriter::printEntry(const PrintableEntryBegin& aEntry) {
     optional uint64 memory_usage = 5;
     optional SourceLocation template_origin = 6;
   }
-    */
-    
-    thin_protobuf::saveVarInt(OS_inner, 1, aEntry.InstantiationKind);    // kind
-    thin_protobuf::saveString(OS_inner, 2, 
-                         printTemplateName(aEntry.Name));                 // name
-    thin_protobuf::saveString(OS_inner, 3, 
-                               printEntryLocation(aEntry.FileName, 
-                                                  aEntry.Line, 
-                                                  aEntry.Column)); // location
-    thin_protobuf::saveDouble(OS_inner, 4, aEntry.TimeStamp);            // time_stamp
-    if ( aEntry.MemoryUsage > 0 )
-      thin_protobuf::saveVarInt(OS_inner, 5, aEntry.MemoryUsage);        // memory_usage
-    if ( !aEntry.TempOri_FileName.empty() )
-      thin_protobuf::saveString(OS_inner, 6, 
-                                 printEntryLocation(aEntry.TempOri_FileName, 
-                                                    aEntry.TempOri_Line, 
-                                                    aEntry.TempOri_Column)); // template_origin
-    
-    entry_contents = OS_inner.str();
-  }
+  */
   
-  std::string oneof_contents;
-  {
-    std::ostringstream OS_inner;
-    
-    /*
-  oneof begin_or_end {
-    Begin begin = 1;
-    End end = 2;
-  } 
-     */
-    
-    thin_protobuf::saveString(OS_inner, 1, entry_contents); // begin
-    
-    oneof_contents = OS_inner.str();
-  }
+  std::uint64_t kind = static_cast<std::uint64_t>(aEntry.InstantiationKind);
+  std::size_t begin_size = thin_protobuf::getVarIntFieldSize(1, kind) + 
+                           thin_protobuf::getStringFieldSize(2, name_size) + 
+                           thin_protobuf::getStringFieldSize(3, loc.size) + 
+                           thin_protobuf::getDoubleFieldSize(4);
+  if ( aEntry.MemoryUsage > 0 )
+    begin_size += thin_protobuf::getVarIntFieldSize(5, aEntry.MemoryUsage);
+  if ( has_ori )
+    begin_size += thin_protobuf::getStringFieldSize(6, ori.size);
+  
+  // repeated TemplightEntry entries = 2;  (oneof begin_or_end: Begin begin = 1;)
+  thin_protobuf::saveStringHeader(buffer, 2, thin_protobuf::getStringFieldSize(1, begin_size));
+  thin_protobuf::saveStringHeader(buffer, 1, begin_size);
   
-  std::ostringstream OS;
-  // repeated TemplightEntry entries = 2;
-  thin_protobuf::saveString(OS, 2, oneof_contents);
-  buffer += OS.str();
+  thin_protobuf::saveVarInt(buffer, 1, kind);                     // kind
+  thin_protobuf::saveStringHeader(buffer, 2, name_size);          // name
+  if ( name )
+    thin_protobuf::saveString(buffer, name_tag, *name);
+  else
+    thin_protobuf::saveVarInt(buffer, 3, dict_id);
+  saveEntryLocation(3, loc);                                       // location
+  thin_protobuf::saveDouble(buffer, 4, aEntry.TimeStamp);         // time_stamp
+  if ( aEntry.MemoryUsage > 0 )
+    thin_protobuf::saveVarInt(buffer, 5, aEntry.MemoryUsage);     // memory_usage
+  if ( has_ori )
+    saveEntryLocation(6, ori);                                     // template_origin
+  
+  if ( segmentSize && ( buffer.size() >= segmentSize ) )
+    writeSegment();
   
 }
 
 void ProtobufWriter::printEntry(const PrintableEntryEnd& aEntry) {
   
-  std::string entry_contents;
-  {
-    std::ostringstream OS_inner;
-    
-    /*
+  if ( nameTraining ) {
+    trainingIsBegin.push_back(false);
+    trainingEnds.push_back(aEntry);
+    return;
+  }
+  
+  /*
   message End {
     optional double time_stamp = 1;
     optional uint64 memory_usage = 2;
   }
-    */
-    
-    thin_protobuf::saveDouble(OS_inner, 1, aEntry.TimeStamp);     // time_stamp
-    if ( aEntry.MemoryUsage > 0 )
-      thin_protobuf::saveVarInt(OS_inner, 2, aEntry.MemoryUsage); // memory_usage
-    
-    entry_contents = OS_inner.str();
-  }
+  */
   
-  std::string oneof_contents;
-  {
-    std::ostringstream OS_inner;
-    
-    /*
-  oneof begin_or_end {
-    Begin begin = 1;
-    End end = 2;
-  } 
-     */
-    
-    thin_protobuf::saveString(OS_inner, 2, entry_contents); // end
-    
-    oneof_contents = OS_inner.str();
-  }
+  std::size_t end_size = thin_protobuf::getDoubleFieldSize(1);
+  if ( aEntry.MemoryUsage > 0 )
+    end_size += thin_protobuf::getVarIntFieldSize(2, aEntry.MemoryUsage);
+  
+  // repeated TemplightEntry entries = 2;  (oneof begin_or_end: End end = 2;)
+  thin_protobuf::saveStringHeader(buffer, 2, thin_protobuf::getStringFieldSize(2, end_size));
+  thin_protobuf::saveStringHeader(buffer, 2, end_size);
   
-  std::ostringstream OS;
-  // repeated TemplightEntry entries = 2;
-  thin_protobuf::saveString(OS, 2, oneof_contents);
-  buffer += OS.str();
+  thin_protobuf::saveDouble(buffer, 1, aEntry.TimeStamp);       // time_stamp
+  if ( aEntry.MemoryUsage > 0 )
+    thin_protobuf::saveVarInt(buffer, 2, aEntry.MemoryUsage);   // memory_usage
+  
+  if ( segmentSize && ( buffer.size() >= segmentSize ) )
+    writeSegment();
   
 }
 
 
 
 } // namespace templight
-
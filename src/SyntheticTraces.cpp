@@ -0,0 +1,229 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <templight/SyntheticTraces.h>
+
+#include <cmath>
+
+namespace templight {
+
+
+namespace {
+
+const char* const synth_namespaces[] = {
+  "std::", "std::__detail::", "boost::mpl::", "boost::fusion::detail::",
+  "boost::proto::", "Eigen::internal::", "detail::", "meta::"
+};
+
+const char* const synth_identifiers[] = {
+  "vector", "basic_string", "pair", "tuple", "enable_if", "conditional",
+  "integral_constant", "is_same", "apply_wrap2", "fold", "transform_view",
+  "if_", "deref", "result_of", "traits", "evaluator", "product", "assign_op",
+  "unary_expr", "binary_expr", "iterator_traits", "allocator_traits"
+};
+
+const char* const synth_builtins[] = {
+  "int", "long", "char", "bool", "double", "float", "void", "unsigned int",
+  "std::size_t", "std::allocator<char>", "0ul", "1ul", "2ul", "true", "false"
+};
+
+const std::size_t synth_max_names = 65536; // bounds the memory held to draw names from.
+
+const std::uint64_t synth_base_memory = 1 << 20;
+
+/* The generator does not use the std distributions, whose results differ
+ * between implementations, such that a seed gives the same trace everywhere. */
+double drawUnit(std::mt19937_64& rng) {
+  return static_cast<double>(rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+}
+
+
+SyntheticTraceGenerator::SyntheticTraceGenerator(const SyntheticTraceOptions& aOptions) :
+  LastEntry(EndOfTrace), options(aOptions), rng(aOptions.Seed), begin_count(0),
+  time_stamp(0.0), memory_usage(synth_base_memory)
+{
+  if ( options.MaxDepth == 0 )
+    options.MaxDepth = 1;
+  if ( options.FileCount == 0 )
+    options.FileCount = 1;
+
+  for(const char* ns : synth_namespaces)
+    for(const char* id : synth_identifiers)
+      templates.push_back(std::string(ns) + id);
+
+  for(unsigned int i = 0; i < options.FileCount; ++i)
+    filenames.push_back("/usr/include/synthetic/lib" + std::to_string(i % 8)
+                        + "/header" + std::to_string(i) + ".hpp");
+}
+
+SyntheticTraceGenerator::LastEntryType SyntheticTraceGenerator::next() {
+  // Close the current entry when it has no more nested entries to generate:
+  if ( !stack.empty() && ( ( stack.back().remaining == 0 ) || ( begin_count >= options.EntryCount ) ) ) {
+    stack.pop_back();
+    time_stamp += 1e-6 * static_cast<double>(1 + rng() % 50);
+    if ( ( options.MemoryCurve == SawtoothMemoryCurve ) && stack.empty() )
+      memory_usage = synth_base_memory;
+    else
+      memory_usage += drawMemoryGrowth(options.MemoryGrowth / 4);
+    LastEndEntry.TimeStamp = time_stamp;
+    LastEndEntry.MemoryUsage = memory_usage;
+    return LastEntry = EndEntry;
+  }
+
+  if ( begin_count >= options.EntryCount )
+    return LastEntry = EndOfTrace;
+
+  unsigned int depth = static_cast<unsigned int>(stack.size());
+  if ( !stack.empty() ) {
+    --stack.back().remaining;
+    if ( stack.back().chain_n != 0 ) {
+      Frame parent = stack.back();
+      makeChainEntry(parent, depth);
+      return LastEntry = BeginEntry;
+    }
+  }
+  makeBeginEntry(depth);
+  return LastEntry = BeginEntry;
+}
+
+void SyntheticTraceGenerator::makeBeginEntry(unsigned int aDepth) {
+  PrintableEntryBegin& entry = LastBeginEntry;
+  Frame frame = {0, 0, 0};
+  if ( !names.empty() && ( drawUnit(rng) < options.MemoizationRatio ) ) {
+    // A memoization of an earlier instantiation, which is always a leaf:
+    entry.InstantiationKind = MemoizationVal;
+    entry.Name = names[rng() % names.size()];
+  } else if ( ( options.RecursionLength >= 2 ) && ( drawUnit(rng) < options.RecursionRatio ) ) {
+    // The start of a recursive chain (see makeChainEntry):
+    entry.InstantiationKind = TemplateInstantiationVal;
+    frame.chain_tmpl = rng() % templates.size();
+    frame.chain_n = options.RecursionLength;
+    makeChainName(frame.chain_tmpl, frame.chain_n, entry.Name);
+    addName(entry.Name);
+    if ( aDepth + 1 < options.MaxDepth )
+      frame.remaining = 2;
+  } else {
+    entry.InstantiationKind = ( rng() % 10 == 0 ) ? static_cast<int>(1 + rng() % 8) : TemplateInstantiationVal;
+    makeName(entry.Name);
+    addName(entry.Name);
+    if ( aDepth + 1 < options.MaxDepth ) {
+      // Uniform count with the requested mean (rounded at random, to keep a fractional mean):
+      double count = 2.0 * options.FanOut * std::pow(options.FanOutDecay, aDepth) * drawUnit(rng);
+      double whole = std::floor(count);
+      frame.remaining = static_cast<std::size_t>(whole) + ( ( drawUnit(rng) < count - whole ) ? 1 : 0 );
+    }
+  }
+  setCommonFields(entry);
+  stack.push_back(frame);
+}
+
+void SyntheticTraceGenerator::makeChainEntry(const Frame& aParent, unsigned int aDepth) {
+  // Like Fibonacci<N>, which instantiates Fibonacci<N-1> and then finds Fibonacci<N-2> memoized:
+  PrintableEntryBegin& entry = LastBeginEntry;
+  Frame frame = {0, 0, 0};
+  if ( aParent.remaining == 1 ) {
+    entry.InstantiationKind = TemplateInstantiationVal;
+    frame.chain_tmpl = aParent.chain_tmpl;
+    frame.chain_n = aParent.chain_n - 1;
+    makeChainName(frame.chain_tmpl, frame.chain_n, entry.Name);
+    addName(entry.Name);
+    if ( ( frame.chain_n >= 2 ) && ( aDepth + 1 < options.MaxDepth ) )
+      frame.remaining = 2;
+  } else {
+    entry.InstantiationKind = MemoizationVal;
+    makeChainName(aParent.chain_tmpl, aParent.chain_n - 2, entry.Name);
+  }
+  setCommonFields(entry);
+  stack.push_back(frame);
+}
+
+void SyntheticTraceGenerator::setCommonFields(PrintableEntryBegin& aEntry) {
+  ++begin_count;
+  aEntry.FileName = filenames[rng() % filenames.size()];
+  aEntry.Line = static_cast<int>(1 + rng() % 2000);
+  aEntry.Column = static_cast<int>(1 + rng() % 80);
+  aEntry.TempOri_FileName = filenames[rng() % filenames.size()];
+  aEntry.TempOri_Line = static_cast<int>(1 + rng() % 2000);
+  aEntry.TempOri_Column = static_cast<int>(1 + rng() % 80);
+
+  time_stamp += 1e-6 * static_cast<double>(1 + rng() % 50);
+  memory_usage += drawMemoryGrowth(options.MemoryGrowth);
+  aEntry.TimeStamp = time_stamp;
+  aEntry.MemoryUsage = memory_usage;
+}
+
+std::uint64_t SyntheticTraceGenerator::drawMemoryGrowth(std::uint64_t aMean) {
+  std::uint64_t growth = rng() % ( 2 * aMean + 1 );
+  if ( options.MemoryCurve == LogarithmicMemoryCurve ) {
+    // Growth inversely proportional to the progress makes a logarithmic curve:
+    growth /= 1 + ( 16 * begin_count ) / ( options.EntryCount + 1 );
+  }
+  return growth;
+}
+
+void SyntheticTraceGenerator::addName(const std::string& aName) {
+  if ( names.size() < synth_max_names )
+    names.push_back(aName);
+  else
+    names[rng() % names.size()] = aName;
+}
+
+void SyntheticTraceGenerator::makeName(std::string& aName) {
+  // Template-ids whose arguments are builtins or earlier names, up to about the target length:
+  std::size_t target = options.NameLength;
+  if ( options.NameLengthSpread > 0.0 ) {
+    // Log-normal lengths (with a Box-Muller draw of the normal variable):
+    double z = std::sqrt(-2.0 * std::log(1.0 - drawUnit(rng))) * std::cos(6.283185307179586 * drawUnit(rng));
+    target = static_cast<std::size_t>(static_cast<double>(options.NameLength) * std::exp(options.NameLengthSpread * z));
+  }
+  const std::size_t max_length = target + target / 2;
+  aName = templates[rng() % templates.size()];
+  aName += '<';
+  bool first = true;
+  while ( first || ( aName.size() + 1 < target ) ) {
+    if ( !first )
+      aName += ", ";
+    first = false;
+    if ( !names.empty() && ( rng() % 4 != 0 ) ) {
+      const std::string& arg = names[rng() % names.size()];
+      if ( aName.size() + arg.size() + 1 <= max_length ) {
+        aName += arg;
+        continue;
+      }
+    }
+    aName += synth_builtins[rng() % (sizeof(synth_builtins) / sizeof(synth_builtins[0]))];
+  }
+  aName += '>';
+}
+
+void SyntheticTraceGenerator::makeChainName(std::size_t aTmpl, unsigned int aN, std::string& aName) const {
+  aName = templates[aTmpl];
+  aName += '<';
+  aName += std::to_string(aN);
+  aName += '>';
+}
+
+
+}
+
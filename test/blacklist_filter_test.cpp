@@ -0,0 +1,205 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_blacklist_filter
+#include <boost/test/unit_test.hpp>
+
+#include "trace_test_utils.h"
+
+#include <templight/BlacklistMatcher.h>
+#include <templight/EntryPrinter.h>
+#include <templight/ProtobufReader.h>
+
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace templight;
+using namespace templight::test;
+
+
+namespace {
+
+const char* const test_patterns[] = {
+  "std::integral_constant<.*",
+  "boost::mpl::.*",
+  ".*::detail::.*"
+};
+
+/* A blacklist file of the test patterns, which is removed when it goes out of scope. */
+struct BlacklistFile {
+  std::string name;
+  BlacklistFile() : name("blacklist_filter_test.txt") {
+    std::ofstream OS(name.c_str());
+    OS << "# The test patterns:" << std::endl;
+    for(const char* pattern : test_patterns)
+      OS << "context " << pattern << std::endl;
+  };
+  ~BlacklistFile() { std::remove(name.c_str()); };
+};
+
+void addTestPatterns(BlacklistMatcher& aMatcher) {
+  for(const char* pattern : test_patterns)
+    aMatcher.addPattern(pattern);
+}
+
+/* Checks the verdicts of a printer on the entries of a buffer, and returns the number of entries. */
+std::size_t checkVerdicts(EntryPrinter& aPrinter, const BlacklistMatcher& aMatcher, const std::string& aBuf, 
+                          std::unordered_set<std::string>& aNames) {
+  std::size_t count = 0;
+  ProtobufReader reader;
+  for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size()); 
+      chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+    // As in the conversion, the printer starts each trace (which resets the verdicts by name ids):
+    if ( chunk == ProtobufReader::Header )
+      aPrinter.initialize(reader.SourceName);
+    if ( chunk != ProtobufReader::BeginEntry )
+      continue;
+    const std::string& name = reader.LastBeginEntry.getName();
+    BOOST_CHECK_EQUAL( aPrinter.isBlacklisted(reader.LastBeginEntry), aMatcher.matches(name) );
+    aNames.insert(name);
+    ++count;
+  }
+  return count;
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( verdict_cache ) {
+  BlacklistFile bl_file;
+  BlacklistMatcher matcher;
+  addTestPatterns(matcher);
+  EntryPrinter printer("-");
+  printer.readBlacklists(bl_file.name);
+  
+  // Each distinct name is matched once, by name id within a trace, and by hash across traces:
+  std::string buf = writeTraces(2);
+  std::unordered_set<std::string> names;
+  std::size_t count = checkVerdicts(printer, matcher, buf, names);
+  BOOST_CHECK_EQUAL( printer.getVerdictCacheHits() + printer.getVerdictCacheMisses(), count );
+  BOOST_CHECK_EQUAL( printer.getVerdictCacheMisses(), names.size() );
+  BOOST_CHECK_LT( names.size(), count );
+  
+  // Including with another reader (whose ids are different), and with names that are not in a dictionary:
+  for(int level : { 2, 0 }) {
+    std::size_t misses = printer.getVerdictCacheMisses();
+    checkVerdicts(printer, matcher, writeTraces(level), names);
+    BOOST_CHECK_EQUAL( printer.getVerdictCacheMisses(), misses );
+  }
+  
+  // And with entries that have no string table, whose names can have the same hash:
+  PrintableEntryBegin kept, blacklisted;
+  kept.Name = "keep::vector<int>";
+  kept.NameHash = 42;
+  blacklisted.Name = "boost::mpl::vector<int>";
+  blacklisted.NameHash = 42;
+  std::size_t misses = printer.getVerdictCacheMisses();
+  for(int i = 0; i < 3; ++i) {
+    BOOST_CHECK( !printer.isBlacklisted(kept) );
+    BOOST_CHECK( printer.isBlacklisted(blacklisted) );
+  }
+  BOOST_CHECK_EQUAL( printer.getVerdictCacheMisses(), misses + 2 );
+  
+  // A new blacklist forgets the verdicts:
+  printer.readBlacklists("");
+  BOOST_CHECK( !printer.isBlacklisted(blacklisted) );
+  BOOST_CHECK_EQUAL( printer.getVerdictCacheMisses(), misses + 2 );
+  printer.readBlacklists(bl_file.name);
+  BOOST_CHECK( printer.isBlacklisted(blacklisted) );
+  BOOST_CHECK_EQUAL( printer.getVerdictCacheMisses(), misses + 3 );
+}
+
+BOOST_AUTO_TEST_CASE( subtree_skipping ) {
+  // The filter rejects some recurring names (whose dictionary entries later entries refer to):
+  std::function<bool(const std::string&)> rejects = [](const std::string& aName) {
+    return ( aName.compare(0, 12, "boost::mpl::") == 0 ) || ( aName.find("::detail::") != std::string::npos );
+  };
+  
+  // The expected entries, with the subtrees of the rejected entries removed:
+  std::vector<RecordedTrace> expected = generateTraces(nullptr);
+  std::uint64_t expected_skipped = 0;
+  for(RecordedTrace& trace : expected) {
+    std::vector<RecordedEntry> kept;
+    std::size_t skipping = 0;
+    for(const RecordedEntry& e : trace.entries) {
+      if ( skipping ) {
+        if ( e.is_begin ) {
+          ++skipping;
+          ++expected_skipped;
+        } else {
+          --skipping;
+        }
+      } else if ( e.is_begin && rejects(e.name) ) {
+        skipping = 1;
+        ++expected_skipped;
+      } else {
+        kept.push_back(e);
+      }
+    }
+    trace.entries.swap(kept);
+  }
+  BOOST_REQUIRE_GT( expected_skipped, 0u );
+  
+  for(int level = 0; level <= 3; ++level) {
+    for(std::size_t segment_size : { std::size_t(0), std::size_t(4096) }) {
+      BOOST_TEST_CONTEXT("level " << level << ", segments of " << segment_size) {
+        std::string buf = writeTraces(level, segment_size);
+        std::vector<RecordedTrace> actual;
+        std::size_t depth = 0;
+        ProtobufReader reader;
+        reader.setEntryFilter([&rejects](const PrintableEntryBegin& aEntry) { return rejects(aEntry.getName()); });
+        for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(buf.data(), buf.size()); 
+            chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+          switch( chunk ) {
+            case ProtobufReader::Header:
+              BOOST_CHECK_EQUAL( depth, 0u );
+              actual.push_back(RecordedTrace());
+              actual.back().source_name = reader.SourceName;
+              break;
+            case ProtobufReader::BeginEntry:
+              BOOST_REQUIRE( !actual.empty() );
+              BOOST_CHECK( !rejects(reader.LastBeginEntry.getName()) );
+              actual.back().entries.push_back(recordEntry(reader.LastBeginEntry));
+              ++depth;
+              break;
+            case ProtobufReader::EndEntry:
+              BOOST_REQUIRE( !actual.empty() );
+              BOOST_REQUIRE_GT( depth, 0u );
+              actual.back().entries.push_back(recordEntry(reader.LastEndEntry));
+              --depth;
+              break;
+            default:
+              break;
+          }
+        }
+        BOOST_CHECK( !reader.hasFailed() );
+        BOOST_CHECK_EQUAL( depth, 0u );
+        BOOST_CHECK_EQUAL( reader.getSkippedEntryCount(), expected_skipped );
+        checkSameTraces(expected, actual);
+      }
+    }
+  }
+}
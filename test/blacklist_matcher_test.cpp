@@ -0,0 +1,153 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_blacklist_matcher
+#include <boost/test/unit_test.hpp>
+
+#include <templight/BlacklistMatcher.h>
+#include <templight/SyntheticTraces.h>
+
+#include <memory>
+#include <regex>
+#include <string>
+#include <vector>
+
+using namespace templight;
+
+
+namespace {
+
+/* The patterns of a blacklist: broad ones on namespaces, narrow ones on templates, 
+ * patterns that are prefixes of one another, and the constructs that the automaton 
+ * leaves to std::regex (back-references, lookaheads and word boundaries). */
+const char* const test_patterns[] = {
+  "std::.*",
+  "std::vector<.*>",
+  "std::vector<int>",
+  "^boost::mpl::.*",
+  ".*::detail::.*",
+  "Eigen::internal::(evaluator|product)<.*",
+  ".*<(int|long), (true|false)>",
+  ".*\\d+ul.*>",
+  "(meta|detail)::if_<[^<>]*>",
+  ".*[Aa]nonymous.*",
+  "foo",
+  "foo::bar",
+  "foo::bar<.*>$",
+  "a{2,4}b?",
+  "(ab|abc)+d",
+  ".*a.{12}",
+  "(\\w+)::\\1<.*",
+  "(?=Fib).*<1\\d>",
+  ".*\\bimpl\\b.*"
+};
+
+/* Names to match: synthetic template names, and names around the patterns (their 
+ * prefixes, their extensions and near-misses), since only full matches count. */
+std::vector<std::string> getTestNames() {
+  std::vector<std::string> result = {
+    "", "s", "std", "std:", "std::", "std::vector", "std::vector<", "std::vector<int>", 
+    "std::vector<int>x", "xstd::vector<int>", "boost::mpl", "boost::mpl::", "boost::mpl::if_<a>", 
+    " boost::mpl::x", "a::detail::b", "::detail::", "Eigen::internal::evaluator<X>", 
+    "Eigen::internal::product", "x<int, true>", "x<int, true> ", "x<long, false>", "v<3ul>", 
+    "meta::if_<a, b>", "meta::if_<a<b>>", "anonymous", "(Anonymous namespace)::x", 
+    "foo", "fo", "foo:", "foo::", "foo::ba", "foo::bar", "foo::barr", "foo::bar<", "foo::bar<>", 
+    "foo::bar<x>y", "aa", "aab", "aaaab", "aaaaab", "a", "abd", "abcd", "ababcd", "abcabd", 
+    "xa123456789012", "xa12345678901", "vec::vec<int>", "vec::vex<int>", "Fibonacci<12>", 
+    "Fibonacci<2>", "Fib<10>", "my::impl<int>", "my::impl_<int>", "myimpl"
+  };
+  SyntheticTraceOptions opts;
+  opts.EntryCount = 2000;
+  opts.NameLength = 40;
+  SyntheticTraceGenerator gen(opts);
+  SyntheticTraceGenerator::LastEntryType entry;
+  while ( ( entry = gen.next() ) != SyntheticTraceGenerator::EndOfTrace ) {
+    if ( entry == SyntheticTraceGenerator::BeginEntry ) {
+      const std::string& name = gen.LastBeginEntry.getName();
+      result.push_back(name);
+      // Every prefix of some of the names:
+      if ( result.size() % 100 == 0 ) {
+        for(std::size_t i = 0; i < name.size(); ++i)
+          result.push_back(name.substr(0, i));
+      }
+    }
+  }
+  return result;
+}
+
+bool matchesAnyRegex(const std::vector<std::regex>& aRegexes, const std::string& aName) {
+  for(const std::regex& re : aRegexes) {
+    if ( std::regex_match(aName, re) )
+      return true;
+  }
+  return false;
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( blacklist_each_pattern_vs_regex ) {
+  std::vector<std::string> names = getTestNames();
+  for(const char* pattern : test_patterns) {
+    BlacklistMatcher matcher;
+    BOOST_REQUIRE( matcher.addPattern(pattern) );
+    std::vector<std::regex> regexes(1, std::regex(pattern));
+    for(const std::string& name : names) {
+      BOOST_CHECK_MESSAGE( matcher.matches(name) == matchesAnyRegex(regexes, name), 
+                           "pattern '" << pattern << "' on name '" << name << "'" );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( blacklist_all_patterns_vs_regex ) {
+  std::vector<std::string> names = getTestNames();
+  BlacklistMatcher matcher;
+  std::vector<std::regex> regexes;
+  for(const char* pattern : test_patterns) {
+    BOOST_REQUIRE( matcher.addPattern(pattern) );
+    regexes.emplace_back(pattern);
+  }
+  BOOST_CHECK_EQUAL( matcher.getAutomatonPatternCount() + matcher.getRegexPatternCount(), regexes.size() );
+  BOOST_CHECK_EQUAL( matcher.getRegexPatternCount(), 3u );
+  // Twice, since the second pass runs on the states that the first pass built:
+  for(int pass = 0; pass < 2; ++pass) {
+    for(const std::string& name : names) {
+      BOOST_CHECK_MESSAGE( matcher.matches(name) == matchesAnyRegex(regexes, name), 
+                           "pass " << pass << " on name '" << name << "'" );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( blacklist_invalid_and_empty ) {
+  BlacklistMatcher matcher;
+  BOOST_CHECK( matcher.empty() );
+  BOOST_CHECK( !matcher.matches("std::vector<int>") );
+  BOOST_CHECK( !matcher.addPattern("std::vector<(int") );
+  BOOST_CHECK( matcher.empty() );
+  BOOST_CHECK( matcher.addPattern("std::.*") );
+  BOOST_CHECK( !matcher.empty() );
+  BOOST_CHECK( matcher.matches("std::vector<int>") );
+  matcher.clear();
+  BOOST_CHECK( matcher.empty() );
+  BOOST_CHECK( !matcher.matches("std::vector<int>") );
+}
+
@@ -0,0 +1,261 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_entry_tree
+#include <boost/test/unit_test.hpp>
+
+#include "trace_test_utils.h"
+
+#include <templight/ExtraWriters.h>
+#include <templight/ProtobufReader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace templight;
+using namespace templight::test;
+
+
+namespace {
+
+/* The structure of a node of a trace, computed from the order of its entries. */
+struct NodeShape {
+  std::size_t begin;   // the position of its beginning entry in the trace.
+  std::size_t end;     // the position of its end entry in the trace.
+  std::uint32_t parent_id;
+  std::uint32_t end_id;
+  std::uint32_t depth;
+};
+
+/* Computes the nodes of traces (appended one after the other, as in a tree of all of them). */
+std::vector<NodeShape> getNodeShapes(const std::vector<RecordedTrace>& aTraces) {
+  std::vector<NodeShape> result;
+  for(const RecordedTrace& trace : aTraces) {
+    std::vector<std::uint32_t> open_ids;
+    for(std::size_t i = 0; i < trace.entries.size(); ++i) {
+      if ( trace.entries[i].is_begin ) {
+        NodeShape node = { i, 0, ( open_ids.empty() ? RecordedDFSEntryTree::invalid_node : open_ids.back() ), 
+                           RecordedDFSEntryTree::invalid_node, static_cast<std::uint32_t>(open_ids.size()) };
+        open_ids.push_back(static_cast<std::uint32_t>(result.size()));
+        result.push_back(node);
+      } else {
+        BOOST_REQUIRE( !open_ids.empty() );
+        result[open_ids.back()].end = i;
+        result[open_ids.back()].end_id = static_cast<std::uint32_t>(result.size());
+        open_ids.pop_back();
+      }
+    }
+    BOOST_REQUIRE( open_ids.empty() );
+  }
+  return result;
+}
+
+/* Records the traces of a protobuf buffer into a tree, as the tree-writers do. */
+void recordFromBuffer(const std::string& aBuf, RecordedDFSEntryTree& aTree) {
+  ProtobufReader reader;
+  for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size()); 
+      chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+    if ( chunk == ProtobufReader::Header )
+      aTree.resetStringIDs();
+    else if ( chunk == ProtobufReader::BeginEntry )
+      aTree.beginEntry(reader.LastBeginEntry);
+    else if ( chunk == ProtobufReader::EndEntry )
+      aTree.endEntry(reader.LastEndEntry);
+  }
+  BOOST_CHECK( !reader.hasFailed() );
+}
+
+/* Records the generated traces into a tree, with entries that carry their strings. */
+void recordGenerated(RecordedDFSEntryTree& aTree) {
+  std::vector<SyntheticTraceOptions> options = getTraceOptions();
+  for(const SyntheticTraceOptions& opts : options) {
+    aTree.resetStringIDs();
+    SyntheticTraceGenerator gen(opts);
+    SyntheticTraceGenerator::LastEntryType entry;
+    while ( ( entry = gen.next() ) != SyntheticTraceGenerator::EndOfTrace ) {
+      if ( entry == SyntheticTraceGenerator::BeginEntry )
+        aTree.beginEntry(gen.LastBeginEntry);
+      else
+        aTree.endEntry(gen.LastEndEntry);
+    }
+  }
+}
+
+/* Checks the nodes of a tree against the traces that it recorded. */
+void checkTree(const RecordedDFSEntryTree& aTree, const std::vector<RecordedTrace>& aTraces) {
+  std::vector<NodeShape> shapes = getNodeShapes(aTraces);
+  BOOST_REQUIRE_EQUAL( aTree.size(), shapes.size() );
+  
+  std::map<std::string, std::uint32_t> name_ids;
+  std::size_t trace = 0, trace_start = 0;
+  EntryTraversalTask task(PrintableEntryBegin(), 0, 0);
+  for(std::size_t i = 0; i < shapes.size(); ++i) {
+    BOOST_TEST_CONTEXT("node " << i) {
+      // The nodes of a trace follow those of the previous traces:
+      while ( ( i > trace_start ) && ( shapes[i].begin == 0 ) && ( shapes[i].depth == 0 ) ) {
+        ++trace;
+        trace_start = i;
+      }
+      BOOST_REQUIRE_LT( trace, aTraces.size() );
+      const RecordedEntry& begin = aTraces[trace].entries[shapes[i].begin];
+      const RecordedEntry& end = aTraces[trace].entries[shapes[i].end];
+      
+      // The structure of the tree:
+      BOOST_CHECK_EQUAL( aTree.parent_ids[i], shapes[i].parent_id );
+      BOOST_CHECK_EQUAL( aTree.end_ids[i], shapes[i].end_id );
+      BOOST_CHECK_EQUAL( aTree.depths[i], shapes[i].depth );
+      
+      // The entries of the node:
+      aTree.getTask(i, task);
+      checkSameEntry(begin, recordEntry(task.start), shapes[i].begin);
+      checkSameEntry(end, recordEntry(task.finish), shapes[i].end);
+      BOOST_CHECK_EQUAL( task.nd_id, i );
+      BOOST_CHECK_EQUAL( task.id_end, shapes[i].end_id );
+      if ( shapes[i].parent_id == RecordedDFSEntryTree::invalid_node )
+        BOOST_CHECK( task.parent_id == EntryTraversalTask::invalid_id );
+      else
+        BOOST_CHECK_EQUAL( task.parent_id, shapes[i].parent_id );
+      
+      // The names are interned: one id per distinct name, across the traces:
+      auto res = name_ids.insert(std::make_pair(begin.name, aTree.name_ids[i]));
+      BOOST_CHECK_EQUAL( res.first->second, aTree.name_ids[i] );
+      std::string name;
+      aTree.appendName(aTree.name_ids[i], name);
+      BOOST_CHECK_EQUAL( name, begin.name );
+    }
+  }
+  std::map<std::uint32_t, std::string> names_by_id;
+  for(const auto& name_id : name_ids)
+    names_by_id.insert(std::make_pair(name_id.second, name_id.first));
+  BOOST_CHECK_EQUAL( names_by_id.size(), name_ids.size() );
+  BOOST_CHECK_EQUAL( names_by_id.rbegin()->first + 1, name_ids.size() );
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( tree_interning ) {
+  std::vector<RecordedTrace> traces = generateTraces(nullptr);
+  
+  // With the strings of the entries, and with the string ids of a reader (which start over with each trace):
+  {
+    RecordedDFSEntryTree tree;
+    recordGenerated(tree);
+    checkTree(tree, traces);
+  }
+  for(int level : { 0, 2 }) {
+    BOOST_TEST_CONTEXT("level " << level) {
+      RecordedDFSEntryTree tree;
+      recordFromBuffer(writeTraces(level), tree);
+      checkTree(tree, traces);
+    }
+  }
+  
+  // Distinct names with the same hash are interned apart, and the same names together:
+  RecordedDFSEntryTree tree;
+  PrintableEntryBegin first, second;
+  first.Name = "std::vector<int>";
+  first.NameHash = 42;
+  second.Name = "std::vector<long>";
+  second.NameHash = 42;
+  for(int i = 0; i < 2; ++i) {
+    tree.beginEntry(first);
+    tree.endEntry(PrintableEntryEnd{1.0, 0});
+    tree.beginEntry(second);
+    tree.endEntry(PrintableEntryEnd{1.0, 0});
+  }
+  BOOST_REQUIRE_EQUAL( tree.size(), 4u );
+  BOOST_CHECK_NE( tree.name_ids[0], tree.name_ids[1] );
+  BOOST_CHECK_EQUAL( tree.name_ids[0], tree.name_ids[2] );
+  BOOST_CHECK_EQUAL( tree.name_ids[1], tree.name_ids[3] );
+  std::string name;
+  tree.appendName(tree.name_ids[3], name);
+  BOOST_CHECK_EQUAL( name, second.Name );
+  
+  // The kinds are narrowed, and checked:
+  PrintableEntryBegin bad_kind;
+  bad_kind.InstantiationKind = 256;
+  BOOST_CHECK_THROW( tree.beginEntry(bad_kind), std::length_error );
+  BOOST_CHECK_EQUAL( tree.size(), 4u );
+}
+
+BOOST_AUTO_TEST_CASE( tree_aggregates ) {
+  std::vector<RecordedTrace> traces = generateTraces(nullptr);
+  std::vector<NodeShape> shapes = getNodeShapes(traces);
+  RecordedDFSEntryTree tree;
+  recordGenerated(tree);
+  std::vector<EntryAggregate> aggregates;
+  tree.computeAggregates(aggregates);
+  BOOST_REQUIRE_EQUAL( aggregates.size(), shapes.size() );
+  
+  // Each aggregate is computed again from the entries of its sub-tree (and of its children):
+  std::size_t trace = 0;
+  for(std::size_t i = 0; i < shapes.size(); ++i) {
+    if ( ( i > 0 ) && ( shapes[i].begin == 0 ) )
+      ++trace;
+    const std::vector<RecordedEntry>& entries = traces[trace].entries;
+    const RecordedEntry& begin = entries[shapes[i].begin];
+    const RecordedEntry& end = entries[shapes[i].end];
+    double incl_time = std::max(end.time - begin.time, 0.0);
+    std::uint64_t incl_memory = ( end.memory > begin.memory ? end.memory - begin.memory : 0 );
+    double children_time = 0.0;
+    std::uint64_t children_memory = 0, peak_memory = begin.memory;
+    std::uint32_t subtree_size = 0, child_count = 0;
+    for(std::size_t j = shapes[i].begin; j <= shapes[i].end; ++j)
+      peak_memory = std::max(peak_memory, entries[j].memory);
+    for(std::size_t k = i; k < shapes.size() && ( k == i || shapes[k].depth > shapes[i].depth ); ++k) {
+      ++subtree_size;
+      if ( shapes[k].parent_id != i )
+        continue;
+      ++child_count;
+      const RecordedEntry& child_begin = entries[shapes[k].begin];
+      const RecordedEntry& child_end = entries[shapes[k].end];
+      children_time += std::max(child_end.time - child_begin.time, 0.0);
+      children_memory += ( child_end.memory > child_begin.memory ? child_end.memory - child_begin.memory : 0 );
+    }
+    BOOST_TEST_CONTEXT("node " << i) {
+      const EntryAggregate& agg = aggregates[i];
+      BOOST_CHECK_EQUAL( agg.InclusiveTime, incl_time );
+      BOOST_CHECK_SMALL( agg.ExclusiveTime - std::max(incl_time - children_time, 0.0), 1e-9 );
+      BOOST_CHECK_EQUAL( agg.InclusiveMemory, incl_memory );
+      BOOST_CHECK_EQUAL( agg.ExclusiveMemory, ( incl_memory > children_memory ? incl_memory - children_memory : 0 ) );
+      BOOST_CHECK_EQUAL( agg.PeakMemory, peak_memory - begin.memory );
+      BOOST_CHECK_EQUAL( agg.SubtreeSize, subtree_size );
+      BOOST_CHECK_EQUAL( agg.SubtreeSize, shapes[i].end_id - i );
+      BOOST_CHECK_EQUAL( agg.Depth, shapes[i].depth );
+      BOOST_CHECK_EQUAL( agg.ChildCount, child_count );
+    }
+  }
+  
+  // The roots of the traces cover all their nodes:
+  std::size_t root_sizes = 0;
+  for(std::size_t i = 0; i < shapes.size(); ++i) {
+    if ( shapes[i].parent_id == RecordedDFSEntryTree::invalid_node )
+      root_sizes += aggregates[i].SubtreeSize;
+  }
+  BOOST_CHECK_EQUAL( root_sizes, shapes.size() );
+}
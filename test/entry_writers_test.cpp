@@ -0,0 +1,311 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_entry_writers
+#include <boost/test/unit_test.hpp>
+
+#include "trace_test_utils.h"
+
+#include <templight/CallGraphWriters.h>
+#include <templight/ExtraWriters.h>
+#include <templight/ProtobufReader.h>
+#include <templight/ProtobufWriter.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace templight;
+using namespace templight::test;
+
+
+namespace {
+
+typedef std::function<EntryWriter*(std::ostream&)> WriterFactory;
+
+struct NamedWriterFactory {
+  const char* format;
+  WriterFactory create;
+};
+
+/* The writers of the output formats, as the conversion creates them. */
+std::vector<NamedWriterFactory> getWriterFactories() {
+  std::vector<NamedWriterFactory> result = {
+    { "protobuf", [](std::ostream& OS) { return new ProtobufWriter(OS, 2); } },
+    { "yaml", [](std::ostream& OS) { return new YamlWriter(OS); } },
+    { "xml", [](std::ostream& OS) { return new XmlWriter(OS); } },
+    { "text", [](std::ostream& OS) { return new TextWriter(OS); } },
+    { "nestedxml", [](std::ostream& OS) { return new NestedXMLWriter(OS); } },
+    { "graphml", [](std::ostream& OS) { return new GraphMLWriter(OS); } },
+    { "graphviz", [](std::ostream& OS) { return new GraphVizWriter(OS); } },
+    { "graphml-cg", [](std::ostream& OS) { return new GraphMLCGWriter(OS); } },
+    { "graphviz-cg", [](std::ostream& OS) { return new GraphVizCGWriter(OS); } },
+    { "callgrind", [](std::ostream& OS) { return new CallGrindWriter(OS); } },
+    { "top", [](std::ostream& OS) { return new TopWriter(OS, 20); } }
+  };
+  return result;
+}
+
+/* Reads the traces of a protobuf buffer, decoding some fields only, into a new writer, and returns its output. */
+std::string writeFromBuffer(const WriterFactory& aCreate, const std::string& aBuf, unsigned int aFields) {
+  std::ostringstream OS;
+  {
+    std::unique_ptr<EntryWriter> writer(aCreate(OS));
+    ProtobufReader reader;
+    reader.setRequiredFields(aFields);
+    bool was_inited = false;
+    for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size()); 
+        chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+      switch( chunk ) {
+        case ProtobufReader::Header:
+          if ( was_inited )
+            writer->finalize();
+          writer->initialize(reader.SourceName);
+          was_inited = true;
+          break;
+        case ProtobufReader::BeginEntry:
+          writer->printEntry(reader.LastBeginEntry);
+          break;
+        case ProtobufReader::EndEntry:
+          writer->printEntry(reader.LastEndEntry);
+          break;
+        default:
+          break;
+      }
+    }
+    BOOST_CHECK( !reader.hasFailed() );
+    if ( was_inited )
+      writer->finalize();
+  }
+  return OS.str();
+}
+
+/* A row of a table of the top report. */
+struct TopRow {
+  double excl_time;
+  double incl_time;
+  std::uint64_t excl_memory;
+  std::uint64_t incl_memory;
+  std::string kind;
+  std::string location;
+  std::string origin;
+  std::string name;
+};
+
+/* Computes the expected tables of the top report of a trace, from its entries. */
+void getExpectedTopRows(const RecordedTrace& aTrace, std::size_t aCount, 
+                        std::vector<TopRow>& aTimeRows, std::vector<TopRow>& aMemoryRows) {
+  // The rows of the entries, in the order in which they end, with their aggregated costs:
+  std::vector<TopRow> rows;
+  std::vector<std::pair<const RecordedEntry*, EntryAggregate>> open_entries;
+  for(const RecordedEntry& e : aTrace.entries) {
+    if ( e.is_begin ) {
+      open_entries.push_back(std::make_pair(&e, EntryAggregate()));
+      continue;
+    }
+    const RecordedEntry& b = *open_entries.back().first;
+    EntryAggregate costs = open_entries.back().second;
+    open_entries.pop_back();
+    costs.complete(b.time, e.time, b.memory, e.memory);
+    if ( !open_entries.empty() )
+      open_entries.back().second.addChild(costs, b.memory);
+    TopRow row = { costs.ExclusiveTime, costs.InclusiveTime, costs.ExclusiveMemory, costs.InclusiveMemory, 
+                   GetInstantiationKindString(b.kind), 
+                   b.file + "|" + std::to_string(b.line) + "|" + std::to_string(b.column), 
+                   ( b.ori_file.empty() ? std::string("-") : 
+                     b.ori_file + "|" + std::to_string(b.ori_line) + "|" + std::to_string(b.ori_column) ), 
+                   b.name };
+    rows.push_back(row);
+  }
+  // Ranked by decreasing costs, and then, by the order in which they end:
+  aTimeRows = rows;
+  std::stable_sort(aTimeRows.begin(), aTimeRows.end(), [](const TopRow& lhs, const TopRow& rhs) {
+    return lhs.excl_time > rhs.excl_time;
+  });
+  aTimeRows.resize(std::min(aCount, aTimeRows.size()));
+  aMemoryRows = rows;
+  std::stable_sort(aMemoryRows.begin(), aMemoryRows.end(), [](const TopRow& lhs, const TopRow& rhs) {
+    return lhs.excl_memory > rhs.excl_memory;
+  });
+  aMemoryRows.resize(std::min(aCount, aMemoryRows.size()));
+}
+
+/* Checks a table of the top report, and its rows, at a position of the lines of the report. */
+void checkTopTable(const std::vector<std::string>& aLines, std::size_t& aPos, const char* aTitle, 
+                   const std::vector<TopRow>& aExpected) {
+  BOOST_REQUIRE_LT( aPos + aExpected.size() + 2, aLines.size() );
+  BOOST_CHECK_EQUAL( aLines[aPos++], "Top " + std::to_string(aExpected.size()) + " entries by " + aTitle + ":" );
+  std::istringstream header_IS(aLines[aPos++]);
+  std::vector<std::string> columns;
+  for(std::string column; header_IS >> column; )
+    columns.push_back(column);
+  const std::vector<std::string> expected_columns = {
+    "Rank", "Excl.", "Time", "(s)", "Incl.", "Time", "(s)", "Excl.", "Memory", "Incl.", "Memory", 
+    "Kind", "Location", "TemplateOrigin", "Name"
+  };
+  BOOST_CHECK( columns == expected_columns );
+  for(std::size_t i = 0; i < aExpected.size(); ++i, ++aPos) {
+    BOOST_TEST_CONTEXT("row " << i << " of the table by " << aTitle) {
+      const TopRow& expected = aExpected[i];
+      std::istringstream IS(aLines[aPos]);
+      std::size_t rank = 0;
+      TopRow actual;
+      BOOST_REQUIRE( IS >> rank >> actual.excl_time >> actual.incl_time >> actual.excl_memory >> actual.incl_memory );
+      // The remaining columns are separated by two spaces (since names have spaces):
+      std::string rest;
+      std::getline(IS, rest);
+      std::vector<std::string> fields;
+      std::size_t start = 2;
+      for(int f = 0; f < 3; ++f) {
+        std::size_t sep = rest.find("  ", start);
+        BOOST_REQUIRE( sep != std::string::npos );
+        fields.push_back(rest.substr(start, sep - start));
+        start = sep + 2;
+      }
+      BOOST_CHECK_EQUAL( rank, i + 1 );
+      BOOST_CHECK_SMALL( actual.excl_time - expected.excl_time, 1e-9 );
+      BOOST_CHECK_SMALL( actual.incl_time - expected.incl_time, 1e-9 );
+      BOOST_CHECK_EQUAL( actual.excl_memory, expected.excl_memory );
+      BOOST_CHECK_EQUAL( actual.incl_memory, expected.incl_memory );
+      BOOST_CHECK_EQUAL( fields[0], expected.kind );
+      BOOST_CHECK_EQUAL( fields[1], expected.location );
+      BOOST_CHECK_EQUAL( fields[2], expected.origin );
+      BOOST_CHECK_EQUAL( rest.substr(start), expected.name );
+    }
+  }
+  BOOST_CHECK_EQUAL( aLines[aPos++], "" );
+}
+
+/* Splits the output of a graph writer into its records (its nodes, with their indented data, and its 
+ * edges), without the ids of the edges (which are numbered in the order of output), and sorts them. */
+std::vector<std::string> getSortedRecords(const std::string& aOutput) {
+  static const std::regex edge_id(" id=\"e[0-9]+\"");
+  std::vector<std::string> result;
+  std::istringstream IS(aOutput);
+  std::string line;
+  while ( std::getline(IS, line) ) {
+    if ( !result.empty() && ( ( line.compare(0, 2, "  ") == 0 ) || ( line == "</node>" ) ) )
+      result.back() += "\n" + line;
+    else
+      result.push_back(std::regex_replace(line, edge_id, ""));
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( streaming_keeps_output ) {
+  std::string buf = writeTraces(2);
+  std::vector<NamedWriterFactory> factories = {
+    { "graphml", [](std::ostream& OS) { return new GraphMLWriter(OS); } },
+    { "graphml", [](std::ostream& OS) { return new GraphMLWriter(OS, true); } },
+    { "graphviz", [](std::ostream& OS) { return new GraphVizWriter(OS); } },
+    { "graphviz", [](std::ostream& OS) { return new GraphVizWriter(OS, true); } }
+  };
+  for(std::size_t i = 0; i < factories.size(); i += 2) {
+    BOOST_TEST_CONTEXT("format " << factories[i].format) {
+      // The same nodes and edges, with the same ids, in another order:
+      std::string buffered = writeFromBuffer(factories[i].create, buf, AllEntryFields);
+      std::string streamed = writeFromBuffer(factories[i + 1].create, buf, AllEntryFields);
+      BOOST_CHECK( streamed != buffered );
+      std::vector<std::string> buffered_records = getSortedRecords(buffered);
+      std::vector<std::string> streamed_records = getSortedRecords(streamed);
+      BOOST_REQUIRE_EQUAL( streamed_records.size(), buffered_records.size() );
+      for(std::size_t j = 0; j < buffered_records.size(); ++j)
+        BOOST_CHECK_EQUAL( streamed_records[j], buffered_records[j] );
+    }
+  }
+  
+  // The nodes are streamed as soon as they close, i.e., after all their children:
+  std::string streamed = writeFromBuffer(factories[3].create, buf, AllEntryFields);
+  static const std::regex node_line("(n[0-9]+) \\[label.*");
+  static const std::regex edge_line("(n[0-9]+) -> (n[0-9]+);");
+  std::map<std::string, std::size_t> node_positions;
+  std::vector<std::pair<std::string, std::string>> edges;
+  std::istringstream IS(streamed);
+  std::string line;
+  std::smatch m;
+  for(std::size_t pos = 0; std::getline(IS, line); ++pos) {
+    if ( std::regex_match(line, m, node_line) )
+      node_positions[m[1]] = pos;
+    else if ( std::regex_match(line, m, edge_line) )
+      edges.push_back(std::make_pair(m[1].str(), m[2].str()));
+  }
+  BOOST_REQUIRE( !edges.empty() );
+  for(const auto& edge : edges) {
+    BOOST_REQUIRE( node_positions.count(edge.first) && node_positions.count(edge.second) );
+    BOOST_CHECK_LT( node_positions[edge.second], node_positions[edge.first] );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( field_masks_keep_output ) {
+  for(int level : { 0, 2 }) {
+    std::string buf = writeTraces(level);
+    for(const NamedWriterFactory& factory : getWriterFactories()) {
+      BOOST_TEST_CONTEXT("format " << factory.format << ", level " << level) {
+        std::ostringstream dummy_OS;
+        std::unique_ptr<EntryWriter> writer(factory.create(dummy_OS));
+        unsigned int fields = writer->getRequiredFields();
+        BOOST_CHECK_EQUAL( fields & AllEntryFields, fields );
+        std::string full_output = writeFromBuffer(factory.create, buf, AllEntryFields);
+        BOOST_CHECK( !full_output.empty() );
+        BOOST_CHECK( writeFromBuffer(factory.create, buf, fields) == full_output );
+      }
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( top_report ) {
+  std::vector<RecordedTrace> traces = generateTraces(nullptr);
+  std::string buf = writeTraces(2);
+  for(std::size_t count : { std::size_t(0), std::size_t(25), std::size_t(100000) }) {
+    BOOST_TEST_CONTEXT("top " << count) {
+      // The report of each trace, read with the fields that the report needs only:
+      WriterFactory create = [count](std::ostream& OS) { return new TopWriter(OS, count); };
+      std::ostringstream dummy_OS;
+      std::string report = writeFromBuffer(create, buf, TopWriter(dummy_OS).getRequiredFields());
+      std::vector<std::string> lines;
+      std::istringstream IS(report);
+      for(std::string line; std::getline(IS, line); )
+        lines.push_back(line);
+      std::size_t pos = 0;
+      for(const RecordedTrace& trace : traces) {
+        BOOST_TEST_CONTEXT("trace " << trace.source_name) {
+          std::vector<TopRow> time_rows, memory_rows;
+          getExpectedTopRows(trace, count, time_rows, memory_rows);
+          BOOST_REQUIRE_LT( pos, lines.size() );
+          BOOST_CHECK_EQUAL( lines[pos++], "SourceFile = " + trace.source_name );
+          checkTopTable(lines, pos, "exclusive time", time_rows);
+          checkTopTable(lines, pos, "exclusive memory", memory_rows);
+        }
+      }
+      BOOST_CHECK_EQUAL( pos, lines.size() );
+    }
+  }
+}
@@ -0,0 +1,143 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_name_compression
+#include <boost/test/unit_test.hpp>
+
+#include <templight/NameCompression.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using namespace templight;
+
+
+namespace {
+
+std::vector<std::string> getTestNames() {
+  std::vector<std::string> result = { "", "f", "ns::Outer<A, 3>", std::string("a\0b\xFF", 4) };
+  std::string nested = "int";
+  for(int i = 0; i < 200; ++i)
+    nested = "std::vector<" + nested + ", std::allocator<" + nested.substr(0, 40) + "> >";
+  result.push_back(nested);
+  return result;
+}
+
+/* Samples of template names, as a trace could have. */
+void getSampleNames(std::string& aSamples, std::vector<std::size_t>& aSampleSizes) {
+  const char* templates[] = { "std::vector", "std::map", "boost::mpl::if_", "ns::detail::impl", "std::pair" };
+  const char* args[] = { "int", "double", "std::string", "ns::Widget<char>", "std::integral_constant<bool, true>" };
+  for(int i = 0; i < 4000; ++i) {
+    std::string name = std::string(templates[i % 5]) + "<" + args[(i / 5) % 5] + ", " + args[(i / 25) % 5] 
+                       + ", " + std::to_string(i) + ">::type";
+    aSamples += name;
+    aSampleSizes.push_back(name.size());
+  }
+}
+
+void checkRoundTrip(NameCompressor& aCompressor, NameDecompressor& aDecompressor, const std::string& aName) {
+  std::string compressed, decompressed;
+  BOOST_REQUIRE( aCompressor.compress(aName.data(), aName.size(), compressed) );
+  BOOST_REQUIRE( aDecompressor.decompress(compressed.data(), compressed.size(), decompressed) );
+  BOOST_CHECK( decompressed == aName );
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( zlib_name_round_trip ) {
+  NameCompressor compressor;
+  NameDecompressor decompressor;
+  BOOST_CHECK( !compressor.hasDictionary() );
+  for(const std::string& name : getTestNames())
+    checkRoundTrip(compressor, decompressor, name);
+  
+  // Corrupt and truncated streams are rejected:
+  std::string name = getTestNames().back();
+  std::string compressed, decompressed;
+  BOOST_REQUIRE( compressor.compress(name.data(), name.size(), compressed) );
+  BOOST_CHECK( !decompressor.decompress(compressed.data(), compressed.size() / 2, decompressed) );
+  compressed[compressed.size() / 2] ^= 0x55;
+  compressed[compressed.size() / 2 + 1] ^= 0x55;
+  BOOST_CHECK( !decompressor.decompress(compressed.data(), compressed.size(), decompressed) );
+  BOOST_CHECK( !decompressor.decompress("garbage", 7, decompressed) );
+}
+
+BOOST_AUTO_TEST_CASE( zstd_name_round_trip ) {
+  std::string samples;
+  std::vector<std::size_t> sample_sizes;
+  getSampleNames(samples, sample_sizes);
+  NameCompressor compressor;
+  bool trained = compressor.train(samples, sample_sizes, 16 * 1024);
+  BOOST_CHECK_EQUAL( trained, hasZstdNameCompression() );
+  BOOST_CHECK_EQUAL( compressor.hasDictionary(), trained );
+  if ( !trained )
+    return;
+  
+  NameDecompressor decompressor;
+  BOOST_REQUIRE( decompressor.setDictionary(compressor.getDictionary().data(), compressor.getDictionary().size()) );
+  for(const std::string& name : getTestNames())
+    checkRoundTrip(compressor, decompressor, name);
+  std::size_t pos = 0;
+  for(std::size_t i = 0; i < sample_sizes.size(); i += 97) {
+    checkRoundTrip(compressor, decompressor, samples.substr(pos, sample_sizes[i]));
+    pos += sample_sizes[i];
+  }
+  
+  // The frames refer to the dictionary, which a decompressor must have:
+  std::string name = "std::map<int, double, 42>::type";
+  std::string compressed, decompressed;
+  BOOST_REQUIRE( compressor.compress(name.data(), name.size(), compressed) );
+  BOOST_CHECK_LT( compressed.size(), name.size() );
+  NameDecompressor no_dict;
+  BOOST_CHECK( !no_dict.decompress(compressed.data(), compressed.size(), decompressed) || ( decompressed != name ) );
+  
+  // Without its dictionary, the compressor falls back to zlib:
+  compressor.clear();
+  BOOST_CHECK( !compressor.hasDictionary() );
+  checkRoundTrip(compressor, no_dict, name);
+}
+
+BOOST_AUTO_TEST_CASE( name_decompression_size_cap ) {
+  // Names that decompress to more than 16 MB are rejected (against corrupt sizes), smaller ones are not:
+  NameCompressor compressor;
+  NameDecompressor decompressor;
+  std::string compressed, decompressed;
+  std::string big_name((std::size_t(1) << 24) + 1, 'x');
+  BOOST_REQUIRE( compressor.compress(big_name.data(), big_name.size(), compressed) );
+  BOOST_CHECK( !decompressor.decompress(compressed.data(), compressed.size(), decompressed) );
+  big_name.resize(std::size_t(1) << 20);
+  checkRoundTrip(compressor, decompressor, big_name);
+  
+  if ( !hasZstdNameCompression() )
+    return;
+  std::string samples;
+  std::vector<std::size_t> sample_sizes;
+  getSampleNames(samples, sample_sizes);
+  BOOST_REQUIRE( compressor.train(samples, sample_sizes, 16 * 1024) );
+  BOOST_REQUIRE( decompressor.setDictionary(compressor.getDictionary().data(), compressor.getDictionary().size()) );
+  checkRoundTrip(compressor, decompressor, big_name);
+  big_name.resize((std::size_t(1) << 24) + 1, 'x');
+  BOOST_REQUIRE( compressor.compress(big_name.data(), big_name.size(), compressed) );
+  BOOST_CHECK( !decompressor.decompress(compressed.data(), compressed.size(), decompressed) );
+}
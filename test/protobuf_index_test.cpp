@@ -0,0 +1,126 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_protobuf_index
+#include <boost/test/unit_test.hpp>
+
+#include "trace_test_utils.h"
+
+#include <templight/ProtobufReader.h>
+#include <templight/ProtobufTraceIndex.h>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace templight;
+using namespace templight::test;
+
+
+namespace {
+
+void checkEntryAt(const std::vector<RecordedEntry>& aEntries, std::uint64_t aEntry, 
+                  ProtobufReader& aReader, ProtobufReader::LastChunkType aChunk) {
+  BOOST_REQUIRE_EQUAL( aChunk, ( aEntries[aEntry].is_begin ? ProtobufReader::BeginEntry : ProtobufReader::EndEntry ) );
+  if ( aEntries[aEntry].is_begin )
+    checkSameEntry(aEntries[aEntry], recordEntry(aReader.LastBeginEntry), aEntry);
+  else
+    checkSameEntry(aEntries[aEntry], recordEntry(aReader.LastEndEntry), aEntry);
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( protobuf_index_save_load ) {
+  std::string buf = writeTraces(2);
+  ProtobufTraceIndex index;
+  index.build(buf.data(), buf.size(), 4);
+  
+  std::stringstream SS;
+  index.save(SS);
+  ProtobufTraceIndex loaded;
+  BOOST_REQUIRE( loaded.load(SS) );
+  BOOST_CHECK_EQUAL( loaded.FileSize, buf.size() );
+  BOOST_CHECK_EQUAL( loaded.HeadHash, index.HeadHash );
+  BOOST_REQUIRE_EQUAL( loaded.Traces.size(), index.Traces.size() );
+  for(std::size_t t = 0; t < index.Traces.size(); ++t) {
+    BOOST_CHECK_EQUAL( loaded.Traces[t].source_name, index.Traces[t].source_name );
+    BOOST_CHECK_EQUAL( loaded.Traces[t].entry_count, index.Traces[t].entry_count );
+    BOOST_CHECK_EQUAL( loaded.Traces[t].checkpoints.size(), index.Traces[t].checkpoints.size() );
+  }
+  
+  // A truncated sidecar is not loaded:
+  std::string saved = SS.str();
+  std::stringstream truncated(saved.substr(0, saved.size() / 2));
+  BOOST_CHECK( !ProtobufTraceIndex().load(truncated) );
+}
+
+BOOST_AUTO_TEST_CASE( protobuf_index_seek_to_entry ) {
+  std::vector<RecordedTrace> expected = generateTraces(nullptr);
+  for(std::size_t segment_size : { std::size_t(0), std::size_t(4096) }) {
+    BOOST_TEST_CONTEXT("segment size " << segment_size) {
+      std::string buf = writeTraces(2, segment_size);
+      ProtobufTraceIndex index;
+      index.build(buf.data(), buf.size(), 4);
+      BOOST_REQUIRE_EQUAL( index.Traces.size(), expected.size() );
+      
+      for(std::size_t t = 0; t < expected.size(); ++t) {
+        const std::vector<RecordedEntry>& entries = expected[t].entries;
+        BOOST_CHECK_EQUAL( index.Traces[t].entry_count, entries.size() );
+        BOOST_CHECK_EQUAL( index.Traces[t].source_name, expected[t].source_name );
+        
+        ProtobufReader reader;
+        reader.startOnMemory(buf.data(), buf.size());
+        BOOST_CHECK_EQUAL( reader.seekToTrace(index, t), ProtobufReader::Header );
+        BOOST_CHECK_EQUAL( reader.SourceName, expected[t].source_name );
+        
+        // Entries at, around and between the checkpoints, in no particular order:
+        std::vector<std::uint64_t> targets = { 0, 1, entries.size() - 1, entries.size() / 2 };
+        for(std::uint64_t e = 3; e < entries.size(); e += 37)
+          targets.push_back(e);
+        for(const ProtobufTraceIndex::Checkpoint& cp : index.Traces[t].checkpoints) {
+          targets.push_back(cp.entry);
+          if ( cp.entry > 0 )
+            targets.push_back(cp.entry - 1);
+        }
+        for(std::uint64_t e : targets) {
+          BOOST_TEST_CONTEXT("trace " << t << ", seek to entry " << e) {
+            checkEntryAt(entries, e, reader, reader.seekToEntry(index, t, e));
+          }
+        }
+        // And the entries that follow are decoded as usual:
+        std::uint64_t e = entries.size() / 3;
+        reader.seekToEntry(index, t, e);
+        for(++e; e < entries.size(); ++e) {
+          ProtobufReader::LastChunkType chunk = reader.next();
+          while ( chunk == ProtobufReader::Other )
+            chunk = reader.next();
+          checkEntryAt(entries, e, reader, chunk);
+        }
+        
+        BOOST_CHECK_EQUAL( reader.seekToEntry(index, t, entries.size()), ProtobufReader::EndOfFile );
+      }
+      BOOST_CHECK_EQUAL( ProtobufReader().seekToTrace(index, expected.size()), ProtobufReader::EndOfFile );
+    }
+  }
+}
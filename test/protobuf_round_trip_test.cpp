@@ -0,0 +1,315 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_protobuf_round_trip
+#include <boost/test/unit_test.hpp>
+
+#include "trace_test_utils.h"
+
+#include <templight/ProtobufReader.h>
+#include <templight/ProtobufTraceIndex.h>
+#include <templight/ProtobufWriter.h>
+
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace templight;
+using namespace templight::test;
+
+
+namespace {
+
+/* An output that cannot seek (like a pipe), such that segments cannot be back-patched. */
+class AppendStreamBuf : public std::streambuf {
+public:
+  std::string data;
+protected:
+  int_type overflow(int_type c) override {
+    if ( !traits_type::eq_int_type(c, traits_type::eof()) )
+      data += traits_type::to_char_type(c);
+    return traits_type::not_eof(c);
+  };
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    data.append(s, static_cast<std::size_t>(n));
+    return n;
+  };
+};
+
+/* Re-encodes the traces of a protobuf buffer, passing the entries of the reader to the writer. */
+std::string reencodeTraces(const std::string& aBuf, int aCompressLevel) {
+  std::ostringstream OS;
+  {
+    ProtobufWriter writer(OS, aCompressLevel);
+    ProtobufReader reader;
+    bool was_inited = false;
+    for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size()); 
+        chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+      if ( chunk == ProtobufReader::Header ) {
+        if ( was_inited )
+          writer.finalize();
+        writer.initialize(reader.SourceName);
+        was_inited = true;
+      } else if ( chunk == ProtobufReader::BeginEntry ) {
+        writer.printEntry(reader.LastBeginEntry);
+      } else if ( chunk == ProtobufReader::EndEntry ) {
+        writer.printEntry(reader.LastEndEntry);
+      }
+    }
+    if ( was_inited )
+      writer.finalize();
+  }
+  return OS.str();
+}
+
+/* Writes a trace of memoizations of the given names. */
+std::string writeNamedTrace(const std::vector<std::string>& aNames, int aCompressLevel) {
+  std::ostringstream OS;
+  {
+    ProtobufWriter writer(OS, aCompressLevel);
+    writer.initialize("names.cpp");
+    PrintableEntryBegin b;
+    PrintableEntryEnd e;
+    b.InstantiationKind = MemoizationVal;
+    b.FileName = "names.cpp";
+    for(std::size_t i = 0; i < aNames.size(); ++i) {
+      b.Name = aNames[i];
+      b.Line = static_cast<int>(i + 1);
+      b.TimeStamp = e.TimeStamp = 0.001 * i;
+      writer.printEntry(b);
+      writer.printEntry(e);
+    }
+    writer.finalize();
+  }
+  return OS.str();
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( protobuf_round_trip_each_level ) {
+  std::vector<RecordedTrace> expected = generateTraces(nullptr);
+  for(int level = 0; level <= 3; ++level) {
+    BOOST_TEST_CONTEXT("compression level " << level) {
+      std::string buf = writeTraces(level);
+      checkSameTraces(expected, readTraces(buf));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( protobuf_round_trip_segments ) {
+  std::vector<RecordedTrace> expected = generateTraces(nullptr);
+  for(int level = 0; level <= 3; ++level) {
+    BOOST_TEST_CONTEXT("compression level " << level) {
+      // On a seekable output, as one message per trace (back-patched):
+      std::string patched = writeTraces(level, 4096);
+      BOOST_CHECK( patched != writeTraces(level) );
+      checkSameTraces(expected, readTraces(patched));
+      
+      // On an output that cannot seek, as continuation messages:
+      AppendStreamBuf sink;
+      {
+        std::ostream OS(&sink);
+        ProtobufWriter writer(OS, level, 4096);
+        generateTraces(&writer);
+      }
+      BOOST_CHECK( sink.data != patched );
+      checkSameTraces(expected, readTraces(sink.data));
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( protobuf_dictionary_name_splitting ) {
+  // Names that the splitting of the dictionary must leave intact (operators, 
+  // nested and empty argument lists, spaces, scopes without a name, etc.):
+  std::vector<std::string> names = {
+    "ns::Outer<A, 3>", "operator<<", "operator<", "operator<=", "operator<<<int>", 
+    "std::operator<< <char, std::char_traits<char> >", "ns::A<B<C<int> >, D>::type", 
+    "f<>", "g< >", "Y<  int  ,  long  >", "::global<int>", "trailing::", "a::b::c", 
+    "", "Z<(1 > 2)>", "lambda at file.cpp:12:3", "W<int>::operator<<<char>", 
+    "ns::Outer<A, 3>", "std::vector<int, std::allocator<int> >"
+  };
+  std::string buf = writeNamedTrace(names, 2);
+  
+  ProtobufReader reader;
+  ProtobufReader::LastChunkType chunk = reader.startOnMemory(buf.data(), buf.size());
+  std::size_t i = 0;
+  for(; chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+    if ( chunk != ProtobufReader::BeginEntry )
+      continue;
+    BOOST_REQUIRE( i < names.size() );
+    BOOST_CHECK_EQUAL( reader.LastBeginEntry.getName(), names[i] );
+    if ( i == 0 ) {
+      // The scopes and the arguments of the name become entries of their own:
+      const char* marked_name = nullptr;
+      std::size_t marked_size = 0;
+      const std::uint32_t* markers = nullptr;
+      std::size_t marker_count = 0;
+      BOOST_REQUIRE( reader.getDictionaryEntry(reader.LastBeginEntry.NameID, marked_name, marked_size, markers, marker_count) );
+      BOOST_CHECK_EQUAL( std::string(marked_name, marked_size), std::string("\0::\0<\0, \0>", 10) );
+      BOOST_REQUIRE_EQUAL( marker_count, 4u );
+      const char* parts[] = { "ns", "Outer", "A", "3" };
+      for(std::size_t m = 0; m < marker_count; ++m)
+        BOOST_CHECK_EQUAL( reader.getName(markers[m]), parts[m] );
+    }
+    ++i;
+  }
+  BOOST_CHECK_EQUAL( i, names.size() );
+  BOOST_CHECK( !reader.hasFailed() );
+  
+  // The parts that names share are only written once:
+  std::vector<std::string> shared_names;
+  const std::string long_arg = "very_long_namespace_name::with_a_long_class_template<" + std::string(400, 'x') + ">";
+  for(int k = 0; k < 100; ++k)
+    shared_names.push_back("ns::Outer<" + long_arg + ", " + std::to_string(k) + ">");
+  std::string plain = writeNamedTrace(shared_names, 0);
+  std::string dict = writeNamedTrace(shared_names, 2);
+  BOOST_CHECK_LT( dict.size() * 4, plain.size() );
+  std::vector<RecordedTrace> traces = readTraces(dict);
+  BOOST_REQUIRE_EQUAL( traces.size(), 1u );
+  BOOST_REQUIRE_EQUAL( traces[0].entries.size(), 2 * shared_names.size() );
+  for(std::size_t k = 0; k < shared_names.size(); ++k)
+    BOOST_CHECK_EQUAL( traces[0].entries[2 * k].name, shared_names[k] );
+}
+
+BOOST_AUTO_TEST_CASE( protobuf_copy_through ) {
+  std::vector<RecordedTrace> expected = generateTraces(nullptr);
+  std::string dict = writeTraces(2);
+  for(int level = 0; level <= 3; ++level) {
+    BOOST_TEST_CONTEXT("compression level " << level) {
+      // The dictionary entries are copied over at level 2, and expanded otherwise:
+      std::string reencoded = reencodeTraces(dict, level);
+      checkSameTraces(expected, readTraces(reencoded));
+      if ( level == 2 )
+        BOOST_CHECK_EQUAL( reencoded.size(), dict.size() );
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE( protobuf_copy_through_after_split ) {
+  // A name that was split up (from a plain name) and is then copied (from the reader's 
+  // dictionary) must have a single dictionary entry:
+  const std::string name = "ns::Outer<A, 3>";
+  std::string src = writeNamedTrace(std::vector<std::string>(2, name), 2);
+  std::ostringstream OS;
+  {
+    ProtobufWriter writer(OS, 2);
+    writer.initialize("names.cpp");
+    PrintableEntryBegin b;
+    b.Name = name;
+    writer.printEntry(b);
+    writer.printEntry(PrintableEntryEnd());
+    ProtobufReader reader;
+    for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(src.data(), src.size()); 
+        chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+      if ( chunk == ProtobufReader::BeginEntry )
+        writer.printEntry(reader.LastBeginEntry);
+      else if ( chunk == ProtobufReader::EndEntry )
+        writer.printEntry(reader.LastEndEntry);
+    }
+    writer.finalize();
+  }
+  std::string out = OS.str();
+  
+  ProtobufReader reader;
+  std::size_t count = 0;
+  for(ProtobufReader::LastChunkType chunk = reader.startOnMemory(out.data(), out.size()); 
+      chunk != ProtobufReader::EndOfFile; chunk = reader.next()) {
+    if ( chunk != ProtobufReader::BeginEntry )
+      continue;
+    BOOST_CHECK_EQUAL( reader.LastBeginEntry.getName(), name );
+    if ( ++count == 3 ) {
+      // The entries of "ns", "Outer", "A", "3" and the name itself:
+      BOOST_CHECK_EQUAL( reader.getNameCount(), 5u );
+    }
+  }
+  BOOST_CHECK_EQUAL( count, 3u );
+}
+
+BOOST_AUTO_TEST_CASE( protobuf_archive_shared_dictionary ) {
+  // The names and filenames of the first trace are shared with the second one:
+  std::vector<RecordedTrace> expected = generateTraces(nullptr);
+  std::vector<std::string> names, file_names;
+  std::unordered_set<std::string> seen;
+  for(const RecordedEntry& e : expected[0].entries) {
+    if ( e.is_begin && seen.insert(e.name).second )
+      names.push_back(e.name);
+    if ( e.is_begin && seen.insert("file:" + e.file).second )
+      file_names.push_back(e.file);
+  }
+  
+  for(int level = 0; level <= 3; ++level) {
+    BOOST_TEST_CONTEXT("compression level " << level) {
+      std::ostringstream OS;
+      {
+        ProtobufWriter writer(OS, level);
+        writer.writeSharedDictionary(names, file_names);
+        generateTraces(&writer);
+      }
+      std::string archive = OS.str();
+      checkSameTraces(expected, readTraces(archive));
+      // The names are only shared with the dictionary compression:
+      if ( level == 2 )
+        BOOST_CHECK_LT( archive.size(), writeTraces(level).size() );
+      
+      // The second trace, seeked to directly, refers to the shared dictionary too:
+      ProtobufTraceIndex index;
+      index.build(archive.data(), archive.size(), 4);
+      BOOST_REQUIRE_EQUAL( index.Traces.size(), expected.size() );
+      ProtobufReader reader;
+      reader.startOnMemory(archive.data(), archive.size());
+      BOOST_REQUIRE_EQUAL( reader.seekToTrace(index, 1), ProtobufReader::Header );
+      std::size_t i = 0;
+      for(ProtobufReader::LastChunkType chunk = reader.next(); 
+          ( chunk != ProtobufReader::EndOfFile ) && ( chunk != ProtobufReader::Header ); chunk = reader.next()) {
+        if ( chunk == ProtobufReader::Other )
+          continue;
+        BOOST_REQUIRE( i < expected[1].entries.size() );
+        if ( chunk == ProtobufReader::BeginEntry )
+          checkSameEntry(expected[1].entries[i], recordEntry(reader.LastBeginEntry), i);
+        else
+          checkSameEntry(expected[1].entries[i], recordEntry(reader.LastEndEntry), i);
+        ++i;
+      }
+      BOOST_CHECK_EQUAL( i, expected[1].entries.size() );
+    }
+  }
+  
+  // A shared dictionary replaces the previous one, for the traces that follow it:
+  std::ostringstream OS;
+  {
+    ProtobufWriter writer(OS, 2);
+    std::vector<SyntheticTraceOptions> opts = getTraceOptions();
+    writer.writeSharedDictionary(names, file_names);
+    generateTraces(&writer, std::vector<SyntheticTraceOptions>(1, opts[0]));
+    writer.writeSharedDictionary(std::vector<std::string>(1, "unused<int>"), std::vector<std::string>());
+    generateTraces(&writer, std::vector<SyntheticTraceOptions>(1, opts[1]));
+  }
+  std::vector<RecordedTrace> replaced = readTraces(OS.str());
+  BOOST_REQUIRE_EQUAL( replaced.size(), 2u );
+  // (each call to generateTraces numbers its traces from 0)
+  replaced[1].source_name = expected[1].source_name;
+  checkSameTraces(expected, replaced);
+}
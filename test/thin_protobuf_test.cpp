@@ -0,0 +1,149 @@
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BOOST_TEST_MODULE templight_thin_protobuf
+#include <boost/test/unit_test.hpp>
+
+#include <templight/ThinProtobuf.h>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+std::string encodeVarInt(std::uint64_t u) {
+  std::ostringstream OS;
+  thin_protobuf::saveVarInt(OS, u);
+  return OS.str();
+}
+
+/* Decodes a varint from the start of a buffer, within a span of a given size 
+ * (the rest of the buffer is padding, which must not be read). */
+std::uint64_t decodeVarInt(const std::string& aBuf, std::size_t aSpanSize, std::size_t& aConsumed) {
+  const std::uint8_t* p_begin = reinterpret_cast<const std::uint8_t*>(aBuf.data());
+  const std::uint8_t* p = p_begin;
+  std::uint64_t u = thin_protobuf::loadVarInt(p, p_begin + aSpanSize);
+  aConsumed = p - p_begin;
+  return u;
+}
+
+std::vector<std::uint64_t> getTestValues() {
+  std::vector<std::uint64_t> result = { 0, 1, 127, 128, 255, 300 };
+  // Around every boundary of the number of 7-bit groups (including the 8-byte word of the fast path):
+  for(unsigned int bits = 7; bits < 64; bits += 7) {
+    std::uint64_t p = std::uint64_t(1) << bits;
+    result.push_back(p - 1);
+    result.push_back(p);
+    result.push_back(p + 1);
+  }
+  result.push_back(std::uint64_t(1) << 63);
+  result.push_back(( std::uint64_t(1) << 63 ) - 1);
+  result.push_back(~std::uint64_t(0) - 1);
+  result.push_back(~std::uint64_t(0));
+  result.push_back(0x0123456789ABCDEFULL);
+  return result;
+}
+
+}
+
+
+BOOST_AUTO_TEST_CASE( varint_round_trip ) {
+  for(std::uint64_t u : getTestValues()) {
+    std::string enc = encodeVarInt(u);
+    BOOST_CHECK_EQUAL( enc.size(), thin_protobuf::getVarIntSize(u) );
+    std::size_t consumed = 0;
+    // Within an exact span (the per-byte path), then with bytes after it (the word-wise path):
+    BOOST_CHECK_EQUAL( decodeVarInt(enc, enc.size(), consumed), u );
+    BOOST_CHECK_EQUAL( consumed, enc.size() );
+    std::string padded = enc + std::string(16, '\xFF');
+    BOOST_CHECK_EQUAL( decodeVarInt(padded, padded.size(), consumed), u );
+    BOOST_CHECK_EQUAL( consumed, enc.size() );
+    padded = enc + std::string(16, '\0');
+    BOOST_CHECK_EQUAL( decodeVarInt(padded, padded.size(), consumed), u );
+    BOOST_CHECK_EQUAL( consumed, enc.size() );
+  }
+}
+
+BOOST_AUTO_TEST_CASE( varint_64bit_overflow ) {
+  // The largest value takes ten bytes, the last one holding its top bit:
+  std::string max_enc = std::string(9, '\xFF') + '\x01';
+  BOOST_CHECK_EQUAL( encodeVarInt(~std::uint64_t(0)), max_enc );
+  std::size_t consumed = 0;
+  
+  // A tenth byte with more than one bit overflows 64 bits, the bits above are dropped:
+  std::string over_enc = std::string(9, '\xFF') + '\x7F';
+  BOOST_CHECK_EQUAL( decodeVarInt(over_enc + "abcdefgh", over_enc.size() + 8, consumed), ~std::uint64_t(0) );
+  BOOST_CHECK_EQUAL( consumed, over_enc.size() );
+  
+  // An over-long varint (more than ten bytes) is consumed whole, without changing the value:
+  std::string long_enc = std::string(12, '\x80') + '\x00';
+  BOOST_CHECK_EQUAL( decodeVarInt(long_enc + "abcdefgh", long_enc.size() + 8, consumed), 0u );
+  BOOST_CHECK_EQUAL( consumed, long_enc.size() );
+  long_enc = std::string(9, '\xFF') + std::string(3, '\x81') + '\x00';
+  BOOST_CHECK_EQUAL( decodeVarInt(long_enc, long_enc.size(), consumed), ~std::uint64_t(0) );
+  BOOST_CHECK_EQUAL( consumed, long_enc.size() );
+}
+
+BOOST_AUTO_TEST_CASE( varint_truncated ) {
+  // A varint cut short by the end of the span stops there, whatever follows the span:
+  for(std::uint64_t u : getTestValues()) {
+    std::string enc = encodeVarInt(u);
+    for(std::size_t cut = 0; cut < enc.size(); ++cut) {
+      std::string padded = enc + std::string(16, '\0');
+      std::size_t consumed = 0;
+      std::uint64_t v = decodeVarInt(padded, cut, consumed);
+      BOOST_CHECK_EQUAL( consumed, cut );
+      // Only the groups within the span are decoded:
+      std::uint64_t mask = ( 7 * cut >= 64 ? ~std::uint64_t(0) : ( std::uint64_t(1) << ( 7 * cut ) ) - 1 );
+      BOOST_CHECK_EQUAL( v, u & mask );
+    }
+  }
+  // A span of continuation bytes only, longer than a word:
+  std::string cont(12, '\x80');
+  std::size_t consumed = 0;
+  BOOST_CHECK_EQUAL( decodeVarInt(cont + '\x01', cont.size(), consumed), 0u );
+  BOOST_CHECK_EQUAL( consumed, cont.size() );
+}
+
+BOOST_AUTO_TEST_CASE( string_span_truncated ) {
+  std::string buf = encodeVarInt(10) + "abcd";
+  const std::uint8_t* p_begin = reinterpret_cast<const std::uint8_t*>(buf.data());
+  const std::uint8_t* p = p_begin;
+  std::size_t size = 0;
+  const std::uint8_t* s = thin_protobuf::loadStringSpan(p, p_begin + buf.size(), size);
+  BOOST_CHECK_EQUAL( s - p_begin, 1 );
+  BOOST_CHECK_EQUAL( size, 4u );
+  BOOST_CHECK( p == p_begin + buf.size() );
+  
+  // A length that overflows the address space is clamped too:
+  buf = encodeVarInt(~std::uint64_t(0)) + "abcd";
+  p_begin = reinterpret_cast<const std::uint8_t*>(buf.data());
+  p = p_begin;
+  s = thin_protobuf::loadStringSpan(p, p_begin + buf.size(), size);
+  BOOST_CHECK_EQUAL( s - p_begin, 10 );
+  BOOST_CHECK_EQUAL( size, 4u );
+  BOOST_CHECK( p == p_begin + buf.size() );
+}
+
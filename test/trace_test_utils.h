@@ -0,0 +1,197 @@
+/**
+ * \file trace_test_utils.h
+ *
+ * This header provides the functions that the unit tests use to generate, record and compare templight traces.
+ *
+ * \author S. Mikael Persson <mikael.s.persson@gmail.com>
+ * \date October 2026
+ */
+
+/*
+ *    Copyright 2026 Sven Mikael Persson
+ *
+ *    THIS SOFTWARE IS DISTRIBUTED UNDER THE TERMS OF THE GNU GENERAL PUBLIC LICENSE v3 (GPLv3).
+ *
+ *    This file is part of templight-tools.
+ *
+ *    Templight-tools is free software: you can redistribute it and/or modify
+ *    it under the terms of the GNU General Public License as published by
+ *    the Free Software Foundation, either version 3 of the License, or
+ *    (at your option) any later version.
+ *
+ *    Templight-tools is distributed in the hope that it will be useful,
+ *    but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *    GNU General Public License for more details.
+ *
+ *    You should have received a copy of the GNU General Public License
+ *    along with templight-tools (as LICENSE in the root folder).
+ *    If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEMPLIGHT_TRACE_TEST_UTILS_H
+#define TEMPLIGHT_TRACE_TEST_UTILS_H
+
+#include <boost/test/unit_test.hpp>
+
+#include <templight/PrintableEntries.h>
+#include <templight/ProtobufReader.h>
+#include <templight/ProtobufWriter.h>
+#include <templight/SyntheticTraces.h>
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace templight {
+
+namespace test {
+
+/* The fields of an entry, with its strings. */
+struct RecordedEntry {
+  bool is_begin;
+  int kind;
+  std::string name;
+  std::string file;
+  int line;
+  int column;
+  std::string ori_file;
+  int ori_line;
+  int ori_column;
+  double time;
+  std::uint64_t memory;
+};
+
+inline RecordedEntry recordEntry(const PrintableEntryBegin& aEntry) {
+  RecordedEntry e = { true, aEntry.InstantiationKind, aEntry.getName(), aEntry.getFileName(),
+    aEntry.Line, aEntry.Column, aEntry.getTempOriFileName(), aEntry.TempOri_Line, aEntry.TempOri_Column,
+    aEntry.TimeStamp, aEntry.MemoryUsage };
+  return e;
+}
+
+inline RecordedEntry recordEntry(const PrintableEntryEnd& aEntry) {
+  RecordedEntry e = { false, 0, "", "", 0, 0, "", 0, 0, aEntry.TimeStamp, aEntry.MemoryUsage };
+  return e;
+}
+
+struct RecordedTrace {
+  std::string source_name;
+  std::vector<RecordedEntry> entries;
+};
+
+inline void checkSameEntry(const RecordedEntry& aExpected, const RecordedEntry& aActual, std::size_t aIndex) {
+  BOOST_TEST_CONTEXT("entry " << aIndex) {
+    BOOST_REQUIRE_EQUAL( aExpected.is_begin, aActual.is_begin );
+    BOOST_CHECK_EQUAL( aExpected.kind, aActual.kind );
+    BOOST_CHECK_EQUAL( aExpected.name, aActual.name );
+    BOOST_CHECK_EQUAL( aExpected.file, aActual.file );
+    BOOST_CHECK_EQUAL( aExpected.line, aActual.line );
+    BOOST_CHECK_EQUAL( aExpected.column, aActual.column );
+    BOOST_CHECK_EQUAL( aExpected.ori_file, aActual.ori_file );
+    BOOST_CHECK_EQUAL( aExpected.ori_line, aActual.ori_line );
+    BOOST_CHECK_EQUAL( aExpected.ori_column, aActual.ori_column );
+    BOOST_CHECK_EQUAL( aExpected.time, aActual.time );
+    BOOST_CHECK_EQUAL( aExpected.memory, aActual.memory );
+  }
+}
+
+inline void checkSameTraces(const std::vector<RecordedTrace>& aExpected, const std::vector<RecordedTrace>& aActual) {
+  BOOST_REQUIRE_EQUAL( aExpected.size(), aActual.size() );
+  for(std::size_t t = 0; t < aExpected.size(); ++t) {
+    BOOST_TEST_CONTEXT("trace " << t) {
+      BOOST_CHECK_EQUAL( aExpected[t].source_name, aActual[t].source_name );
+      BOOST_REQUIRE_EQUAL( aExpected[t].entries.size(), aActual[t].entries.size() );
+      for(std::size_t i = 0; i < aExpected[t].entries.size(); ++i)
+        checkSameEntry(aExpected[t].entries[i], aActual[t].entries[i], i);
+    }
+  }
+}
+
+/* Two traces, with recursive chains and memoizations (which the name dictionary compresses). */
+inline std::vector<SyntheticTraceOptions> getTraceOptions() {
+  std::vector<SyntheticTraceOptions> result(2);
+  result[0].EntryCount = 3000;
+  result[0].NameLength = 40;
+  result[0].RecursionRatio = 0.05;
+  result[0].Seed = 1;
+  result[1].EntryCount = 1000;
+  result[1].NameLength = 60;
+  result[1].NameLengthSpread = 0.5;
+  result[1].FileCount = 8;
+  result[1].MemoryCurve = SawtoothMemoryCurve;
+  result[1].Seed = 2;
+  return result;
+}
+
+/* Generates the traces, into a writer (if any), and returns what was generated. */
+inline std::vector<RecordedTrace> generateTraces(EntryWriter* aWriter,
+                                                 const std::vector<SyntheticTraceOptions>& aOptions = getTraceOptions()) {
+  std::vector<RecordedTrace> result;
+  for(std::size_t t = 0; t < aOptions.size(); ++t) {
+    result.push_back(RecordedTrace());
+    result.back().source_name = "synthetic" + std::to_string(t) + ".cpp";
+    if ( aWriter )
+      aWriter->initialize(result.back().source_name);
+    SyntheticTraceGenerator gen(aOptions[t]);
+    SyntheticTraceGenerator::LastEntryType entry;
+    while ( ( entry = gen.next() ) != SyntheticTraceGenerator::EndOfTrace ) {
+      if ( entry == SyntheticTraceGenerator::BeginEntry ) {
+        result.back().entries.push_back(recordEntry(gen.LastBeginEntry));
+        if ( aWriter )
+          aWriter->printEntry(gen.LastBeginEntry);
+      } else {
+        result.back().entries.push_back(recordEntry(gen.LastEndEntry));
+        if ( aWriter )
+          aWriter->printEntry(gen.LastEndEntry);
+      }
+    }
+    if ( aWriter )
+      aWriter->finalize();
+  }
+  return result;
+}
+
+/* Reads all the traces of a protobuf buffer. */
+inline std::vector<RecordedTrace> readTraces(const std::string& aBuf) {
+  std::vector<RecordedTrace> result;
+  ProtobufReader reader;
+  ProtobufReader::LastChunkType chunk = reader.startOnMemory(aBuf.data(), aBuf.size());
+  while ( chunk != ProtobufReader::EndOfFile ) {
+    switch( chunk ) {
+      case ProtobufReader::Header:
+        result.push_back(RecordedTrace());
+        result.back().source_name = reader.SourceName;
+        break;
+      case ProtobufReader::BeginEntry:
+        BOOST_REQUIRE( !result.empty() );
+        result.back().entries.push_back(recordEntry(reader.LastBeginEntry));
+        break;
+      case ProtobufReader::EndEntry:
+        BOOST_REQUIRE( !result.empty() );
+        result.back().entries.push_back(recordEntry(reader.LastEndEntry));
+        break;
+      default:
+        break;
+    }
+    chunk = reader.next();
+  }
+  BOOST_CHECK( !reader.hasFailed() );
+  return result;
+}
+
+/* Writes the generated traces into a protobuf buffer. */
+inline std::string writeTraces(int aCompressLevel, std::size_t aSegmentSize = 0) {
+  std::ostringstream OS;
+  {
+    ProtobufWriter writer(OS, aCompressLevel, aSegmentSize);
+    generateTraces(&writer);
+  }
+  return OS.str();
+}
+
+}
+
+}
+
+#endif